@@ -17,11 +17,14 @@
 #include <sys/types.h>
 
 #include <ctype.h>
+#include <string.h>
+#include <strings.h>
 
 int	abnf_is_pct_encoded(const char *, size_t);
 int	abnf_is_unreserved(int);
 int	abnf_is_sub_delims(int);
 int	abnf_is_tchar(int);
+int	abnf_has_token(const char *, const char *);
 
 int
 abnf_is_pct_encoded(const char *s, size_t ns)
@@ -59,3 +62,35 @@ abnf_is_tchar(int c)
 		c == '^' || c == '_' || c == '`' || c == '|' || c == '~' ||
 		isalnum(c));
 }
+
+/*
+ * Check whether the comma-separated list of tokens s contains token, which is
+ * compared case-insensitively, as it is the case for the Connection header
+ * field.
+ */
+int
+abnf_has_token(const char *s, const char *token)
+{
+	const char	*end;
+	size_t		 len;
+
+	len = strlen(token);
+	while (*s != '\0') {
+		/* Skip the OWS and empty elements in between. */
+		if (*s == ' ' || *s == '\t' || *s == ',') {
+			++s;
+			continue;
+		}
+
+		for (end = s; abnf_is_tchar(*end); ++end)
+			;
+		if ((size_t)(end - s) == len && strncasecmp(s, token, len) == 0)
+			return (1);
+
+		/* Go to the next element. */
+		if ((s = strchr(end, ',')) == NULL)
+			break;
+	}
+
+	return (0);
+}
@@ -21,5 +21,6 @@ int	abnf_is_pct_encoded(const char *, size_t);
 int	abnf_is_unreserved(int);
 int	abnf_is_sub_delims(int);
 int	abnf_is_tchar(int);
+int	abnf_has_token(const char *, const char *);
 
 #endif
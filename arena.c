@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2022 Emil Engler <engler+yhttp@unveil2.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+/*
+ * Allocations are being aligned suitably for any type.
+ */
+union arena_align {
+	long double	  ld;
+	long long	  ll;
+	void		 *p;
+	void		(*fn)(void);
+};
+
+#define NALIGN		sizeof(union arena_align)
+#define ALIGN(n)	(((n) + NALIGN - 1) & ~(NALIGN - 1))
+
+/*
+ * The blocks of an arena are being allocated with NBLOCK bytes, which covers
+ * a typical request.  Allocations larger than a quarter of it get a block of
+ * their own, so that they do not waste the space left in the current one.
+ */
+#define NBLOCK		8192
+#define NBIG		(NBLOCK / 4)
+
+struct arena_block {
+	struct arena_block	*next;
+	size_t			 size;	/* Space of the data. */
+	size_t			 used;	/* Used space of the data. */
+};
+
+#define NHDR		ALIGN(sizeof(struct arena_block))
+#define DATA(b)		((unsigned char *)(b) + NHDR)
+
+static struct arena_block	*arena_block(size_t);
+
+static struct arena_block *
+arena_block(size_t size)
+{
+	struct arena_block	*b;
+
+	if (size > SIZE_MAX - NHDR) {
+		errno = ENOMEM;
+		return (NULL);
+	}
+	if ((b = malloc(NHDR + size)) == NULL)
+		return (NULL);
+	b->next = NULL;
+	b->size = size;
+	b->used = 0;
+
+	return (b);
+}
+
+void
+arena_init(struct arena *arena)
+{
+	arena->blocks = NULL;
+}
+
+/*
+ * Release all allocations, but keep a block of the regular size for the
+ * allocations that follow.
+ */
+void
+arena_reset(struct arena *arena)
+{
+	struct arena_block	*b, *next, *keep;
+
+	keep = NULL;
+	for (b = arena->blocks; b != NULL; b = next) {
+		next = b->next;
+		if (keep == NULL && b->size == NBLOCK - NHDR) {
+			keep = b;
+			continue;
+		}
+		free(b);
+	}
+
+	if (keep != NULL) {
+		keep->next = NULL;
+		keep->used = 0;
+	}
+	arena->blocks = keep;
+}
+
+/*
+ * The arena itself may have been allocated from it, which is why it is not
+ * being touched once the first block has been passed to free(3).
+ */
+void
+arena_free(struct arena *arena)
+{
+	struct arena_block	*b, *next;
+
+	b = arena->blocks;
+	arena->blocks = NULL;
+	for (; b != NULL; b = next) {
+		next = b->next;
+		free(b);
+	}
+}
+
+/*
+ * Allocate n bytes, which remain valid until the arena is being reset or
+ * freed.  Like malloc(3), NULL is being returned with errno set on failure.
+ */
+void *
+arena_alloc(struct arena *arena, size_t n)
+{
+	struct arena_block	*b;
+	void			*p;
+
+	if (n == 0)
+		n = 1;
+	if (n > SIZE_MAX - NALIGN) {
+		errno = ENOMEM;
+		return (NULL);
+	}
+	n = ALIGN(n);
+
+	b = arena->blocks;
+	if (b != NULL && b->size - b->used >= n) {
+		p = DATA(b) + b->used;
+		b->used += n;
+		return (p);
+	}
+
+	if (n > NBIG) {
+		/* It goes behind the current block, which keeps its space. */
+		if ((b = arena_block(n)) == NULL)
+			return (NULL);
+		b->used = n;
+		if (arena->blocks != NULL) {
+			b->next = arena->blocks->next;
+			arena->blocks->next = b;
+		} else
+			arena->blocks = b;
+		return (DATA(b));
+	}
+
+	if ((b = arena_block(NBLOCK - NHDR)) == NULL)
+		return (NULL);
+	b->next = arena->blocks;
+	arena->blocks = b;
+	b->used = n;
+
+	return (DATA(b));
+}
+
+char *
+arena_strdup(struct arena *arena, const char *s)
+{
+	return (arena_strndup(arena, s, strlen(s)));
+}
+
+/*
+ * Copy the first n bytes of s into a string, like strndup(3) does, except
+ * that s must consist of at least n bytes.
+ */
+char *
+arena_strndup(struct arena *arena, const char *s, size_t n)
+{
+	char	*p;
+
+	if (n == SIZE_MAX) {
+		errno = ENOMEM;
+		return (NULL);
+	}
+	if ((p = arena_alloc(arena, n + 1)) == NULL)
+		return (NULL);
+	memcpy(p, s, n);
+	p[n] = '\0';
+
+	return (p);
+}
+
+/*
+ * Return a string in the printf(3) style, see util_aprintf().
+ */
+char *
+arena_printf(struct arena *arena, const char *fmt, ...)
+{
+	char	*s;
+	va_list	 v1, v2;
+	int	 sz;
+
+	s = NULL;
+	va_start(v1, fmt);
+	va_copy(v2, v1);
+
+	if ((sz = vsnprintf(NULL, 0, fmt, v1)) < 0)
+		goto end;
+	if ((s = arena_alloc(arena, (size_t)sz + 1)) == NULL)
+		goto end;
+	if (vsnprintf(s, (size_t)sz + 1, fmt, v2) < 0)
+		s = NULL;
+end:
+	va_end(v1);
+	va_end(v2);
+	return (s);
+}
@@ -16,15 +16,39 @@
 
 #include <sys/types.h>
 
+#include <stdarg.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "buf.h"
 #include "yhttp.h"
 
+/*
+ * An emptied buffer keeps its space for the next message, unless it is larger
+ * than NKEEP bytes.
+ */
+#define NKEEP	(64 * 1024)
+
+static void	buf_compact(struct buf *);
 static int	buf_grow(struct buf *, size_t);
 
+/*
+ * Reclaim the space that has been popped in front of buf->buf, by moving
+ * the data back to the front.
+ */
+static void
+buf_compact(struct buf *buf)
+{
+	if (buf->off == 0)
+		return;
+
+	memmove(buf->buf - buf->off, buf->buf, buf->used);
+	buf->buf -= buf->off;
+	buf->off = 0;
+}
+
 static int
 buf_grow(struct buf *buf, size_t ndata)
 {
@@ -38,20 +62,22 @@ buf_grow(struct buf *buf, size_t ndata)
 	 */
 	if (SIZE_MAX - buf->used < ndata)	/* buf->used + ndata */
 		return (YHTTP_EOVERFLOW);
+	if (ndata < buf->nbuf - buf->off - buf->used)
+		return (YHTTP_OK);
+
+	/* Otherwise, the space that has been popped is being reclaimed. */
+	buf_compact(buf);
 	if ((buf->used + ndata) < buf->nbuf)
 		return (YHTTP_OK);
 
 	/*
-	 * The new size of the buffer composites as follows:
-	 * old space + (ndata * 2)
-	 * The following will perform several integer overflow checks in
-	 * order to determine if the reallocation can take place.
+	 * The new size of the buffer is twice the space that is needed,
+	 * which is at least twice the old space, so that appending many small
+	 * pieces only takes a logarithmic number of reallocations.
 	 */
-	if (ndata > SIZE_MAX / 2)		/* ndata * 2 */
+	if (buf->used + ndata > SIZE_MAX / 2)	/* (buf->used + ndata) * 2 */
 		return (YHTTP_EOVERFLOW);
-	if (SIZE_MAX - buf->nbuf < (ndata * 2))	/* buf->nbuf + (ndata * 2) */
-		return (YHTTP_EOVERFLOW);
-	n_nbuf = buf->nbuf + (ndata * 2);
+	n_nbuf = (buf->used + ndata) * 2;
 
 	/* Now we can perform the actual reallocation. */
 	if ((n_buf = realloc(buf->buf, n_nbuf)) == NULL)
@@ -69,6 +95,7 @@ buf_init(struct buf *buf)
 	buf->buf = NULL;
 	buf->nbuf = 0;
 	buf->used = 0;
+	buf->off = 0;
 }
 
 void
@@ -77,7 +104,7 @@ buf_wipe(struct buf *buf)
 	if (buf == NULL)
 		return;
 
-	free(buf->buf);
+	free(buf->buf - buf->off);
 	buf_init(buf);
 }
 
@@ -95,20 +122,94 @@ buf_append(struct buf *buf, const unsigned char *data, size_t ndata)
 	return (YHTTP_OK);
 }
 
+/*
+ * Make sure that at least n bytes can be written to buf->buf + buf->used,
+ * without growing the buffer any further than that.  This allows data to
+ * be received into the buffer directly, with the caller accounting for it
+ * in buf->used.
+ */
+int
+buf_reserve(struct buf *buf, size_t n)
+{
+	unsigned char	*n_buf;
+	size_t		 n_nbuf;
+
+	if (SIZE_MAX - buf->used <= n)		/* buf->used + n + 1 */
+		return (YHTTP_EOVERFLOW);
+	if (n < buf->nbuf - buf->off - buf->used)
+		return (YHTTP_OK);
+
+	buf_compact(buf);
+	if (n < buf->nbuf - buf->used)
+		return (YHTTP_OK);
+
+	n_nbuf = buf->used + n + 1;
+
+	if ((n_buf = realloc(buf->buf, n_nbuf)) == NULL)
+		return (YHTTP_ERRNO);
+
+	buf->buf = n_buf;
+	buf->nbuf = n_nbuf;
+
+	return (YHTTP_OK);
+}
+
+/*
+ * Append a string in the printf(3) style, which is being formatted into the
+ * buffer directly, instead of a temporary allocation.
+ */
+int
+buf_printf(struct buf *buf, const char *fmt, ...)
+{
+	va_list	ap;
+	size_t	room;
+	int	n, rc;
+
+	/* Most strings fit into the space that is left already. */
+	room = buf->nbuf - buf->off - buf->used;
+	va_start(ap, fmt);
+	n = vsnprintf((char *)buf->buf + buf->used, room, fmt, ap);
+	va_end(ap);
+	if (n < 0)
+		return (YHTTP_EINVAL);
+
+	if ((size_t)n >= room) {
+		if ((rc = buf_grow(buf, (size_t)n + 1)) != YHTTP_OK)
+			return (rc);
+		va_start(ap, fmt);
+		vsnprintf((char *)buf->buf + buf->used, (size_t)n + 1, fmt, ap);
+		va_end(ap);
+	}
+	buf->used += n;
+
+	return (YHTTP_OK);
+}
+
 /*
  * Remove the first n bytes in the buf.
+ * Nothing is being copied, so pointers into the remaining data stay valid
+ * until the next buf_append().
  */
 int
 buf_pop(struct buf *buf, size_t n)
 {
-	struct buf	n_buf;
-	int		rc;
+	if (n == 0)
+		return (YHTTP_OK);
 
-	buf_init(&n_buf);
-	if ((rc = buf_append(&n_buf, buf->buf + n, buf->used - n)) != YHTTP_OK)
-		return (rc);
-	buf_wipe(buf);
-	memcpy(buf, &n_buf, sizeof(struct buf));
+	buf->buf += n;
+	buf->used -= n;
+	buf->off += n;
+
+	/*
+	 * Once the buffer has been emptied, it starts over at the front, or
+	 * from scratch, if a large message has made it grow beyond NKEEP.
+	 */
+	if (buf->used == 0 && buf->nbuf > NKEEP)
+		buf_wipe(buf);
+	else if (buf->used == 0) {
+		buf->buf -= buf->off;
+		buf->off = 0;
+	}
 
 	return (YHTTP_OK);
 }
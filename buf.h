@@ -17,16 +17,24 @@
 #ifndef BUF_H
 #define BUF_H
 
+/*
+ * Popping data from the front only advances buf by off bytes into the
+ * allocation, so that pointers into the remaining data stay valid.  The
+ * data is only being moved back to the front once space runs out.
+ */
 struct buf {
 	unsigned char	*buf;
-	size_t		 nbuf;	/* Allocated space of buf. */
+	size_t		 nbuf;	/* Allocated space, starting at buf - off. */
 	size_t		 used;	/* Used space inside buf. */
+	size_t		 off;	/* Space that has been popped in front of buf. */
 };
 
 void	buf_init(struct buf *);
 void	buf_wipe(struct buf *);
 
 int	buf_append(struct buf *, const unsigned char *, size_t);
+int	buf_reserve(struct buf *, size_t);
+int	buf_printf(struct buf *, const char *, ...);
 int	buf_pop(struct buf *, size_t);
 
 #endif
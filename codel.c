@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2022 Emil Engler <engler+yhttp@unveil2.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+
+#include <stdint.h>
+
+#include "codel.h"
+
+static uint64_t	codel_next(struct codel *, uint64_t);
+
+/*
+ * The control law: while shedding, the distance between two shed requests
+ * shrinks with the square root of the number of requests shed so far.
+ */
+static uint64_t
+codel_next(struct codel *c, uint64_t t)
+{
+	uint64_t	root;
+
+	for (root = 1; (root + 1) * (root + 1) <= c->count; ++root)
+		;
+
+	return (t + c->interval / root);
+}
+
+void
+codel_init(struct codel *c, uint64_t target, uint64_t interval)
+{
+	c->target = target;
+	c->interval = interval;
+	c->first_above = 0;
+	c->drop_next = 0;
+	c->count = 0;
+	c->lastcount = 0;
+	c->ok_to_drop = 0;
+	c->dropping = 0;
+}
+
+/*
+ * Feed the time a request has been waiting, measured at now, into c.
+ */
+void
+codel_sample(struct codel *c, uint64_t sojourn, uint64_t now)
+{
+	if (sojourn < c->target) {
+		c->first_above = 0;
+		c->ok_to_drop = 0;
+	} else if (c->first_above == 0) {
+		c->first_above = now + c->interval;
+		c->ok_to_drop = 0;
+	} else if (now >= c->first_above)
+		c->ok_to_drop = 1;
+}
+
+/*
+ * Return whether the request that is about to be handled at now is to be
+ * shed.
+ */
+int
+codel_shed(struct codel *c, uint64_t now)
+{
+	size_t	delta;
+
+	if (c->dropping) {
+		if (!c->ok_to_drop) {
+			/* The waiting time is acceptable again. */
+			c->dropping = 0;
+			return (0);
+		}
+		if (now < c->drop_next)
+			return (0);
+
+		++c->count;
+		c->drop_next = codel_next(c, c->drop_next);
+		return (1);
+	}
+
+	if (!c->ok_to_drop)
+		return (0);
+
+	/*
+	 * Start an episode.  If the previous one ended only recently, continue
+	 * with its shedding rate rather than starting over.
+	 */
+	c->dropping = 1;
+	delta = c->count - c->lastcount;
+	if (delta > 1 && now - c->drop_next < 16 * c->interval)
+		c->count = delta;
+	else
+		c->count = 1;
+	c->lastcount = c->count;
+	c->drop_next = codel_next(c, now);
+
+	return (1);
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2022 Emil Engler <engler+yhttp@unveil2.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef CODEL_H
+#define CODEL_H
+
+/*
+ * A controller in the style of CoDel (RFC 8289), which decides whether
+ * requests are to be shed, based upon the time they have been waiting before
+ * being handled.  All times are in milliseconds.
+ */
+struct codel {
+	uint64_t	target;		/* The acceptable waiting time. */
+	uint64_t	interval;	/* How long it may be exceeded. */
+	uint64_t	first_above;	/* When target has been exceeded for
+					   a whole interval, or 0. */
+	uint64_t	drop_next;	/* When to shed the next request. */
+	size_t		count;		/* Requests shed in this episode. */
+	size_t		lastcount;	/* count of the previous episode. */
+	int		ok_to_drop;	/* The last sample allows shedding. */
+	int		dropping;	/* An episode is in progress. */
+};
+
+void	codel_init(struct codel *, uint64_t, uint64_t);
+void	codel_sample(struct codel *, uint64_t, uint64_t);
+int	codel_shed(struct codel *, uint64_t);
+
+#endif
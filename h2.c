@@ -0,0 +1,1348 @@
+/*
+ * Copyright (c) 2022 Emil Engler <engler+yhttp@unveil2.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "arena.h"
+#include "buf.h"
+#include "hash.h"
+#include "hpack.h"
+#include "parser.h"
+#include "yhttp.h"
+#include "yhttp-internal.h"
+#include "resp.h"
+#include "h2.h"
+
+/*
+ * Frames are at most H2_NFRAME bytes in either direction, being the default
+ * of SETTINGS_MAX_FRAME_SIZE, which the server never raises.
+ */
+#define H2_NFRAME	16384
+
+/* The SETTINGS_MAX_CONCURRENT_STREAMS of the server. */
+#define H2_NSTREAMS	100
+
+#define H2_WINDOW	65535		/* The initial flow-control window. */
+#define H2_MAXWINDOW	0x7fffffff
+
+enum h2_type {
+	H2_DATA,
+	H2_HEADERS,
+	H2_PRIORITY,
+	H2_RST_STREAM,
+	H2_SETTINGS,
+	H2_PUSH_PROMISE,
+	H2_PING,
+	H2_GOAWAY,
+	H2_WINDOW_UPDATE,
+	H2_CONTINUATION
+};
+
+#define H2_END_STREAM	0x01
+#define H2_ACK		0x01
+#define H2_END_HEADERS	0x04
+#define H2_PADDED	0x08
+#define H2_PRIO		0x20
+
+/*
+ * The state of decoding the header block of a stream.
+ */
+struct h2_fields {
+	struct h2_stream	*st;		/* NULL to discard the fields. */
+	char			*method;	/* The pseudo-header fields. */
+	char			*path;
+	char			*scheme;
+	char			*authority;
+	int			 trailer;	/* A trailer section. */
+	int			 regular;	/* A regular field has been seen. */
+	int			 malformed;
+	size_t			 nheader;	/* Bytes as in HTTP/1.1. */
+	size_t			 nfields;
+};
+
+static uint32_t		 h2_get32(const unsigned char *);
+static int		 h2_frame(struct buf *, size_t, enum h2_type, int,
+				  uint32_t);
+static int		 h2_rst(struct h2 *, uint32_t, enum h2_error);
+static int		 h2_window_update(struct h2 *, uint32_t, uint32_t);
+
+static struct h2_stream	*h2_find(struct h2 *, uint32_t);
+static struct h2_stream	*h2_open(struct h2 *, uint32_t, struct parser *);
+static void		 h2_close(struct h2 *, struct h2_stream *);
+static int		 h2_reset(struct h2 *, struct h2_stream *,
+				  enum h2_error);
+static int		 h2_done(struct h2 *, struct h2_stream *);
+static void		 h2_finish(struct h2_stream *);
+
+static int		 h2_field(void *, const char *, size_t, const char *,
+				  size_t);
+static void		 h2_fields_free(struct h2_fields *);
+static int		 h2_request(struct h2_stream *, struct h2_fields *);
+static int		 h2_headers(struct h2 *, uint32_t, int);
+static int		 h2_settings(struct h2 *, const unsigned char *,
+				     size_t);
+static size_t		 h2_base64url(const char *, unsigned char *);
+
+static int		 h2_on_data(struct h2 *, int, uint32_t,
+				    const unsigned char *, size_t);
+static int		 h2_on_headers(struct h2 *, enum h2_type, int,
+				       uint32_t, const unsigned char *,
+				       size_t);
+static int		 h2_on_rst_stream(struct h2 *, uint32_t,
+					  const unsigned char *, size_t);
+static int		 h2_on_settings(struct h2 *, int, uint32_t,
+					const unsigned char *, size_t);
+static int		 h2_on_ping(struct h2 *, int, uint32_t,
+				    const unsigned char *, size_t);
+static int		 h2_on_window_update(struct h2 *, uint32_t,
+					     const unsigned char *, size_t);
+static int		 h2_on_frame(struct h2 *, enum h2_type, int, uint32_t,
+				     const unsigned char *, size_t);
+
+static int		 h2_send_headers(struct h2 *, uint32_t, struct buf *,
+					 int);
+static int		 h2_send_data(struct h2 *, struct h2_stream *);
+
+static uint32_t
+h2_get32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+		(uint32_t)p[2] << 8 | (uint32_t)p[3]);
+}
+
+/*
+ * Append the header of a frame to buf, with its payload to follow.
+ */
+static int
+h2_frame(struct buf *buf, size_t len, enum h2_type type, int flags,
+	 uint32_t id)
+{
+	unsigned char	hdr[9];
+
+	hdr[0] = len >> 16;
+	hdr[1] = len >> 8;
+	hdr[2] = len;
+	hdr[3] = type;
+	hdr[4] = flags;
+	hdr[5] = id >> 24;
+	hdr[6] = id >> 16;
+	hdr[7] = id >> 8;
+	hdr[8] = id;
+
+	return (buf_append(buf, hdr, sizeof(hdr)));
+}
+
+/*
+ * Reset the stream id with the error code.
+ */
+static int
+h2_rst(struct h2 *h2, uint32_t id, enum h2_error code)
+{
+	unsigned char	payload[4];
+	int		rc;
+
+	if ((rc = h2_frame(h2->out, 4, H2_RST_STREAM, 0, id)) != YHTTP_OK)
+		return (rc);
+	payload[0] = 0;
+	payload[1] = 0;
+	payload[2] = 0;
+	payload[3] = code;
+
+	return (buf_append(h2->out, payload, sizeof(payload)));
+}
+
+/*
+ * Allow the client to send another n bytes on the stream id, or on the
+ * connection as a whole, if id is 0.
+ */
+static int
+h2_window_update(struct h2 *h2, uint32_t id, uint32_t n)
+{
+	unsigned char	payload[4];
+	int		rc;
+
+	rc = h2_frame(h2->out, 4, H2_WINDOW_UPDATE, 0, id);
+	if (rc != YHTTP_OK)
+		return (rc);
+	payload[0] = n >> 24;
+	payload[1] = n >> 16;
+	payload[2] = n >> 8;
+	payload[3] = n;
+
+	return (buf_append(h2->out, payload, sizeof(payload)));
+}
+
+static struct h2_stream *
+h2_find(struct h2 *h2, uint32_t id)
+{
+	struct h2_stream	*st;
+
+	for (st = h2->streams; st != NULL; st = st->next) {
+		if (st->id == id)
+			return (st);
+	}
+
+	return (NULL);
+}
+
+/*
+ * Open the stream id, whose request is being held by parser, or by a new
+ * parser, if it is NULL.
+ */
+static struct h2_stream *
+h2_open(struct h2 *h2, uint32_t id, struct parser *parser)
+{
+	struct h2_stream	*st, **tail;
+
+	if ((st = malloc(sizeof(struct h2_stream))) == NULL)
+		return (NULL);
+	if (parser == NULL) {
+		if ((parser = parser_init()) == NULL) {
+			free(st);
+			return (NULL);
+		}
+		parser->head = h2->head;
+		parser->chunk = h2->chunk;
+		parser->udata = h2->udata;
+		parser->limits = h2->limits;
+		parser->state = PARSER_HEADERS;
+	}
+
+	st->next = NULL;
+	st->parser = parser;
+	st->id = id;
+	st->window = h2->initwin;
+	st->tfirst = h2->now;
+	st->clen = SIZE_MAX;
+	st->nsent = 0;
+	st->closed = 0;
+	st->taken = 0;
+	st->sending = 0;
+	st->dead = 0;
+
+	for (tail = &h2->streams; *tail != NULL; tail = &(*tail)->next)
+		;
+	*tail = st;
+	++h2->nstreams;
+
+	return (st);
+}
+
+/*
+ * Remove a stream.  A body that is still being produced by the callback
+ * function is being aborted, just like on a connection that goes away.
+ */
+static void
+h2_close(struct h2 *h2, struct h2_stream *st)
+{
+	struct yhttp_requ_internal	*internal;
+	struct h2_stream		**p;
+
+	for (p = &h2->streams; *p != st; p = &(*p)->next)
+		;
+	*p = st->next;
+	--h2->nstreams;
+
+	internal = st->parser->requ->internal;
+	if (st->sending && internal->resp->fill != NULL)
+		internal->resp->fill(st->parser->requ, NULL, 0,
+				     internal->resp->arg);
+
+	parser_free(st->parser);
+	free(st);
+}
+
+/*
+ * Reset a stream due to an error.  A stream that is being handled by the
+ * callback function is only removed afterwards.
+ */
+static int
+h2_reset(struct h2 *h2, struct h2_stream *st, enum h2_error code)
+{
+	int	rc;
+
+	if ((rc = h2_rst(h2, st->id, code)) != YHTTP_OK)
+		return (rc);
+
+	if (st->taken && !st->sending)
+		st->dead = 1;
+	else
+		h2_close(h2, st);
+
+	return (YHTTP_OK);
+}
+
+/*
+ * Remove a stream once its response has been queued in full.  A client that
+ * is still sending the request is told to stop (RFC 7540, 8.1).
+ */
+static int
+h2_done(struct h2 *h2, struct h2_stream *st)
+{
+	int	rc;
+
+	if (!st->closed && (rc = h2_rst(h2, st->id, H2_NO_ERROR)) != YHTTP_OK)
+		return (rc);
+	h2_close(h2, st);
+
+	return (YHTTP_OK);
+}
+
+/*
+ * Complete the request of a stream, once the client has ended it.
+ */
+static void
+h2_finish(struct h2_stream *st)
+{
+	struct parser	*parser;
+
+	st->closed = 1;
+	parser = st->parser;
+	if (parser->err)
+		return;
+
+	if (st->clen != SIZE_MAX && st->clen != parser->requ->nbody) {
+		parser->err = 400;
+		return;
+	}
+
+	if (parser->chunk == NULL)
+		parser->requ->body = parser->buf.buf;
+	parser->state = PARSER_DONE;
+}
+
+/*
+ * Add a decoded header field to the request of a stream.  A malformed request
+ * is only being reported after the whole block has been decoded, as the
+ * decoder has to stay in sync with the encoder of the client.
+ */
+static int
+h2_field(void *arg, const char *name, size_t nname, const char *value,
+	 size_t nvalue)
+{
+	struct yhttp_requ_internal	 *internal;
+	struct h2_fields		 *f;
+	struct parser			 *parser;
+	const char			 *prev;
+	char				**pseudo, *s;
+	size_t				  i;
+
+	f = arg;
+	if (f->st == NULL || f->malformed)
+		return (YHTTP_OK);
+	parser = f->st->parser;
+	f->nheader += nname + nvalue + 4;
+	++f->nfields;
+
+	if (nname != 0 && name[0] == ':') {
+		/* Pseudo-header fields precede all others. */
+		if (f->regular || f->trailer)
+			goto malformed;
+
+		if (strcmp(name, ":method") == 0)
+			pseudo = &f->method;
+		else if (strcmp(name, ":path") == 0)
+			pseudo = &f->path;
+		else if (strcmp(name, ":scheme") == 0)
+			pseudo = &f->scheme;
+		else if (strcmp(name, ":authority") == 0)
+			pseudo = &f->authority;
+		else
+			goto malformed;
+		if (*pseudo != NULL)
+			goto malformed;
+
+		if ((*pseudo = strndup(value, nvalue)) == NULL)
+			return (YHTTP_ERRNO);
+		return (YHTTP_OK);
+	}
+	f->regular = 1;
+
+	/* Field names are lower case, without any connection-specific ones. */
+	for (i = 0; i < nname; ++i) {
+		if (isupper((unsigned char)name[i]))
+			goto malformed;
+	}
+	if (strcmp(name, "connection") == 0 ||
+	    strcmp(name, "keep-alive") == 0 ||
+	    strcmp(name, "proxy-connection") == 0 ||
+	    strcmp(name, "transfer-encoding") == 0 ||
+	    strcmp(name, "upgrade") == 0)
+		goto malformed;
+	if (strcmp(name, "te") == 0 && strcmp(value, "trailers") != 0)
+		goto malformed;
+
+	if (parser->err)
+		return (YHTTP_OK);
+
+	/* A cookie may have been split into several fields. */
+	if (strcmp(name, "cookie") == 0 &&
+	    (prev = yhttp_header(parser->requ, "cookie")) != NULL) {
+		internal = parser->requ->internal;
+		s = arena_printf(&internal->arena, "%s; %s", prev, value);
+		if (s == NULL)
+			return (YHTTP_ERRNO);
+		return (hash_set(&internal->arena, internal->headers, "cookie",
+				 s));
+	}
+
+	return (parser_field(parser, name, nname, value, nvalue));
+malformed:
+	f->malformed = 1;
+	return (YHTTP_OK);
+}
+
+static void
+h2_fields_free(struct h2_fields *f)
+{
+	free(f->method);
+	free(f->path);
+	free(f->scheme);
+	free(f->authority);
+}
+
+/*
+ * Complete the header of the request of a stream, after its header fields
+ * have been decoded.
+ */
+static int
+h2_request(struct h2_stream *st, struct h2_fields *f)
+{
+	struct parser	*parser;
+	int		 rc;
+
+	parser = st->parser;
+	if (parser->err)
+		return (YHTTP_OK);
+
+	if ((parser->limits.nheader != 0 &&
+	     f->nheader > parser->limits.nheader) ||
+	    (parser->limits.nfields != 0 &&
+	     f->nfields > parser->limits.nfields)) {
+		parser->err = 431;
+		return (YHTTP_OK);
+	}
+
+	/* The authority takes the place of the Host header field. */
+	if (f->authority != NULL &&
+	    yhttp_header(parser->requ, "host") == NULL) {
+		rc = parser_field(parser, "host", 4, f->authority,
+				  strlen(f->authority));
+		if (rc != YHTTP_OK || parser->err)
+			return (rc);
+	}
+
+	rc = parser_h2_request(parser, f->method, strlen(f->method), f->path,
+			       strlen(f->path));
+	if (rc != YHTTP_OK || parser->err)
+		return (rc);
+
+	/* The body is being counted as it arrives. */
+	if (yhttp_header(parser->requ, "content-length") != NULL)
+		st->clen = parser->requ->nbody;
+	parser->requ->nbody = 0;
+
+	if (parser->chunk != NULL && parser->head != NULL)
+		parser->head(parser->requ, parser->udata);
+
+	return (YHTTP_OK);
+}
+
+/*
+ * Handle a complete header block of the stream id, which either opens the
+ * stream, or contains its trailer section.
+ */
+static int
+h2_headers(struct h2 *h2, uint32_t id, int flags)
+{
+	struct h2_fields	f;
+	struct h2_stream	*st;
+	int			refused, rc;
+
+	memset(&f, 0, sizeof(f));
+	refused = 0;
+	if ((st = h2_find(h2, id)) != NULL)
+		f.trailer = 1;
+	else if (id > h2->lastid) {
+		h2->lastid = id;
+		if (h2->nstreams >= H2_NSTREAMS || h2->closing)
+			refused = 1;
+		else if ((st = h2_open(h2, id, NULL)) == NULL)
+			return (YHTTP_ERRNO);
+	}
+	f.st = st;
+
+	/* The block of a stream that has been closed is still decoded. */
+	rc = hpack_decode(&h2->hpack, h2->block.buf, h2->block.used, h2_field,
+			  &f);
+	buf_wipe(&h2->block);
+	if (rc != YHTTP_OK) {
+		h2_fields_free(&f);
+		if (rc == YHTTP_EINVAL)
+			return (h2_goaway(h2, H2_COMPRESSION_ERROR));
+		return (rc);
+	}
+
+	if (st == NULL) {
+		h2_fields_free(&f);
+		return (refused ? h2_rst(h2, id, H2_REFUSED_STREAM) :
+		    YHTTP_OK);
+	}
+
+	/* A trailer section ends the stream, without pseudo-header fields. */
+	if (f.trailer) {
+		if (!(flags & H2_END_STREAM) || f.method != NULL ||
+		    f.path != NULL || f.scheme != NULL || f.authority != NULL)
+			f.malformed = 1;
+	} else if (f.method == NULL || f.path == NULL || f.scheme == NULL)
+		f.malformed = 1;
+	if (f.malformed) {
+		h2_fields_free(&f);
+		return (h2_reset(h2, st, H2_PROTOCOL_ERROR));
+	}
+
+	rc = f.trailer ? YHTTP_OK : h2_request(st, &f);
+	h2_fields_free(&f);
+	if (rc != YHTTP_OK)
+		return (rc);
+
+	if (flags & H2_END_STREAM)
+		h2_finish(st);
+
+	return (YHTTP_OK);
+}
+
+/*
+ * Apply the settings of the client.
+ */
+static int
+h2_settings(struct h2 *h2, const unsigned char *p, size_t n)
+{
+	struct h2_stream	*st;
+	uint32_t		 value;
+	int64_t			 delta;
+	size_t			 i;
+
+	for (i = 0; i + 6 <= n; i += 6) {
+		value = h2_get32(p + i + 2);
+		switch (p[i] << 8 | p[i + 1]) {
+		case 0x2:	/* SETTINGS_ENABLE_PUSH */
+			if (value > 1)
+				return (h2_goaway(h2, H2_PROTOCOL_ERROR));
+			break;
+		case 0x4:	/* SETTINGS_INITIAL_WINDOW_SIZE */
+			if (value > H2_MAXWINDOW)
+				return (h2_goaway(h2, H2_FLOW_CONTROL_ERROR));
+			delta = (int64_t)value - h2->initwin;
+			for (st = h2->streams; st != NULL; st = st->next) {
+				if (st->window + delta > H2_MAXWINDOW)
+					return (h2_goaway(h2,
+					    H2_FLOW_CONTROL_ERROR));
+				st->window += delta;
+			}
+			h2->initwin = value;
+			break;
+		case 0x5:	/* SETTINGS_MAX_FRAME_SIZE */
+			if (value < 16384 || value > 16777215)
+				return (h2_goaway(h2, H2_PROTOCOL_ERROR));
+			break;
+		default:
+			/* Others do not matter to a server without push. */
+			break;
+		}
+	}
+
+	return (YHTTP_OK);
+}
+
+/*
+ * Decode the base64url string s without padding into out, which must have
+ * room for 3 / 4 of its length.  A string that is not valid yields
+ * SIZE_MAX.
+ */
+static size_t
+h2_base64url(const char *s, unsigned char *out)
+{
+	const char	*alphabet, *p;
+	uint32_t	 bits;
+	size_t		 i, n;
+
+	alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+		   "abcdefghijklmnopqrstuvwxyz0123456789-_";
+	bits = 0;
+	n = 0;
+	for (i = 0; s[i] != '\0' && s[i] != '='; ++i) {
+		if ((p = strchr(alphabet, s[i])) == NULL)
+			return (SIZE_MAX);
+		bits = bits << 6 | (p - alphabet);
+		if (i % 4 == 3) {
+			out[n++] = bits >> 16;
+			out[n++] = bits >> 8;
+			out[n++] = bits;
+			bits = 0;
+		}
+	}
+
+	switch (i % 4) {
+	case 1:
+		return (SIZE_MAX);
+	case 2:
+		out[n++] = bits >> 4;
+		break;
+	case 3:
+		out[n++] = bits >> 10;
+		out[n++] = bits >> 2;
+		break;
+	}
+
+	return (n);
+}
+
+static int
+h2_on_data(struct h2 *h2, int flags, uint32_t id, const unsigned char *p,
+	   size_t n)
+{
+	struct h2_stream	*st;
+	struct parser		*parser;
+	size_t			 len, pad;
+	int			 rc;
+
+	if (id == 0)
+		return (h2_goaway(h2, H2_PROTOCOL_ERROR));
+	len = n;
+	if (flags & H2_PADDED) {
+		if (n == 0 || (pad = p[0]) >= n)
+			return (h2_goaway(h2, H2_PROTOCOL_ERROR));
+		++p;
+		n -= pad + 1;
+	}
+
+	/*
+	 * The credit is given back right away, as the size of a body is
+	 * bounded by the limits instead of flow control.
+	 */
+	if (len != 0 && (rc = h2_window_update(h2, 0, len)) != YHTTP_OK)
+		return (rc);
+
+	if ((st = h2_find(h2, id)) == NULL)
+		return (id > h2->lastid ?
+		    h2_goaway(h2, H2_PROTOCOL_ERROR) : YHTTP_OK);
+	if (st->closed)
+		return (h2_reset(h2, st, H2_STREAM_CLOSED));
+	if (len != 0 && !(flags & H2_END_STREAM) &&
+	    (rc = h2_window_update(h2, id, len)) != YHTTP_OK)
+		return (rc);
+
+	parser = st->parser;
+	if (!parser->err && n != 0) {
+		if (parser->limits.nbody != 0 &&
+		    n > parser->limits.nbody - parser->requ->nbody)
+			parser->err = 413;
+		else if (st->clen != SIZE_MAX &&
+			 n > st->clen - parser->requ->nbody)
+			parser->err = 400;
+		else if (parser->chunk != NULL)
+			parser->chunk(parser->requ, p, n, parser->udata);
+		else if ((rc = buf_append(&parser->buf, p, n)) != YHTTP_OK)
+			return (rc);
+		parser->requ->nbody += n;
+	}
+
+	if (flags & H2_END_STREAM)
+		h2_finish(st);
+
+	return (YHTTP_OK);
+}
+
+/*
+ * Handle a HEADERS or a CONTINUATION frame, collecting the fragments of a
+ * header block until it is complete.
+ */
+static int
+h2_on_headers(struct h2 *h2, enum h2_type type, int flags, uint32_t id,
+	      const unsigned char *p, size_t n)
+{
+	struct h2_stream	*st;
+	size_t			 pad;
+	int			 rc;
+
+	if (type == H2_CONTINUATION) {
+		if (h2->cont == 0)
+			return (h2_goaway(h2, H2_PROTOCOL_ERROR));
+	} else {
+		/* Streams of the client have odd IDs. */
+		if (id == 0 || id % 2 == 0)
+			return (h2_goaway(h2, H2_PROTOCOL_ERROR));
+		st = h2_find(h2, id);
+		if (st != NULL && st->closed)
+			return (h2_goaway(h2, H2_STREAM_CLOSED));
+
+		pad = 0;
+		if (flags & H2_PADDED) {
+			if (n == 0)
+				return (h2_goaway(h2, H2_PROTOCOL_ERROR));
+			pad = p[0];
+			++p;
+			--n;
+		}
+		if (flags & H2_PRIO) {
+			if (n < 5)
+				return (h2_goaway(h2, H2_PROTOCOL_ERROR));
+			p += 5;
+			n -= 5;
+		}
+		if (pad > n)
+			return (h2_goaway(h2, H2_PROTOCOL_ERROR));
+		n -= pad;
+
+		h2->cont = id;
+		h2->cflags = flags;
+	}
+
+	if ((rc = buf_append(&h2->block, p, n)) != YHTTP_OK)
+		return (rc);
+	if (h2->limits.nheader != 0 && h2->block.used > h2->limits.nheader)
+		return (h2_goaway(h2, H2_ENHANCE_YOUR_CALM));
+	if (!(flags & H2_END_HEADERS))
+		return (YHTTP_OK);
+
+	id = h2->cont;
+	h2->cont = 0;
+	return (h2_headers(h2, id, h2->cflags));
+}
+
+static int
+h2_on_rst_stream(struct h2 *h2, uint32_t id, const unsigned char *p,
+		 size_t n)
+{
+	struct h2_stream	*st;
+
+	if (n != 4)
+		return (h2_goaway(h2, H2_FRAME_SIZE_ERROR));
+	if (id == 0 || id > h2->lastid)
+		return (h2_goaway(h2, H2_PROTOCOL_ERROR));
+
+	if ((st = h2_find(h2, id)) == NULL)
+		return (YHTTP_OK);
+	if (st->taken && !st->sending)
+		st->dead = 1;
+	else
+		h2_close(h2, st);
+
+	return (YHTTP_OK);
+}
+
+static int
+h2_on_settings(struct h2 *h2, int flags, uint32_t id, const unsigned char *p,
+	       size_t n)
+{
+	int	rc;
+
+	if (id != 0)
+		return (h2_goaway(h2, H2_PROTOCOL_ERROR));
+	if (flags & H2_ACK)
+		return (n == 0 ? YHTTP_OK : h2_goaway(h2, H2_FRAME_SIZE_ERROR));
+	if (n % 6 != 0)
+		return (h2_goaway(h2, H2_FRAME_SIZE_ERROR));
+
+	if ((rc = h2_settings(h2, p, n)) != YHTTP_OK || h2->closing)
+		return (rc);
+	h2->settings = 1;
+
+	return (h2_frame(h2->out, 0, H2_SETTINGS, H2_ACK, 0));
+}
+
+static int
+h2_on_ping(struct h2 *h2, int flags, uint32_t id, const unsigned char *p,
+	   size_t n)
+{
+	int	rc;
+
+	if (n != 8)
+		return (h2_goaway(h2, H2_FRAME_SIZE_ERROR));
+	if (id != 0)
+		return (h2_goaway(h2, H2_PROTOCOL_ERROR));
+	if (flags & H2_ACK)
+		return (YHTTP_OK);
+
+	if ((rc = h2_frame(h2->out, 8, H2_PING, H2_ACK, 0)) != YHTTP_OK)
+		return (rc);
+	return (buf_append(h2->out, p, n));
+}
+
+static int
+h2_on_window_update(struct h2 *h2, uint32_t id, const unsigned char *p,
+		    size_t n)
+{
+	struct h2_stream	*st;
+	uint32_t		 inc;
+
+	if (n != 4)
+		return (h2_goaway(h2, H2_FRAME_SIZE_ERROR));
+	inc = h2_get32(p) & H2_MAXWINDOW;
+
+	if (id == 0) {
+		if (inc == 0)
+			return (h2_goaway(h2, H2_PROTOCOL_ERROR));
+		if (h2->window + inc > H2_MAXWINDOW)
+			return (h2_goaway(h2, H2_FLOW_CONTROL_ERROR));
+		h2->window += inc;
+		return (YHTTP_OK);
+	}
+
+	if ((st = h2_find(h2, id)) == NULL)
+		return (id > h2->lastid ?
+		    h2_goaway(h2, H2_PROTOCOL_ERROR) : YHTTP_OK);
+	if (inc == 0)
+		return (h2_reset(h2, st, H2_PROTOCOL_ERROR));
+	if (st->window + inc > H2_MAXWINDOW)
+		return (h2_reset(h2, st, H2_FLOW_CONTROL_ERROR));
+	st->window += inc;
+
+	return (YHTTP_OK);
+}
+
+static int
+h2_on_frame(struct h2 *h2, enum h2_type type, int flags, uint32_t id,
+	    const unsigned char *p, size_t n)
+{
+	/* The client has to start with its settings. */
+	if (!h2->settings && type != H2_SETTINGS)
+		return (h2_goaway(h2, H2_PROTOCOL_ERROR));
+
+	/* Nothing may interrupt a header block. */
+	if (h2->cont != 0 && (type != H2_CONTINUATION || id != h2->cont))
+		return (h2_goaway(h2, H2_PROTOCOL_ERROR));
+
+	switch (type) {
+	case H2_DATA:
+		return (h2_on_data(h2, flags, id, p, n));
+	case H2_HEADERS:
+	case H2_CONTINUATION:
+		return (h2_on_headers(h2, type, flags, id, p, n));
+	case H2_PRIORITY:
+		/* Priorities are not supported and therefore ignored. */
+		if (id == 0)
+			return (h2_goaway(h2, H2_PROTOCOL_ERROR));
+		return (n == 5 ? YHTTP_OK : h2_rst(h2, id, H2_FRAME_SIZE_ERROR));
+	case H2_RST_STREAM:
+		return (h2_on_rst_stream(h2, id, p, n));
+	case H2_SETTINGS:
+		return (h2_on_settings(h2, flags, id, p, n));
+	case H2_PUSH_PROMISE:
+		return (h2_goaway(h2, H2_PROTOCOL_ERROR));
+	case H2_PING:
+		return (h2_on_ping(h2, flags, id, p, n));
+	case H2_GOAWAY:
+		if (id != 0)
+			return (h2_goaway(h2, H2_PROTOCOL_ERROR));
+		h2->goaway = 1;
+		return (YHTTP_OK);
+	case H2_WINDOW_UPDATE:
+		return (h2_on_window_update(h2, id, p, n));
+	default:
+		/* Unknown frames are ignored. */
+		return (YHTTP_OK);
+	}
+}
+
+/*
+ * Queue the header block of a response, which is being split into frames of
+ * at most H2_NFRAME bytes.
+ */
+static int
+h2_send_headers(struct h2 *h2, uint32_t id, struct buf *block, int end)
+{
+	enum h2_type	type;
+	size_t		n, off;
+	int		flags, rc;
+
+	type = H2_HEADERS;
+	off = 0;
+	do {
+		n = block->used - off;
+		if (n > H2_NFRAME)
+			n = H2_NFRAME;
+		flags = type == H2_HEADERS && end ? H2_END_STREAM : 0;
+		if (off + n == block->used)
+			flags |= H2_END_HEADERS;
+
+		if ((rc = h2_frame(h2->out, n, type, flags, id)) != YHTTP_OK)
+			return (rc);
+		if ((rc = buf_append(h2->out, block->buf + off, n)) != YHTTP_OK)
+			return (rc);
+		off += n;
+		type = H2_CONTINUATION;
+	} while (off != block->used);
+
+	return (YHTTP_OK);
+}
+
+/*
+ * Queue the next DATA frame of a response, as far as the windows allow.
+ */
+static int
+h2_send_data(struct h2 *h2, struct h2_stream *st)
+{
+	struct yhttp_requ_internal	*internal;
+	struct yhttp_resp		*resp;
+	const unsigned char		*data;
+	unsigned char			 chunk[H2_NFRAME];
+	size_t				 n;
+	ssize_t				 nfill;
+	int				 end, rc;
+
+	internal = st->parser->requ->internal;
+	resp = internal->resp;
+
+	n = H2_NFRAME;
+	if ((int64_t)n > h2->window)
+		n = h2->window;
+	if ((int64_t)n > st->window)
+		n = st->window;
+
+	if (resp->fill != NULL) {
+		nfill = resp->fill(st->parser->requ, chunk, n, resp->arg);
+		if (nfill < 0 || (size_t)nfill > n) {
+			/* The response cannot be completed anymore. */
+			st->sending = 0;
+			if ((rc = h2_rst(h2, st->id, H2_INTERNAL_ERROR)) !=
+			    YHTTP_OK)
+				return (rc);
+			h2_close(h2, st);
+			return (YHTTP_OK);
+		}
+		data = chunk;
+		n = nfill;
+		end = n == 0;
+	} else {
+		data = resp->body + st->nsent;
+		if (n > resp->nbody - st->nsent)
+			n = resp->nbody - st->nsent;
+		end = st->nsent + n == resp->nbody;
+	}
+
+	rc = h2_frame(h2->out, n, H2_DATA, end ? H2_END_STREAM : 0, st->id);
+	if (rc != YHTTP_OK)
+		return (rc);
+	if ((rc = buf_append(h2->out, data, n)) != YHTTP_OK)
+		return (rc);
+	st->nsent += n;
+	st->window -= n;
+	h2->window -= n;
+
+	if (end) {
+		st->sending = 0;
+		return (h2_done(h2, st));
+	}
+
+	return (YHTTP_OK);
+}
+
+/*
+ * Create the state of an HTTP/2 connection, whose streams take their
+ * callback functions and limits from tmpl.  The settings of the server are
+ * queued to out right away.
+ */
+struct h2 *
+h2_init(const struct parser *tmpl, struct buf *out)
+{
+	struct h2	*h2;
+	unsigned char	 settings[12];
+	size_t		 n;
+
+	if ((h2 = malloc(sizeof(struct h2))) == NULL)
+		return (NULL);
+
+	hpack_init(&h2->hpack, 4096);
+	buf_init(&h2->in);
+	buf_init(&h2->block);
+	h2->out = out;
+	h2->streams = NULL;
+	h2->nstreams = 0;
+	h2->lastid = 0;
+	h2->cont = 0;
+	h2->cflags = 0;
+	h2->npreface = 0;
+	h2->settings = 0;
+	h2->window = H2_WINDOW;
+	h2->initwin = H2_WINDOW;
+	h2->goaway = 0;
+	h2->closing = 0;
+	h2->now = 0;
+	h2->head = tmpl->head;
+	h2->chunk = tmpl->chunk;
+	h2->udata = tmpl->udata;
+	h2->limits = tmpl->limits;
+
+	/* SETTINGS_MAX_CONCURRENT_STREAMS and SETTINGS_MAX_HEADER_LIST_SIZE */
+	n = 0;
+	settings[n++] = 0;
+	settings[n++] = 0x3;
+	settings[n++] = 0;
+	settings[n++] = 0;
+	settings[n++] = 0;
+	settings[n++] = H2_NSTREAMS;
+	if (h2->limits.nheader != 0 && h2->limits.nheader <= UINT32_MAX) {
+		settings[n++] = 0;
+		settings[n++] = 0x6;
+		settings[n++] = h2->limits.nheader >> 24;
+		settings[n++] = h2->limits.nheader >> 16;
+		settings[n++] = h2->limits.nheader >> 8;
+		settings[n++] = h2->limits.nheader;
+	}
+	if (h2_frame(out, n, H2_SETTINGS, 0, 0) != YHTTP_OK ||
+	    buf_append(out, settings, n) != YHTTP_OK) {
+		h2_free(h2);
+		return (NULL);
+	}
+
+	return (h2);
+}
+
+void
+h2_free(struct h2 *h2)
+{
+	if (h2 == NULL)
+		return;
+
+	while (h2->streams != NULL)
+		h2_close(h2, h2->streams);
+	hpack_free(&h2->hpack);
+	buf_wipe(&h2->in);
+	buf_wipe(&h2->block);
+	free(h2);
+}
+
+/*
+ * Process the frames that have been received, starting with the connection
+ * preface of the client.  A connection error is not reported, but leads to
+ * a GOAWAY frame, with closing being set.
+ */
+int
+h2_parse(struct h2 *h2, const unsigned char *data, size_t ndata)
+{
+	const unsigned char	*p;
+	size_t			 len, off;
+	int			 rc;
+
+	for (; h2->npreface < H2_NPREFACE && ndata != 0; --ndata, ++data) {
+		if (*data != H2_PREFACE[h2->npreface++])
+			return (h2_goaway(h2, H2_PROTOCOL_ERROR));
+	}
+	if (h2->closing || ndata == 0)
+		return (YHTTP_OK);
+
+	if ((rc = buf_append(&h2->in, data, ndata)) != YHTTP_OK)
+		return (rc);
+
+	off = 0;
+	while (!h2->closing && h2->in.used - off >= 9) {
+		p = h2->in.buf + off;
+		len = (size_t)p[0] << 16 | (size_t)p[1] << 8 | p[2];
+		if (len > H2_NFRAME)
+			return (h2_goaway(h2, H2_FRAME_SIZE_ERROR));
+		if (h2->in.used - off - 9 < len)
+			break;
+
+		rc = h2_on_frame(h2, p[3], p[4], h2_get32(p + 5) & H2_MAXWINDOW,
+				 p + 9, len);
+		if (rc != YHTTP_OK)
+			return (rc);
+		off += 9 + len;
+	}
+
+	return (buf_pop(&h2->in, h2->closing ? h2->in.used : off));
+}
+
+/*
+ * Continue an HTTP/1.1 request that has asked for an upgrade to h2c as the
+ * stream 1 of the connection, after the response that switches protocols
+ * has been queued.  The parser of the request is being taken over, with the
+ * bytes that follow the request being processed right away.
+ */
+int
+h2_upgrade(struct h2 *h2, struct parser *parser)
+{
+	struct h2_stream	*st;
+	const char		*value;
+	unsigned char		*settings;
+	size_t			 n;
+	int			 rc;
+
+	if ((st = h2_open(h2, 1, parser)) == NULL) {
+		parser_free(parser);
+		return (YHTTP_ERRNO);
+	}
+	st->closed = 1;
+	h2->lastid = 1;
+
+	/* The settings are acknowledged implicitly by the switch. */
+	value = yhttp_header(parser->requ, "HTTP2-Settings");
+	if ((settings = malloc(strlen(value) * 3 / 4 + 1)) == NULL)
+		return (YHTTP_ERRNO);
+	n = h2_base64url(value, settings);
+	if (n == SIZE_MAX || n % 6 != 0)
+		rc = h2_goaway(h2, H2_PROTOCOL_ERROR);
+	else
+		rc = h2_settings(h2, settings, n);
+	free(settings);
+	if (rc != YHTTP_OK || h2->closing)
+		return (rc);
+
+	return (h2_parse(h2, parser->buf.buf + parser->pos,
+			 parser->buf.used - parser->pos));
+}
+
+/*
+ * Return the next stream whose request is ready to be handled, or has
+ * failed.  It is up to the caller to pass it on to h2_respond() or to
+ * h2_reject() eventually.
+ */
+struct h2_stream *
+h2_take(struct h2 *h2)
+{
+	struct h2_stream	*st;
+
+	for (st = h2->streams; st != NULL; st = st->next) {
+		if (st->taken || st->dead)
+			continue;
+		if (st->parser->err || st->parser->state == PARSER_DONE) {
+			st->taken = 1;
+			return (st);
+		}
+	}
+
+	return (NULL);
+}
+
+/*
+ * Queue the header of the response of a stream, once the callback function
+ * has been run.  Its body follows by h2_send(), as flow control permits.
+ */
+int
+h2_respond(struct h2 *h2, struct h2_stream *st)
+{
+	struct yhttp_requ_internal	 *internal;
+	struct yhttp_resp		 *resp;
+	struct hash			**headers;
+	struct buf			  block;
+	char				  len[32];
+	size_t				  i;
+	int				  end, rc;
+
+	/* The client has reset the stream in the meantime. */
+	if (st->dead) {
+		h2_close(h2, st);
+		return (YHTTP_OK);
+	}
+
+	internal = st->parser->requ->internal;
+	resp = internal->resp;
+
+	buf_init(&block);
+	if ((rc = hpack_encode_status(&block, resp->status)) != YHTTP_OK)
+		goto end;
+	if ((headers = hash_dump(resp->arena, resp->headers)) == NULL) {
+		rc = YHTTP_ERRNO;
+		goto end;
+	}
+	for (i = 0; headers[i] != NULL; ++i) {
+		if (strcasecmp(headers[i]->name, "Connection") == 0 ||
+		    strcasecmp(headers[i]->name, "Keep-Alive") == 0 ||
+		    strcasecmp(headers[i]->name, "Proxy-Connection") == 0 ||
+		    strcasecmp(headers[i]->name, "Transfer-Encoding") == 0 ||
+		    strcasecmp(headers[i]->name, "Upgrade") == 0)
+			continue;
+		rc = hpack_encode(&block, headers[i]->name, headers[i]->value);
+		if (rc != YHTTP_OK)
+			goto end;
+	}
+
+	if (resp->fill == NULL) {
+		snprintf(len, sizeof(len), "%zu", resp->nbody);
+		if ((rc = hpack_encode(&block, "content-length", len)) !=
+		    YHTTP_OK)
+			goto end;
+	}
+
+	/* The response to HEAD has no body. */
+	end = st->parser->requ->method == YHTTP_HEAD ||
+	    (resp->fill == NULL && resp->nbody == 0);
+	if ((rc = h2_send_headers(h2, st->id, &block, end)) != YHTTP_OK)
+		goto end;
+
+	if (end) {
+		if (resp->fill != NULL)
+			resp->fill(st->parser->requ, NULL, 0, resp->arg);
+		rc = h2_done(h2, st);
+	} else
+		st->sending = 1;
+end:
+	buf_wipe(&block);
+	return (rc);
+}
+
+/*
+ * Answer the request of a stream with a minimal response with the status
+ * code status, without having run the callback function.  Unless it is 0,
+ * the client is asked to try again after retry seconds.
+ */
+int
+h2_reject(struct h2 *h2, struct h2_stream *st, int status, unsigned int retry)
+{
+	const char	*rp;
+	char		 s[16];
+	int		 rc;
+
+	rp = resp_find_rp(status);
+	if ((rc = yhttp_resp_status(st->parser->requ, status)) != YHTTP_OK)
+		return (rc);
+	if (retry != 0) {
+		snprintf(s, sizeof(s), "%u", retry);
+		rc = yhttp_resp_header(st->parser->requ, "Retry-After", s);
+		if (rc != YHTTP_OK)
+			return (rc);
+	}
+	rc = yhttp_resp_body(st->parser->requ, (const unsigned char *)rp,
+			     strlen(rp));
+	if (rc != YHTTP_OK)
+		return (rc);
+
+	return (h2_respond(h2, st));
+}
+
+/*
+ * Queue an interim response with the status 103 and the Link header field
+ * link on the stream st, ahead of its final response.
+ */
+int
+h2_hint(struct h2 *h2, struct h2_stream *st, const char *link)
+{
+	struct buf	block;
+	int		rc;
+
+	/* The client has reset the stream in the meantime. */
+	if (st->dead)
+		return (YHTTP_OK);
+
+	buf_init(&block);
+	if ((rc = hpack_encode_status(&block, 103)) == YHTTP_OK &&
+	    (rc = hpack_encode(&block, "link", link)) == YHTTP_OK)
+		rc = h2_send_headers(h2, st->id, &block, 0);
+	buf_wipe(&block);
+
+	return (rc);
+}
+
+/*
+ * Queue the bodies of the responses, one frame per stream at a time, until
+ * room bytes have been queued, or the windows of the client are exhausted.
+ */
+int
+h2_send(struct h2 *h2, size_t room)
+{
+	struct h2_stream	*st, *next;
+	size_t			 start;
+	int			 progress, rc;
+
+	start = h2->out->used;
+	do {
+		progress = 0;
+		for (st = h2->streams; st != NULL; st = next) {
+			next = st->next;
+			if (h2->out->used - start >= room || h2->window <= 0)
+				return (YHTTP_OK);
+			if (!st->sending || st->window <= 0)
+				continue;
+
+			if ((rc = h2_send_data(h2, st)) != YHTTP_OK)
+				return (rc);
+			progress = 1;
+		}
+	} while (progress);
+
+	return (YHTTP_OK);
+}
+
+/*
+ * Tell the client that the connection is going away, due to the error code,
+ * with all streams up to the latest one being handled.
+ */
+int
+h2_goaway(struct h2 *h2, enum h2_error code)
+{
+	unsigned char	payload[8];
+	int		rc;
+
+	if (h2->closing)
+		return (YHTTP_OK);
+	h2->closing = 1;
+
+	if ((rc = h2_frame(h2->out, 8, H2_GOAWAY, 0, 0)) != YHTTP_OK)
+		return (rc);
+	payload[0] = h2->lastid >> 24;
+	payload[1] = h2->lastid >> 16;
+	payload[2] = h2->lastid >> 8;
+	payload[3] = h2->lastid;
+	payload[4] = 0;
+	payload[5] = 0;
+	payload[6] = 0;
+	payload[7] = code;
+
+	return (buf_append(h2->out, payload, sizeof(payload)));
+}
+
+/*
+ * Check whether h2_send() is able to queue anything.
+ */
+int
+h2_pending(const struct h2 *h2)
+{
+	const struct h2_stream	*st;
+
+	if (h2->window <= 0)
+		return (0);
+	for (st = h2->streams; st != NULL; st = st->next) {
+		if (st->sending && st->window > 0)
+			return (1);
+	}
+
+	return (0);
+}
+
+/*
+ * Check whether a request is still being received.
+ */
+int
+h2_receiving(const struct h2 *h2)
+{
+	const struct h2_stream	*st;
+
+	for (st = h2->streams; st != NULL; st = st->next) {
+		if (!st->closed && !st->taken)
+			return (1);
+	}
+
+	return (0);
+}
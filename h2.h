@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2022 Emil Engler <engler+yhttp@unveil2.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef H2_H
+#define H2_H
+
+/* The connection preface of the client. */
+#define H2_PREFACE	"PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_NPREFACE	24
+
+enum h2_error {
+	H2_NO_ERROR,
+	H2_PROTOCOL_ERROR,
+	H2_INTERNAL_ERROR,
+	H2_FLOW_CONTROL_ERROR,
+	H2_SETTINGS_TIMEOUT,
+	H2_STREAM_CLOSED,
+	H2_FRAME_SIZE_ERROR,
+	H2_REFUSED_STREAM,
+	H2_CANCEL,
+	H2_COMPRESSION_ERROR,
+	H2_CONNECT_ERROR,
+	H2_ENHANCE_YOUR_CALM
+};
+
+/*
+ * A stream carries a single request, which is being held by its parser
+ * along with the response, just like on an HTTP/1.x connection.
+ */
+struct h2_stream {
+	struct h2_stream	*next;
+	struct parser		*parser;
+	uint32_t		 id;
+	int64_t			 window;	/* Bytes the client accepts. */
+	uint64_t		 tfirst;	/* When the request began. */
+	size_t			 clen;		/* Content-Length or SIZE_MAX. */
+	size_t			 nsent;		/* Transmitted bytes of the body. */
+	int			 closed;	/* The request is complete. */
+	int			 taken;		/* Returned by h2_take(). */
+	int			 sending;	/* The body is being transmitted. */
+	int			 dead;		/* Reset while being handled. */
+};
+
+struct h2 {
+	struct hpack		 hpack;		/* The decoder of the client. */
+	struct buf		 in;		/* An incomplete frame. */
+	struct buf		 block;		/* An incomplete header block. */
+	struct buf		*out;		/* The output queue. */
+	struct h2_stream	*streams;	/* In the order of their IDs. */
+	size_t			 nstreams;
+	uint32_t		 lastid;	/* The latest stream of the client. */
+	uint32_t		 cont;		/* The stream of block, or 0. */
+	int			 cflags;	/* The flags of its HEADERS frame. */
+	size_t			 npreface;	/* Bytes of the preface received. */
+	int			 settings;	/* SETTINGS have been received. */
+	int64_t			 window;	/* Bytes the client accepts. */
+	int64_t			 initwin;	/* The same for new streams. */
+	int			 goaway;	/* The client is going away. */
+	int			 closing;	/* GOAWAY has been sent. */
+	uint64_t		 now;		/* When streams are being opened. */
+
+	/* Passed on to the parsers of the streams. */
+	void			(*head)(struct yhttp_requ *, void *);
+	void			(*chunk)(struct yhttp_requ *,
+					 const unsigned char *, size_t,
+					 void *);
+	void			*udata;
+	struct parser_limits	 limits;
+};
+
+struct h2		*h2_init(const struct parser *, struct buf *);
+void			 h2_free(struct h2 *);
+
+int			 h2_parse(struct h2 *, const unsigned char *, size_t);
+int			 h2_upgrade(struct h2 *, struct parser *);
+
+struct h2_stream	*h2_take(struct h2 *);
+int			 h2_respond(struct h2 *, struct h2_stream *);
+int			 h2_reject(struct h2 *, struct h2_stream *, int,
+				   unsigned int);
+int			 h2_hint(struct h2 *, struct h2_stream *,
+				 const char *);
+int			 h2_send(struct h2 *, size_t);
+int			 h2_goaway(struct h2 *, enum h2_error);
+
+int			 h2_pending(const struct h2 *);
+int			 h2_receiving(const struct h2 *);
+
+#endif
@@ -21,6 +21,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "arena.h"
 #include "hash.h"
 #include "yhttp.h"
 
@@ -46,8 +47,12 @@ hash(const char *s)
 	return (h % NHASH);
 }
 
+/*
+ * The table, its nodes and the arrays of hash_dump() are being allocated from
+ * arena, which releases them all at once.  There is no hash_free().
+ */
 struct hash **
-hash_init(void)
+hash_init(struct arena *arena)
 {
 	struct hash	**ht;
 	size_t		  i;
@@ -56,7 +61,7 @@ hash_init(void)
 	 * Allocate an array of struct hash pointers, where each of them is
 	 * the head node of a linked list for that specific index.
 	 */
-	if ((ht = malloc(sizeof(struct hash) * NHASH)) == NULL)
+	if ((ht = arena_alloc(arena, sizeof(struct hash *) * NHASH)) == NULL)
 		return (NULL);
 
 	/* Initialize all pointers to NULL. */
@@ -66,37 +71,12 @@ hash_init(void)
 	return (ht);
 }
 
-void
-hash_free(struct hash *ht[])
-{
-	struct hash	*tmp;
-	size_t		 i;
-
-	if (ht == NULL)
-		return;
-
-	/* Free all linked lists inside the hash table array. */
-	for (i = 0; i < NHASH; ++i) {
-		while (ht[i] != NULL) {
-			tmp = ht[i];
-			ht[i] = ht[i]->next;
-
-			free(tmp->name);
-			free(tmp->value);
-			free(tmp);
-		}
-	}
-
-	free(ht);
-}
-
 /*
  * Return an allocated array that contains all nodes in the hash table.
  * The end of this array is denoted by a node with adress NULL.
- * The returned array must be passed to free(3) afterwards.
  */
 struct hash **
-hash_dump(struct hash *ht[])
+hash_dump(struct arena *arena, struct hash *ht[])
 {
 	struct hash	**nodes, *node;
 	size_t		  nnodes, i, j;
@@ -111,7 +91,8 @@ hash_dump(struct hash *ht[])
 	/* Allocate nodes. */
 	if (nnodes > SIZE_MAX / sizeof(struct hash *))
 		return (NULL);
-	if ((nodes = malloc(sizeof(struct hash *) * nnodes)) == NULL)
+	if ((nodes = arena_alloc(arena, sizeof(struct hash *) * nnodes)) ==
+	    NULL)
 		return (NULL);
 
 	/* Initialize nodes. */
@@ -140,8 +121,14 @@ hash_get(struct hash *ht[], const char *name)
 	return (node);
 }
 
+/*
+ * Set the entry name to value.  Neither of them is being copied, as they
+ * usually have been allocated from arena as well, so they must remain valid
+ * as long as the hash table.
+ */
 int
-hash_set(struct hash *ht[], const char *name, const char *value)
+hash_set(struct arena *arena, struct hash *ht[], const char *name,
+	 const char *value)
 {
 	struct hash	*node;
 	size_t		 h;
@@ -149,26 +136,14 @@ hash_set(struct hash *ht[], const char *name, const char *value)
 	/* Check if the entry already exists. */
 	if ((node = hash_get(ht, name)) != NULL) {
 		/* The entry already exists, overwrite name and value. */
-		free(node->name);
-		free(node->value);
-		node->name = NULL;
-		node->value = NULL;
-
-		if ((node->name = strdup(name)) == NULL)
-			goto err;
-		if ((node->value = strdup(value)) == NULL)
-			goto err;
+		node->name = (char *)name;
+		node->value = (char *)value;
 	} else {
 		/* The entry does not exist yet, create and add it. */
-		if ((node = malloc(sizeof(struct hash))) == NULL)
+		if ((node = arena_alloc(arena, sizeof(struct hash))) == NULL)
 			return (YHTTP_ERRNO);
-		node->name = NULL;
-		node->value = NULL;
-
-		if ((node->name = strdup(name)) == NULL)
-			goto err;
-		if ((node->value = strdup(value)) == NULL)
-			goto err;
+		node->name = (char *)name;
+		node->value = (char *)value;
 
 		/* Insert the new node into the front of the linked list. */
 		h = hash(name);
@@ -180,11 +155,6 @@ hash_set(struct hash *ht[], const char *name, const char *value)
 	}
 
 	return (YHTTP_OK);
-err:
-	free(node->name);
-	free(node->value);
-	free(node);
-	return (YHTTP_ERRNO);
 }
 
 void
@@ -212,8 +182,5 @@ hash_unset(struct hash *ht[], const char *name)
 		node->prev->next = node->next;
 	}
 
-	/* Delete the node. */
-	free(node->name);
-	free(node->value);
-	free(node);
+	/* The node itself is being released along with the arena. */
 }
@@ -24,12 +24,14 @@ struct hash {
 	struct hash	*prev;
 };
 
-struct hash	**hash_init(void);
-void		  hash_free(struct hash *[]);
+struct arena;
 
-struct hash	**hash_dump(struct hash *[]);
+struct hash	**hash_init(struct arena *);
+
+struct hash	**hash_dump(struct arena *, struct hash *[]);
 struct hash	 *hash_get(struct hash *[], const char *);
-int		  hash_set(struct hash *[], const char *, const char *);
+int		  hash_set(struct arena *, struct hash *[], const char *,
+			   const char *);
 void		  hash_unset(struct hash *[], const char *);
 
 
@@ -0,0 +1,581 @@
+/*
+ * Copyright (c) 2022 Emil Engler <engler+yhttp@unveil2.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buf.h"
+#include "hpack.h"
+#include "yhttp.h"
+
+/* The overhead of an entry in the dynamic table. */
+#define HPACK_OVERHEAD	32
+
+struct hpack_static {
+	const char	*name;
+	const char	*value;
+};
+
+static int	hpack_int(const unsigned char **, const unsigned char *, int,
+			  size_t *);
+static int	hpack_huff(const unsigned char *, size_t, char *, size_t *);
+static int	hpack_str(const unsigned char **, const unsigned char *,
+			  char **, size_t *);
+static int	hpack_get(struct hpack *, size_t, const char **, size_t *,
+			  const char **, size_t *);
+static void	hpack_evict(struct hpack *, size_t);
+static int	hpack_add(struct hpack *, const char *, size_t, const char *,
+			  size_t);
+static int	hpack_put_int(struct buf *, unsigned char, int, size_t);
+static int	hpack_put_str(struct buf *, const char *, int);
+
+/* The static table of RFC 7541, Appendix A, starting with index 1. */
+static const struct hpack_static	hpack_table[] = {
+	{ ":authority", "" },
+	{ ":method", "GET" },
+	{ ":method", "POST" },
+	{ ":path", "/" },
+	{ ":path", "/index.html" },
+	{ ":scheme", "http" },
+	{ ":scheme", "https" },
+	{ ":status", "200" },
+	{ ":status", "204" },
+	{ ":status", "206" },
+	{ ":status", "304" },
+	{ ":status", "400" },
+	{ ":status", "404" },
+	{ ":status", "500" },
+	{ "accept-charset", "" },
+	{ "accept-encoding", "gzip, deflate" },
+	{ "accept-language", "" },
+	{ "accept-ranges", "" },
+	{ "accept", "" },
+	{ "access-control-allow-origin", "" },
+	{ "age", "" },
+	{ "allow", "" },
+	{ "authorization", "" },
+	{ "cache-control", "" },
+	{ "content-disposition", "" },
+	{ "content-encoding", "" },
+	{ "content-language", "" },
+	{ "content-length", "" },
+	{ "content-location", "" },
+	{ "content-range", "" },
+	{ "content-type", "" },
+	{ "cookie", "" },
+	{ "date", "" },
+	{ "etag", "" },
+	{ "expect", "" },
+	{ "expires", "" },
+	{ "from", "" },
+	{ "host", "" },
+	{ "if-match", "" },
+	{ "if-modified-since", "" },
+	{ "if-none-match", "" },
+	{ "if-range", "" },
+	{ "if-unmodified-since", "" },
+	{ "last-modified", "" },
+	{ "link", "" },
+	{ "location", "" },
+	{ "max-forwards", "" },
+	{ "proxy-authenticate", "" },
+	{ "proxy-authorization", "" },
+	{ "range", "" },
+	{ "referer", "" },
+	{ "refresh", "" },
+	{ "retry-after", "" },
+	{ "server", "" },
+	{ "set-cookie", "" },
+	{ "strict-transport-security", "" },
+	{ "transfer-encoding", "" },
+	{ "user-agent", "" },
+	{ "vary", "" },
+	{ "via", "" },
+	{ "www-authenticate", "" }
+};
+
+#define HPACK_NSTATIC	(sizeof(hpack_table) / sizeof(hpack_table[0]))
+
+/*
+ * The Huffman code of RFC 7541, Appendix B, is canonical.  It is therefore
+ * fully described by the number of codes of each length in bits, along with
+ * the symbols ordered by the length of their codes.  Symbol 256 is EOS.
+ */
+static const unsigned char	hpack_huff_count[] = {
+	0, 0, 0, 0, 0, 10, 26, 32, 6, 0, 5, 3, 2, 6, 2, 3, 0, 0, 0, 3, 8, 13,
+	26, 29, 12, 4, 15, 19, 29, 0, 4
+};
+
+static const uint16_t		hpack_huff_syms[] = {
+	 48,  49,  50,  97,  99, 101, 105, 111, 115, 116,  32,  37,
+	 45,  46,  47,  51,  52,  53,  54,  55,  56,  57,  61,  65,
+	 95,  98, 100, 102, 103, 104, 108, 109, 110, 112, 114, 117,
+	 58,  66,  67,  68,  69,  70,  71,  72,  73,  74,  75,  76,
+	 77,  78,  79,  80,  81,  82,  83,  84,  85,  86,  87,  89,
+	106, 107, 113, 118, 119, 120, 121, 122,  38,  42,  44,  59,
+	 88,  90,  33,  34,  40,  41,  63,  39,  43, 124,  35,  62,
+	  0,  36,  64,  91,  93, 126,  94, 125,  60,  96, 123,  92,
+	195, 208, 128, 130, 131, 162, 184, 194, 224, 226, 153, 161,
+	167, 172, 176, 177, 179, 209, 216, 217, 227, 229, 230, 129,
+	132, 133, 134, 136, 146, 154, 156, 160, 163, 164, 169, 170,
+	173, 178, 181, 185, 186, 187, 189, 190, 196, 198, 228, 232,
+	233,   1, 135, 137, 138, 139, 140, 141, 143, 147, 149, 150,
+	151, 152, 155, 157, 158, 165, 166, 168, 174, 175, 180, 182,
+	183, 188, 191, 197, 231, 239,   9, 142, 144, 145, 148, 159,
+	171, 206, 215, 225, 236, 237, 199, 207, 234, 235, 192, 193,
+	200, 201, 202, 205, 210, 213, 218, 219, 238, 240, 242, 243,
+	255, 203, 204, 211, 212, 214, 221, 222, 223, 241, 244, 245,
+	246, 247, 248, 250, 251, 252, 253, 254,   2,   3,   4,   5,
+	  6,   7,   8,  11,  12,  14,  15,  16,  17,  18,  19,  20,
+	 21,  23,  24,  25,  26,  27,  28,  29,  30,  31, 127, 220,
+	249,  10,  13,  22, 256
+};
+
+#define HPACK_NHUFF	(sizeof(hpack_huff_count) - 1)
+
+/*
+ * Decode an integer with an n-bit prefix at *p and advance *p past it.
+ */
+static int
+hpack_int(const unsigned char **p, const unsigned char *end, int n,
+	  size_t *value)
+{
+	size_t	max;
+	int	shift;
+
+	if (*p == end)
+		return (YHTTP_EINVAL);
+
+	max = (1 << n) - 1;
+	*value = *(*p)++ & max;
+	if (*value < max)
+		return (YHTTP_OK);
+
+	/* Larger values than 2^28 are of no use and would overflow. */
+	for (shift = 0; shift <= 21; shift += 7) {
+		if (*p == end)
+			return (YHTTP_EINVAL);
+		*value += (size_t)(**p & 0x7f) << shift;
+		if (!(*(*p)++ & 0x80))
+			return (YHTTP_OK);
+	}
+
+	return (YHTTP_EINVAL);
+}
+
+/*
+ * Decode the Huffman encoded string s into out, which must have room for
+ * ns * 8 / 5 bytes, being the length of the shortest code.
+ */
+static int
+hpack_huff(const unsigned char *s, size_t ns, char *out, size_t *nout)
+{
+	size_t		i;
+	uint32_t	code, first;
+	int		bit, len, index;
+
+	*nout = 0;
+	code = 0;
+	first = 0;
+	index = 0;
+	len = 0;
+	for (i = 0; i < ns; ++i) {
+		for (bit = 7; bit >= 0; --bit) {
+			code |= (s[i] >> bit) & 1;
+			++len;
+
+			if (code - first < hpack_huff_count[len]) {
+				index += code - first;
+				if (hpack_huff_syms[index] == 256)
+					return (YHTTP_EINVAL);
+				out[(*nout)++] = hpack_huff_syms[index];
+				code = 0;
+				first = 0;
+				index = 0;
+				len = 0;
+				continue;
+			}
+
+			index += hpack_huff_count[len];
+			first = (first + hpack_huff_count[len]) << 1;
+			code <<= 1;
+			if (len == HPACK_NHUFF)
+				return (YHTTP_EINVAL);
+		}
+	}
+
+	/* The padding consists of up to 7 bits of the EOS code, all ones. */
+	if (len > 7 || code >> 1 != (1U << len) - 1)
+		return (YHTTP_EINVAL);
+
+	return (YHTTP_OK);
+}
+
+/*
+ * Decode a string literal at *p into an allocated, NUL terminated string.
+ */
+static int
+hpack_str(const unsigned char **p, const unsigned char *end, char **s,
+	  size_t *ns)
+{
+	size_t	len;
+	int	huff, rc;
+
+	if (*p == end)
+		return (YHTTP_EINVAL);
+	huff = **p & 0x80;
+	if ((rc = hpack_int(p, end, 7, &len)) != YHTTP_OK)
+		return (rc);
+	if (len > (size_t)(end - *p))
+		return (YHTTP_EINVAL);
+
+	if (huff) {
+		if ((*s = malloc(len * 8 / 5 + 1)) == NULL)
+			return (YHTTP_ERRNO);
+		if ((rc = hpack_huff(*p, len, *s, ns)) != YHTTP_OK) {
+			free(*s);
+			return (rc);
+		}
+	} else {
+		if ((*s = malloc(len + 1)) == NULL)
+			return (YHTTP_ERRNO);
+		memcpy(*s, *p, len);
+		*ns = len;
+	}
+	(*s)[*ns] = '\0';
+	*p += len;
+
+	return (YHTTP_OK);
+}
+
+/*
+ * Look the entry with the given index up in the static or the dynamic table.
+ */
+static int
+hpack_get(struct hpack *hp, size_t index, const char **name, size_t *nname,
+	  const char **value, size_t *nvalue)
+{
+	struct hpack_entry	*e;
+
+	if (index == 0)
+		return (YHTTP_EINVAL);
+
+	if (index <= HPACK_NSTATIC) {
+		*name = hpack_table[index - 1].name;
+		*nname = strlen(*name);
+		*value = hpack_table[index - 1].value;
+		*nvalue = strlen(*value);
+		return (YHTTP_OK);
+	}
+
+	index -= HPACK_NSTATIC;
+	if (index > hp->nentries)
+		return (YHTTP_EINVAL);
+	e = &hp->entries[hp->nentries - index];
+	*name = e->name;
+	*nname = e->nname;
+	*value = e->value;
+	*nvalue = e->nvalue;
+
+	return (YHTTP_OK);
+}
+
+/*
+ * Evict the oldest entries, until there is room for another size bytes.
+ */
+static void
+hpack_evict(struct hpack *hp, size_t size)
+{
+	size_t	i, n;
+
+	for (n = 0; n < hp->nentries && hp->size + size > hp->max; ++n) {
+		hp->size -= hp->entries[n].nname + hp->entries[n].nvalue +
+		    HPACK_OVERHEAD;
+		free(hp->entries[n].name);
+		free(hp->entries[n].value);
+	}
+
+	if (n == 0)
+		return;
+	for (i = n; i < hp->nentries; ++i)
+		hp->entries[i - n] = hp->entries[i];
+	hp->nentries -= n;
+}
+
+/*
+ * Add an entry to the dynamic table.  An entry that is larger than the
+ * table just leaves it empty.  As name may refer to an entry of the table
+ * itself, it is being copied before any entry is evicted (RFC 7541, 4.4).
+ */
+static int
+hpack_add(struct hpack *hp, const char *name, size_t nname,
+	  const char *value, size_t nvalue)
+{
+	struct hpack_entry	*e, *n_entries;
+	char			*n_name, *n_value;
+	size_t			 size, n_nalloc;
+
+	size = nname + nvalue + HPACK_OVERHEAD;
+	if (size > hp->max) {
+		hpack_evict(hp, size);
+		return (YHTTP_OK);
+	}
+
+	n_name = strndup(name, nname);
+	n_value = strndup(value, nvalue);
+	if (n_name == NULL || n_value == NULL)
+		goto err;
+
+	hpack_evict(hp, size);
+
+	/* Every entry takes HPACK_OVERHEAD bytes at least. */
+	if (hp->nentries == hp->nalloc) {
+		n_nalloc = hp->nalloc == 0 ? 8 : hp->nalloc * 2;
+		if (n_nalloc > hp->max / HPACK_OVERHEAD)
+			n_nalloc = hp->max / HPACK_OVERHEAD;
+		n_entries = realloc(hp->entries, sizeof(struct hpack_entry) *
+				    n_nalloc);
+		if (n_entries == NULL)
+			goto err;
+		hp->entries = n_entries;
+		hp->nalloc = n_nalloc;
+	}
+
+	e = &hp->entries[hp->nentries];
+	e->name = n_name;
+	e->value = n_value;
+	e->nname = nname;
+	e->nvalue = nvalue;
+	++hp->nentries;
+	hp->size += size;
+
+	return (YHTTP_OK);
+err:
+	free(n_name);
+	free(n_value);
+	return (YHTTP_ERRNO);
+}
+
+void
+hpack_init(struct hpack *hp, size_t limit)
+{
+	hp->entries = NULL;
+	hp->nentries = 0;
+	hp->nalloc = 0;
+	hp->size = 0;
+	hp->max = limit;
+	hp->limit = limit;
+}
+
+void
+hpack_free(struct hpack *hp)
+{
+	size_t	i;
+
+	for (i = 0; i < hp->nentries; ++i) {
+		free(hp->entries[i].name);
+		free(hp->entries[i].value);
+	}
+	free(hp->entries);
+	hpack_init(hp, hp->limit);
+}
+
+/*
+ * Decode the header block s and pass every field on to field, along with
+ * arg.  Any other return value than YHTTP_OK of field stops the decoding.
+ * A block that cannot be decoded yields YHTTP_EINVAL, which leaves hp in an
+ * undefined state.
+ */
+int
+hpack_decode(struct hpack *hp, const unsigned char *s, size_t ns,
+	     int (*field)(void *, const char *, size_t, const char *, size_t),
+	     void *arg)
+{
+	const unsigned char	*p, *end;
+	const char		*name, *value;
+	char			*lname, *lvalue;
+	size_t			 index, nname, nvalue;
+	int			 add, fields, rc;
+
+	p = s;
+	end = s + ns;
+	fields = 0;
+	while (p != end) {
+		if (*p & 0x80) {
+			/* An indexed header field. */
+			if ((rc = hpack_int(&p, end, 7, &index)) != YHTTP_OK)
+				return (rc);
+			rc = hpack_get(hp, index, &name, &nname, &value,
+				       &nvalue);
+			if (rc != YHTTP_OK)
+				return (rc);
+			if ((rc = field(arg, name, nname, value, nvalue)) !=
+			    YHTTP_OK)
+				return (rc);
+			fields = 1;
+			continue;
+		}
+
+		if ((*p & 0xe0) == 0x20) {
+			/* A dynamic table size update precedes all fields. */
+			if (fields)
+				return (YHTTP_EINVAL);
+			if ((rc = hpack_int(&p, end, 5, &index)) != YHTTP_OK)
+				return (rc);
+			if (index > hp->limit)
+				return (YHTTP_EINVAL);
+			hp->max = index;
+			hpack_evict(hp, 0);
+			continue;
+		}
+
+		/*
+		 * A literal header field, with incremental indexing or
+		 * without.  Never indexed fields are not treated any
+		 * differently, as they are not being forwarded.
+		 */
+		add = (*p & 0xc0) == 0x40;
+		rc = hpack_int(&p, end, add ? 6 : 4, &index);
+		if (rc != YHTTP_OK)
+			return (rc);
+
+		lname = NULL;
+		if (index != 0) {
+			rc = hpack_get(hp, index, &name, &nname, &value,
+				       &nvalue);
+		} else {
+			rc = hpack_str(&p, end, &lname, &nname);
+			name = lname;
+		}
+		if (rc != YHTTP_OK)
+			return (rc);
+		if ((rc = hpack_str(&p, end, &lvalue, &nvalue)) != YHTTP_OK) {
+			free(lname);
+			return (rc);
+		}
+
+		rc = field(arg, name, nname, lvalue, nvalue);
+		if (rc == YHTTP_OK && add)
+			rc = hpack_add(hp, name, nname, lvalue, nvalue);
+		free(lname);
+		free(lvalue);
+		if (rc != YHTTP_OK)
+			return (rc);
+		fields = 1;
+	}
+
+	return (YHTTP_OK);
+}
+
+static int
+hpack_put_int(struct buf *buf, unsigned char first, int n, size_t value)
+{
+	unsigned char	b;
+	size_t		max;
+	int		rc;
+
+	max = (1 << n) - 1;
+	if (value < max) {
+		b = first | value;
+		return (buf_append(buf, &b, 1));
+	}
+
+	b = first | max;
+	if ((rc = buf_append(buf, &b, 1)) != YHTTP_OK)
+		return (rc);
+	for (value -= max; value >= 0x80; value >>= 7) {
+		b = (value & 0x7f) | 0x80;
+		if ((rc = buf_append(buf, &b, 1)) != YHTTP_OK)
+			return (rc);
+	}
+	b = value;
+
+	return (buf_append(buf, &b, 1));
+}
+
+/*
+ * Encode s as a string literal without Huffman coding, converting it to lower
+ * case if lower is set.
+ */
+static int
+hpack_put_str(struct buf *buf, const char *s, int lower)
+{
+	unsigned char	c;
+	size_t		i, len;
+	int		rc;
+
+	len = strlen(s);
+	if ((rc = hpack_put_int(buf, 0x00, 7, len)) != YHTTP_OK)
+		return (rc);
+	if (!lower)
+		return (buf_append(buf, (const unsigned char *)s, len));
+
+	for (i = 0; i < len; ++i) {
+		c = tolower((unsigned char)s[i]);
+		if ((rc = buf_append(buf, &c, 1)) != YHTTP_OK)
+			return (rc);
+	}
+
+	return (YHTTP_OK);
+}
+
+/*
+ * Append the header field name with value to buf, as a literal that is not
+ * being added to the dynamic table of the peer, so that the encoder does not
+ * have to keep any state.
+ */
+int
+hpack_encode(struct buf *buf, const char *name, const char *value)
+{
+	int	rc;
+
+	if ((rc = hpack_put_int(buf, 0x00, 4, 0)) != YHTTP_OK)
+		return (rc);
+	if ((rc = hpack_put_str(buf, name, 1)) != YHTTP_OK)
+		return (rc);
+
+	return (hpack_put_str(buf, value, 0));
+}
+
+/*
+ * Append the :status pseudo-header field to buf, using the static table
+ * wherever possible.
+ */
+int
+hpack_encode_status(struct buf *buf, int status)
+{
+	char	s[4];
+	size_t	i;
+	int	rc;
+
+	snprintf(s, sizeof(s), "%03d", status);
+	for (i = 0; i < HPACK_NSTATIC; ++i) {
+		if (strcmp(hpack_table[i].name, ":status") == 0 &&
+		    strcmp(hpack_table[i].value, s) == 0)
+			return (hpack_put_int(buf, 0x80, 7, i + 1));
+	}
+
+	/* A literal with the name of the first :status entry. */
+	if ((rc = hpack_put_int(buf, 0x00, 4, 8)) != YHTTP_OK)
+		return (rc);
+
+	return (hpack_put_str(buf, s, 0));
+}
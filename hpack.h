@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2022 Emil Engler <engler+yhttp@unveil2.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef HPACK_H
+#define HPACK_H
+
+/*
+ * An entry of the dynamic table, with the name and the value being
+ * terminated by a NUL byte.
+ */
+struct hpack_entry {
+	char	*name;
+	char	*value;
+	size_t	 nname;
+	size_t	 nvalue;
+};
+
+/*
+ * The decoder of the header blocks of an HTTP/2 connection (RFC 7541).  The
+ * entries of its dynamic table are kept with the oldest one first.
+ */
+struct hpack {
+	struct hpack_entry	*entries;
+	size_t			 nentries;
+	size_t			 nalloc;	/* Allocated entries. */
+	size_t			 size;		/* The size of all entries. */
+	size_t			 max;		/* The current maximum size. */
+	size_t			 limit;		/* The maximum that has been
+						   announced to the peer. */
+};
+
+void	hpack_init(struct hpack *, size_t);
+void	hpack_free(struct hpack *);
+
+int	hpack_decode(struct hpack *, const unsigned char *, size_t,
+		     int (*)(void *, const char *, size_t, const char *,
+			     size_t),
+		     void *);
+
+int	hpack_encode(struct buf *, const char *, const char *);
+int	hpack_encode_status(struct buf *, int);
+
+#endif
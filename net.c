@@ -25,178 +25,1603 @@
 #include <fcntl.h>
 #include <limits.h>
 #include <poll.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "abnf.h"
+#include "arena.h"
 #include "buf.h"
+#include "codel.h"
+#include "hash.h"
+#include "hpack.h"
 #include "parser.h"
+#include "pool.h"
 #include "yhttp.h"
 #include "yhttp-internal.h"
 #include "resp.h"
+#include "timer.h"
+#include "h2.h"
+#include "ws.h"
 #include "net.h"
 
+/*
+ * On Linux, readiness is obtained through epoll(7) instead of poll(2), which
+ * only reports the connections that are actually ready, rather than having
+ * to scan all of them after each wakeup.  Defining NET_NO_EPOLL keeps the
+ * portable poll(2) backend.
+ */
+#if defined(__linux__) && !defined(NET_NO_EPOLL)
+#define NET_EPOLL
+#include <sys/epoll.h>
+#endif
+
 #define NGROW	128
 
-struct poll_data {
-	/*
-	 * The parsers array is being kept alongside with the pfds array in
-	 * terms of size and indices, meaning that the index of a connected
-	 * client inside pfds also refers to its accompanying parser instance
-	 * inside parsers.
-	 */
-	struct parser	**parsers;
-	struct pollfd	 *pfds;
-	size_t		  npfds;
-	size_t		  used;
-};
+/*
+ * No new requests are being read from a connection, while more than NHWM
+ * bytes of its responses have not been transmitted yet.
+ */
+#define NHWM	(256 * 1024)
+
+/*
+ * A body that is produced by the callback function is being requested in
+ * pieces of at most NCHUNK bytes, while less than NCHUNK bytes of the output
+ * queue have not been transmitted yet.
+ */
+#define NCHUNK	(16 * 1024)
+
+/*
+ * Requests are being received into the buffer of their parser directly, with
+ * room for NREAD to NREAD_MAX bytes per recv(2), depending on how much the
+ * previous ones of the connection have filled.  The body of a request may
+ * get more, as the parser grows its room along with the body received.
+ */
+#define NREAD		4096
+#define NREAD_MAX	(64 * 1024)
+
+/*
+ * The parsers of finished requests, along with their request, and the output
+ * queues of connections that have gone idle are being kept for the following
+ * requests, up to NSPARE of each per event loop, or as many as have been
+ * allocated up front with YHTTP_OPT_SPARE_REQUESTS.
+ */
+#define NSPARE		32
+
+/*
+ * Without any file descriptors or memory left for a new connection, accepting
+ * is being paused for NBACKOFF milliseconds, unless one of the own clients
+ * goes away earlier.
+ */
+#define NBACKOFF	100
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL	0
+#endif
+
+/*
+ * The timeouts a connection may be subject to.
+ */
+enum net_timeout {
+	NET_TIMEOUT_NONE,
+	NET_TIMEOUT_IDLE,	/* No request, or the client does not read. */
+	NET_TIMEOUT_HEADER,	/* The request line and the header fields. */
+	NET_TIMEOUT_BODY	/* No progress while reading the body. */
+};
+
+struct conn {
+	struct timer		 timer;	/* Must be the first member. */
+	enum net_timeout	 tkind;	/* What the timer is armed for. */
+	struct sockaddr_storage	 addr;	/* The address of the client. */
+	uint64_t		 tfirst;/* When the request began to arrive. */
+	uint64_t		 trecv;	/* When data has been received last. */
+	struct parser	*parser;
+	struct h2	*h2;		/* Once it has switched to HTTP/2. */
+	struct yhttp_ws	*ws;		/* Once it has switched to WebSocket. */
+	struct buf	 out;		/* Responses not yet transmitted. */
+	size_t		 nsent;		/* Transmitted bytes of out. */
+	size_t		 nrequs;	/* Requests answered so far. */
+	size_t		 nread;		/* Room for the next recv(2). */
+	size_t		 index;		/* The slot inside of poll_data. */
+	int		 fd;
+	int		 busy;		/* Jobs of it in the pool. */
+	int		 closing;	/* Close once out has been sent. */
+	int		 dead;		/* Close once the job is done. */
+	int		 streaming;	/* The body is being produced. */
+	int		 keep_alive;	/* Persists after streaming. */
+};
+
+/*
+ * A request that is being handled by the handler pool, or a 103 response
+ * that its callback function hands over to the event loop.  A callback
+ * function that is run by the event loop itself has one with a NULL cq.
+ */
+struct net_job {
+	struct pool_job	  job;		/* Must be the first member. */
+	struct conn	 *conn;
+	struct yhttp_requ
+			 *requ;
+	struct h2_stream *stream;	/* The stream of requ, or NULL. */
+	char		 *hint;		/* The Link of a 103, or NULL. */
+	void		(*cb)(struct yhttp_requ *, void *);
+	void		 *udata;
+	uint64_t	  tfirst;	/* When requ began to arrive. */
+	uint64_t	  tstart;	/* When the callback has started. */
+};
+
+struct poll_data {
+	/*
+	 * The conns array is being kept alongside with the pfds array in
+	 * terms of size and indices, meaning that the index of a connected
+	 * client inside pfds also refers to its accompanying connection
+	 * inside conns.  A free slot has a NULL connection.
+	 */
+	struct conn	**conns;
+	struct pollfd	 *pfds;
+	size_t		  npfds;
+	size_t		  used;
+
+	/*
+	 * A stack of the indices of all free slots, with the lowest index on
+	 * top, so that a free slot is found in constant time.
+	 */
+	size_t		 *free;
+	size_t		  nfree;
+
+	/*
+	 * The indices of all slots that have pending events after a call to
+	 * net_poll_wait().  The events themselves are stored in the revents
+	 * field of the respective pfds entry.
+	 */
+	size_t		 *ready;
+	size_t		  nready;
+#ifdef NET_EPOLL
+	struct epoll_event
+			 *events;
+	int		  epfd;
+#endif
+
+	struct pool	 *pool;		/* The handler pool or NULL. */
+	struct pool_cq	  cq;		/* Finished jobs of this loop. */
+	size_t		  nbusy;	/* Jobs of this loop in the pool. */
+	size_t		  naccept;	/* Connections accepted per wakeup. */
+	size_t		  maxrequs;	/* Requests per connection, or 0. */
+	struct parser_limits
+			  limits;	/* Passed on to the parsers. */
+	struct parser	**spare;	/* Parsers ready to be reused. */
+	size_t		  nspare;
+	struct buf	 *outs;		/* Output queues ready to be reused. */
+	size_t		  nouts;
+	size_t		  maxspare;	/* Of both of them. */
+
+	/*
+	 * Once nclients reaches maxclients, the listening sockets are no
+	 * longer being polled, until nclients has dropped below resume again,
+	 * or tresume has passed.
+	 */
+	struct conn	 *listen[2];	/* The listening sockets. */
+	size_t		  nclients;	/* The number of connected clients. */
+	size_t		  maxclients;	/* 0 for no limit. */
+	size_t		  resume;
+	uint64_t	  tresume;	/* 0 for none. */
+	int		  paused;
+
+	struct timer_wheel
+			  wheel;	/* The timers of the connections. */
+	uint64_t	  now;		/* The time of the last wakeup. */
+	uint64_t	  tidle;	/* The timeouts in milliseconds, */
+	uint64_t	  theader;	/* with 0 disabling them. */
+	uint64_t	  tbody;
+
+	struct codel	  codel;	/* Whether to shed requests. */
+	struct yhttp_stats
+			 *stats;	/* The counters of the instance. */
+
+	/* Passed on to the parsers, see yhttp_stream() and yhttp_expect(). */
+	void		(*head)(struct yhttp_requ *, void *);
+	void		(*chunk)(struct yhttp_requ *, const unsigned char *,
+				 size_t, void *);
+	int		(*expect)(struct yhttp_requ *, void *);
+	void		 *udata;
+};
+
+static void	 net_drop(struct poll_data *, size_t);
+static short	 net_events(struct conn *);
+static int	 net_finish_requ(struct poll_data *, size_t, int);
+static int	 net_flush(struct poll_data *, size_t);
+static int	 net_hint(struct yhttp_requ *, const char *);
+static int	 net_hint_queue(struct conn *, struct h2_stream *,
+				const char *);
+static int	 net_parser(struct poll_data *, struct conn *);
+static struct parser
+		*net_parser_new(struct poll_data *);
+static void	 net_parser_put(struct poll_data *, struct parser *);
+static void	 net_out_put(struct poll_data *, struct buf *);
+static int	 net_spare(struct poll_data *, size_t);
+static int	 net_h2_process(struct poll_data *, size_t,
+				void (*)(struct yhttp_requ *, void *), void *);
+static int	 net_h2_respond(struct poll_data *, size_t,
+				struct h2_stream *);
+static int	 net_h2_switch(struct poll_data *, size_t,
+			       void (*)(struct yhttp_requ *, void *), void *);
+static int	 net_process(struct poll_data *, size_t,
+			     void (*)(struct yhttp_requ *, void *), void *);
+static int	 net_pump(struct poll_data *, size_t,
+			  void (*)(struct yhttp_requ *, void *), void *);
+static void	 net_pump_abort(struct conn *);
+static int	 net_respond(struct poll_data *, size_t);
+static int	 net_send(struct conn *);
+static int	 net_shed(struct poll_data *, uint64_t);
+static void	 net_timer(struct poll_data *, struct conn *);
+static int	 net_ws_pull(struct poll_data *, size_t);
+static void	 net_ws_release(struct conn *);
+static int	 net_ws_switch(struct poll_data *, size_t);
+
+static int	 net_handle_accept(struct poll_data *, size_t);
+static int	 net_handle_client(struct poll_data *, size_t,
+				   void (*)(struct yhttp_requ *, void *),
+				   void *);
+static int	 net_recv(struct poll_data *, size_t,
+			  void (*)(struct yhttp_requ *, void *), void *);
+static int	 net_handle_conn(struct poll_data *, size_t,
+				 void (*)(struct yhttp_requ *, void *),
+				 void *);
+static int	 net_handle_done(struct poll_data *,
+				 void (*)(struct yhttp_requ *, void *),
+				 void *);
+static int	 net_handle_timeout(struct poll_data *, struct conn *);
+static int	 net_is_keep_alive(struct poll_data *, struct conn *);
+static int	 net_listen(struct poll_data *, short);
+static int	 net_pause(struct poll_data *, size_t, uint64_t);
+static void	 net_job_run(struct pool_job *);
+static int	 net_job_submit(struct poll_data *, size_t,
+				struct h2_stream *,
+				void (*)(struct yhttp_requ *, void *),
+				void *);
+static void	 net_job_drain(struct poll_data *);
+static int	 net_nonblock(int);
+static void	 net_poll_init(struct poll_data *);
+static void	 net_poll_free(struct poll_data *);
+static int	 net_poll_open(struct poll_data *);
+static int	 net_poll_wait(struct poll_data *, int);
+static int	 net_poll_resize(struct poll_data *, size_t);
+static int	 net_poll_grow(struct poll_data *);
+static int	 net_poll_compact(struct poll_data *);
+static int	 net_poll_add(struct poll_data *, int, short,
+			      const struct sockaddr_storage *);
+static int	 net_poll_events(struct poll_data *, size_t, short);
+static void	 net_poll_del(struct poll_data *, size_t);
+static void	 net_poll_close(struct poll_data *, size_t);
+static int	 net_socket(int, uint16_t, int);
+
+/*
+ * Close a connection right away, or as soon as its job has left the pool.
+ */
+static void
+net_drop(struct poll_data *pd, size_t index)
+{
+	struct conn	*conn;
+
+	conn = pd->conns[index];
+	if (conn->busy) {
+		conn->dead = 1;
+		net_poll_events(pd, index, 0);
+	} else
+		net_poll_close(pd, index);
+}
+
+/*
+ * Return the events a connection has to be polled for in its current state.
+ */
+static short
+net_events(struct conn *conn)
+{
+	short	events;
+
+	events = 0;
+	if (conn->h2 != NULL) {
+		/* The streams are independent of each other. */
+		if (!conn->closing && !conn->dead &&
+		    conn->out.used - conn->nsent < NHWM)
+			events |= POLLIN;
+		if ((conn->out.used != conn->nsent || h2_pending(conn->h2)) &&
+		    !conn->dead)
+			events |= POLLOUT;
+		return (events);
+	}
+
+	if (!conn->busy && !conn->closing && !conn->dead &&
+	    !conn->streaming && conn->out.used - conn->nsent < NHWM)
+		events |= POLLIN;
+	if ((conn->out.used != conn->nsent || conn->streaming) && !conn->dead)
+		events |= POLLOUT;
+
+	return (events);
+}
+
+/*
+ * Give a connection a parser, once the first bytes of a request have arrived.
+ * An idle connection does not have one, keeping its memory down to the
+ * connection itself.  A spare one is being preferred over a new one.
+ */
+static int
+net_parser(struct poll_data *pd, struct conn *conn)
+{
+	/* The response is going to need an output queue as well. */
+	if (conn->out.buf == NULL && pd->nouts != 0)
+		conn->out = pd->outs[--pd->nouts];
+
+	if (pd->nspare != 0) {
+		conn->parser = pd->spare[--pd->nspare];
+		return (YHTTP_OK);
+	}
+
+	if ((conn->parser = net_parser_new(pd)) == NULL)
+		return (YHTTP_ERRNO);
+	return (YHTTP_OK);
+}
+
+static struct parser *
+net_parser_new(struct poll_data *pd)
+{
+	struct parser	*parser;
+
+	if ((parser = parser_init()) == NULL)
+		return (NULL);
+	parser->head = pd->head;
+	parser->chunk = pd->chunk;
+	parser->expect = pd->expect;
+	parser->limits = pd->limits;
+	parser->udata = pd->udata;
+
+	return (parser);
+}
+
+/*
+ * Take a parser back that a connection no longer needs, resetting it for
+ * another request, unless there are enough spare ones already.  Whatever is
+ * left in its buffer is being discarded.
+ */
+static void
+net_parser_put(struct poll_data *pd, struct parser *parser)
+{
+	if (parser == NULL)
+		return;
+
+	if (pd->nspare == pd->maxspare) {
+		parser_free(parser);
+		return;
+	}
+
+	parser->pos = parser->buf.used;
+	if (parser_reset(parser) != YHTTP_OK) {
+		parser_free(parser);
+		return;
+	}
+	pd->spare[pd->nspare++] = parser;
+}
+
+/*
+ * Take the output queue of a connection back, once it is empty and the
+ * connection has gone idle, unless there are enough spare ones already.
+ */
+static void
+net_out_put(struct poll_data *pd, struct buf *out)
+{
+	buf_pop(out, out->used);
+	if (out->buf == NULL)
+		return;
+
+	if (pd->nouts == pd->maxspare) {
+		buf_wipe(out);
+		return;
+	}
+	pd->outs[pd->nouts++] = *out;
+	buf_init(out);
+}
+
+/*
+ * Make room for the spare parsers and output queues, with n of each being
+ * allocated up front, so that the first requests do not have to wait for
+ * them.
+ */
+static int
+net_spare(struct poll_data *pd, size_t n)
+{
+	int	rc;
+
+	pd->maxspare = n > NSPARE ? n : NSPARE;
+	if (pd->maxspare > SIZE_MAX / sizeof(struct buf)) {
+		errno = ENOMEM;
+		return (YHTTP_ERRNO);
+	}
+	if ((pd->spare = malloc(sizeof(struct parser *) * pd->maxspare)) ==
+	    NULL)
+		return (YHTTP_ERRNO);
+	if ((pd->outs = malloc(sizeof(struct buf) * pd->maxspare)) == NULL)
+		return (YHTTP_ERRNO);
+
+	while (pd->nspare < n) {
+		if ((pd->spare[pd->nspare] = net_parser_new(pd)) == NULL)
+			return (YHTTP_ERRNO);
+		++pd->nspare;
+	}
+	while (pd->nouts < n) {
+		buf_init(&pd->outs[pd->nouts]);
+		if ((rc = buf_reserve(&pd->outs[pd->nouts], NREAD)) !=
+		    YHTTP_OK)
+			return (rc);
+		++pd->nouts;
+	}
+
+	return (YHTTP_OK);
+}
+
+/*
+ * Prepare a connection for its next request once the response has been
+ * queued, or close it afterwards, if it does not persist.
+ */
+static int
+net_finish_requ(struct poll_data *pd, size_t index, int keep_alive)
+{
+	struct conn	*conn;
+	int		 rc;
+
+	conn = pd->conns[index];
+	++conn->nrequs;
+	if (keep_alive && conn->parser->buf.used == conn->parser->pos) {
+		/*
+		 * Nothing of the next request is there yet, so the connection
+		 * goes idle without a parser, until something arrives.
+		 */
+		net_parser_put(pd, conn->parser);
+		conn->parser = NULL;
+	} else if (keep_alive) {
+		/* Keep the bytes of the next request that are there already. */
+		if ((rc = parser_reset(conn->parser)) != YHTTP_OK)
+			return (rc);
+		if (conn->parser->state != PARSER_RLINE ||
+		    conn->parser->buf.used != 0)
+			conn->tfirst = conn->trecv;
+	} else {
+		/* Connection is close, close it after the response. */
+		conn->closing = 1;
+	}
+
+	return (YHTTP_OK);
+}
+
+/*
+ * Transmit as much of the output queue as the socket accepts without
+ * blocking.  The rest is being transmitted once the socket becomes writable.
+ */
+static int
+net_flush(struct poll_data *pd, size_t index)
+{
+	struct conn	*conn;
+
+	conn = pd->conns[index];
+	if (net_send(conn) == -1) {
+		/* The connection is broken. */
+		net_drop(pd, index);
+		return (YHTTP_OK);
+	}
+
+	if (conn->nsent == conn->out.used) {
+		/*
+		 * Everything has been sent, so the queue is being released, or
+		 * kept for the next response, if a request is under way.
+		 */
+		if (conn->parser != NULL)
+			buf_pop(&conn->out, conn->out.used);
+		else
+			net_out_put(pd, &conn->out);
+		conn->nsent = 0;
+
+		if (conn->closing && !conn->busy) {
+			net_poll_close(pd, index);
+			return (YHTTP_OK);
+		}
+	}
+
+	net_timer(pd, conn);
+	return (net_poll_events(pd, index, net_events(conn)));
+}
+
+/*
+ * Send a 103 response with the Link header field link, as asked for by the
+ * callback function of requ.  If it is being run by the pool, the response
+ * is handed over to the event loop, which owns the output queue.
+ */
+static int
+net_hint(struct yhttp_requ *requ, const char *link)
+{
+	struct yhttp_requ_internal	*internal;
+	struct net_job			*njob, *hint;
+
+	internal = requ->internal;
+	njob = internal->hintarg;
+	if (njob->job.cq == NULL) {
+		if (net_hint_queue(njob->conn, njob->stream, link) != YHTTP_OK)
+			return (YHTTP_ERRNO);
+
+		/*
+		 * Like net_drop(), but the request is still in use, so that
+		 * the caller closes the broken connection after the callback.
+		 */
+		if (net_send(njob->conn) == -1)
+			njob->conn->dead = 1;
+		return (YHTTP_OK);
+	}
+
+	/* It precedes the finished job in the completion queue. */
+	if ((hint = malloc(sizeof(struct net_job))) == NULL)
+		return (YHTTP_ERRNO);
+	*hint = *njob;
+	if ((hint->hint = strdup(link)) == NULL) {
+		free(hint);
+		return (YHTTP_ERRNO);
+	}
+	pool_cq_push(njob->job.cq, &hint->job);
+
+	return (YHTTP_OK);
+}
+
+/*
+ * Queue a 103 response on a connection, or on its stream st, unless the
+ * client is going away or does not know interim responses.
+ */
+static int
+net_hint_queue(struct conn *conn, struct h2_stream *st, const char *link)
+{
+	if (conn->dead || conn->closing)
+		return (YHTTP_OK);
+
+	if (st != NULL)
+		return (h2_hint(conn->h2, st, link));
+	if (conn->parser->minor == 0)
+		return (YHTTP_OK);
+
+	return (resp_hint(&conn->out, link));
+}
+
+/*
+ * Send as much of the output queue of a connection as the socket accepts
+ * without blocking.  Return -1 if the connection is broken.
+ */
+static int
+net_send(struct conn *conn)
+{
+	ssize_t	n;
+
+	while (conn->nsent != conn->out.used) {
+		n = send(conn->fd, conn->out.buf + conn->nsent,
+			 conn->out.used - conn->nsent, MSG_NOSIGNAL);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			else if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			return (-1);
+		}
+		conn->nsent += n;
+	}
+
+	return (0);
+}
+
+/*
+ * Handle all complete requests that have been received on a connection, and
+ * transmit their responses at once.  The connection may have been closed
+ * afterwards.
+ */
+static int
+net_process(struct poll_data *pd, size_t index,
+	    void (*cb)(struct yhttp_requ *, void *), void *udata)
+{
+	struct yhttp_requ_internal	*internal;
+	struct conn			*conn;
+	struct net_job			 self;
+	int				 rc;
+
+	conn = pd->conns[index];
+	if (conn->h2 != NULL)
+		return (net_h2_process(pd, index, cb, udata));
+
+	while (!conn->busy && !conn->closing && !conn->streaming &&
+	       conn->ws == NULL && conn->parser != NULL) {
+		if (conn->parser->err) {
+			rc = resp_err(&conn->out, conn->parser->err);
+			if (rc != YHTTP_OK) {
+				net_poll_close(pd, index);
+				return (YHTTP_OK);
+			}
+			conn->closing = 1;
+			break;
+		}
+
+		/*
+		 * The client waits for this before it sends the body, unless
+		 * the body has arrived already nonetheless.
+		 */
+		if (conn->parser->cont) {
+			conn->parser->cont = 0;
+			if (conn->parser->state != PARSER_DONE &&
+			    (rc = resp_continue(&conn->out)) != YHTTP_OK) {
+				net_poll_close(pd, index);
+				return (YHTTP_OK);
+			}
+		}
+
+		/* The connection is switching over to HTTP/2. */
+		if (conn->parser->state == PARSER_H2 ||
+		    (conn->parser->state == PARSER_DONE &&
+		     conn->parser->upgrade))
+			return (net_h2_switch(pd, index, cb, udata));
+
+		if (conn->parser->state != PARSER_DONE)
+			break;
+
+		/* The IP address is only formatted on demand. */
+		internal = conn->parser->requ->internal;
+		internal->addr = (struct sockaddr *)&conn->addr;
+
+		if (net_shed(pd, conn->tfirst)) {
+			rc = resp_unavail(&conn->out, 1);
+			if (rc != YHTTP_OK) {
+				net_poll_close(pd, index);
+				return (YHTTP_OK);
+			}
+			conn->closing = 1;
+			break;
+		}
+
+		/*
+		 * The remaining requests are handled once the pool is done
+		 * with this one.
+		 */
+		if (pd->pool != NULL) {
+			rc = net_job_submit(pd, index, NULL, cb, udata);
+			if (rc != YHTTP_OK)
+				return (rc);
+			break;
+		}
+
+		self.job.cq = NULL;
+		self.conn = conn;
+		self.stream = NULL;
+		internal->hint = net_hint;
+		internal->hintarg = &self;
+		cb(conn->parser->requ, udata);
+		internal->hint = NULL;
+		if (conn->dead) {
+			/* A 103 response has found it broken. */
+			net_poll_close(pd, index);
+			return (YHTTP_OK);
+		}
+		if ((rc = net_respond(pd, index)) != YHTTP_OK)
+			return (rc);
+		if (pd->conns[index] != conn)
+			return (YHTTP_OK);	/* It has been closed. */
+	}
+
+	if (conn->ws != NULL)
+		return (net_ws_pull(pd, index));
+
+	return (net_flush(pd, index));
+}
+
+/*
+ * Handle all requests of an HTTP/2 connection that are ready, and queue as
+ * much of the responses as flow control permits.  Unlike on an HTTP/1.x
+ * connection, requests keep being received while others are being handled
+ * by the pool.
+ */
+static int
+net_h2_process(struct poll_data *pd, size_t index,
+	       void (*cb)(struct yhttp_requ *, void *), void *udata)
+{
+	struct yhttp_requ_internal	*internal;
+	struct conn			*conn;
+	struct h2_stream		*st;
+	struct net_job			 self;
+	size_t				 queued;
+	int				 rc;
+
+	conn = pd->conns[index];
+	while (!conn->closing && (st = h2_take(conn->h2)) != NULL) {
+		internal = st->parser->requ->internal;
+		internal->addr = (struct sockaddr *)&conn->addr;
+
+		if (st->parser->err)
+			rc = h2_reject(conn->h2, st, st->parser->err, 0);
+		else if (net_shed(pd, st->tfirst))
+			rc = h2_reject(conn->h2, st, 503, 1);
+		else if (pd->pool != NULL) {
+			rc = net_job_submit(pd, index, st, cb, udata);
+			if (rc != YHTTP_OK)
+				return (rc);
+			continue;
+		} else {
+			self.job.cq = NULL;
+			self.conn = conn;
+			self.stream = st;
+			internal->hint = net_hint;
+			internal->hintarg = &self;
+			cb(st->parser->requ, udata);
+			internal->hint = NULL;
+			if (conn->dead) {
+				/* A 103 response has found it broken. */
+				net_poll_close(pd, index);
+				return (YHTTP_OK);
+			}
+			rc = net_h2_respond(pd, index, st);
+		}
+		if (rc != YHTTP_OK || pd->conns[index] != conn ||
+		    conn->dead) {
+			if (rc != YHTTP_OK)
+				net_drop(pd, index);
+			return (YHTTP_OK);
+		}
+	}
+
+	/* The bodies are being queued like those of net_pump(). */
+	queued = conn->out.used - conn->nsent;
+	if (queued < NCHUNK && h2_send(conn->h2, NCHUNK - queued) != YHTTP_OK) {
+		net_drop(pd, index);
+		return (YHTTP_OK);
+	}
+
+	/* A client that goes away does so once all of its streams are done. */
+	if (conn->h2->closing || (conn->h2->goaway && conn->h2->nstreams == 0))
+		conn->closing = 1;
+
+	return (net_flush(pd, index));
+}
+
+/*
+ * Queue the response of a stream, once the callback function has been run.
+ */
+static int
+net_h2_respond(struct poll_data *pd, size_t index, struct h2_stream *st)
+{
+	if (h2_respond(pd->conns[index]->h2, st) != YHTTP_OK)
+		net_drop(pd, index);
+
+	return (YHTTP_OK);
+}
+
+/*
+ * Switch a connection over to HTTP/2, either because the client has started
+ * with the connection preface (prior knowledge), or because its request has
+ * asked for an upgrade to h2c.  In the latter case, the request becomes the
+ * stream 1 of the connection.
+ */
+static int
+net_h2_switch(struct poll_data *pd, size_t index,
+	      void (*cb)(struct yhttp_requ *, void *), void *udata)
+{
+	struct conn	*conn;
+	struct parser	*parser;
+	int		 rc;
+
+	conn = pd->conns[index];
+	parser = conn->parser;
+
+	/* The preface has to start the connection. */
+	if (parser->state == PARSER_H2 && conn->nrequs != 0) {
+		parser->err = 505;
+		return (net_process(pd, index, cb, udata));
+	}
+
+	if (parser->state == PARSER_DONE &&
+	    resp_switch(&conn->out, "h2c") != YHTTP_OK) {
+		net_poll_close(pd, index);
+		return (YHTTP_OK);
+	}
+	if ((conn->h2 = h2_init(parser, &conn->out)) == NULL) {
+		net_poll_close(pd, index);
+		return (YHTTP_OK);
+	}
+	conn->h2->now = pd->now;
+	conn->parser = NULL;
+
+	if (parser->state == PARSER_H2) {
+		rc = h2_parse(conn->h2, parser->buf.buf, parser->buf.used);
+		net_parser_put(pd, parser);
+	} else
+		rc = h2_upgrade(conn->h2, parser);
+	if (rc != YHTTP_OK) {
+		net_poll_close(pd, index);
+		return (YHTTP_OK);
+	}
+
+	return (net_process(pd, index, cb, udata));
+}
+
+/*
+ * Queue the next pieces of a body that is produced by the callback function,
+ * as long as the socket keeps up with them.  Once it is complete, the next
+ * requests of the connection are being handled.
+ */
+static int
+net_pump(struct poll_data *pd, size_t index,
+	 void (*cb)(struct yhttp_requ *, void *), void *udata)
+{
+	struct yhttp_requ_internal	*internal;
+	struct conn			*conn;
+	unsigned char			 chunk[NCHUNK];
+	ssize_t				 n;
+	int				 rc;
+
+	conn = pd->conns[index];
+	internal = conn->parser->requ->internal;
+
+	while (conn->out.used - conn->nsent < NCHUNK) {
+		n = internal->resp->fill(conn->parser->requ, chunk,
+					 sizeof(chunk), internal->resp->arg);
+		if (n < 0 || (size_t)n > sizeof(chunk)) {
+			/* The response cannot be completed anymore. */
+			conn->streaming = 0;
+			net_drop(pd, index);
+			return (YHTTP_OK);
+		}
+
+		/* HTTP/1.0 clients learn about the end by the close. */
+		if (conn->parser->minor == 0)
+			rc = buf_append(&conn->out, chunk, n);
+		else
+			rc = resp_chunk(&conn->out, chunk, n);
+		if (rc != YHTTP_OK) {
+			net_drop(pd, index);
+			return (YHTTP_OK);
+		}
+
+		if (n == 0) {
+			conn->streaming = 0;
+			rc = net_finish_requ(pd, index, conn->keep_alive);
+			if (rc != YHTTP_OK)
+				return (rc);
+			return (net_process(pd, index, cb, udata));
+		}
+	}
+
+	return (net_flush(pd, index));
+}
+
+/*
+ * Tell the callback function that produces a body, that the connection is
+ * going away before the body has been completed, by calling it one last time
+ * without a buffer.
+ */
+static void
+net_pump_abort(struct conn *conn)
+{
+	struct yhttp_requ_internal	*internal;
+
+	if (!conn->streaming)
+		return;
+
+	internal = conn->parser->requ->internal;
+	internal->resp->fill(conn->parser->requ, NULL, 0, internal->resp->arg);
+	conn->streaming = 0;
+}
+
+/*
+ * Queue the response, once the callback function has been run.
+ */
+static int
+net_respond(struct poll_data *pd, size_t index)
+{
+	struct yhttp_requ_internal	*internal;
+	struct conn			*conn;
+	const char			*value;
+	int				 keep_alive;
+
+	conn = pd->conns[index];
+	internal = conn->parser->requ->internal;
+
+	/* The callback function has accepted a WebSocket handshake. */
+	if (internal->resp->ws != NULL)
+		return (net_ws_switch(pd, index));
+
+	/*
+	 * HTTP/1.0 clients are told that the connection persists.  As they do
+	 * not know chunks, a body that is produced by the callback function
+	 * ends with the connection instead.
+	 */
+	keep_alive = net_is_keep_alive(pd, conn);
+	if (internal->resp->fill != NULL && conn->parser->minor == 0)
+		keep_alive = 0;
+	if (!keep_alive)
+		value = "close";
+	else if (conn->parser->minor == 0)
+		value = "keep-alive";
+	else
+		value = NULL;
+
+	if (resp(&conn->out, internal->resp, value,
+		 conn->parser->minor != 0) != YHTTP_OK) {
+		net_drop(pd, index);
+		return (YHTTP_OK);
+	}
+
+	/* The body follows once the socket is writable, see net_pump(). */
+	if (internal->resp->fill != NULL) {
+		conn->streaming = 1;
+		conn->keep_alive = keep_alive;
+		return (YHTTP_OK);
+	}
+
+	return (net_finish_requ(pd, index, keep_alive));
+}
+
+/*
+ * Decide whether to shed a request that has begun to arrive at tfirst without
+ * running the callback function, because requests have been waiting for too
+ * long before being handled recently.
+ */
+static int
+net_shed(struct poll_data *pd, uint64_t tfirst)
+{
+	uint64_t	now;
+	int		dropping, shed;
+
+	if (pd->codel.target == 0)
+		return (0);
+
+	now = timer_now();
+	dropping = pd->codel.dropping;
+	codel_sample(&pd->codel, now - tfirst, now);
+	shed = codel_shed(&pd->codel, now);
+
+	/* Other threads may read the counters at any time. */
+	if (!dropping && pd->codel.dropping) {
+		__sync_add_and_fetch(&pd->stats->nshedding, 1);
+		__sync_add_and_fetch(&pd->stats->nepisodes, 1);
+	} else if (dropping && !pd->codel.dropping)
+		__sync_sub_and_fetch(&pd->stats->nshedding, 1);
+	if (shed)
+		__sync_add_and_fetch(&pd->stats->nshed, 1);
+
+	return (shed);
+}
+
+/*
+ * Arm the timer of a connection according to its current state.
+ */
+static void
+net_timer(struct poll_data *pd, struct conn *conn)
+{
+	enum net_timeout	kind;
+	uint64_t		timeout;
+
+	if (conn->busy || conn->dead)
+		kind = NET_TIMEOUT_NONE;
+	else if (conn->out.used != conn->nsent || conn->streaming)
+		kind = NET_TIMEOUT_IDLE;
+	else if (conn->h2 != NULL)
+		kind = h2_receiving(conn->h2) ? NET_TIMEOUT_BODY :
+		    NET_TIMEOUT_IDLE;
+	else if (conn->ws != NULL || conn->parser == NULL)
+		kind = NET_TIMEOUT_IDLE;
+	else if (conn->parser->state == PARSER_RLINE &&
+		 conn->parser->buf.used == 0)
+		kind = NET_TIMEOUT_IDLE;
+	else if (conn->parser->state == PARSER_BODY ||
+		 conn->parser->state == PARSER_CHUNKED)
+		kind = NET_TIMEOUT_BODY;
+	else
+		kind = NET_TIMEOUT_HEADER;
+
+	/* Unlike the others, the header timeout is not reset by progress. */
+	if (kind == NET_TIMEOUT_HEADER && conn->tkind == NET_TIMEOUT_HEADER &&
+	    timer_armed(&conn->timer))
+		return;
+
+	conn->tkind = kind;
+	if (kind == NET_TIMEOUT_IDLE)
+		timeout = pd->tidle;
+	else if (kind == NET_TIMEOUT_HEADER)
+		timeout = pd->theader;
+	else if (kind == NET_TIMEOUT_BODY)
+		timeout = pd->tbody;
+	else
+		timeout = 0;
+
+	if (timeout == 0)
+		timer_cancel(&pd->wheel, &conn->timer);
+	else
+		timer_arm(&pd->wheel, &conn->timer, pd->now, timeout);
+}
+
+/*
+ * Take the frames of a WebSocket over into the output queue, as long as the
+ * client keeps up with them, and transmit them.
+ */
+static int
+net_ws_pull(struct poll_data *pd, size_t index)
+{
+	struct conn	*conn;
+
+	conn = pd->conns[index];
+	if (conn->out.used - conn->nsent < NHWM &&
+	    ws_take(conn->ws, &conn->out) != YHTTP_OK) {
+		net_drop(pd, index);
+		return (YHTTP_OK);
+	}
+
+	/* Both sides have sent a close frame, or the client has failed. */
+	if (ws_done(conn->ws))
+		conn->closing = 1;
+
+	return (net_flush(pd, index));
+}
+
+/*
+ * Tell the callback function of a WebSocket that its connection is going
+ * away, after which the WebSocket must not be used anymore.
+ */
+static void
+net_ws_release(struct conn *conn)
+{
+	if (conn->ws == NULL)
+		return;
+
+	conn->ws->cb(conn->ws, YHTTP_WS_CLOSE, NULL, 0, conn->ws->arg);
+	ws_free(conn->ws);
+	conn->ws = NULL;
+}
+
+/*
+ * Switch a connection over to the WebSocket protocol, once the callback
+ * function has accepted the handshake of its request.  The frames that have
+ * been received along with the request are handled right away.
+ */
+static int
+net_ws_switch(struct poll_data *pd, size_t index)
+{
+	struct yhttp_requ_internal	*internal;
+	struct conn			*conn;
+	struct parser			*parser;
+	struct yhttp_ws			*ws;
+	int				 rc;
+
+	conn = pd->conns[index];
+	parser = conn->parser;
+	internal = parser->requ->internal;
+
+	if (resp(&conn->out, internal->resp, NULL, 1) != YHTTP_OK) {
+		net_drop(pd, index);
+		return (YHTTP_OK);
+	}
+	ws = ws_init(internal->resp->ws, internal->resp->arg,
+		     pd->limits.nbody, &pd->cq);
+	if (ws == NULL) {
+		net_drop(pd, index);
+		return (YHTTP_OK);
+	}
+	ws->conn = conn;
+	conn->ws = ws;
+	conn->parser = NULL;
+	++conn->nrequs;
+
+	ws->cb(ws, YHTTP_WS_OPEN, NULL, 0, ws->arg);
+	rc = ws_parse(ws, parser->buf.buf + parser->pos,
+		      parser->buf.used - parser->pos);
+	net_parser_put(pd, parser);
+	if (rc != YHTTP_OK)
+		net_drop(pd, index);
+
+	return (YHTTP_OK);
+}
+
+/*
+ * Accept the pending connections of a listening socket, until there are none
+ * left or the budget of a single wakeup has been spent.
+ */
+static int
+net_handle_accept(struct poll_data *pd, size_t index)
+{
+	struct sockaddr_storage	 addr;
+	socklen_t		 naddr;
+	size_t			 i;
+	int			 c, s;
+
+	s = pd->conns[index]->fd;
+
+	for (i = 0; i < pd->naccept; ++i) {
+		if (pd->maxclients != 0 && pd->nclients >= pd->maxclients) {
+			/* Leave the remaining clients in the backlog. */
+			return (net_pause(pd, pd->maxclients -
+					  pd->maxclients / 8, 0));
+		}
+
+		naddr = sizeof(addr);
+#ifdef SOCK_NONBLOCK
+		c = accept4(s, (struct sockaddr *)&addr, &naddr,
+			    SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+		c = accept(s, (struct sockaddr *)&addr, &naddr);
+#endif
+		if (c == -1) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+
+			/*
+			 * Without any file descriptors left, the listening
+			 * socket would stay ready, so wait for a client to
+			 * go away, or for a while if there are none.
+			 */
+			if (errno == EMFILE || errno == ENFILE)
+				return (net_pause(pd, pd->nclients,
+						  pd->now + NBACKOFF));
+
+			/* Not a FATAL error, including EAGAIN. */
+			return (YHTTP_OK);
+		}
+#ifndef SOCK_NONBLOCK
+		if (net_nonblock(c) != YHTTP_OK ||
+		    fcntl(c, F_SETFD, FD_CLOEXEC) == -1) {
+			close(c);
+			continue;
+		}
+#endif
+
+		/* Without the memory for it, back off like without fds. */
+		if (net_poll_add(pd, c, POLLIN, &addr) != YHTTP_OK) {
+			close(c);
+			return (net_pause(pd, pd->nclients,
+					  pd->now + NBACKOFF));
+		}
+	}
+
+	return (YHTTP_OK);
+}
+
+static int
+net_handle_client(struct poll_data *pd, size_t index,
+		  void (*cb)(struct yhttp_requ *, void *), void *udata)
+{
+	struct conn	*conn;
+	unsigned char	 msg[4096];
+	ssize_t		 n;
+
+	conn = pd->conns[index];
+	if (conn->h2 == NULL && conn->ws == NULL)
+		return (net_recv(pd, index, cb, udata));
+
+	n = recv(conn->fd, msg, sizeof(msg), 0);
+	if (n <= 0) {
+		if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+				errno == EINTR))
+			return (YHTTP_OK);
+
+		/* Connection was closed or error occurred. */
+		net_drop(pd, index);
+	} else if (conn->h2 != NULL) {
+		conn->trecv = pd->now;
+		conn->h2->now = pd->now;
+
+		/* A failure of either only costs this connection. */
+		if (h2_parse(conn->h2, msg, n) != YHTTP_OK) {
+			net_drop(pd, index);
+			return (YHTTP_OK);
+		}
+
+		return (net_process(pd, index, cb, udata));
+	} else {
+		conn->trecv = pd->now;
+
+		if (ws_parse(conn->ws, msg, n) != YHTTP_OK) {
+			net_drop(pd, index);
+			return (YHTTP_OK);
+		}
+
+		return (net_ws_pull(pd, index));
+	}
+
+	return (YHTTP_OK);
+}
+
+/*
+ * Receive an HTTP/1.x request into the buffer of its parser, sparing a copy
+ * of the data.
+ */
+static int
+net_recv(struct poll_data *pd, size_t index,
+	 void (*cb)(struct yhttp_requ *, void *), void *udata)
+{
+	struct conn	*conn;
+	unsigned char	 msg[NREAD];
+	unsigned char	*room;
+	size_t		 nroom;
+	ssize_t		 n;
+	int		 rc;
+
+	conn = pd->conns[index];
+
+	/*
+	 * An idle connection only gets a parser if there actually is a
+	 * request, rather than the client closing it.
+	 */
+	if (conn->parser == NULL) {
+		room = msg;
+		nroom = sizeof(msg);
+	} else if (parser_room(conn->parser, conn->nread, &room,
+			       &nroom) != YHTTP_OK) {
+		/* Running out of memory only costs this connection. */
+		net_poll_close(pd, index);
+		return (YHTTP_OK);
+	}
+
+	n = recv(conn->fd, room, nroom, 0);
+	if (n <= 0) {
+		if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+				errno == EINTR))
+			return (YHTTP_OK);
+
+		/* Connection was closed or error occurred. */
+		net_drop(pd, index);
+		return (YHTTP_OK);
+	}
+
+	/* Grow the room while it gets filled, and shrink it back if not. */
+	if ((size_t)n == nroom && conn->nread < NREAD_MAX)
+		conn->nread *= 2;
+	else if ((size_t)n < conn->nread / 4 && conn->nread > NREAD)
+		conn->nread /= 2;
+
+	if (conn->parser == NULL && net_parser(pd, conn) != YHTTP_OK) {
+		net_poll_close(pd, index);
+		return (YHTTP_OK);
+	}
+
+	/* The waiting time of a request starts with its first byte. */
+	if (conn->parser->state == PARSER_RLINE &&
+	    conn->parser->buf.used == 0)
+		conn->tfirst = pd->now;
+	conn->trecv = pd->now;
+
+	if (room == msg)
+		rc = parser_parse(conn->parser, msg, n);
+	else
+		rc = parser_commit(conn->parser, n);
+	if (rc != YHTTP_OK) {
+		net_poll_close(pd, index);
+		return (YHTTP_OK);
+	}
+
+	return (net_process(pd, index, cb, udata));
+}
+
+/*
+ * Handle the events of a connected client.
+ */
+static int
+net_handle_conn(struct poll_data *pd, size_t index,
+		void (*cb)(struct yhttp_requ *, void *), void *udata)
+{
+	struct conn	*conn;
+	short		 revents;
+	int		 rc;
+
+	conn = pd->conns[index];
+	revents = pd->pfds[index].revents;
+
+	if (revents & POLLOUT) {
+		if (conn->h2 != NULL && !conn->dead)
+			rc = net_h2_process(pd, index, cb, udata);
+		else if (conn->ws != NULL && !conn->dead)
+			rc = net_ws_pull(pd, index);
+		else if (conn->streaming && !conn->busy && !conn->dead)
+			rc = net_pump(pd, index, cb, udata);
+		else
+			rc = net_flush(pd, index);
+		if (rc != YHTTP_OK)
+			return (rc);
+		if (pd->conns[index] != conn)
+			return (YHTTP_OK);	/* It has been closed. */
+	}
+
+	if (!(revents & (POLLIN | POLLHUP | POLLERR)))
+		return (YHTTP_OK);
+	if (conn->closing ||
+	    (conn->h2 == NULL && (conn->busy || conn->streaming))) {
+		/* Only a hang-up or an error can get here. */
+		net_drop(pd, index);
+		return (YHTTP_OK);
+	}
+
+	return (net_handle_client(pd, index, cb, udata));
+}
+
+/*
+ * Transmit the responses of all requests that have been handled by the pool
+ * in the meantime.
+ */
+static int
+net_handle_done(struct poll_data *pd,
+		void (*cb)(struct yhttp_requ *, void *), void *udata)
+{
+	struct pool_job		*job, *next;
+	struct net_job		*njob;
+	struct conn		*conn;
+	struct yhttp_requ_internal
+				*internal;
+	struct h2_stream	*st;
+	struct yhttp_ws		*ws;
+	size_t			 index;
+	int			 rc;
+
+	for (job = pool_cq_take(&pd->cq); job != NULL; job = next) {
+		next = job->next;
+
+		/* Frames that have been queued by yhttp_ws_send(). */
+		if (job->fn == NULL) {
+			ws = (struct yhttp_ws *)job;
+			if (!ws_taken(ws))
+				continue;
+			conn = ws->conn;
+			if (conn->dead || conn->closing)
+				continue;
+			if ((rc = net_ws_pull(pd, conn->index)) != YHTTP_OK)
+				goto err;
+			continue;
+		}
+
+		njob = (struct net_job *)job;
+		conn = njob->conn;
+		st = njob->stream;
+		index = conn->index;
+
+		/* A 103 response, while the callback is still running. */
+		if (njob->hint != NULL) {
+			rc = net_hint_queue(conn, st, njob->hint);
+			free(njob->hint);
+			free(job);
+			if (rc != YHTTP_OK)
+				net_drop(pd, index);
+			else if ((rc = net_flush(pd, index)) != YHTTP_OK)
+				goto err;
+			continue;
+		}
+		internal = njob->requ->internal;
+		internal->hint = NULL;
+
+		/* Account for the time the job has spent in the pool. */
+		if (pd->codel.target != 0)
+			codel_sample(&pd->codel, njob->tstart - njob->tfirst,
+				     pd->now);
+		free(job);
+		--pd->nbusy;
+
+		--conn->busy;
+		if (conn->dead) {
+			/* The client went away in the meantime. */
+			if (conn->busy == 0)
+				net_poll_close(pd, index);
+			continue;
+		}
+
+		/* Go on with the requests that have been pipelined. */
+		if (st != NULL)
+			rc = net_h2_respond(pd, index, st);
+		else
+			rc = net_respond(pd, index);
+		if (rc == YHTTP_OK && pd->conns[index] == conn && !conn->dead)
+			rc = net_process(pd, index, cb, udata);
 
-static int	 net_finish_requ(struct poll_data *, size_t);
+		if (rc != YHTTP_OK)
+			goto err;
+	}
 
-static int	 net_handle_accept(struct poll_data *, size_t);
-static int	 net_handle_client(struct poll_data *, size_t,
-				   void (*)(struct yhttp_requ *, void *),
-				   void *);
-static char	*net_ip(int);
-static int	 net_is_keep_alive(struct yhttp_requ *);
-static int	 net_nonblock(int);
-static void	 net_poll_init(struct poll_data *);
-static void	 net_poll_free(struct poll_data *);
-static int	 net_poll_grow(struct poll_data *);
-static int	 net_poll_add(struct poll_data *, int, short);
-static void	 net_poll_del(struct poll_data *, size_t);
-static void	 net_poll_close(struct poll_data *, size_t);
-static int	 net_socket(int, uint16_t);
+	return (YHTTP_OK);
+err:
+	/* Do not lose track of the remaining jobs. */
+	for (job = next; job != NULL; job = next) {
+		next = job->next;
+		if (job->fn == NULL) {
+			ws_taken((struct yhttp_ws *)job);
+			continue;
+		}
+		njob = (struct net_job *)job;
+		if (njob->hint == NULL) {
+			--njob->conn->busy;
+			--pd->nbusy;
+		}
+		free(njob->hint);
+		free(job);
+	}
+	return (rc);
+}
 
+/*
+ * Answer a request that has not been received in time with 408, or close the
+ * connection if there is none.  HTTP/2 clients are sent a GOAWAY frame
+ * instead.
+ */
 static int
-net_finish_requ(struct poll_data *pd, size_t index)
+net_handle_timeout(struct poll_data *pd, struct conn *conn)
 {
-	if (net_is_keep_alive(pd->parsers[index]->requ)) {
-		/* Connection is keep-alive, just reset it. */
-		parser_free(pd->parsers[index]);
+	int	rc;
 
-		if ((pd->parsers[index] = parser_init()) == NULL)
-			return (YHTTP_ERRNO);
+	/* An idle WebSocket client is asked for a sign of life first. */
+	if (conn->ws != NULL && !conn->ws->pinged && !conn->closing &&
+	    conn->out.used == conn->nsent) {
+		if (ws_ping(conn->ws) != YHTTP_OK) {
+			net_poll_close(pd, conn->index);
+			return (YHTTP_OK);
+		}
+		return (net_ws_pull(pd, conn->index));
+	}
+
+	if ((conn->h2 == NULL && conn->tkind != NET_TIMEOUT_HEADER &&
+	     conn->tkind != NET_TIMEOUT_BODY) ||
+	    conn->out.used != conn->nsent) {
+		net_poll_close(pd, conn->index);
 		return (YHTTP_OK);
-	} else {
-		/* Connection is close, close it. */
-		net_poll_close(pd, index);
+	}
+
+	if (conn->h2 != NULL)
+		rc = h2_goaway(conn->h2, H2_NO_ERROR);
+	else
+		rc = resp_err(&conn->out, 408);
+	if (rc != YHTTP_OK) {
+		net_poll_close(pd, conn->index);
 		return (YHTTP_OK);
 	}
+	conn->closing = 1;
+
+	return (net_flush(pd, conn->index));
 }
 
+/*
+ * Decide whether a connection persists after the response to its current
+ * request, which the callback function may prevent by setting the Connection
+ * header field to close.
+ */
 static int
-net_handle_accept(struct poll_data *pd, size_t index)
+net_is_keep_alive(struct poll_data *pd, struct conn *conn)
 {
-	int	c, rc, s;
-
-	s = pd->pfds[index].fd;
+	struct yhttp_requ_internal	*internal;
+	struct hash			*node;
 
-	/* The IP address is being obtained later by getpeername(2). */
-	if ((c = accept(s, NULL, NULL)) == -1)
-		return (YHTTP_OK);	/* Not a FATAL error. */
+	if (conn->parser->err || !conn->parser->keep_alive)
+		return (0);
+	if (pd->maxrequs != 0 && conn->nrequs + 1 >= pd->maxrequs)
+		return (0);
 
-	if ((rc = net_poll_add(pd, c, POLLIN)) != YHTTP_OK)
-		return (rc);
+	internal = conn->parser->requ->internal;
+	node = hash_get(internal->resp->headers, "Connection");
+	if (node != NULL && abnf_has_token(node->value, "close"))
+		return (0);
 
-	return (YHTTP_OK);
+	return (1);
 }
 
+/*
+ * Set the events of the listening sockets.
+ */
 static int
-net_handle_client(struct poll_data *pd, size_t index,
-		  void (*cb)(struct yhttp_requ *, void *), void *udata)
+net_listen(struct poll_data *pd, short events)
 {
-	struct yhttp_requ_internal	*internal;
-	char				*client_ip;
-	unsigned char			 msg[4096];
-	ssize_t				 n;
-	int				 rc, s;
-
-	s = pd->pfds[index].fd;
-
-	n = recv(s, msg, sizeof(msg), 0);
-	if (n <= 0) {
-		if (n == -1 && (errno == EAGAIN || errno == EINTR))
-			return (YHTTP_OK);
+	size_t	i;
+	int	rc;
 
-		/* Connection was closed or error occurred. */
-		net_poll_close(pd, index);
-	} else {
-		rc = parser_parse(pd->parsers[index], msg, n);
-		if (rc != YHTTP_OK) {
-			net_poll_close(pd, index);
+	for (i = 0; i < 2; ++i) {
+		if (pd->listen[i] == NULL)
+			continue;
+		rc = net_poll_events(pd, pd->listen[i]->index, events);
+		if (rc != YHTTP_OK)
 			return (rc);
-		}
-
-		if (pd->parsers[index]->err) {
-			if (resp_err(s, pd->parsers[index]->err) != YHTTP_OK) {
-				net_poll_close(pd, index);
-				return (YHTTP_OK);
-			}
-			return (net_finish_requ(pd, index));
-		} else if (pd->parsers[index]->state == PARSER_DONE) {
-			/* Obtain the IP address. */
-			if ((client_ip = net_ip(s)) == NULL)
-				return (YHTTP_ERRNO);
-			pd->parsers[index]->requ->client_ip = client_ip;
-
-			internal = pd->parsers[index]->requ->internal;
-			cb(pd->parsers[index]->requ, udata);
-			if (resp(s, internal->resp) != YHTTP_OK) {
-				net_poll_close(pd, index);
-				return (YHTTP_OK);
-			}
-			return (net_finish_requ(pd, index));
-		}
 	}
+	pd->paused = events == 0;
 
 	return (YHTTP_OK);
 }
 
-static char *
-net_ip(int s)
+/*
+ * Stop accepting connections until fewer than resume clients are left, or
+ * until tresume, unless it is 0.
+ */
+static int
+net_pause(struct poll_data *pd, size_t resume, uint64_t tresume)
 {
-	char			*str;
-	void			*addr;
-	struct sockaddr_storage	 sa;
-	socklen_t		 nsa;
-	int			 af;
+	pd->resume = resume;
+	pd->tresume = tresume;
+	return (net_listen(pd, 0));
+}
 
-	/* Obtain the address information and socket domain. */
-	nsa = sizeof(sa);
-	if (getpeername(s, (struct sockaddr *)&sa, &nsa) == -1)
-		return (NULL);
-	af = sa.ss_family;
+static void
+net_job_run(struct pool_job *job)
+{
+	struct net_job	*njob;
 
-	if ((str = malloc(INET6_ADDRSTRLEN)) == NULL)
-		return (NULL);
-	memset(str, '\0', INET6_ADDRSTRLEN);
+	njob = (struct net_job *)job;
+	njob->tstart = timer_now();
+	njob->cb(njob->requ, njob->udata);
+}
 
-	assert(af == AF_INET || af == AF_INET6);
-	if (af == AF_INET)
-		addr = &(((struct sockaddr_in *)&sa)->sin_addr);
-	else if (af == AF_INET6)
-		addr = &(((struct sockaddr_in6 *)&sa)->sin6_addr);
+/*
+ * Hand the request of a connection, or of the stream st of an HTTP/2
+ * connection, over to the handler pool.  No further requests are being read
+ * from an HTTP/1.x connection until the response has been queued, as
+ * net_events() only polls for the remaining output in the meantime.
+ */
+static int
+net_job_submit(struct poll_data *pd, size_t index, struct h2_stream *st,
+	       void (*cb)(struct yhttp_requ *, void *), void *udata)
+{
+	struct yhttp_requ_internal	*internal;
+	struct net_job			*njob;
+	int				 rc;
 
-	if (inet_ntop(af, addr, str, INET6_ADDRSTRLEN) == NULL) {
-		free(str);
-		return (NULL);
+	if ((njob = malloc(sizeof(struct net_job))) == NULL)
+		return (YHTTP_ERRNO);
+	njob->job.fn = net_job_run;
+	njob->job.cq = &pd->cq;
+	njob->conn = pd->conns[index];
+	njob->stream = st;
+	if (st != NULL) {
+		njob->requ = st->parser->requ;
+		njob->tfirst = st->tfirst;
+	} else {
+		njob->requ = njob->conn->parser->requ;
+		njob->tfirst = njob->conn->tfirst;
+	}
+	njob->hint = NULL;
+	njob->cb = cb;
+	njob->udata = udata;
+	internal = njob->requ->internal;
+	internal->hint = net_hint;
+	internal->hintarg = njob;
+
+	if ((rc = pool_submit(pd->pool, &njob->job)) != YHTTP_OK) {
+		internal->hint = NULL;
+		free(njob);
+		return (rc);
 	}
+	++njob->conn->busy;
+	++pd->nbusy;
 
-	return (str);
+	return (YHTTP_OK);
 }
 
-static int
-net_is_keep_alive(struct yhttp_requ *requ)
+/*
+ * Wait for all jobs of this event loop that are still in the pool, so that
+ * their connections can be freed.
+ */
+static void
+net_job_drain(struct poll_data *pd)
 {
-	char	*value;
-
-	value = yhttp_header(requ, "Connection");
-	if (value != NULL && strcmp(value, "keep-alive") == 0)
-		return (1);
-	else
-		return (0);
+	struct pollfd	 pfd;
+	struct pool_job	*job, *next;
+	struct net_job	*njob;
+
+	while (pd->nbusy > 0) {
+		pfd.fd = pd->cq.fd[0];
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, INFTIM) == -1 && errno != EINTR)
+			return;
+
+		for (job = pool_cq_take(&pd->cq); job != NULL; job = next) {
+			next = job->next;
+			if (job->fn == NULL) {
+				ws_taken((struct yhttp_ws *)job);
+				continue;
+			}
+			njob = (struct net_job *)job;
+			if (njob->hint == NULL) {
+				--njob->conn->busy;
+				--pd->nbusy;
+			}
+			free(njob->hint);
+			free(job);
+		}
+	}
 }
 
 static int
@@ -214,115 +1639,457 @@ net_nonblock(int fd)
 static void
 net_poll_init(struct poll_data *pd)
 {
-	pd->parsers = NULL;
+	pd->conns = NULL;
 	pd->pfds = NULL;
 	pd->npfds = 0;
 	pd->used = 0;
+	pd->free = NULL;
+	pd->nfree = 0;
+	pd->ready = NULL;
+	pd->nready = 0;
+#ifdef NET_EPOLL
+	pd->events = NULL;
+	pd->epfd = -1;
+#endif
+	pd->pool = NULL;
+	pool_cq_init(&pd->cq);
+	pd->nbusy = 0;
+	pd->naccept = 1;
+	pd->maxrequs = 0;
+	memset(&pd->limits, 0, sizeof(pd->limits));
+	pd->spare = NULL;
+	pd->nspare = 0;
+	pd->outs = NULL;
+	pd->nouts = 0;
+	pd->maxspare = 0;
+	pd->listen[0] = NULL;
+	pd->listen[1] = NULL;
+	pd->nclients = 0;
+	pd->maxclients = 0;
+	pd->resume = 0;
+	pd->tresume = 0;
+	pd->paused = 0;
+	pd->now = timer_now();
+	timer_wheel_init(&pd->wheel, pd->now);
+	pd->tidle = 0;
+	pd->theader = 0;
+	pd->tbody = 0;
+	codel_init(&pd->codel, 0, 0);
+	pd->stats = NULL;
+	pd->head = NULL;
+	pd->chunk = NULL;
+	pd->expect = NULL;
+	pd->udata = NULL;
 }
 
 static void
 net_poll_free(struct poll_data *pd)
 {
-	size_t	i;
+	struct pool_job	*job, *next;
+	size_t		 i;
 
 	if (pd == NULL)
 		return;
 
-	/* Free parsers. */
-	for (i = 0; i < pd->npfds; ++i)
-		parser_free(pd->parsers[i]);
-	free(pd->parsers);
+	/* Free connections. */
+	for (i = 0; i < pd->npfds; ++i) {
+		if (pd->conns[i] == NULL)
+			continue;
+		net_pump_abort(pd->conns[i]);
+		net_ws_release(pd->conns[i]);
+		h2_free(pd->conns[i]->h2);
+		parser_free(pd->conns[i]->parser);
+		buf_wipe(&pd->conns[i]->out);
+		free(pd->conns[i]);
+	}
+	free(pd->conns);
+
+	for (i = 0; i < pd->nspare; ++i)
+		parser_free(pd->spare[i]);
+	free(pd->spare);
+	for (i = 0; i < pd->nouts; ++i)
+		buf_wipe(&pd->outs[i]);
+	free(pd->outs);
 
 	free(pd->pfds);
+	free(pd->free);
+	free(pd->ready);
+#ifdef NET_EPOLL
+	free(pd->events);
+	if (pd->epfd != -1)
+		close(pd->epfd);
+#endif
+
+	/* Free the WebSockets whose wakeups are still pending. */
+	if (pd->cq.fd[0] != -1) {
+		for (job = pool_cq_take(&pd->cq); job != NULL; job = next) {
+			next = job->next;
+			if (job->fn == NULL)
+				ws_taken((struct yhttp_ws *)job);
+		}
+	}
+	pool_cq_free(&pd->cq);
 }
 
+/*
+ * Create the kernel side of the readiness backend.  Slots that have been added
+ * before are registered with it as well.  Without a call to this function,
+ * pd only performs the bookkeeping of the slots.
+ */
 static int
-net_poll_grow(struct poll_data *pd)
+net_poll_open(struct poll_data *pd)
+{
+#ifdef NET_EPOLL
+	struct epoll_event	ev;
+	size_t			i;
+
+	if ((pd->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+		return (YHTTP_ERRNO);
+
+	for (i = 0; i < pd->npfds; ++i) {
+		if (pd->conns[i] == NULL || pd->pfds[i].events == 0)
+			continue;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = pd->pfds[i].events;
+		ev.data.u64 = i;
+		if (epoll_ctl(pd->epfd, EPOLL_CTL_ADD, pd->conns[i]->fd,
+			      &ev) == -1)
+			return (YHTTP_ERRNO);
+	}
+#endif
+
+	return (YHTTP_OK);
+}
+
+/*
+ * Wait up to timeout milliseconds for events and store the indices of all
+ * slots that have pending events in pd->ready.
+ */
+static int
+net_poll_wait(struct poll_data *pd, int timeout)
+{
+	size_t	i;
+	int	n;
+
+	pd->nready = 0;
+
+#ifdef NET_EPOLL
+	n = epoll_wait(pd->epfd, pd->events, pd->npfds, timeout);
+	if (n == -1)
+		return (errno == EINTR ? YHTTP_OK : YHTTP_ERRNO);
+
+	/* Only the slots reported by the kernel are touched. */
+	for (i = 0; i < (size_t)n; ++i) {
+		pd->ready[pd->nready] = pd->events[i].data.u64;
+		pd->pfds[pd->ready[pd->nready++]].revents =
+		    pd->events[i].events;
+	}
+#else
+	n = poll(pd->pfds, pd->npfds, timeout);
+	if (n == -1)
+		return (errno == EINTR ? YHTTP_OK : YHTTP_ERRNO);
+
+	for (i = 0; i < pd->npfds && pd->nready < (size_t)n; ++i) {
+		if (pd->pfds[i].revents != 0)
+			pd->ready[pd->nready++] = i;
+	}
+#endif
+
+	return (YHTTP_OK);
+}
+
+/*
+ * Resize the arrays of pd to n_npfds slots.  Shrinking them requires all
+ * connections to be located in the slots that remain.
+ */
+static int
+net_poll_resize(struct poll_data *pd, size_t n_npfds)
 {
-	struct parser	**n_parsers;
+	struct conn	**n_conns;
 	struct pollfd	 *n_pfds;
-	size_t		 n_npfds, i;
+	size_t		 *n_free, *n_ready;
+	size_t		  i;
+#ifdef NET_EPOLL
+	struct epoll_event
+			 *n_events;
+#endif
 
 	/* Check for integer overflows before reallocation. */
-	if (SIZE_MAX - NGROW < pd->npfds)
-		return (YHTTP_EOVERFLOW);
-	n_npfds = pd->npfds + 128;
-	if (n_npfds > SIZE_MAX / sizeof(struct parser *))
+	if (n_npfds > SIZE_MAX / sizeof(struct conn *))
 		return (YHTTP_EOVERFLOW);
 	if (n_npfds > SIZE_MAX / sizeof(struct pollfd))
 		return (YHTTP_EOVERFLOW);
+	if (n_npfds > SIZE_MAX / sizeof(size_t))
+		return (YHTTP_EOVERFLOW);
+	if (n_npfds > INT_MAX)
+		return (YHTTP_EOVERFLOW);
+#ifdef NET_EPOLL
+	if (n_npfds > SIZE_MAX / sizeof(struct epoll_event))
+		return (YHTTP_EOVERFLOW);
+#endif
 
-	/* Reallocate the arrays. */
-	n_parsers = realloc(pd->parsers, sizeof(struct parser *) * n_npfds);
-	if (n_parsers == NULL)
+	/*
+	 * Reallocate the arrays.  If shrinking one of them fails, the larger
+	 * array is simply kept.
+	 */
+	n_conns = realloc(pd->conns, sizeof(struct conn *) * n_npfds);
+	if (n_conns != NULL)
+		pd->conns = n_conns;
+	else if (n_npfds > pd->npfds)
 		return (YHTTP_ERRNO);
-	pd->parsers = n_parsers;
 	n_pfds = realloc(pd->pfds, sizeof(struct pollfd) * n_npfds);
-	if (n_pfds == NULL)
+	if (n_pfds != NULL)
+		pd->pfds = n_pfds;
+	else if (n_npfds > pd->npfds)
 		return (YHTTP_ERRNO);
-	pd->pfds = n_pfds;
-
-	pd->npfds = n_npfds;
+	n_free = realloc(pd->free, sizeof(size_t) * n_npfds);
+	if (n_free != NULL)
+		pd->free = n_free;
+	else if (n_npfds > pd->npfds)
+		return (YHTTP_ERRNO);
+	n_ready = realloc(pd->ready, sizeof(size_t) * n_npfds);
+	if (n_ready != NULL)
+		pd->ready = n_ready;
+	else if (n_npfds > pd->npfds)
+		return (YHTTP_ERRNO);
+#ifdef NET_EPOLL
+	n_events = realloc(pd->events, sizeof(struct epoll_event) * n_npfds);
+	if (n_events != NULL)
+		pd->events = n_events;
+	else if (n_npfds > pd->npfds)
+		return (YHTTP_ERRNO);
+#endif
 
 	/* Initialize the new fields. */
-	for (i = pd->used; i < pd->npfds; ++i) {
-		pd->parsers[i] = NULL;
+	for (i = pd->npfds; i < n_npfds; ++i) {
+		pd->conns[i] = NULL;
 
 		pd->pfds[i].fd = -1;
 		pd->pfds[i].events = 0;
 		pd->pfds[i].revents = 0;
 	}
+	pd->npfds = n_npfds;
+
+	/* Rebuild the stack of free slots. */
+	pd->nfree = 0;
+	for (i = pd->npfds; i > 0; --i) {
+		if (pd->conns[i - 1] == NULL)
+			pd->free[pd->nfree++] = i - 1;
+	}
 
 	return (YHTTP_OK);
 }
 
+/*
+ * Double the number of slots, so that the cost of growing is amortized over
+ * all additions.
+ */
 static int
-net_poll_add(struct poll_data *pd, int fd, short events)
+net_poll_grow(struct poll_data *pd)
 {
-	size_t	i;
-	int	rc;
+	if (pd->npfds == 0)
+		return (net_poll_resize(pd, NGROW));
+	if (pd->npfds > SIZE_MAX / 2)
+		return (YHTTP_EOVERFLOW);
+
+	return (net_poll_resize(pd, pd->npfds * 2));
+}
+
+/*
+ * Once most slots have become free, e.g. after a mass disconnect, move all
+ * connections to the front and shrink the arrays, so that the number of
+ * slots scanned by poll(2) follows the number of connections again.  It must
+ * not be called while events of ready slots are pending.
+ */
+static int
+net_poll_compact(struct poll_data *pd)
+{
+	size_t			 i, j, n_npfds;
+#ifdef NET_EPOLL
+	struct epoll_event	 ev;
+#endif
+
+	/* Keep half of the slots free to avoid growing right away again. */
+	n_npfds = NGROW;
+	while (n_npfds / 2 < pd->used)
+		n_npfds *= 2;
+	if (n_npfds >= pd->npfds)
+		return (YHTTP_OK);
+
+	for (i = 0, j = 0; i < pd->npfds; ++i) {
+		if (pd->conns[i] == NULL)
+			continue;
+
+		if (i != j) {
+			pd->conns[j] = pd->conns[i];
+			pd->conns[j]->index = j;
+			pd->pfds[j] = pd->pfds[i];
+			pd->conns[i] = NULL;
+			pd->pfds[i].fd = -1;
+			pd->pfds[i].events = 0;
+			pd->pfds[i].revents = 0;
+
+#ifdef NET_EPOLL
+			/* The kernel reports the index of a slot. */
+			if (pd->epfd != -1 && pd->pfds[j].events != 0) {
+				memset(&ev, 0, sizeof(ev));
+				ev.events = pd->pfds[j].events;
+				ev.data.u64 = j;
+				if (epoll_ctl(pd->epfd, EPOLL_CTL_MOD,
+					      pd->conns[j]->fd, &ev) == -1)
+					return (YHTTP_ERRNO);
+			}
+#endif
+		}
+		++j;
+	}
+
+	return (net_poll_resize(pd, n_npfds));
+}
+
+static int
+net_poll_add(struct poll_data *pd, int fd, short events,
+	     const struct sockaddr_storage *addr)
+{
+	struct conn		*conn;
+	size_t			 i;
+	int			 rc;
+#ifdef NET_EPOLL
+	struct epoll_event	 ev;
+#endif
 
 	/* Check if we need to grow pd->pfds. */
-	if (pd->npfds == pd->used) {
+	if (pd->nfree == 0) {
 		if ((rc = net_poll_grow(pd)) != YHTTP_OK)
 			return (rc);
+	}
+	i = pd->free[pd->nfree - 1];
+	assert(pd->conns[i] == NULL);
 
-		/* No need to search for a free slot in this case. */
-		if ((pd->parsers[pd->used] = parser_init()) == NULL)
+	if ((conn = malloc(sizeof(struct conn))) == NULL)
+		return (YHTTP_ERRNO);
+	conn->parser = NULL;
+	if (addr != NULL)
+		memcpy(&conn->addr, addr, sizeof(conn->addr));
+	else
+		memset(&conn->addr, 0, sizeof(conn->addr));
+	timer_init(&conn->timer);
+	conn->tkind = NET_TIMEOUT_NONE;
+	conn->h2 = NULL;
+	conn->ws = NULL;
+	buf_init(&conn->out);
+	conn->nsent = 0;
+	conn->nrequs = 0;
+	conn->nread = NREAD;
+	conn->tfirst = 0;
+	conn->trecv = 0;
+	conn->index = i;
+	conn->fd = fd;
+	conn->busy = 0;
+	conn->closing = 0;
+	conn->dead = 0;
+	conn->streaming = 0;
+	conn->keep_alive = 0;
+
+#ifdef NET_EPOLL
+	if (pd->epfd != -1) {
+		memset(&ev, 0, sizeof(ev));
+		ev.events = events;
+		ev.data.u64 = i;
+		if (epoll_ctl(pd->epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+			free(conn);
 			return (YHTTP_ERRNO);
+		}
+	}
+#endif
+
+	--pd->nfree;
+	pd->conns[i] = conn;
+	pd->pfds[i].fd = fd;
+	pd->pfds[i].events = events;
+	pd->pfds[i].revents = 0;
+	++pd->used;
+
+	/* Clients are idle until they send a request. */
+	if (addr != NULL) {
+		++pd->nclients;
+		net_timer(pd, conn);
+	}
 
-		pd->pfds[pd->used].fd = fd;
-		pd->pfds[pd->used++].events = events;
+	return (YHTTP_OK);
+}
 
+/*
+ * Change the events that are being polled for on a slot.  A slot without any
+ * events is not being polled at all, not even for hang-ups.
+ */
+static int
+net_poll_events(struct poll_data *pd, size_t index, short events)
+{
+	struct conn		*conn;
+#ifdef NET_EPOLL
+	struct epoll_event	 ev;
+	int			 op;
+#endif
+
+	conn = pd->conns[index];
+	if (pd->pfds[index].events == events)
 		return (YHTTP_OK);
-	} else {
-		/* Search for a free slot. */
-		for (i = 0; i < pd->npfds; ++i) {
-			if (pd->pfds[i].fd == -1)
-				break;
-		}
-		assert(i < pd->npfds);
 
-		if ((pd->parsers[i] = parser_init()) == NULL)
+#ifdef NET_EPOLL
+	if (pd->epfd != -1) {
+		if (events == 0)
+			op = EPOLL_CTL_DEL;
+		else if (pd->pfds[index].events == 0)
+			op = EPOLL_CTL_ADD;
+		else
+			op = EPOLL_CTL_MOD;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = events;
+		ev.data.u64 = index;
+		if (epoll_ctl(pd->epfd, op, conn->fd, &ev) == -1)
 			return (YHTTP_ERRNO);
+	}
+#endif
 
-		pd->pfds[i].fd = fd;
-		pd->pfds[i].events = events;
-		++pd->used;
+	/* poll(2) ignores negative file descriptors. */
+	pd->pfds[index].fd = events == 0 ? -1 : conn->fd;
+	pd->pfds[index].events = events;
+	pd->pfds[index].revents = 0;
 
-		return (YHTTP_OK);
-	}
+	return (YHTTP_OK);
 }
 
 static void
 net_poll_del(struct poll_data *pd, size_t index)
 {
-	parser_free(pd->parsers[index]);
-	pd->parsers[index] = NULL;
+#ifdef NET_EPOLL
+	if (pd->epfd != -1 && pd->pfds[index].events != 0)
+		epoll_ctl(pd->epfd, EPOLL_CTL_DEL, pd->conns[index]->fd, NULL);
+#endif
+
+	/* Only clients have an address. */
+	if (pd->conns[index]->addr.ss_family != AF_UNSPEC)
+		--pd->nclients;
+	timer_cancel(&pd->wheel, &pd->conns[index]->timer);
+	net_pump_abort(pd->conns[index]);
+	net_ws_release(pd->conns[index]);
+	h2_free(pd->conns[index]->h2);
+	net_parser_put(pd, pd->conns[index]->parser);
+	net_out_put(pd, &pd->conns[index]->out);
+	free(pd->conns[index]);
+	pd->conns[index] = NULL;
 
+	/*
+	 * Resetting revents also discards events of this slot that are still
+	 * pending in pd->ready.
+	 */
 	pd->pfds[index].fd = -1;
 	pd->pfds[index].events = 0;
 	pd->pfds[index].revents = 0;
+	pd->free[pd->nfree++] = index;
 	--pd->used;
 }
 
@@ -331,13 +2098,18 @@ net_poll_close(struct poll_data *pd, size_t index)
 {
 	int	s;
 
-	s = pd->pfds[index].fd;
+	s = pd->conns[index]->fd;
 	net_poll_del(pd, index);
 	close(s);
 }
 
+/*
+ * Create a listening socket.  If reuseport is set, several sockets may be
+ * bound to the same port, with the kernel distributing incoming connections
+ * among them.
+ */
 static int
-net_socket(int domain, uint16_t port)
+net_socket(int domain, uint16_t port, int reuseport)
 {
 	struct sockaddr_in6	sa6;
 	struct sockaddr_in	sa4;
@@ -356,6 +2128,29 @@ net_socket(int domain, uint16_t port)
 	rc = setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &true, sizeof(true));
 	if (rc == -1)
 		goto err;
+	if (reuseport) {
+#ifdef SO_REUSEPORT_LB
+		/* FreeBSD only balances the load with SO_REUSEPORT_LB. */
+		rc = setsockopt(s, SOL_SOCKET, SO_REUSEPORT_LB, &true,
+				sizeof(true));
+#else
+		rc = setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &true,
+				sizeof(true));
+#endif
+		if (rc == -1)
+			goto err;
+	}
+	if (domain == AF_INET6) {
+		/*
+		 * Some systems (e.g. Linux) let IPv6 sockets accept IPv4
+		 * connections by default, which would make binding the IPv4
+		 * socket to the same port fail.
+		 */
+		rc = setsockopt(s, IPPROTO_IPV6, IPV6_V6ONLY, &true,
+				sizeof(true));
+		if (rc == -1)
+			goto err;
+	}
 
 	/* Bind the socket. */
 	if (domain == AF_INET) {
@@ -385,106 +2180,173 @@ err:
 	return (YHTTP_ERRNO);
 }
 
+/*
+ * Run a single event loop with its own listening sockets, until read_pipe
+ * becomes readable.  With more than one event loop per instance, each of them
+ * binds its listeners with SO_REUSEPORT.
+ */
 int
-net_dispatch(uint16_t port, int read_pipe,
+net_dispatch(struct yhttp *yh, int read_pipe,
 	     void (*cb)(struct yhttp_requ *, void *), void *udata)
 {
 	struct poll_data	pd;
-	size_t			i;
-	int			quit, rc, s4, s6;
+	struct timer		*t;
+	uint64_t		now;
+	size_t			i, j;
+	int			fd, quit, rc, reuseport, s4, s6, timeout;
 
 	net_poll_init(&pd);
 	s4 = -1;
 	s6 = -1;
+	reuseport = yh->npipes > 1;
+	pd.naccept = yh->naccept;
+	pd.maxrequs = yh->maxrequs;
+	pd.limits.nrline = yh->maxrline;
+	pd.limits.nheader = yh->maxheader;
+	pd.limits.nfields = yh->maxfields;
+	pd.limits.nbody = yh->maxbody;
+	pd.tidle = yh->tidle;
+	pd.theader = yh->theader;
+	pd.tbody = yh->tbody;
+	codel_init(&pd.codel, yh->shedtarget, yh->shedinterval);
+	pd.stats = &yh->stats;
+	pd.head = yh->head;
+	pd.chunk = yh->chunk;
+	pd.expect = yh->expect;
+	pd.udata = udata;
+
+	/* The limits are being divided among the event loops. */
+	if (yh->maxconns != 0)
+		pd.maxclients = (yh->maxconns + yh->npipes - 1) / yh->npipes;
+	rc = net_spare(&pd, (yh->nspare + yh->npipes - 1) / yh->npipes);
+	if (rc != YHTTP_OK)
+		goto end;
 
-	if ((s4 = net_socket(AF_INET, port)) == YHTTP_ERRNO) {
+	if ((s4 = net_socket(AF_INET, yh->port, reuseport)) == YHTTP_ERRNO) {
 		rc = YHTTP_ERRNO;
 		goto end;
 	}
-	if ((s6 = net_socket(AF_INET6, port)) == YHTTP_ERRNO) {
+	if ((s6 = net_socket(AF_INET6, yh->port, reuseport)) == YHTTP_ERRNO) {
 		rc = YHTTP_ERRNO;
 		goto end;
 	}
 
 	/* Add the sockets and pipe to poll(2). */
-	if ((rc = net_poll_add(&pd, read_pipe, POLLIN)) != YHTTP_OK)
+	if ((rc = net_poll_add(&pd, read_pipe, POLLIN, NULL)) != YHTTP_OK)
+		goto end;
+	if ((rc = net_poll_add(&pd, s4, POLLIN, NULL)) != YHTTP_OK)
+		goto end;
+	if ((rc = net_poll_add(&pd, s6, POLLIN, NULL)) != YHTTP_OK)
+		goto end;
+
+	/*
+	 * Finished jobs of the handler pool, as well as the frames of
+	 * yhttp_ws_send(), wake the loop up.
+	 */
+	pd.pool = yh->pool;
+	if ((rc = pool_cq_open(&pd.cq)) != YHTTP_OK)
 		goto end;
-	if ((rc = net_poll_add(&pd, s4, POLLIN)) != YHTTP_OK)
+	if ((rc = net_poll_add(&pd, pd.cq.fd[0], POLLIN, NULL)) != YHTTP_OK)
 		goto end;
-	if ((rc = net_poll_add(&pd, s6, POLLIN)) != YHTTP_OK)
+	if ((rc = net_poll_open(&pd)) != YHTTP_OK)
 		goto end;
 
+	/* Remember the listening sockets, in order to pause them. */
+	for (i = 0, j = 0; i < pd.npfds; ++i) {
+		if (pd.conns[i] != NULL &&
+		    (pd.conns[i]->fd == s4 || pd.conns[i]->fd == s6))
+			pd.listen[j++] = pd.conns[i];
+	}
+
 	/* The actual event loop. */
 	quit = 0;
 	while(!quit) {
-		rc = poll(pd.pfds, pd.npfds, INFTIM);
-		if (rc == -1) {
-			if (errno == EINTR)
-				continue;
-			else
+		/* No events are pending at this point. */
+		if (pd.used < pd.npfds / 4) {
+			if ((rc = net_poll_compact(&pd)) != YHTTP_OK)
+				goto end;
+		}
+		if (pd.paused && (pd.nclients < pd.resume ||
+		    (pd.tresume != 0 && pd.now >= pd.tresume))) {
+			if ((rc = net_listen(&pd, POLLIN)) != YHTTP_OK)
 				goto end;
 		}
 
-		for (i = 0; i < pd.npfds; ++i) {
-			if (!(pd.pfds[i].revents & POLLIN))
+		/* Sleep until the next timer is due at most. */
+		now = timer_now();
+		timeout = timer_wheel_timeout(&pd.wheel, now);
+		if (pd.paused && pd.tresume != 0) {
+			if (pd.tresume <= now)
+				timeout = 0;
+			else if (timeout == -1 ||
+			    pd.tresume - now < (uint64_t)timeout)
+				timeout = pd.tresume - now;
+		}
+		if ((rc = net_poll_wait(&pd, timeout)) != YHTTP_OK)
+			goto end;
+		pd.now = timer_now();
+
+		for (j = 0; j < pd.nready; ++j) {
+			i = pd.ready[j];
+
+			/*
+			 * A hang-up or an error is handled like regular input,
+			 * as recv(2) will report it afterwards.
+			 */
+			if (!(pd.pfds[i].revents &
+			      (POLLIN | POLLOUT | POLLHUP | POLLERR)))
 				continue;
 
-			if (pd.pfds[i].fd == s4 || pd.pfds[i].fd == s6) {
+			fd = pd.conns[i]->fd;
+			if (fd == s4 || fd == s6) {
 				/* Handle incoming connection. */
 				rc = net_handle_accept(&pd, i);
 				if (rc != YHTTP_OK)
 					goto end;
-			} else if (pd.pfds[i].fd == read_pipe) {
+			} else if (fd == read_pipe) {
 				/* Terminate execution. */
 				quit = 1;
 				break;
+			} else if (fd == pd.cq.fd[0]) {
+				/* Handle finished jobs of the pool. */
+				rc = net_handle_done(&pd, cb, udata);
+				if (rc != YHTTP_OK)
+					goto end;
 			} else {
 				/* Handle connected client. */
-				rc = net_handle_client(&pd, i, cb, udata);
+				rc = net_handle_conn(&pd, i, cb, udata);
 				if (rc != YHTTP_OK)
 					goto end;
 			}
 		}
+		if (quit)
+			break;
+
+		/* Handle the connections that have timed out. */
+		while ((t = timer_wheel_expire(&pd.wheel, pd.now)) != NULL) {
+			rc = net_handle_timeout(&pd, (struct conn *)t);
+			if (rc != YHTTP_OK)
+				goto end;
+		}
 	}
 
 	rc = YHTTP_OK;
 end:
+	net_job_drain(&pd);
+	if (pd.codel.dropping)
+		__sync_sub_and_fetch(&pd.stats->nshedding, 1);
+
 	/* Close all file descriptors. */
 	for (i = 0; i < pd.npfds; ++i) {
-		if (pd.pfds[i].fd == read_pipe)
+		if (pd.conns[i] == NULL)
+			continue;
+		fd = pd.conns[i]->fd;
+		if (fd == read_pipe || fd == pd.cq.fd[0])
 			continue;
 		else
-			close(pd.pfds[i].fd);
+			close(fd);
 	}
 	net_poll_free(&pd);
 
 	return (rc);
 }
-
-ssize_t
-net_send(int s, const unsigned char *data, size_t ndata)
-{
-	ssize_t	n;
-	size_t	sent;
-
-	sent = 0;
-	do {
-		n = send(s, data + sent, ndata - sent, 0);
-		if (n <= 0) {
-			if (n == -1 && (errno == EAGAIN || errno == EINTR))
-				continue;
-			return (n);
-		}
-
-		/* Integer overflow check. */
-		if (SIZE_MAX - (size_t)n < sent)
-			return (-1);
-		sent += n;
-	} while (sent != ndata);
-
-	/* Unlikely but it's better to go safe. */
-	if (sent > SSIZE_MAX)
-		return (-1);
-
-	return (sent);
-}
@@ -17,8 +17,7 @@
 #ifndef NET_H
 #define NET_H
 
-int	net_dispatch(uint16_t, int, void (*)(struct yhttp_requ *, void *),
-		     void *);
-ssize_t	net_send(int, const unsigned char *, size_t);
+int	net_dispatch(struct yhttp *, int,
+		     void (*)(struct yhttp_requ *, void *), void *);
 
 #endif
@@ -22,8 +22,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
 #include "abnf.h"
+#include "arena.h"
 #include "buf.h"
 #include "hash.h"
 #include "parser.h"
@@ -45,15 +47,33 @@ static int		 parser_rline_query(struct parser *, const char *,
 					    size_t);
 static int		 parser_rline_target(struct parser *, const char *,
 					     size_t);
+static int		 parser_rline_version(struct parser *, const char *,
+					      size_t);
 static int		 parser_rline(struct parser *);
 
 static int		 parser_header_field(struct parser *, const char *,
 					     size_t);
 static int		 parser_headers(struct parser *);
 
+static void		 parser_connection(struct parser *);
+static void		 parser_upgrade(struct parser *);
+static void		 parser_expect(struct parser *);
+
+static int		 parser_te(struct parser *);
 static int		 parser_cl(struct parser *);
+static size_t		 parser_stream(struct parser *, const unsigned char *,
+				       size_t);
 static int		 parser_body(struct parser *);
 
+static int		 parser_chunk_size(struct parser *, const char *,
+					   size_t);
+static int		 parser_chunk_data(struct parser *, unsigned char *,
+					   size_t);
+static int		 parser_chunked(struct parser *);
+
+static int		 parser_run(struct parser *);
+static void		 parser_clear(struct parser *);
+
 /* String associations for methods with their enum yhttp_method. */
 static const char	*methods[] = {
 	"GET",		/* GET */
@@ -143,11 +163,11 @@ static int
 parser_keyvalue(struct parser *parser, struct hash *ht[], const char *s,
 		size_t ns)
 {
-	const char	*equal;
-	char		*key, *value;
-	size_t		 keylen, valuelen;
-	int		 has_value;
-	int		 rc;
+	struct yhttp_requ_internal	*internal;
+	const char			*equal;
+	char				*key, *value;
+	size_t				 keylen, valuelen;
+	int				 has_value;
 
 	equal = memchr(s, '=', ns);
 	if (equal == NULL)
@@ -175,22 +195,15 @@ parser_keyvalue(struct parser *parser, struct hash *ht[], const char *s,
 		valuelen = 0;
 	}
 
-	key = strndup(s, keylen);
-	value = strndup(equal + 1, valuelen);
-	if (key == NULL || value == NULL) {
-		free(key);
-		free(value);
+	internal = parser->requ->internal;
+	key = arena_strndup(&internal->arena, s, keylen);
+	value = arena_strndup(&internal->arena, has_value ? equal + 1 : "",
+			      valuelen);
+	if (key == NULL || value == NULL)
 		return (YHTTP_ERRNO);
-	}
 
 	/* Insert the key and the value into the hash table. */
-	rc = hash_set(ht, key, value);
-	free(key);
-	free(value);
-	if (rc != YHTTP_OK)
-		return (rc);
-
-	return (YHTTP_OK);
+	return (hash_set(&internal->arena, ht, key, value));
 malformatted:
 	parser->err = 400;
 	return (YHTTP_OK);
@@ -221,7 +234,8 @@ parser_rline_method(struct parser *parser, const char *s, size_t ns)
 static int
 parser_rline_path(struct parser *parser, const char *s, size_t ns)
 {
-	size_t	i, remaining;
+	struct yhttp_requ_internal	*internal;
+	size_t				 i, remaining;
 
 	/* Validate the path. */
 	/* The first character must be a slash. */
@@ -243,7 +257,9 @@ parser_rline_path(struct parser *parser, const char *s, size_t ns)
 	}
 
 	/* Extract the path. */
-	if ((parser->requ->path = strndup(s, ns)) == NULL)
+	internal = parser->requ->internal;
+	if ((parser->requ->path = arena_strndup(&internal->arena, s, ns)) ==
+	    NULL)
 		return (YHTTP_ERRNO);
 
 	return (YHTTP_OK);
@@ -301,25 +317,62 @@ parser_rline_target(struct parser *parser, const char *s, size_t ns)
 	return (rc);
 }
 
+/*
+ * Only HTTP/1.x is supported, as HTTP/2 and later do not use a request line.
+ */
+static int
+parser_rline_version(struct parser *parser, const char *s, size_t ns)
+{
+	if (ns != 8 || memcmp(s, "HTTP/", 5) != 0 ||
+	    !isdigit((unsigned char)s[5]) || s[6] != '.' ||
+	    !isdigit((unsigned char)s[7])) {
+		parser->err = 400;
+		return (YHTTP_OK);
+	}
+
+	if (s[5] != '1')
+		parser->err = 505;
+	else
+		parser->minor = s[7] - '0';
+
+	return (YHTTP_OK);
+}
+
 static int
 parser_rline(struct parser *parser)
 {
 	unsigned char	*eol, *p, *spaces[2];
-	size_t		 len, methodlen, targetlen;
+	size_t		 len, methodlen, targetlen, versionlen;
 	int		 i, rc;
 
 	if (parser->buf.used == 0)
 		return (YHTTP_OK);
 
 	eol = parser_find_eol(parser->buf.buf, parser->buf.used);
-	if (eol == NULL)
+	if (eol == NULL) {
+		/* Do not wait for the end of a line that is too long anyway. */
+		if (parser->limits.nrline != 0 &&
+		    parser->buf.used > parser->limits.nrline + 1)
+			goto toolong;
 		return (YHTTP_OK);
+	}
 	len = eol - parser->buf.buf;
+	if (parser->limits.nrline != 0 && len > parser->limits.nrline)
+		goto toolong;
 
 	/* Check for ASCII '\0'. */
 	if (memchr(parser->buf.buf, '\0', len) != NULL)
 		goto malformatted;
 
+	/*
+	 * The connection preface of HTTP/2 with prior knowledge starts like a
+	 * request line.  It is left in buf, as a whole for the HTTP/2 side.
+	 */
+	if (len == 14 && memcmp(parser->buf.buf, "PRI * HTTP/2.0", 14) == 0) {
+		parser->state = PARSER_H2;
+		return (YHTTP_OK);
+	}
+
 	/* Get the two spaces. */
 	i = 0;
 	for (p = parser->buf.buf; p != eol && i < 2; ++p) {
@@ -350,7 +403,14 @@ parser_rline(struct parser *parser)
 	if (rc != YHTTP_OK || parser->err)
 		goto malformatted;
 
-	/* The HTTP-version can be ignored (for now). */
+	/* Extract the HTTP-version. */
+	/* From the character after the second space until the end. */
+	versionlen = eol - spaces[1] - 1;
+	rc = parser_rline_version(parser, (char *)spaces[1] + 1, versionlen);
+	if (rc != YHTTP_OK)
+		return (rc);
+	if (parser->err)
+		return (YHTTP_OK);
 
 	/* We are done with the rline. */
 	parser->state = PARSER_HEADERS;
@@ -361,29 +421,22 @@ parser_rline(struct parser *parser)
 malformatted:
 	parser->err = 400;
 	return (YHTTP_OK);
+toolong:
+	parser->err = 414;
+	return (YHTTP_OK);
 }
 
 static int
 parser_header_field(struct parser *parser, const char *s, size_t ns)
 {
-	struct yhttp_requ_internal	*internal;
-	const char			*colon, *name_start, *value_start;
-	char				*name, *value;
-	size_t				 i, namelen, valuelen;
-	int				 rc;
+	const char	*colon, *name_start, *value_start;
+	size_t		 i, namelen, valuelen;
 
 	if ((colon = memchr(s, ':', ns)) == NULL)
 		goto malformatted;
 
-	/* Validate the name. */
 	name_start = s;
 	namelen = colon - name_start;
-	if (namelen == 0)
-		goto malformatted;
-	for (i = 0; i < namelen; ++i) {
-		if (!abnf_is_tchar(name_start[i]))
-			goto malformatted;
-	}
 
 	/* "Find" the start of the value (skipping OWS). */
 	for (i = namelen + 1; i < ns; ++i) {
@@ -404,6 +457,33 @@ parser_header_field(struct parser *parser, const char *s, size_t ns)
 	valuelen = i - (value_start - s);
 	assert(valuelen > 0);
 
+	return (parser_field(parser, name_start, namelen, value_start,
+			     valuelen));
+malformatted:
+	parser->err = 400;
+	return (YHTTP_OK);
+}
+
+/*
+ * Validate a header field and add it to the request.  Requests that arrive
+ * over HTTP/2 have their fields added this way as well.
+ */
+int
+parser_field(struct parser *parser, const char *name_start, size_t namelen,
+	     const char *value_start, size_t valuelen)
+{
+	struct yhttp_requ_internal	*internal;
+	char				*name, *value;
+	size_t				 i;
+
+	/* Validate the name. */
+	if (namelen == 0)
+		goto malformatted;
+	for (i = 0; i < namelen; ++i) {
+		if (!abnf_is_tchar(name_start[i]))
+			goto malformatted;
+	}
+
 	/* Validate the value. */
 	for (i = 0; i < valuelen; ++i) {
 		if (!isprint(value_start[i]))
@@ -411,29 +491,18 @@ parser_header_field(struct parser *parser, const char *s, size_t ns)
 	}
 
 	/* Extract the name and the value. */
-	name = NULL;
-	value = NULL;
-	name = strndup(name_start, namelen);
-	value = strndup(value_start, valuelen);
-	if (name == NULL || value == NULL) {
-		free(name);
-		free(value);
+	internal = parser->requ->internal;
+	name = arena_strndup(&internal->arena, name_start, namelen);
+	value = arena_strndup(&internal->arena, value_start, valuelen);
+	if (name == NULL || value == NULL)
 		return (YHTTP_ERRNO);
-	}
 
 	/* Check if a header field with name is already present. */
-	if (yhttp_header(parser->requ, name) != NULL) {
-		free(name);
-		free(value);
+	if (yhttp_header(parser->requ, name) != NULL)
 		goto malformatted;
-	}
 
 	/* Insert the header field into the hash table. */
-	internal = parser->requ->internal;
-	rc = hash_set(internal->headers, name, value);
-	free(name);
-	free(value);
-	return (rc);
+	return (hash_set(&internal->arena, internal->headers, name, value));
 malformatted:
 	parser->err = 400;
 	return (YHTTP_OK);
@@ -443,7 +512,7 @@ static int
 parser_headers(struct parser *parser)
 {
 	unsigned char	*sol, *eol, *eoh;
-	size_t		 remaining, parsed, linelen;
+	size_t		 remaining, parsed, linelen, nfields;
 	int		 rc;
 
 	if (parser->buf.used == 0)
@@ -451,9 +520,11 @@ parser_headers(struct parser *parser)
 
 	/*
 	 * Check if the header has been fully received, by traversing all
-	 * lines, until the empty line has been found.
+	 * lines, until the empty line has been found.  The limits are being
+	 * enforced on the way, before the header has been received in full.
 	 */
 	sol = parser->buf.buf;
+	nfields = 0;
 	while (1) {
 		/*
 		 * The remaining value is being composed by subtracting the
@@ -467,6 +538,9 @@ parser_headers(struct parser *parser)
 			 * No eol means that the line has not been fully
 			 * received yet.  Wait for more input.
 			 */
+			if (parser->limits.nheader != 0 &&
+			    parser->buf.used > parser->limits.nheader + 1)
+				goto toolarge;
 			return (YHTTP_OK);
 		} else if (eol == sol) {
 			/*
@@ -479,6 +553,14 @@ parser_headers(struct parser *parser)
 
 		/* Go to the next line. */
 		sol = eol + (*eol == '\r' ? 2 : 1);
+		++nfields;
+
+		if (parser->limits.nheader != 0 &&
+		    (size_t)(sol - parser->buf.buf) > parser->limits.nheader)
+			goto toolarge;
+		if (parser->limits.nfields != 0 &&
+		    nfields > parser->limits.nfields)
+			goto toolarge;
 	}
 
 	/* As we have the end of the header now, parse all lines. */
@@ -501,58 +583,426 @@ parser_headers(struct parser *parser)
 		sol = eol + (*eol == '\r' ? 2 : 1);
 	}
 
-	/*
-	 * Check if a Transfer-Encoding has been supplied, which we do not
-	 * support.
-	 */
+	/* Get the Transfer-Encoding or the Content-Length. */
 	if (yhttp_header(parser->requ, "Transfer-Encoding") != NULL)
-		goto unsupported;
-
-	/* Get the Content-Length. */
-	rc = parser_cl(parser);
+		rc = parser_te(parser);
+	else
+		rc = parser_cl(parser);
 	if (rc != YHTTP_OK || parser->err)
 		return (rc);
 
+	parser_connection(parser);
+	parser_upgrade(parser);
+	parser_expect(parser);
+	if (parser->err)
+		return (YHTTP_OK);
+
 	/* We are done with the header. */
-	parser->state = PARSER_BODY;
+	parser->nleft = parser->requ->nbody;
+	if (parser->chunk != NULL && parser->head != NULL)
+		parser->head(parser->requ, parser->udata);
 	parsed = (sol - parser->buf.buf);
 	return (buf_pop(&parser->buf, *sol == '\r' ? parsed + 2 : parsed + 1));
 malformatted:
 	parser->err = 400;
 	return (YHTTP_OK);
-unsupported:
-	parser->err = 501;
+toolarge:
+	parser->err = 431;
 	return (YHTTP_OK);
 }
 
+/*
+ * Determine whether the connection persists after this request.  HTTP/1.1
+ * connections do so by default, whereas HTTP/1.0 ones have to ask for it.
+ */
+static void
+parser_connection(struct parser *parser)
+{
+	const char	*value;
+
+	parser->keep_alive = parser->minor >= 1;
+
+	if ((value = yhttp_header(parser->requ, "Connection")) == NULL)
+		return;
+	if (abnf_has_token(value, "close"))
+		parser->keep_alive = 0;
+	else if (abnf_has_token(value, "keep-alive"))
+		parser->keep_alive = 1;
+}
+
+/*
+ * Recognize a request to upgrade the connection to HTTP/2 (h2c), which has
+ * to carry the initial settings of the client along (RFC 7540, 3.2).
+ */
+static void
+parser_upgrade(struct parser *parser)
+{
+	const char	*value;
+
+	if (parser->minor == 0)
+		return;
+
+	value = yhttp_header(parser->requ, "Upgrade");
+	if (value == NULL || !abnf_has_token(value, "h2c"))
+		return;
+	value = yhttp_header(parser->requ, "Connection");
+	if (value == NULL || !abnf_has_token(value, "Upgrade") ||
+	    !abnf_has_token(value, "HTTP2-Settings"))
+		return;
+	if (yhttp_header(parser->requ, "HTTP2-Settings") == NULL)
+		return;
+
+	parser->upgrade = 1;
+}
+
+/*
+ * Handle "Expect: 100-continue", which makes the client wait for an interim
+ * response before it sends the body.  The expect callback may reject the
+ * request instead, sparing the client from sending the body for nothing.
+ */
+static void
+parser_expect(struct parser *parser)
+{
+	const char	*value;
+	int		 status;
+
+	if ((value = yhttp_header(parser->requ, "Expect")) == NULL)
+		return;
+
+	/* HTTP/1.0 clients do not know about expectations. */
+	if (parser->minor == 0)
+		return;
+
+	if (strcasecmp(value, "100-continue") != 0) {
+		parser->err = 417;
+		return;
+	}
+
+	/* There is nothing to wait for without a body. */
+	if (parser->state == PARSER_BODY && parser->requ->nbody == 0)
+		return;
+
+	if (parser->expect != NULL) {
+		status = parser->expect(parser->requ, parser->udata);
+		if (status != 100) {
+			/* Only an error may take the place of the body. */
+			if (status >= 400 && status <= 599)
+				parser->err = status;
+			else
+				parser->err = 417;
+			return;
+		}
+	}
+
+	parser->cont = 1;
+}
+
+/*
+ * Only the chunked transfer coding is supported.  Together with a
+ * Content-Length, the length of the body would be ambiguous.
+ */
 static int
-parser_cl(struct parser *parser)
+parser_te(struct parser *parser)
 {
 	const char	*value;
 
+	if (yhttp_header(parser->requ, "Content-Length") != NULL) {
+		parser->err = 400;
+		return (YHTTP_OK);
+	}
+
+	value = yhttp_header(parser->requ, "Transfer-Encoding");
+	if (strcasecmp(value, "chunked") != 0) {
+		parser->err = 501;
+		return (YHTTP_OK);
+	}
+
+	parser->state = PARSER_CHUNKED;
+	parser->cstate = PARSER_CHUNK_SIZE;
+	return (YHTTP_OK);
+}
+
+static int
+parser_cl(struct parser *parser)
+{
+	const char	*p, *value;
+	size_t		 nbody;
+
+	parser->state = PARSER_BODY;
+
 	/* Check if a "Content-Length" header field has been supplied. */
 	if ((value = yhttp_header(parser->requ, "Content-Length")) == NULL)
 		return (YHTTP_OK);
 
-	if (sscanf(value, "%zu", &parser->requ->nbody) == 1)
-		return (YHTTP_OK);
-	else {
+	/* Content-Length = 1*DIGIT, without a sign or anything else. */
+	nbody = 0;
+	for (p = value; *p != '\0'; ++p) {
+		if (!isdigit((unsigned char)*p) ||
+		    nbody > (SIZE_MAX - (*p - '0')) / 10) {
+			parser->err = 400;
+			return (YHTTP_OK);
+		}
+		nbody = nbody * 10 + (*p - '0');
+	}
+	if (p == value) {
 		parser->err = 400;
 		return (YHTTP_OK);
 	}
+	parser->requ->nbody = nbody;
+
+	if (parser->limits.nbody != 0 && nbody > parser->limits.nbody)
+		parser->err = 413;
+	return (YHTTP_OK);
 }
 
+/*
+ * Pass the part of data that belongs to the message body on to the chunk
+ * callback function and return its length.
+ */
+static size_t
+parser_stream(struct parser *parser, const unsigned char *data, size_t ndata)
+{
+	size_t	n;
+
+	n = ndata < parser->nleft ? ndata : parser->nleft;
+	if (n != 0)
+		parser->chunk(parser->requ, data, n, parser->udata);
+
+	parser->nleft -= n;
+	if (parser->nleft == 0)
+		parser->state = PARSER_DONE;
+
+	return (n);
+}
+
+/*
+ * Bytes beyond the message body belong to the next request, which a client
+ * may have sent already without waiting for the response (pipelining).
+ */
 static int
 parser_body(struct parser *parser)
 {
-	if (parser->buf.used == parser->requ->nbody) {
+	size_t	n;
+
+	if (parser->chunk != NULL) {
+		/* The beginning of the body has arrived with the header. */
+		n = parser_stream(parser, parser->buf.buf, parser->buf.used);
+		return (n == 0 ? YHTTP_OK : buf_pop(&parser->buf, n));
+	}
+
+	if (parser->buf.used >= parser->requ->nbody) {
 		parser->requ->body = parser->buf.buf;
+		parser->pos = parser->requ->nbody;
 		parser->state = PARSER_DONE;
 	}
 
 	return (YHTTP_OK);
 }
 
+/*
+ * Parse the line of a chunk, which consists of its size in hexadecimal,
+ * optionally followed by chunk extensions, which are being ignored.
+ */
+static int
+parser_chunk_size(struct parser *parser, const char *s, size_t ns)
+{
+	size_t	i, digit;
+
+	parser->nchunk = 0;
+	for (i = 0; i < ns && isxdigit((unsigned char)s[i]); ++i) {
+		if (isdigit((unsigned char)s[i]))
+			digit = s[i] - '0';
+		else
+			digit = tolower((unsigned char)s[i]) - 'a' + 10;
+
+		if (parser->nchunk > (SIZE_MAX - digit) / 16)
+			goto malformatted;
+		parser->nchunk = parser->nchunk * 16 + digit;
+	}
+	if (i == 0)
+		goto malformatted;
+
+	/* Skip the BWS in front of the chunk extensions. */
+	while (i < ns && (s[i] == ' ' || s[i] == '\t'))
+		++i;
+	if (i != ns && s[i] != ';')
+		goto malformatted;
+
+	/* The body is rejected as soon as it would become too large. */
+	if (parser->limits.nbody != 0 &&
+	    parser->nchunk > parser->limits.nbody - parser->requ->nbody)
+		parser->err = 413;
+
+	return (YHTTP_OK);
+malformatted:
+	parser->err = 400;
+	return (YHTTP_OK);
+}
+
+/*
+ * Move the data of a chunk right behind the data that has been decoded so
+ * far, or pass it on while streaming.
+ */
+static int
+parser_chunk_data(struct parser *parser, unsigned char *data, size_t ndata)
+{
+	if (SIZE_MAX - parser->requ->nbody < ndata) {
+		parser->err = 400;
+		return (YHTTP_OK);
+	}
+
+	if (parser->chunk != NULL)
+		parser->chunk(parser->requ, data, ndata, parser->udata);
+	else
+		memmove(parser->buf.buf + parser->requ->nbody, data, ndata);
+	parser->requ->nbody += ndata;
+
+	return (YHTTP_OK);
+}
+
+/*
+ * Decode as much of a chunked body as has been received.  The chunk lines
+ * are being removed from buf in place, so that the decoded body ends up at
+ * its start, just like any other body.
+ */
+static int
+parser_chunked(struct parser *parser)
+{
+	unsigned char	*data, *eol;
+	size_t		 n, remaining;
+	int		 rc;
+
+	while (parser->state == PARSER_CHUNKED) {
+		data = parser->buf.buf + parser->pos;
+		remaining = parser->buf.used - parser->pos;
+		if (remaining == 0)
+			break;
+
+		if (parser->cstate == PARSER_CHUNK_DATA) {
+			n = remaining < parser->nchunk ? remaining :
+			    parser->nchunk;
+			rc = parser_chunk_data(parser, data, n);
+			if (rc != YHTTP_OK || parser->err)
+				return (rc);
+			parser->pos += n;
+			parser->nchunk -= n;
+			if (parser->nchunk == 0)
+				parser->cstate = PARSER_CHUNK_CRLF;
+			continue;
+		}
+
+		if ((eol = parser_find_eol(data, remaining)) == NULL) {
+			/* The lines are subject to the header limits. */
+			if (parser->limits.nheader != 0 &&
+			    remaining > parser->limits.nheader + 1) {
+				parser->err =
+				    parser->cstate == PARSER_CHUNK_TRAILER ?
+				    431 : 400;
+				return (YHTTP_OK);
+			}
+			break;
+		}
+		n = eol - data;
+		if (memchr(data, '\0', n) != NULL)
+			goto malformatted;
+
+		if (parser->cstate == PARSER_CHUNK_SIZE) {
+			rc = parser_chunk_size(parser, (char *)data, n);
+			if (rc != YHTTP_OK || parser->err)
+				return (rc);
+			if (parser->nchunk == 0)
+				parser->cstate = PARSER_CHUNK_TRAILER;
+			else
+				parser->cstate = PARSER_CHUNK_DATA;
+		} else if (parser->cstate == PARSER_CHUNK_CRLF) {
+			/* Nothing may follow the data of a chunk. */
+			if (n != 0)
+				goto malformatted;
+			parser->cstate = PARSER_CHUNK_SIZE;
+		} else if (n == 0) {
+			/* The empty line ends the trailer section. */
+			if (parser->chunk == NULL)
+				parser->requ->body = parser->buf.buf;
+			parser->state = PARSER_DONE;
+		} else {
+			/* Trailer fields are being added to the header. */
+			parser->ntrailer += *eol == '\r' ? n + 2 : n + 1;
+			++parser->ntfields;
+			if ((parser->limits.nheader != 0 &&
+			     parser->ntrailer > parser->limits.nheader) ||
+			    (parser->limits.nfields != 0 &&
+			     parser->ntfields > parser->limits.nfields)) {
+				parser->err = 431;
+				return (YHTTP_OK);
+			}
+			rc = parser_header_field(parser, (char *)data, n);
+			if (rc != YHTTP_OK || parser->err)
+				return (rc);
+		}
+		parser->pos += *eol == '\r' ? n + 2 : n + 1;
+	}
+
+	/* While streaming, nothing needs to be kept. */
+	if (parser->chunk != NULL && parser->pos != 0) {
+		if ((rc = buf_pop(&parser->buf, parser->pos)) != YHTTP_OK)
+			return (rc);
+		parser->pos = 0;
+	}
+
+	return (YHTTP_OK);
+malformatted:
+	parser->err = 400;
+	return (YHTTP_OK);
+}
+
+/*
+ * Run the state functions on the data in the buffer.
+ */
+static int
+parser_run(struct parser *parser)
+{
+	int	rc;
+
+	if (parser->state == PARSER_RLINE) {
+		if ((rc = parser_rline(parser)) != YHTTP_OK)
+			return (rc);
+	}
+	if (parser->state == PARSER_HEADERS) {
+		if ((rc = parser_headers(parser)) != YHTTP_OK)
+			return (rc);
+	}
+	if (parser->state == PARSER_CHUNKED) {
+		if ((rc = parser_chunked(parser)) != YHTTP_OK)
+			return (rc);
+	}
+	if (parser->state == PARSER_BODY) {
+		if ((rc = parser_body(parser)) != YHTTP_OK)
+			return (rc);
+	}
+
+	return (YHTTP_OK);
+}
+
+/*
+ * Set the state of parser up for a request that has not been started yet.
+ */
+static void
+parser_clear(struct parser *parser)
+{
+	parser->state = PARSER_RLINE;
+	parser->err = 0;
+	parser->minor = 1;
+	parser->keep_alive = 0;
+	parser->upgrade = 0;
+	parser->nleft = 0;
+	parser->cont = 0;
+	parser->cstate = PARSER_CHUNK_SIZE;
+	parser->nchunk = 0;
+	parser->pos = 0;
+	parser->ntrailer = 0;
+	parser->ntfields = 0;
+}
+
 struct parser *
 parser_init(void)
 {
@@ -565,8 +1015,12 @@ parser_init(void)
 		goto err;
 
 	buf_init(&parser->buf);
-	parser->state = PARSER_RLINE;
-	parser->err = 0;
+	parser_clear(parser);
+	memset(&parser->limits, 0, sizeof(parser->limits));
+	parser->head = NULL;
+	parser->chunk = NULL;
+	parser->udata = NULL;
+	parser->expect = NULL;
 
 	return (parser);
 err:
@@ -588,8 +1042,18 @@ parser_free(struct parser *parser)
 int
 parser_parse(struct parser *parser, const unsigned char *data, size_t ndata)
 {
+	size_t	n;
 	int	rc;
 
+	/* A streamed body bypasses the buffer, keeping it small. */
+	if (parser->state == PARSER_BODY && parser->chunk != NULL) {
+		n = parser_stream(parser, data, ndata);
+		data += n;
+		ndata -= n;
+		if (ndata == 0)
+			return (YHTTP_OK);
+	}
+
 	/*
 	 * Every new TCP message is being added to the buffer first.
 	 * Afterwards, the appropriate state function (rline, headers, body)
@@ -601,18 +1065,102 @@ parser_parse(struct parser *parser, const unsigned char *data, size_t ndata)
 	if ((rc = buf_append(&parser->buf, data, ndata)) != YHTTP_OK)
 		return (rc);
 
-	if (parser->state == PARSER_RLINE) {
-		if ((rc = parser_rline(parser)) != YHTTP_OK)
-			return (rc);
-	}
-	if (parser->state == PARSER_HEADERS) {
-		if ((rc = parser_headers(parser)) != YHTTP_OK)
-			return (rc);
-	}
-	if (parser->state == PARSER_BODY) {
-		if ((rc = parser_body(parser)) != YHTTP_OK)
-			return (rc);
+	return (parser_run(parser));
+}
+
+/*
+ * Provide room for at least hint bytes at the end of the buffer, so that
+ * the caller can receive into it directly, without parser_parse() having
+ * to copy the data.  While a body is being buffered, the room grows along
+ * with the data that has arrived, up to the rest of the body, rather than
+ * covering the declared length right away, which the client may never send.
+ */
+int
+parser_room(struct parser *parser, size_t hint, unsigned char **room,
+	    size_t *nroom)
+{
+	size_t	nleft;
+	int	rc;
+
+	if (parser->state == PARSER_BODY && parser->chunk == NULL &&
+	    parser->requ->nbody > parser->buf.used) {
+		nleft = parser->requ->nbody - parser->buf.used;
+		if (hint < parser->buf.used)
+			hint = parser->buf.used;
+		if (hint > nleft)
+			hint = nleft;
 	}
 
+	if ((rc = buf_reserve(&parser->buf, hint)) != YHTTP_OK)
+		return (rc);
+
+	*room = parser->buf.buf + parser->buf.used;
+	*nroom = parser->buf.nbuf - parser->buf.off - parser->buf.used;
+
 	return (YHTTP_OK);
 }
+
+/*
+ * Parse the n bytes that have been written into the room of parser_room().
+ */
+int
+parser_commit(struct parser *parser, size_t n)
+{
+	parser->buf.used += n;
+
+	return (parser_run(parser));
+}
+
+/*
+ * Reset parser in place for the next request on the same connection, once
+ * its request has been done, keeping its buffer, limits and callbacks.  The
+ * bytes that have been received beyond the end of the request, starting at
+ * pos, are being parsed right away.
+ */
+int
+parser_reset(struct parser *parser)
+{
+	int	rc;
+
+	if ((rc = buf_pop(&parser->buf, parser->pos)) != YHTTP_OK)
+		return (rc);
+	if ((parser->requ = yhttp_requ_reset(parser->requ)) == NULL)
+		return (YHTTP_ERRNO);
+	parser_clear(parser);
+
+	if (parser->buf.used == 0)
+		return (YHTTP_OK);
+
+	return (parser_run(parser));
+}
+
+/*
+ * Complete the header of a request that has arrived over HTTP/2, once all
+ * of its fields have been added, with the method and the path taking the
+ * place of the request line.  Its body follows in pieces, if any.
+ */
+int
+parser_h2_request(struct parser *parser, const char *method, size_t nmethod,
+		  const char *path, size_t npath)
+{
+	int	rc;
+
+	/* Measured like the equivalent request line. */
+	if (parser->limits.nrline != 0 &&
+	    nmethod + npath + 10 > parser->limits.nrline) {
+		parser->err = 414;
+		return (YHTTP_OK);
+	}
+
+	rc = parser_rline_method(parser, method, nmethod);
+	if (rc != YHTTP_OK || parser->err)
+		return (rc);
+	rc = parser_rline_target(parser, path, npath);
+	if (rc != YHTTP_OK || parser->err)
+		return (rc);
+
+	parser->minor = 1;
+	parser->keep_alive = 1;
+
+	return (parser_cl(parser));
+}
@@ -20,8 +20,30 @@
 enum parser_state {
 	PARSER_RLINE,	/* Request line. */
 	PARSER_HEADERS,	/* Header fields. */
+	PARSER_CHUNKED,	/* Message body with the chunked transfer coding. */
 	PARSER_BODY,	/* Message body. */
-	PARSER_DONE	/* Request has been parsed successfully. */
+	PARSER_DONE,	/* Request has been parsed successfully. */
+	PARSER_H2	/* The connection preface of HTTP/2 has arrived. */
+};
+
+/*
+ * The parts of a message body with the chunked transfer coding.
+ */
+enum parser_chunk {
+	PARSER_CHUNK_SIZE,	/* The line with the size of a chunk. */
+	PARSER_CHUNK_DATA,	/* The data of a chunk. */
+	PARSER_CHUNK_CRLF,	/* The line break after the data. */
+	PARSER_CHUNK_TRAILER	/* The trailer fields. */
+};
+
+/*
+ * The limits of a request, with 0 meaning no limit.
+ */
+struct parser_limits {
+	size_t	nrline;		/* Bytes of the request line. */
+	size_t	nheader;	/* Bytes of the header fields. */
+	size_t	nfields;	/* Number of header fields. */
+	size_t	nbody;		/* Bytes of the decoded message body. */
 };
 
 struct parser {
@@ -29,11 +51,51 @@ struct parser {
 	struct buf		 buf;
 	enum parser_state	 state;
 	int			 err;
+	int			 minor;		/* Of the HTTP-version. */
+	int			 keep_alive;	/* Persistent connection. */
+	int			 upgrade;	/* Asks for HTTP/2 (h2c). */
+	struct parser_limits	 limits;
+
+	/*
+	 * Unless chunk is NULL, the message body is not being buffered, but
+	 * passed on to chunk as it arrives, after the header has been passed
+	 * on to head.
+	 */
+	void			(*head)(struct yhttp_requ *, void *);
+	void			(*chunk)(struct yhttp_requ *,
+					 const unsigned char *, size_t,
+					 void *);
+	void			*udata;
+	size_t			 nleft;		/* Bytes yet to be streamed. */
+
+	/* Accepts or rejects a request with "Expect: 100-continue". */
+	int			(*expect)(struct yhttp_requ *, void *);
+	int			 cont;		/* 100 Continue is due. */
+
+	/*
+	 * A chunked body is being decoded in place, with the decoded data at
+	 * the start of buf and the data that has not been decoded yet at pos.
+	 * Once the request is done, the bytes following it start at pos.
+	 */
+	enum parser_chunk	 cstate;
+	size_t			 nchunk;	/* Bytes left of the chunk. */
+	size_t			 pos;
+	size_t			 ntrailer;	/* Bytes of the trailer. */
+	size_t			 ntfields;	/* Trailer fields. */
 };
 
 struct parser	*parser_init(void);
 void		 parser_free(struct parser *);
 
 int		 parser_parse(struct parser *, const unsigned char *, size_t);
+int		 parser_room(struct parser *, size_t, unsigned char **,
+			     size_t *);
+int		 parser_commit(struct parser *, size_t);
+int		 parser_reset(struct parser *);
+
+int		 parser_field(struct parser *, const char *, size_t,
+			      const char *, size_t);
+int		 parser_h2_request(struct parser *, const char *, size_t,
+				   const char *, size_t);
 
 #endif
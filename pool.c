@@ -0,0 +1,403 @@
+/*
+ * Copyright (c) 2022 Emil Engler <engler+yhttp@unveil2.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pool.h"
+#include "yhttp.h"
+
+/*
+ * Every worker owns a deque of jobs, implemented as a ring buffer.  The owner
+ * takes the oldest job from the front, whereas idle workers steal the newest
+ * job from the back, so that a single slow handler does not hold up the jobs
+ * that have been queued behind it.
+ */
+struct worker {
+	pthread_mutex_t	  mtx;		/* Protects the deque. */
+	struct pool_job	**jobs;
+	size_t		  njobs;	/* Allocated space of jobs. */
+	size_t		  head;		/* Index of the front. */
+	size_t		  used;
+	struct pool	 *pool;
+	pthread_t	  thread;
+};
+
+struct pool {
+	pthread_mutex_t	  mtx;		/* Protects quit, used with cond. */
+	pthread_cond_t	  cond;		/* Signals new jobs to idle workers. */
+	struct worker	 *workers;
+	size_t		  nworkers;
+	size_t		  next;		/* Round-robin submission. */
+	size_t		  pending;	/* Submitted but not yet taken jobs. */
+	int		  quit;
+};
+
+static int		 pool_push(struct worker *, struct pool_job *);
+static struct pool_job	*pool_pop_front(struct worker *);
+static struct pool_job	*pool_pop_back(struct worker *);
+static struct pool_job	*pool_take(struct pool *, size_t);
+static void		*pool_run(void *);
+
+static int
+pool_push(struct worker *w, struct pool_job *job)
+{
+	struct pool_job	**n_jobs;
+	size_t		  n_njobs, i;
+
+	if (w->used == w->njobs) {
+		/* Double the ring buffer, moving the jobs to its start. */
+		if (w->njobs == 0)
+			n_njobs = 16;
+		else if (w->njobs > SIZE_MAX / 2 / sizeof(struct pool_job *))
+			return (YHTTP_EOVERFLOW);
+		else
+			n_njobs = w->njobs * 2;
+		n_jobs = malloc(sizeof(struct pool_job *) * n_njobs);
+		if (n_jobs == NULL)
+			return (YHTTP_ERRNO);
+
+		for (i = 0; i < w->used; ++i)
+			n_jobs[i] = w->jobs[(w->head + i) % w->njobs];
+		free(w->jobs);
+		w->jobs = n_jobs;
+		w->njobs = n_njobs;
+		w->head = 0;
+	}
+
+	w->jobs[(w->head + w->used++) % w->njobs] = job;
+
+	return (YHTTP_OK);
+}
+
+static struct pool_job *
+pool_pop_front(struct worker *w)
+{
+	struct pool_job	*job;
+
+	job = NULL;
+	pthread_mutex_lock(&w->mtx);
+	if (w->used != 0) {
+		job = w->jobs[w->head];
+		w->head = (w->head + 1) % w->njobs;
+		--w->used;
+	}
+	pthread_mutex_unlock(&w->mtx);
+
+	return (job);
+}
+
+static struct pool_job *
+pool_pop_back(struct worker *w)
+{
+	struct pool_job	*job;
+
+	job = NULL;
+	pthread_mutex_lock(&w->mtx);
+	if (w->used != 0)
+		job = w->jobs[(w->head + --w->used) % w->njobs];
+	pthread_mutex_unlock(&w->mtx);
+
+	return (job);
+}
+
+/*
+ * Take a job for the worker with the index id, either from its own deque or
+ * by stealing it from another one.
+ */
+static struct pool_job *
+pool_take(struct pool *pool, size_t id)
+{
+	struct pool_job	*job;
+	size_t		 i;
+
+	if ((job = pool_pop_front(&pool->workers[id])) == NULL) {
+		for (i = 1; i < pool->nworkers && job == NULL; ++i) {
+			job = pool_pop_back(
+			    &pool->workers[(id + i) % pool->nworkers]);
+		}
+	}
+
+	if (job != NULL)
+		__sync_sub_and_fetch(&pool->pending, 1);
+
+	return (job);
+}
+
+static void *
+pool_run(void *arg)
+{
+	struct pool_job	*job;
+	struct worker	*w;
+	struct pool	*pool;
+	size_t		 id;
+	int		 quit;
+
+	w = arg;
+	pool = w->pool;
+	id = w - pool->workers;
+
+	for (;;) {
+		if ((job = pool_take(pool, id)) != NULL) {
+			job->fn(job);
+			pool_cq_push(job->cq, job);
+			continue;
+		}
+
+		/* Sleep until new jobs are being submitted. */
+		pthread_mutex_lock(&pool->mtx);
+		while (__sync_add_and_fetch(&pool->pending, 0) == 0 &&
+		       !pool->quit)
+			pthread_cond_wait(&pool->cond, &pool->mtx);
+		quit = pool->quit &&
+		    __sync_add_and_fetch(&pool->pending, 0) == 0;
+		pthread_mutex_unlock(&pool->mtx);
+
+		if (quit)
+			break;
+	}
+
+	return (NULL);
+}
+
+/*
+ * Push a finished job.  This is lock-free, so that no worker can be blocked
+ * by an event loop or by another worker.  Threads other than the workers
+ * may push jobs of their own, which have not been run by the pool, in order
+ * to wake the event loop up.
+ */
+void
+pool_cq_push(struct pool_cq *cq, struct pool_job *job)
+{
+	struct pool_job	*head;
+	uint64_t	 one;
+
+	do {
+		head = cq->head;
+		job->next = head;
+	} while (!__sync_bool_compare_and_swap(&cq->head, head, job));
+
+	/*
+	 * Only the transition from empty needs to wake up the event loop.
+	 * EAGAIN means that a wakeup is pending already, and the descriptor
+	 * stays valid until the event loop is gone, so that nothing else can
+	 * fail apart from being interrupted.
+	 */
+	if (head == NULL) {
+		one = 1;
+		while (write(cq->fd[1], &one, sizeof(one)) == -1 &&
+		       errno == EINTR)
+			;
+	}
+}
+
+struct pool *
+pool_init(size_t nworkers)
+{
+	struct pool	*pool;
+	size_t		 i, nstarted;
+
+	if (nworkers == 0 || nworkers > SIZE_MAX / sizeof(struct worker))
+		return (NULL);
+
+	if ((pool = malloc(sizeof(struct pool))) == NULL)
+		return (NULL);
+	pool->workers = malloc(sizeof(struct worker) * nworkers);
+	if (pool->workers == NULL) {
+		free(pool);
+		return (NULL);
+	}
+	pool->nworkers = nworkers;
+	pool->next = 0;
+	pool->pending = 0;
+	pool->quit = 0;
+	pthread_mutex_init(&pool->mtx, NULL);
+	pthread_cond_init(&pool->cond, NULL);
+
+	for (i = 0; i < nworkers; ++i) {
+		pthread_mutex_init(&pool->workers[i].mtx, NULL);
+		pool->workers[i].jobs = NULL;
+		pool->workers[i].njobs = 0;
+		pool->workers[i].head = 0;
+		pool->workers[i].used = 0;
+		pool->workers[i].pool = pool;
+	}
+
+	for (nstarted = 0; nstarted < nworkers; ++nstarted) {
+		errno = pthread_create(&pool->workers[nstarted].thread, NULL,
+				       pool_run, &pool->workers[nstarted]);
+		if (errno != 0)
+			break;
+	}
+	if (nstarted != nworkers) {
+		/* Let pool_free() only join the workers that are running. */
+		for (i = nstarted; i < nworkers; ++i)
+			pthread_mutex_destroy(&pool->workers[i].mtx);
+		pool->nworkers = nstarted;
+		pool_free(pool);
+		return (NULL);
+	}
+
+	return (pool);
+}
+
+/*
+ * Stop all workers and free the pool.  Submitted jobs are still being run
+ * beforehand.
+ */
+void
+pool_free(struct pool *pool)
+{
+	size_t	i;
+
+	if (pool == NULL)
+		return;
+
+	pthread_mutex_lock(&pool->mtx);
+	pool->quit = 1;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->mtx);
+
+	for (i = 0; i < pool->nworkers; ++i)
+		pthread_join(pool->workers[i].thread, NULL);
+
+	for (i = 0; i < pool->nworkers; ++i) {
+		pthread_mutex_destroy(&pool->workers[i].mtx);
+		free(pool->workers[i].jobs);
+	}
+	pthread_mutex_destroy(&pool->mtx);
+	pthread_cond_destroy(&pool->cond);
+	free(pool->workers);
+	free(pool);
+}
+
+/*
+ * Queue job to be run by one of the workers.  Once it has been run, it gets
+ * pushed into job->cq.
+ */
+int
+pool_submit(struct pool *pool, struct pool_job *job)
+{
+	struct worker	*w;
+	int		 rc;
+
+	w = &pool->workers[__sync_fetch_and_add(&pool->next, 1) %
+			   pool->nworkers];
+
+	/*
+	 * The job is being counted before it can be taken, or pool_take()
+	 * could decrement pending below 0.
+	 */
+	pthread_mutex_lock(&w->mtx);
+	__sync_add_and_fetch(&pool->pending, 1);
+	if ((rc = pool_push(w, job)) != YHTTP_OK)
+		__sync_sub_and_fetch(&pool->pending, 1);
+	pthread_mutex_unlock(&w->mtx);
+	if (rc != YHTTP_OK)
+		return (rc);
+
+	pthread_mutex_lock(&pool->mtx);
+	pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->mtx);
+
+	return (YHTTP_OK);
+}
+
+void
+pool_cq_init(struct pool_cq *cq)
+{
+	cq->head = NULL;
+	cq->fd[0] = -1;
+	cq->fd[1] = -1;
+}
+
+/*
+ * Create the wakeup descriptors of cq.  This is an eventfd(2) on Linux and a
+ * non-blocking pipe(2) everywhere else.
+ */
+int
+pool_cq_open(struct pool_cq *cq)
+{
+#ifdef __linux__
+	if ((cq->fd[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+		return (YHTTP_ERRNO);
+	cq->fd[1] = cq->fd[0];
+#else
+	int	i, flags;
+
+	if (pipe(cq->fd) == -1)
+		return (YHTTP_ERRNO);
+	for (i = 0; i < 2; ++i) {
+		if ((flags = fcntl(cq->fd[i], F_GETFL)) == -1 ||
+		    fcntl(cq->fd[i], F_SETFL, flags | O_NONBLOCK) == -1) {
+			pool_cq_free(cq);
+			return (YHTTP_ERRNO);
+		}
+	}
+#endif
+
+	return (YHTTP_OK);
+}
+
+void
+pool_cq_free(struct pool_cq *cq)
+{
+	if (cq == NULL)
+		return;
+
+	if (cq->fd[0] != -1)
+		close(cq->fd[0]);
+	if (cq->fd[1] != -1 && cq->fd[1] != cq->fd[0])
+		close(cq->fd[1]);
+	pool_cq_init(cq);
+}
+
+/*
+ * Take all finished jobs out of cq, ordered from the oldest to the newest.
+ */
+struct pool_job *
+pool_cq_take(struct pool_cq *cq)
+{
+	struct pool_job	*head, *next, *prev;
+	uint64_t	 buf[16];
+
+	/* Consume the wakeup before emptying the queue, not the other way. */
+	while (read(cq->fd[0], buf, sizeof(buf)) > 0)
+		;
+
+	head = __sync_lock_test_and_set(&cq->head, NULL);
+
+	/* Reverse the list. */
+	prev = NULL;
+	while (head != NULL) {
+		next = head->next;
+		head->next = prev;
+		prev = head;
+		head = next;
+	}
+
+	return (prev);
+}
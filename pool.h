@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2022 Emil Engler <engler+yhttp@unveil2.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+struct pool_job {
+	void		(*fn)(struct pool_job *);	/* Run by a worker. */
+	struct pool_cq	 *cq;		/* Receives the finished job. */
+	struct pool_job	 *next;
+};
+
+/*
+ * A completion queue, into which the workers push finished jobs and which is
+ * being emptied by a single event loop.  Pushing into an empty queue makes
+ * fd[0] readable.
+ */
+struct pool_cq {
+	struct pool_job	*head;		/* Finished jobs, newest first. */
+	int		 fd[2];		/* The wakeup descriptors. */
+};
+
+struct pool	*pool_init(size_t);
+void		 pool_free(struct pool *);
+
+int		 pool_submit(struct pool *, struct pool_job *);
+
+void		 pool_cq_init(struct pool_cq *);
+int		 pool_cq_open(struct pool_cq *);
+void		 pool_cq_free(struct pool_cq *);
+void		 pool_cq_push(struct pool_cq *, struct pool_job *);
+struct pool_job	*pool_cq_take(struct pool_cq *);
+
+#endif
@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2022 Emil Engler <engler+yhttp@unveil2.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../arena.c"
+
+static void	test_arena_alloc(void);
+static void	test_arena_big(void);
+static void	test_arena_strndup(void);
+static void	test_arena_printf(void);
+static void	test_arena_reset(void);
+static void	test_arena_free(void);
+
+static void
+test_arena_alloc(void)
+{
+	struct arena	 arena;
+	unsigned char	*p, *q;
+
+	arena_init(&arena);
+	if (arena.blocks != NULL)
+		errx(1, "arena_init: arena.blocks is not NULL");
+
+	if ((p = arena_alloc(&arena, 1)) == NULL)
+		err(1, "arena_alloc");
+	if ((q = arena_alloc(&arena, 1)) == NULL)
+		err(1, "arena_alloc");
+
+	/* Both come from the same block and are aligned for any type. */
+	if (arena.blocks == NULL || arena.blocks->next != NULL)
+		errx(1, "arena_alloc: want one block");
+	if ((uintptr_t)p % NALIGN != 0 || (uintptr_t)q % NALIGN != 0)
+		errx(1, "arena_alloc: allocation is not aligned");
+	if (q != p + NALIGN)
+		errx(1, "arena_alloc: have offset %td, want %zu", q - p, NALIGN);
+	if (arena.blocks->used != 2 * NALIGN)
+		errx(1, "arena_alloc: have used %zu, want %zu",
+		     arena.blocks->used, 2 * NALIGN);
+
+	/* A full block is followed by a new one. */
+	if (arena_alloc(&arena, NBIG) == NULL)
+		err(1, "arena_alloc");
+	while (arena.blocks->next == NULL) {
+		if (arena_alloc(&arena, NBIG) == NULL)
+			err(1, "arena_alloc");
+	}
+	if (arena.blocks->next->next != NULL)
+		errx(1, "arena_alloc: want two blocks");
+
+	if (arena_alloc(&arena, SIZE_MAX) != NULL || errno != ENOMEM)
+		errx(1, "arena_alloc: want ENOMEM");
+
+	arena_free(&arena);
+}
+
+static void
+test_arena_big(void)
+{
+	struct arena		 arena;
+	struct arena_block	*b;
+	unsigned char		*p;
+
+	arena_init(&arena);
+	if (arena_alloc(&arena, 16) == NULL)
+		err(1, "arena_alloc");
+	b = arena.blocks;
+
+	/* A big allocation gets a block of its own behind the current one. */
+	if ((p = arena_alloc(&arena, NBLOCK)) == NULL)
+		err(1, "arena_alloc");
+	memset(p, 'a', NBLOCK);
+	if (arena.blocks != b)
+		errx(1, "arena_alloc: current block has been replaced");
+	if (b->next == NULL || DATA(b->next) != p || b->next->size != NBLOCK)
+		errx(1, "arena_alloc: big allocation is not behind the current block");
+
+	/* The current block keeps its space. */
+	if (arena_alloc(&arena, 16) != DATA(b) + 16)
+		errx(1, "arena_alloc: current block has not been used");
+
+	arena_free(&arena);
+}
+
+static void
+test_arena_strndup(void)
+{
+	struct arena	 arena;
+	char		*s;
+
+	arena_init(&arena);
+
+	if ((s = arena_strndup(&arena, "foobar", 3)) == NULL)
+		err(1, "arena_strndup");
+	if (strcmp(s, "foo") != 0)
+		errx(1, "arena_strndup: have %s, want foo", s);
+
+	if ((s = arena_strndup(&arena, "", 0)) == NULL)
+		err(1, "arena_strndup");
+	if (strcmp(s, "") != 0)
+		errx(1, "arena_strndup: have %s, want empty string", s);
+
+	if ((s = arena_strdup(&arena, "bar")) == NULL)
+		err(1, "arena_strdup");
+	if (strcmp(s, "bar") != 0)
+		errx(1, "arena_strdup: have %s, want bar", s);
+
+	arena_free(&arena);
+}
+
+static void
+test_arena_printf(void)
+{
+	struct arena	 arena;
+	char		*s;
+
+	arena_init(&arena);
+
+	if ((s = arena_printf(&arena, "%s=%d", "foo", 42)) == NULL)
+		err(1, "arena_printf");
+	if (strcmp(s, "foo=42") != 0)
+		errx(1, "arena_printf: have %s, want foo=42", s);
+
+	arena_free(&arena);
+}
+
+static void
+test_arena_reset(void)
+{
+	struct arena		 arena;
+	struct arena_block	*b;
+	int			 i;
+
+	arena_init(&arena);
+	for (i = 0; i < 16; ++i) {
+		if (arena_alloc(&arena, NBIG) == NULL)
+			err(1, "arena_alloc");
+	}
+	if (arena_alloc(&arena, NBLOCK) == NULL)
+		err(1, "arena_alloc");
+
+	/* Only a single block of the regular size is being kept. */
+	arena_reset(&arena);
+	if ((b = arena.blocks) == NULL)
+		errx(1, "arena_reset: arena.blocks is NULL");
+	if (b->next != NULL)
+		errx(1, "arena_reset: more than one block has been kept");
+	if (b->size != NBLOCK - NHDR || b->used != 0)
+		errx(1, "arena_reset: have size %zu and used %zu, want %zu and 0",
+		     b->size, b->used, (size_t)(NBLOCK - NHDR));
+
+	if (arena_alloc(&arena, 16) != DATA(b))
+		errx(1, "arena_alloc: kept block has not been used");
+
+	/* A reset of an empty arena keeps it empty. */
+	arena_free(&arena);
+	arena_reset(&arena);
+	if (arena.blocks != NULL)
+		errx(1, "arena_reset: arena.blocks is not NULL");
+}
+
+static void
+test_arena_free(void)
+{
+	struct arena	*arena, stack;
+
+	/* The arena may live inside of its own allocation. */
+	arena_init(&stack);
+	if ((arena = arena_alloc(&stack, sizeof(*arena))) == NULL)
+		err(1, "arena_alloc");
+	*arena = stack;
+	if (arena_alloc(arena, NBLOCK) == NULL)
+		err(1, "arena_alloc");
+	arena_free(arena);
+
+	arena_init(&stack);
+	arena_free(&stack);
+	if (stack.blocks != NULL)
+		errx(1, "arena_free: arena.blocks is not NULL");
+}
+
+int
+main(int argc, char *argv[])
+{
+	test_arena_alloc();
+	test_arena_big();
+	test_arena_strndup();
+	test_arena_printf();
+	test_arena_reset();
+	test_arena_free();
+
+	return (0);
+}
@@ -21,13 +21,14 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include "../buf.h"
+#include "../buf.c"
 #include "../yhttp.h"
 
 static void	test_buf_init(void);
 static void	test_buf_wipe(void);
 static void	test_buf_append(void);
 static void	test_buf_pop(void);
+static void	test_buf_reserve(void);
 
 static void
 test_buf_init(void)
@@ -41,6 +42,8 @@ test_buf_init(void)
 		errx(1, "buf_init: buf.nbuf is not 0");
 	if (buf.used != 0)
 		errx(1, "buf_init: buf.used is not 0");
+	if (buf.off != 0)
+		errx(1, "buf_init: buf.off is not 0");
 }
 
 static void
@@ -49,6 +52,7 @@ test_buf_wipe(void)
 	struct buf	buf;
 
 	buf.buf = NULL;
+	buf.off = 0;
 	buf_wipe(&buf);
 	if (buf.buf != NULL)
 		errx(1, "buf_wipe: buf.buf is not NULL");
@@ -65,6 +69,7 @@ test_buf_append(void)
 {
 	unsigned char	data[8192];
 	struct buf	buf;
+	size_t		i, nbuf, ngrown;
 
 	buf_init(&buf);
 	arc4random_buf(data, 8192);
@@ -103,6 +108,19 @@ test_buf_append(void)
 		errx(1, "buf_append: data does not match");
 	buf_wipe(&buf);
 
+	/* Small pieces make the buffer grow geometrically. */
+	for (i = 0, nbuf = 0, ngrown = 0; i < 1000; ++i) {
+		if (buf_append(&buf, data, 3) != YHTTP_OK)
+			err(1, "buf_append");
+		if (buf.nbuf != nbuf)
+			++ngrown;
+		nbuf = buf.nbuf;
+	}
+	if (ngrown > 10)
+		errx(1, "buf_append: have %zu reallocations, want at most 10",
+		     ngrown);
+	buf_wipe(&buf);
+
 	/* Test some integer overflows. */
 	buf.used = SIZE_MAX - 10;
 	if (buf_append(&buf, data, 11) != YHTTP_EOVERFLOW)
@@ -124,6 +142,7 @@ static void
 test_buf_pop(void)
 {
 	const char		*content;
+	unsigned char		*base;
 	struct buf		 buf;
 
 	content = "hello world";
@@ -131,17 +150,85 @@ test_buf_pop(void)
 	buf_init(&buf);
 	if (buf_append(&buf, (const unsigned char *)content, strlen(content)) != YHTTP_OK)
 		errx(1, "buf_append");
+	base = buf.buf;
 
 	if (buf_pop(&buf, 6) != YHTTP_OK)
 		errx(1, "buf_pop");
 
-	if (buf.nbuf != 10)
-		errx(1, "buf_pop: have nbuf %zu, want 10", buf.nbuf);
+	/* Popping must neither reallocate nor move the remaining data. */
+	if (buf.buf != base + 6)
+		errx(1, "buf_pop: data has been moved");
+	if (buf.nbuf != 22)
+		errx(1, "buf_pop: have nbuf %zu, want 22", buf.nbuf);
+	if (buf.off != 6)
+		errx(1, "buf_pop: have off %zu, want 6", buf.off);
 	if (buf.used != 5)
 		errx(1, "buf_pop: have used %zu, want 5", buf.used);
 	if (memcmp(buf.buf, "world", 5) != 0)
 		errx(1, "buf_pop: data does not match");
 
+	/* Running out of space moves the data back to the front. */
+	if (buf_append(&buf, (const unsigned char *)" and much more", 14) != YHTTP_OK)
+		errx(1, "buf_append");
+	if (buf.off != 0 || buf.nbuf != 22)
+		errx(1, "buf_append: have off %zu, nbuf %zu, want 0, 22",
+		     buf.off, buf.nbuf);
+	if (buf.used != 19 || memcmp(buf.buf, "world and much more", 19) != 0)
+		errx(1, "buf_append: data does not match");
+
+	/* An emptied buffer starts over at the front, unless it is large. */
+	if (buf_pop(&buf, 5) != YHTTP_OK || buf_pop(&buf, 14) != YHTTP_OK)
+		errx(1, "buf_pop");
+	if (buf.used != 0 || buf.off != 0 || buf.buf != base)
+		errx(1, "buf_pop: have used %zu, off %zu, want 0, 0",
+		     buf.used, buf.off);
+	if (buf_reserve(&buf, NKEEP) != YHTTP_OK)
+		errx(1, "buf_reserve");
+	buf.used = 10;
+	if (buf_pop(&buf, 10) != YHTTP_OK)
+		errx(1, "buf_pop");
+	if (buf.buf != NULL || buf.nbuf != 0)
+		errx(1, "buf_pop: have nbuf %zu, want 0", buf.nbuf);
+
+	buf_wipe(&buf);
+}
+
+static void
+test_buf_reserve(void)
+{
+	struct buf	buf;
+
+	buf_init(&buf);
+	if (buf_reserve(&buf, 100) != YHTTP_OK)
+		errx(1, "buf_reserve");
+	if (buf.nbuf != 101)
+		errx(1, "buf_reserve: have nbuf %zu, want 101", buf.nbuf);
+
+	/* Reserved space is not being grown any further. */
+	memset(buf.buf, 'a', 100);
+	buf.used = 40;
+	if (buf_pop(&buf, 20) != YHTTP_OK || buf_reserve(&buf, 60) != YHTTP_OK)
+		errx(1, "buf_reserve");
+	if (buf.nbuf != 101 || buf.off != 20)
+		errx(1, "buf_reserve: have nbuf %zu, off %zu, want 101, 20",
+		     buf.nbuf, buf.off);
+
+	/* Unless the popped space is being reclaimed. */
+	if (buf_reserve(&buf, 70) != YHTTP_OK)
+		errx(1, "buf_reserve");
+	if (buf.nbuf != 101 || buf.off != 0 || buf.used != 20)
+		errx(1, "buf_reserve: have nbuf %zu, off %zu, used %zu, "
+		     "want 101, 0, 20", buf.nbuf, buf.off, buf.used);
+	if (buf_reserve(&buf, 100) != YHTTP_OK)
+		errx(1, "buf_reserve");
+	if (buf.nbuf != 121)
+		errx(1, "buf_reserve: have nbuf %zu, want 121", buf.nbuf);
+
+	buf.used = SIZE_MAX - 10;
+	if (buf_reserve(&buf, 10) != YHTTP_EOVERFLOW)
+		errx(1, "buf_reserve: want YHTTP_EOVERFLOW");
+	buf.used = 0;
+
 	buf_wipe(&buf);
 }
 
@@ -152,5 +239,6 @@ main(int argc, char *argv[])
 	test_buf_wipe();
 	test_buf_append();
 	test_buf_pop();
+	test_buf_reserve();
 	return (0);
 }
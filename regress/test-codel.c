@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2022 Emil Engler <engler+yhttp@unveil2.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "../codel.c"
+
+int
+main(int argc, char *argv[])
+{
+	struct codel	c;
+	uint64_t	now;
+
+	codel_init(&c, 5, 100);
+
+	/* Short waiting times never lead to shedding. */
+	for (now = 0; now < 1000; now += 10) {
+		codel_sample(&c, 4, now);
+		if (codel_shed(&c, now))
+			errx(1, "codel_shed: shed below target at %llu",
+			     (unsigned long long)now);
+	}
+
+	/* Exceeding target for less than an interval is tolerated. */
+	codel_sample(&c, 50, 1000);
+	if (codel_shed(&c, 1000))
+		errx(1, "codel_shed: shed without an interval above target");
+	codel_sample(&c, 50, 1050);
+	if (codel_shed(&c, 1050))
+		errx(1, "codel_shed: shed without an interval above target");
+
+	/* After a whole interval, the episode starts. */
+	codel_sample(&c, 50, 1100);
+	if (!codel_shed(&c, 1100))
+		errx(1, "codel_shed: did not shed after an interval");
+	if (!c.dropping)
+		errx(1, "codel_shed: not dropping");
+
+	/* The next request is only shed once drop_next has been reached. */
+	codel_sample(&c, 50, 1110);
+	if (codel_shed(&c, 1110))
+		errx(1, "codel_shed: shed before drop_next");
+	codel_sample(&c, 50, 1200);
+	if (!codel_shed(&c, 1200))
+		errx(1, "codel_shed: did not shed at drop_next");
+	if (c.count != 2)
+		errx(1, "codel_shed: have count %zu, want 2", c.count);
+	if (c.drop_next != 1200 + 100 / 1)
+		errx(1, "codel_shed: have drop_next %llu",
+		     (unsigned long long)c.drop_next);
+
+	/* A single short waiting time ends the episode. */
+	codel_sample(&c, 1, 1210);
+	if (codel_shed(&c, 1210))
+		errx(1, "codel_shed: shed below target");
+	if (c.dropping)
+		errx(1, "codel_shed: still dropping");
+
+	return (0);
+}
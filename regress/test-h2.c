@@ -0,0 +1,415 @@
+/*
+ * Copyright (c) 2022 Emil Engler <engler+yhttp@unveil2.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../h2.c"
+
+static void	append(struct buf *, const void *, size_t);
+static void	field(struct buf *, const char *, const char *);
+static void	request(struct buf *, uint32_t, const char *, const char *,
+			int);
+static size_t	find(const struct buf *, enum h2_type, uint32_t);
+static struct h2
+		*start(struct parser *, struct buf *);
+static void	test_request(void);
+static void	test_body(void);
+static void	test_errors(void);
+static void	test_window(void);
+static void	test_base64url(void);
+
+static void
+append(struct buf *buf, const void *data, size_t n)
+{
+	if (buf_append(buf, data, n) != YHTTP_OK)
+		errx(1, "buf_append");
+}
+
+/*
+ * Append a literal header field without indexing to a header block.
+ */
+static void
+field(struct buf *block, const char *name, const char *value)
+{
+	if (hpack_encode(block, name, value) != YHTTP_OK)
+		errx(1, "hpack_encode");
+}
+
+/*
+ * Append a HEADERS frame with a request to buf.
+ */
+static void
+request(struct buf *buf, uint32_t id, const char *method, const char *path,
+	int flags)
+{
+	struct buf	block;
+
+	buf_init(&block);
+	field(&block, ":method", method);
+	field(&block, ":scheme", "http");
+	field(&block, ":path", path);
+	field(&block, ":authority", "example.com");
+	if (h2_frame(buf, block.used, H2_HEADERS, flags | H2_END_HEADERS,
+		     id) != YHTTP_OK)
+		errx(1, "h2_frame");
+	append(buf, block.buf, block.used);
+	buf_wipe(&block);
+}
+
+/*
+ * Return the offset of the first frame of the given type on stream id in
+ * buf, or SIZE_MAX.
+ */
+static size_t
+find(const struct buf *buf, enum h2_type type, uint32_t id)
+{
+	size_t	len, off;
+
+	for (off = 0; off + 9 <= buf->used; off += 9 + len) {
+		len = buf->buf[off] << 16 | buf->buf[off + 1] << 8 |
+		    buf->buf[off + 2];
+		if (buf->buf[off + 3] == type &&
+		    h2_get32(buf->buf + off + 5) == id)
+			return (off);
+	}
+
+	return (SIZE_MAX);
+}
+
+/*
+ * Create a connection, which has received the preface and the settings of
+ * the client already.
+ */
+static struct h2 *
+start(struct parser *tmpl, struct buf *out)
+{
+	struct h2	*h2;
+	struct buf	 in;
+
+	buf_init(&in);
+	append(&in, H2_PREFACE, H2_NPREFACE);
+	if (h2_frame(&in, 0, H2_SETTINGS, 0, 0) != YHTTP_OK)
+		errx(1, "h2_frame");
+
+	if ((h2 = h2_init(tmpl, out)) == NULL)
+		errx(1, "h2_init");
+	if (h2_parse(h2, in.buf, in.used) != YHTTP_OK)
+		errx(1, "h2_parse");
+	if (h2->closing || !h2->settings)
+		errx(1, "h2_parse: preface has not been accepted");
+	if (find(out, H2_SETTINGS, 0) != 0)
+		errx(1, "h2_init: settings are not first");
+	buf_wipe(&in);
+
+	return (h2);
+}
+
+static void
+test_request(void)
+{
+	struct parser		*tmpl;
+	struct h2		*h2;
+	struct h2_stream	*st;
+	struct buf		 in, out;
+	size_t			 off;
+	const char		*host;
+
+	if ((tmpl = parser_init()) == NULL)
+		errx(1, "parser_init");
+	buf_init(&out);
+	h2 = start(tmpl, &out);
+
+	/* Two requests, with the frames arriving byte by byte. */
+	buf_init(&in);
+	request(&in, 1, "GET", "/a?b=c", H2_END_STREAM);
+	request(&in, 3, "HEAD", "/d", H2_END_STREAM);
+	for (off = 0; off < in.used; ++off) {
+		if (h2_parse(h2, in.buf + off, 1) != YHTTP_OK)
+			errx(1, "h2_parse");
+	}
+	buf_wipe(&in);
+
+	if ((st = h2_take(h2)) == NULL || st->id != 1)
+		errx(1, "h2_take: stream 1 is not ready");
+	if (st->parser->requ->method != YHTTP_GET ||
+	    strcmp(st->parser->requ->path, "/a") != 0 ||
+	    strcmp(yhttp_query(st->parser->requ, "b"), "c") != 0)
+		errx(1, "h2_take: request of stream 1 differs");
+	host = yhttp_header(st->parser->requ, "Host");
+	if (host == NULL || strcmp(host, "example.com") != 0)
+		errx(1, "h2_take: have host %s, want example.com",
+		     host == NULL ? "NULL" : host);
+
+	/* An interim response does not end the stream. */
+	if (h2_hint(h2, st, "</a.css>; rel=preload") != YHTTP_OK)
+		errx(1, "h2_hint");
+	if ((off = find(&out, H2_HEADERS, 1)) == SIZE_MAX ||
+	    out.buf[off + 4] != H2_END_HEADERS || out.buf[off + 9] != 0x08)
+		errx(1, "h2_hint: HEADERS frame with 103 differs");
+	out.used = off;
+
+	if (yhttp_resp_body(st->parser->requ, (const unsigned char *)"hi",
+			    2) != YHTTP_OK)
+		errx(1, "yhttp_resp_body");
+	if (h2_respond(h2, st) != YHTTP_OK || h2_send(h2, SIZE_MAX) !=
+	    YHTTP_OK)
+		errx(1, "h2_respond");
+	if (find(&out, H2_HEADERS, 1) == SIZE_MAX)
+		errx(1, "h2_respond: no HEADERS frame");
+	if ((off = find(&out, H2_DATA, 1)) == SIZE_MAX)
+		errx(1, "h2_send: no DATA frame");
+	if (out.buf[off + 2] != 2 || out.buf[off + 4] != H2_END_STREAM ||
+	    memcmp(out.buf + off + 9, "hi", 2) != 0)
+		errx(1, "h2_send: DATA frame differs");
+	if (h2->nstreams != 1)
+		errx(1, "h2_respond: have %zu streams, want 1", h2->nstreams);
+
+	/* The response to HEAD ends with its header. */
+	if ((st = h2_take(h2)) == NULL || st->id != 3)
+		errx(1, "h2_take: stream 3 is not ready");
+	if (yhttp_resp_body(st->parser->requ, (const unsigned char *)"hi",
+			    2) != YHTTP_OK)
+		errx(1, "yhttp_resp_body");
+	if (h2_respond(h2, st) != YHTTP_OK)
+		errx(1, "h2_respond");
+	if ((off = find(&out, H2_HEADERS, 3)) == SIZE_MAX ||
+	    !(out.buf[off + 4] & H2_END_STREAM))
+		errx(1, "h2_respond: HEADERS of HEAD does not end the stream");
+	if (find(&out, H2_DATA, 3) != SIZE_MAX || h2->nstreams != 0)
+		errx(1, "h2_respond: HEAD has a body");
+
+	h2_free(h2);
+	parser_free(tmpl);
+	buf_wipe(&out);
+}
+
+static void
+test_body(void)
+{
+	struct parser		*tmpl;
+	struct h2		*h2;
+	struct h2_stream	*st;
+	struct buf		 block, in, out;
+
+	if ((tmpl = parser_init()) == NULL)
+		errx(1, "parser_init");
+	tmpl->limits.nbody = 4;
+	buf_init(&out);
+	h2 = start(tmpl, &out);
+
+	/* A body in two pieces, followed by a trailer section. */
+	buf_init(&in);
+	request(&in, 1, "POST", "/", 0);
+	h2_frame(&in, 2, H2_DATA, 0, 1);
+	append(&in, "ab", 2);
+	h2_frame(&in, 2, H2_DATA, 0, 1);
+	append(&in, "cd", 2);
+	buf_init(&block);
+	field(&block, "x-sum", "abcd");
+	h2_frame(&in, block.used, H2_HEADERS, H2_END_HEADERS | H2_END_STREAM,
+		 1);
+	append(&in, block.buf, block.used);
+	buf_wipe(&block);
+
+	/* A body that exceeds the limit. */
+	request(&in, 3, "POST", "/", 0);
+	h2_frame(&in, 5, H2_DATA, H2_END_STREAM, 3);
+	append(&in, "abcde", 5);
+	if (h2_parse(h2, in.buf, in.used) != YHTTP_OK)
+		errx(1, "h2_parse");
+	buf_wipe(&in);
+
+	if ((st = h2_take(h2)) == NULL || st->id != 1)
+		errx(1, "h2_take: stream 1 is not ready");
+	if (st->parser->err != 0 || st->parser->requ->nbody != 4 ||
+	    memcmp(st->parser->requ->body, "abcd", 4) != 0)
+		errx(1, "h2_take: body of stream 1 differs");
+	if (yhttp_header(st->parser->requ, "x-sum") == NULL)
+		errx(1, "h2_take: trailer field is missing");
+	if (find(&out, H2_WINDOW_UPDATE, 0) == SIZE_MAX ||
+	    find(&out, H2_WINDOW_UPDATE, 1) == SIZE_MAX)
+		errx(1, "h2_parse: the credit has not been given back");
+	if (h2_respond(h2, st) != YHTTP_OK)
+		errx(1, "h2_respond");
+
+	if ((st = h2_take(h2)) == NULL || st->id != 3)
+		errx(1, "h2_take: stream 3 is not ready");
+	if (st->parser->err != 413)
+		errx(1, "h2_take: have err %d, want 413", st->parser->err);
+	if (h2_reject(h2, st, st->parser->err, 0) != YHTTP_OK ||
+	    h2_send(h2, SIZE_MAX) != YHTTP_OK)
+		errx(1, "h2_reject");
+	if (h2->nstreams != 0)
+		errx(1, "h2_reject: have %zu streams, want 0", h2->nstreams);
+
+	h2_free(h2);
+	parser_free(tmpl);
+	buf_wipe(&out);
+}
+
+static void
+test_errors(void)
+{
+	struct parser		*tmpl;
+	struct h2		*h2;
+	struct buf		 block, in, out;
+	size_t			 off;
+
+	if ((tmpl = parser_init()) == NULL)
+		errx(1, "parser_init");
+
+	/* A preface that differs. */
+	buf_init(&out);
+	if ((h2 = h2_init(tmpl, &out)) == NULL)
+		errx(1, "h2_init");
+	if (h2_parse(h2, (const unsigned char *)"GET / HTTP/1.1\r\n", 16) !=
+	    YHTTP_OK)
+		errx(1, "h2_parse");
+	if (!h2->closing || find(&out, H2_GOAWAY, 0) == SIZE_MAX)
+		errx(1, "h2_parse: preface has been accepted");
+	h2_free(h2);
+	buf_wipe(&out);
+
+	/* A malformed request resets the stream only. */
+	buf_init(&out);
+	h2 = start(tmpl, &out);
+	buf_init(&in);
+	buf_init(&block);
+	field(&block, ":method", "GET");
+	field(&block, ":path", "/");
+	h2_frame(&in, block.used, H2_HEADERS, H2_END_HEADERS | H2_END_STREAM,
+		 1);
+	append(&in, block.buf, block.used);
+	buf_wipe(&block);
+	if (h2_parse(h2, in.buf, in.used) != YHTTP_OK)
+		errx(1, "h2_parse");
+	if (h2->closing || (off = find(&out, H2_RST_STREAM, 1)) == SIZE_MAX ||
+	    out.buf[off + 12] != H2_PROTOCOL_ERROR)
+		errx(1, "h2_parse: request without :scheme is not reset");
+	if (h2->nstreams != 0 || h2_take(h2) != NULL)
+		errx(1, "h2_parse: reset stream is still there");
+
+	/* Streams of the client have odd IDs. */
+	in.used = 0;
+	request(&in, 2, "GET", "/", H2_END_STREAM);
+	if (h2_parse(h2, in.buf, in.used) != YHTTP_OK)
+		errx(1, "h2_parse");
+	if (!h2->closing || find(&out, H2_GOAWAY, 0) == SIZE_MAX)
+		errx(1, "h2_parse: even stream ID has been accepted");
+	buf_wipe(&in);
+	h2_free(h2);
+	buf_wipe(&out);
+
+	parser_free(tmpl);
+}
+
+static void
+test_window(void)
+{
+	struct parser		*tmpl;
+	struct h2		*h2;
+	struct h2_stream	*st;
+	struct buf		 in, out;
+	unsigned char		 body[20000], settings[6];
+	size_t			 n, off;
+
+	if ((tmpl = parser_init()) == NULL)
+		errx(1, "parser_init");
+	buf_init(&out);
+	h2 = start(tmpl, &out);
+
+	/* SETTINGS_INITIAL_WINDOW_SIZE of 100 bytes. */
+	settings[0] = 0;
+	settings[1] = 0x4;
+	settings[2] = 0;
+	settings[3] = 0;
+	settings[4] = 0;
+	settings[5] = 100;
+	buf_init(&in);
+	h2_frame(&in, sizeof(settings), H2_SETTINGS, 0, 0);
+	append(&in, settings, sizeof(settings));
+	request(&in, 1, "GET", "/", H2_END_STREAM);
+	if (h2_parse(h2, in.buf, in.used) != YHTTP_OK)
+		errx(1, "h2_parse");
+
+	memset(body, 'x', sizeof(body));
+	if ((st = h2_take(h2)) == NULL)
+		errx(1, "h2_take");
+	if (yhttp_resp_body(st->parser->requ, body, sizeof(body)) !=
+	    YHTTP_OK || h2_respond(h2, st) != YHTTP_OK)
+		errx(1, "h2_respond");
+	if (h2_send(h2, SIZE_MAX) != YHTTP_OK)
+		errx(1, "h2_send");
+	if ((off = find(&out, H2_DATA, 1)) == SIZE_MAX || out.buf[off + 2] !=
+	    100 || h2_pending(h2))
+		errx(1, "h2_send: the window of the stream is exceeded");
+
+	/* More credit lets the remainder follow in frames of H2_NFRAME. */
+	in.used = 0;
+	h2_frame(&in, 4, H2_WINDOW_UPDATE, 0, 1);
+	append(&in, "\x00\x01\x00\x00", 4);
+	if (h2_parse(h2, in.buf, in.used) != YHTTP_OK || !h2_pending(h2))
+		errx(1, "h2_parse: WINDOW_UPDATE has not been applied");
+	out.used = 0;
+	if (h2_send(h2, SIZE_MAX) != YHTTP_OK)
+		errx(1, "h2_send");
+	n = 0;
+	for (off = 0; off < out.used; off += 9 + (h2_get32(out.buf + off) >> 8))
+		n += h2_get32(out.buf + off) >> 8;
+	if (n != sizeof(body) - 100 || h2->nstreams != 0)
+		errx(1, "h2_send: have %zu bytes, want %zu", n,
+		     sizeof(body) - 100);
+	buf_wipe(&in);
+
+	h2_free(h2);
+	parser_free(tmpl);
+	buf_wipe(&out);
+}
+
+static void
+test_base64url(void)
+{
+	unsigned char	out[32];
+	size_t		n;
+
+	n = h2_base64url("AAMAAABkAAQAoAAAAAIAAAAA", out);
+	if (n != 18 || memcmp(out, "\x00\x03\x00\x00\x00\x64\x00\x04\x00\xa0"
+	    "\x00\x00\x00\x02\x00\x00\x00\x00", 18) != 0)
+		errx(1, "h2_base64url: have %zu bytes, want 18", n);
+	if ((n = h2_base64url("_-8", out)) != 2 || out[0] != 0xff ||
+	    out[1] != 0xef)
+		errx(1, "h2_base64url: have %zu bytes, want 2", n);
+	if (h2_base64url("AAMAA", out) != SIZE_MAX ||
+	    h2_base64url("AA+A", out) != SIZE_MAX)
+		errx(1, "h2_base64url: invalid string has been accepted");
+}
+
+int
+main(int argc, char *argv[])
+{
+	test_request();
+	test_body();
+	test_errors();
+	test_window();
+	test_base64url();
+
+	return (0);
+}
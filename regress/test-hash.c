@@ -19,6 +19,7 @@
 #include <err.h>
 #include <stdlib.h>
 
+#include "../arena.h"
 #include "../hash.c"
 
 struct name_hash {
@@ -72,10 +73,12 @@ test_hash(void)
 static void
 test_hash_init(void)
 {
+	struct arena	  arena;
 	struct hash	**ht;
 	size_t		  i;
 
-	if ((ht = hash_init()) == NULL)
+	arena_init(&arena);
+	if ((ht = hash_init(&arena)) == NULL)
 		err(1, "hash_init");
 
 	/* Check if all fields have been initialized to NULL. */
@@ -84,41 +87,45 @@ test_hash_init(void)
 			errx(1, "hash_init: ht[%zu] is not NULL", i);
 	}
 
-	hash_free(ht);
+	arena_free(&arena);
 }
 
 static void
 test_hash_get(void)
 {
+	struct arena	  arena;
 	struct hash	**ht;
 
-	if ((ht = hash_init()) == NULL)
+	arena_init(&arena);
+	if ((ht = hash_init(&arena)) == NULL)
 		err(1, "hash_init");
 
-	if (hash_set(ht, "foo", "bar") != YHTTP_OK)
+	if (hash_set(&arena, ht, "foo", "bar") != YHTTP_OK)
 		errx(1, "hash_set");
 
 	/* Test case insensitive access. */
 	if (hash_get(ht, "FOO") != hash_get(ht, "foo"))
 		errx(1, "hash_get");
 
-	hash_free(ht);
+	arena_free(&arena);
 }
 
 static void
 test_hash_dump(void)
 {
+	struct arena	  arena;
 	struct hash	**ht, **dump;
 
-	if ((ht = hash_init()) == NULL)
+	arena_init(&arena);
+	if ((ht = hash_init(&arena)) == NULL)
 		err(1, "hash_init");
 
-	if (hash_set(ht, "foo", "bar") != YHTTP_OK)
+	if (hash_set(&arena, ht, "foo", "bar") != YHTTP_OK)
 		errx(1, "hash_set");
-	if (hash_set(ht, "bar", "foo") != YHTTP_OK)
+	if (hash_set(&arena, ht, "bar", "foo") != YHTTP_OK)
 		errx(1, "hash_set");
 
-	if ((dump = hash_dump(ht)) == NULL)
+	if ((dump = hash_dump(&arena, ht)) == NULL)
 		errx(1, "hash_dump");
 
 	if (dump[0] != hash_get(ht, "bar"))
@@ -128,8 +135,7 @@ test_hash_dump(void)
 	if (dump[2] != NULL)
 		errx(1, "hash_dump: dump[2] is not NULL");
 
-	free(dump);
-	hash_free(ht);
+	arena_free(&arena);
 }
 
 static void
@@ -144,17 +150,19 @@ static void
 test_hash_set1(void)
 {
 	/* Testing very simple sets across the hash table. */
+	struct arena	  arena;
 	struct hash	**ht;
 	size_t		  i, h;
 
-	if ((ht = hash_init()) == NULL)
+	arena_init(&arena);
+	if ((ht = hash_init(&arena)) == NULL)
 		err(1, "hash_init");
 
 	/* Populate the hash table until ringo. */
 	for (i = 0; i < 4; ++i) {
 		h = data[i].hash;
 
-		if (hash_set(ht, data[i].name, data[i].name) != YHTTP_OK)
+		if (hash_set(&arena, ht, data[i].name, data[i].name) != YHTTP_OK)
 			err(1, "hash_set");
 
 		if (ht[h] == NULL)
@@ -165,27 +173,29 @@ test_hash_set1(void)
 			errx(1, "hash_set: value was not set properly");
 	}
 
-	hash_free(ht);
+	arena_free(&arena);
 }
 
 static void
 test_hash_set2(void)
 {
 	/* Testing hash collisions for john. */
+	struct arena	  arena;
 	struct hash	**ht;
 	struct hash	 *prev;
 	size_t		  i, h;
 
-	if ((ht = hash_init()) == NULL)
+	arena_init(&arena);
+	if ((ht = hash_init(&arena)) == NULL)
 		err(1, "hash_init");
-	if (hash_set(ht, "john", "john") != YHTTP_OK)
+	if (hash_set(&arena, ht, "john", "john") != YHTTP_OK)
 		err(1, "hash_set");
 
 	for (i = 4; i < 8; ++i) {
 		h = data[i].hash;
 		prev = ht[h];
 
-		if (hash_set(ht, data[i].name, data[i].name) != YHTTP_OK)
+		if (hash_set(&arena, ht, data[i].name, data[i].name) != YHTTP_OK)
 			err(1, "hash_set");
 
 		if (ht[h]->prev != NULL)
@@ -196,23 +206,25 @@ test_hash_set2(void)
 			errx(1, "hash_set: prev->next->prev was not set properly");
 	}
 
-	hash_free(ht);
+	arena_free(&arena);
 }
 
 static void
 test_hash_set3(void)
 {
 	/* Testing the modification of values. */
+	struct arena		  arena;
 	struct hash		**ht;
 	struct hash		 *node;
 	const struct name_hash	 *nh;
 
-	if ((ht = hash_init()) == NULL)
+	arena_init(&arena);
+	if ((ht = hash_init(&arena)) == NULL)
 		err(1, "hash_init");
 
 	/* Populate the hash table with the default data. */
 	for (nh = data; nh->name != NULL; ++nh) {
-		if (hash_set(ht, nh->name, nh->name) != YHTTP_OK)
+		if (hash_set(&arena, ht, nh->name, nh->name) != YHTTP_OK)
 			err(1, "hash_set");
 	}
 
@@ -223,29 +235,31 @@ test_hash_set3(void)
 		if (strcmp(node->value, nh->name) != 0)
 			errx(1, "hash_set: value was not set properly");
 
-		if (hash_set(ht, nh->name, "foo") != YHTTP_OK)
+		if (hash_set(&arena, ht, nh->name, "foo") != YHTTP_OK)
 			err(1, "hash_set");
 
 		if (strcmp(node->value, "foo") != 0)
 			errx(1, "hash_set: value is not foo");
 	}
 
-	hash_free(ht);
+	arena_free(&arena);
 }
 
 static void
 test_hash_unset(void)
 {
+	struct arena		  arena;
 	struct hash		**ht;
 	struct hash		 *prev, *next;
 	const struct name_hash	 *nh;
 
-	if ((ht = hash_init()) == NULL)
+	arena_init(&arena);
+	if ((ht = hash_init(&arena)) == NULL)
 		err(1, "hash_init");
 
 	/* Populate the hash table with the default data. */
 	for (nh = data; nh->name != NULL; ++nh) {
-		if (hash_set(ht, nh->name, nh->name) != YHTTP_OK)
+		if (hash_set(&arena, ht, nh->name, nh->name) != YHTTP_OK)
 			err(1, "hash_set");
 	}
 
@@ -266,7 +280,7 @@ test_hash_unset(void)
 	if (next->next->next != NULL)
 		errx(1, "hash_unset: linked list removal failed");
 
-	hash_free(ht);
+	arena_free(&arena);
 }
 
 int
@@ -278,6 +292,5 @@ main(int argc, char *argv[])
 	test_hash_dump();
 	test_hash_set();
 	test_hash_unset();
-	hash_free(NULL);
 	return (0);
 }
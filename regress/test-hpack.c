@@ -0,0 +1,254 @@
+/*
+ * Copyright (c) 2022 Emil Engler <engler+yhttp@unveil2.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../hpack.c"
+
+struct hpack_test {
+	const char	*block;		/* Hexadecimal. */
+	const char	*fields;	/* The fields as "name: value\n". */
+	size_t		 size;		/* Of the dynamic table afterwards. */
+};
+
+static size_t	unhex(const char *, unsigned char *);
+static int	test_field(void *, const char *, size_t, const char *, size_t);
+static void	test_decode(const struct hpack_test *, int);
+static void	test_evict(void);
+static void	test_errors(void);
+static void	test_encode(void);
+
+/* RFC 7541, Appendix C.3, without Huffman coding. */
+static const struct hpack_test	plain[] = {
+	{ "828684410f7777772e6578616d706c652e636f6d",
+	  ":method: GET\n:scheme: http\n:path: /\n"
+	  ":authority: www.example.com\n", 57 },
+	{ "828684be58086e6f2d6361636865",
+	  ":method: GET\n:scheme: http\n:path: /\n"
+	  ":authority: www.example.com\ncache-control: no-cache\n", 110 },
+	{ "828785bf400a637573746f6d2d6b65790c637573746f6d2d76616c7565",
+	  ":method: GET\n:scheme: https\n:path: /index.html\n"
+	  ":authority: www.example.com\ncustom-key: custom-value\n", 164 },
+	{ NULL, NULL, 0 }
+};
+
+/* RFC 7541, Appendix C.4, with Huffman coding. */
+static const struct hpack_test	huff[] = {
+	{ "828684418cf1e3c2e5f23a6ba0ab90f4ff",
+	  ":method: GET\n:scheme: http\n:path: /\n"
+	  ":authority: www.example.com\n", 57 },
+	{ "828684be5886a8eb10649cbf",
+	  ":method: GET\n:scheme: http\n:path: /\n"
+	  ":authority: www.example.com\ncache-control: no-cache\n", 110 },
+	{ "828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf",
+	  ":method: GET\n:scheme: https\n:path: /index.html\n"
+	  ":authority: www.example.com\ncustom-key: custom-value\n", 164 },
+	{ NULL, NULL, 0 }
+};
+
+static const char	*invalid[] = {
+	"80",			/* Index 0. */
+	"be",			/* Index 62 with an empty dynamic table. */
+	"1f",			/* An integer that ends prematurely. */
+	"1fffffffff0f",		/* An integer that is too large. */
+	"3fe21f",		/* A size update beyond the limit. */
+	"823f",			/* A size update after a field. */
+	"0003666f6f",		/* A value that is missing. */
+	"0081fe00",		/* A Huffman string with bad padding. */
+	"0084ffffffff00",	/* A Huffman string with EOS. */
+	NULL
+};
+
+static size_t
+unhex(const char *s, unsigned char *out)
+{
+	size_t		i;
+	unsigned int	b;
+
+	for (i = 0; s[i * 2] != '\0'; ++i) {
+		if (sscanf(&s[i * 2], "%2x", &b) != 1)
+			errx(1, "unhex: %s", s);
+		out[i] = b;
+	}
+
+	return (i);
+}
+
+static int
+test_field(void *arg, const char *name, size_t nname, const char *value,
+	   size_t nvalue)
+{
+	struct buf	*buf = arg;
+
+	if (strlen(name) != nname || strlen(value) != nvalue)
+		errx(1, "hpack_decode: field is not terminated");
+	if (buf_append(buf, (const unsigned char *)name, nname) != YHTTP_OK ||
+	    buf_append(buf, (const unsigned char *)": ", 2) != YHTTP_OK ||
+	    buf_append(buf, (const unsigned char *)value, nvalue) != YHTTP_OK ||
+	    buf_append(buf, (const unsigned char *)"\n", 1) != YHTTP_OK)
+		errx(1, "buf_append");
+
+	return (YHTTP_OK);
+}
+
+/*
+ * Decode the blocks of tests in order, using the same table.
+ */
+static void
+test_decode(const struct hpack_test *tests, int huffman)
+{
+	struct hpack	 hp;
+	struct buf	 out;
+	unsigned char	 block[64];
+	size_t		 i, n;
+
+	hpack_init(&hp, 4096);
+	for (i = 0; tests[i].block != NULL; ++i) {
+		buf_init(&out);
+		n = unhex(tests[i].block, block);
+		if (hpack_decode(&hp, block, n, test_field, &out) != YHTTP_OK)
+			errx(1, "hpack_decode: %d: %zu: failed", huffman, i);
+		if (out.used != strlen(tests[i].fields) ||
+		    memcmp(out.buf, tests[i].fields, out.used) != 0)
+			errx(1, "hpack_decode: %d: %zu: have %.*s, want %s",
+			     huffman, i, (int)out.used, out.buf,
+			     tests[i].fields);
+		if (hp.size != tests[i].size)
+			errx(1, "hpack_decode: %d: %zu: have size %zu, want %zu",
+			     huffman, i, hp.size, tests[i].size);
+		buf_wipe(&out);
+	}
+
+	/* Shrinking the table evicts the oldest entries. */
+	n = unhex("3f5a", block);
+	if (hpack_decode(&hp, block, n, test_field, NULL) != YHTTP_OK)
+		errx(1, "hpack_decode: size update failed");
+	if (hp.max != 121 || hp.nentries != 2 || hp.size != 107)
+		errx(1, "hpack_decode: have max %zu, nentries %zu, size %zu, "
+		     "want 121, 2, 107", hp.max, hp.nentries, hp.size);
+	if (strcmp(hp.entries[0].name, "cache-control") != 0)
+		errx(1, "hpack_decode: have %s, want cache-control",
+		     hp.entries[0].name);
+
+	hpack_free(&hp);
+}
+
+/*
+ * Index a name of the dynamic table with incremental indexing, while the
+ * table is too full to keep the entry that the name is being taken from.
+ */
+static void
+test_evict(void)
+{
+	struct hpack	 hp;
+	struct buf	 out;
+	unsigned char	 block[64];
+	const char	*want;
+	size_t		 n;
+
+	hpack_init(&hp, 64);
+	buf_init(&out);
+	n = unhex("400a637573746f6d2d6b65790c637573746f6d2d76616c7565"
+		  "7e0178", block);
+	if (hpack_decode(&hp, block, n, test_field, &out) != YHTTP_OK)
+		errx(1, "hpack_decode: evict failed");
+	want = "custom-key: custom-value\ncustom-key: x\n";
+	if (out.used != strlen(want) || memcmp(out.buf, want, out.used) != 0)
+		errx(1, "hpack_decode: have %.*s, want %s", (int)out.used,
+		     out.buf, want);
+	if (hp.nentries != 1 || hp.size != 43)
+		errx(1, "hpack_decode: have nentries %zu, size %zu, want 1, 43",
+		     hp.nentries, hp.size);
+	if (strcmp(hp.entries[0].name, "custom-key") != 0 ||
+	    strcmp(hp.entries[0].value, "x") != 0)
+		errx(1, "hpack_decode: have %s: %s, want custom-key: x",
+		     hp.entries[0].name, hp.entries[0].value);
+
+	buf_wipe(&out);
+	hpack_free(&hp);
+}
+
+static void
+test_errors(void)
+{
+	struct hpack	 hp;
+	struct buf	 out;
+	unsigned char	 block[64];
+	size_t		 i, n;
+	int		 rc;
+
+	for (i = 0; invalid[i] != NULL; ++i) {
+		hpack_init(&hp, 4096);
+		buf_init(&out);
+		n = unhex(invalid[i], block);
+		if ((rc = hpack_decode(&hp, block, n, test_field, &out)) !=
+		    YHTTP_EINVAL)
+			errx(1, "hpack_decode: %s: have %d, want YHTTP_EINVAL",
+			     invalid[i], rc);
+		buf_wipe(&out);
+		hpack_free(&hp);
+	}
+}
+
+static void
+test_encode(void)
+{
+	struct hpack	 hp;
+	struct buf	 block, out;
+	const char	*want;
+
+	buf_init(&block);
+	if (hpack_encode_status(&block, 200) != YHTTP_OK ||
+	    hpack_encode_status(&block, 201) != YHTTP_OK ||
+	    hpack_encode(&block, "Content-Type", "text/plain") != YHTTP_OK)
+		errx(1, "hpack_encode");
+	if (block.used < 1 || block.buf[0] != 0x88)
+		errx(1, "hpack_encode_status: 200 is not indexed");
+
+	hpack_init(&hp, 4096);
+	buf_init(&out);
+	if (hpack_decode(&hp, block.buf, block.used, test_field, &out) !=
+	    YHTTP_OK)
+		errx(1, "hpack_decode: encoded block failed");
+	want = ":status: 200\n:status: 201\ncontent-type: text/plain\n";
+	if (out.used != strlen(want) || memcmp(out.buf, want, out.used) != 0)
+		errx(1, "hpack_encode: have %.*s, want %s", (int)out.used,
+		     out.buf, want);
+	if (hp.nentries != 0)
+		errx(1, "hpack_encode: have %zu entries, want 0",
+		     hp.nentries);
+
+	buf_wipe(&block);
+	buf_wipe(&out);
+	hpack_free(&hp);
+}
+
+int
+main(int argc, char *argv[])
+{
+	test_decode(plain, 0);
+	test_decode(huff, 1);
+	test_evict();
+	test_errors();
+	test_encode();
+
+	return (0);
+}
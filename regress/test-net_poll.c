@@ -24,6 +24,7 @@
 static void	test_net_poll_init(void);
 static void	test_net_poll_free(void);
 static void	test_net_poll_grow(void);
+static void	test_net_poll_wait(void);
 static void	test_net_poll_add(void);
 static void	test_net_poll_grow(void);
 
@@ -34,8 +35,8 @@ test_net_poll_init(void)
 
 	net_poll_init(&pd);
 
-	if (pd.parsers != NULL)
-		errx(1, "net_poll_init: have pd.parsers not NULL, want NULL");
+	if (pd.conns != NULL)
+		errx(1, "net_poll_init: have pd.conns not NULL, want NULL");
 	if (pd.pfds != NULL)
 		errx(1, "net_poll_init: have pd.pfds not NULL, want NULL");
 	if (pd.npfds != 0)
@@ -68,8 +69,8 @@ test_net_poll_grow(void)
 	if (pd.used != 0)
 		errx(1, "net_poll_grow: have pd.used %zu, want 0", pd.used);
 	for (i = 0; i < pd.npfds; ++i) {
-		if (pd.parsers[i] != NULL)
-			errx(1, "net_poll_grow: have pd.parsers[%zu] not NULL, want NULL", i);
+		if (pd.conns[i] != NULL)
+			errx(1, "net_poll_grow: have pd.conns[%zu] not NULL, want NULL", i);
 		if (pd.pfds[i].fd != -1)
 			errx(1, "net_poll_grow: have pd.pfds[%zu].fd not -1, want -1", i);
 		if (pd.pfds[i].events != 0)
@@ -79,6 +80,7 @@ test_net_poll_grow(void)
 
 		/* For the next test. */
 		pd.pfds[i].fd = 0;
+		pd.conns[i] = (struct conn *)&pd;
 	}
 	pd.used = NGROW;
 
@@ -93,8 +95,8 @@ test_net_poll_grow(void)
 			errx(1, "net_poll_grow: have pd.pfds[%zu].fd not 0, want 0", i);
 	}
 	for (i = NGROW; i < pd.npfds; ++i) {
-		if (pd.parsers[i] != NULL)
-			errx(1, "net_poll_grow: have pd.parsers[%zu] not NULL, want NULL", i);
+		if (pd.conns[i] != NULL)
+			errx(1, "net_poll_grow: have pd.conns[%zu] not NULL, want NULL", i);
 		if (pd.pfds[i].fd != -1)
 			errx(1, "net_poll_grow: have pd.pfds[%zu].fd not -1, want -1", i);
 		if (pd.pfds[i].events != 0)
@@ -103,6 +105,9 @@ test_net_poll_grow(void)
 			errx(1, "net_poll_grow: have pd.pfds[%zu].revents %hd, want 0", i, pd.pfds[i].revents);
 	}
 
+	/* The connections above are not real. */
+	for (i = 0; i < NGROW; ++i)
+		pd.conns[i] = NULL;
 	net_poll_free(&pd);
 }
 
@@ -116,7 +121,7 @@ test_net_poll_add(void)
 	net_poll_init(&pd);
 
 	/* Test in combination with net_poll_grow(). */
-	if ((rc = net_poll_add(&pd, 1, POLLIN)) != YHTTP_OK)
+	if ((rc = net_poll_add(&pd, 1, POLLIN, NULL)) != YHTTP_OK)
 		errx(1, "net_poll_add: have %d, want YHTTP_OK", rc);
 
 	if (pd.pfds == NULL)
@@ -126,8 +131,11 @@ test_net_poll_add(void)
 	if (pd.used != 1)
 		errx(1, "net_poll_add: have pd.used %zu, want 1", pd.used);
 
-	if (pd.parsers[0]->state != PARSER_RLINE)
-		errx(1, "net_poll_add: have pd.parsers[0]->state %d, want PARSER_RLINE", pd.parsers[0]->state);
+	/* The parser is only created once a request arrives. */
+	if (pd.conns[0]->parser != NULL)
+		errx(1, "net_poll_add: have pd.conns[0]->parser, want NULL");
+	if (pd.conns[0]->fd != 1)
+		errx(1, "net_poll_add: have pd.conns[0]->fd %d, want 1", pd.conns[0]->fd);
 	if (pd.pfds[0].fd != 1)
 		errx(1, "net_poll_add: have pd.pfds[0].fd %d, want 1", pd.pfds[0].fd);
 	if (pd.pfds[0].events != POLLIN)
@@ -136,17 +144,21 @@ test_net_poll_add(void)
 		errx(1, "net_poll_add: have pd.pfds[0].revents %d, want 0", pd.pfds[0].revents);
 
 	/* Test the search for a free slot. */
-	for (i = 1; i < pd.npfds; ++i)
-		pd.pfds[i].fd = 5;
-	pd.pfds[55].fd = -1;
+	for (i = 1; i < pd.npfds; ++i) {
+		if ((rc = net_poll_add(&pd, 5, POLLIN, NULL)) != YHTTP_OK)
+			errx(1, "net_poll_add: have %d, want YHTTP_OK", rc);
+	}
+	net_poll_del(&pd, 55);
 
-	if ((rc = net_poll_add(&pd, 55, POLLOUT)) != YHTTP_OK)
+	if ((rc = net_poll_add(&pd, 55, POLLOUT, NULL)) != YHTTP_OK)
 		errx(1, "net_poll_add: have %d, want YHTTP_OK", rc);
 
 	if (pd.pfds[55].fd != 55)
 		errx(1, "net_poll_add: have pd.pfds[55].fd %d, want 55", pd.pfds[55].fd);
 	if (pd.pfds[55].events != POLLOUT)
 		errx(1, "net_poll_add: have pd.pfds[55].events %hd, want POLLOUT", pd.pfds[55].events);
+	if (pd.conns[55]->index != 55)
+		errx(1, "net_poll_add: have pd.conns[55]->index %zu, want 55", pd.conns[55]->index);
 
 	net_poll_free(&pd);
 }
@@ -155,19 +167,20 @@ static void
 test_net_poll_del(void)
 {
 	struct poll_data	pd;
+	struct sockaddr_storage	addr;
 	size_t			i;
 	int			rc;
 
 	net_poll_init(&pd);
 
 	for (i = 0; i < NGROW + 1; ++i) {
-		if ((rc = net_poll_add(&pd, i, POLLIN)) != YHTTP_OK)
+		if ((rc = net_poll_add(&pd, i, POLLIN, NULL)) != YHTTP_OK)
 			errx(1, "net_poll_del: net_poll_add %d", rc);
 	}
 
 	net_poll_del(&pd, 55);
-	if (pd.parsers[55] != NULL)
-		errx(1, "net_poll_del: pd.parsers[55] is not NULL, want NULL");
+	if (pd.conns[55] != NULL)
+		errx(1, "net_poll_del: pd.conns[55] is not NULL, want NULL");
 	if (pd.pfds[55].fd != -1)
 		errx(1, "net_poll_del: pd.pfds[55].fd is not -1");
 	if (pd.pfds[55].events != 0)
@@ -175,7 +188,107 @@ test_net_poll_del(void)
 	if (pd.pfds[55].revents != 0)
 		errx(1, "net_poll_del: pd.pfds[55].revents is not 0");
 
+	/* Only connections with an address are clients. */
+	memset(&addr, 0, sizeof(addr));
+	addr.ss_family = AF_INET;
+	if ((rc = net_poll_add(&pd, 55, POLLIN, &addr)) != YHTTP_OK)
+		errx(1, "net_poll_del: net_poll_add %d", rc);
+	if (pd.nclients != 1)
+		errx(1, "net_poll_del: have pd.nclients %zu, want 1", pd.nclients);
+	net_poll_del(&pd, 55);
+	net_poll_del(&pd, 56);
+	if (pd.nclients != 0)
+		errx(1, "net_poll_del: have pd.nclients %zu, want 0", pd.nclients);
+
+	net_poll_free(&pd);
+}
+
+static void
+test_net_poll_compact(void)
+{
+	struct poll_data	pd;
+	size_t			i;
+	int			rc;
+
+	net_poll_init(&pd);
+
+	for (i = 0; i < NGROW * 4; ++i) {
+		if ((rc = net_poll_add(&pd, i, POLLIN, NULL)) != YHTTP_OK)
+			errx(1, "net_poll_compact: net_poll_add %d", rc);
+	}
+	if (pd.npfds != NGROW * 4)
+		errx(1, "net_poll_compact: have pd.npfds %zu, want %d", pd.npfds, NGROW * 4);
+
+	/* Nothing to compact yet. */
+	if ((rc = net_poll_compact(&pd)) != YHTTP_OK)
+		errx(1, "net_poll_compact: have %d, want YHTTP_OK", rc);
+	if (pd.npfds != NGROW * 4)
+		errx(1, "net_poll_compact: have pd.npfds %zu, want %d", pd.npfds, NGROW * 4);
+
+	/* Keep the first and the last connection only. */
+	for (i = 1; i < NGROW * 4 - 1; ++i)
+		net_poll_del(&pd, i);
+
+	if ((rc = net_poll_compact(&pd)) != YHTTP_OK)
+		errx(1, "net_poll_compact: have %d, want YHTTP_OK", rc);
+	if (pd.npfds != NGROW)
+		errx(1, "net_poll_compact: have pd.npfds %zu, want %d", pd.npfds, NGROW);
+	if (pd.used != 2)
+		errx(1, "net_poll_compact: have pd.used %zu, want 2", pd.used);
+	if (pd.nfree != NGROW - 2)
+		errx(1, "net_poll_compact: have pd.nfree %zu, want %d", pd.nfree, NGROW - 2);
+	if (pd.conns[0]->fd != 0 || pd.pfds[0].fd != 0)
+		errx(1, "net_poll_compact: slot 0 has been moved");
+	if (pd.conns[1]->fd != NGROW * 4 - 1 || pd.pfds[1].fd != NGROW * 4 - 1)
+		errx(1, "net_poll_compact: slot %d has not been moved to 1", NGROW * 4 - 1);
+	if (pd.conns[1]->index != 1)
+		errx(1, "net_poll_compact: have pd.conns[1]->index %zu, want 1", pd.conns[1]->index);
+
+	/* The lowest free slot is being used next. */
+	if ((rc = net_poll_add(&pd, 7, POLLIN, NULL)) != YHTTP_OK)
+		errx(1, "net_poll_compact: net_poll_add %d", rc);
+	if (pd.conns[2] == NULL || pd.conns[2]->fd != 7)
+		errx(1, "net_poll_compact: slot 2 is not being used");
+
+	net_poll_free(&pd);
+}
+
+static void
+test_net_poll_wait(void)
+{
+	struct poll_data	pd;
+	int			fds[2], rc;
+
+	if (pipe(fds) == -1)
+		err(1, "net_poll_wait: pipe");
+
+	net_poll_init(&pd);
+	if ((rc = net_poll_add(&pd, fds[0], POLLIN, NULL)) != YHTTP_OK)
+		errx(1, "net_poll_wait: net_poll_add %d", rc);
+	if ((rc = net_poll_open(&pd)) != YHTTP_OK)
+		errx(1, "net_poll_wait: net_poll_open %d", rc);
+
+	/* Nothing is pending yet. */
+	if ((rc = net_poll_wait(&pd, 0)) != YHTTP_OK)
+		errx(1, "net_poll_wait: have %d, want YHTTP_OK", rc);
+	if (pd.nready != 0)
+		errx(1, "net_poll_wait: have pd.nready %zu, want 0", pd.nready);
+
+	if (write(fds[1], "x", 1) != 1)
+		err(1, "net_poll_wait: write");
+
+	if ((rc = net_poll_wait(&pd, INFTIM)) != YHTTP_OK)
+		errx(1, "net_poll_wait: have %d, want YHTTP_OK", rc);
+	if (pd.nready != 1)
+		errx(1, "net_poll_wait: have pd.nready %zu, want 1", pd.nready);
+	if (pd.ready[0] != 0)
+		errx(1, "net_poll_wait: have pd.ready[0] %zu, want 0", pd.ready[0]);
+	if (!(pd.pfds[0].revents & POLLIN))
+		errx(1, "net_poll_wait: have pd.pfds[0].revents %hd, want POLLIN", pd.pfds[0].revents);
+
 	net_poll_free(&pd);
+	close(fds[0]);
+	close(fds[1]);
 }
 
 int
@@ -186,6 +299,8 @@ main(int argc, char *argv[])
 	test_net_poll_grow();
 	test_net_poll_add();
 	test_net_poll_del();
+	test_net_poll_compact();
+	test_net_poll_wait();
 
 	return (0);
 }
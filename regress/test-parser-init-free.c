@@ -21,6 +21,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "../arena.h"
 #include "../buf.h"
 #include "../parser.h"
 #include "../yhttp.h"
@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) 2022 Emil Engler <engler+yhttp@unveil2.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../parser.c"
+
+static struct parser	*parse(const char *, int);
+static void		 test_chunk(struct yhttp_requ *,
+				    const unsigned char *, size_t, void *);
+
+static char	streamed[32];
+static size_t	nstreamed;
+
+/*
+ * Parse s either at once or byte by byte, until the request is done.
+ */
+static struct parser *
+parse(const char *s, int bytewise)
+{
+	struct parser	*parser;
+	size_t		 i, len;
+	int		 rc;
+
+	if ((parser = parser_init()) == NULL)
+		errx(1, "parser_chunked: parser_init");
+
+	len = strlen(s);
+	if (bytewise) {
+		for (i = 0; i < len && parser->state != PARSER_DONE; ++i) {
+			rc = parser_parse(parser, (const unsigned char *)s + i,
+					  1);
+			if (rc != YHTTP_OK)
+				errx(1, "parser_chunked: parser_parse");
+		}
+	} else {
+		rc = parser_parse(parser, (const unsigned char *)s, len);
+		if (rc != YHTTP_OK)
+			errx(1, "parser_chunked: parser_parse");
+	}
+
+	return (parser);
+}
+
+static void
+test_chunk(struct yhttp_requ *requ, const unsigned char *data, size_t ndata,
+	   void *udata)
+{
+	if (nstreamed + ndata > sizeof(streamed))
+		errx(1, "parser_chunked: body too long");
+	memcpy(streamed + nstreamed, data, ndata);
+	nstreamed += ndata;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct parser	*parser;
+	const char	*s, *value;
+	int		 bytewise, rc;
+
+	/* A body with a chunk extension, a trailer and a pipelined request. */
+	s = "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+	    "5;name=value\r\nhello\r\n"
+	    "6\nworld!\n"
+	    "0\r\nX-Trailer: yes\r\n\r\n"
+	    "GET / HTTP/1.1\r\n\r\n";
+	for (bytewise = 0; bytewise <= 1; ++bytewise) {
+		parser = parse(s, bytewise);
+		if (parser->err != 0)
+			errx(1, "parser_chunked: have err %d, want 0",
+			     parser->err);
+		if (parser->state != PARSER_DONE)
+			errx(1, "parser_chunked: have state %d, want DONE",
+			     parser->state);
+		if (parser->requ->nbody != 11 ||
+		    memcmp(parser->requ->body, "helloworld!", 11) != 0)
+			errx(1, "parser_chunked: wrong body");
+		value = yhttp_header(parser->requ, "X-Trailer");
+		if (value == NULL || strcmp(value, "yes") != 0)
+			errx(1, "parser_chunked: trailer missing");
+
+		if (parser_reset(parser) != YHTTP_OK)
+			errx(1, "parser_chunked: parser_reset");
+		if (!bytewise && (parser->state != PARSER_DONE ||
+		    parser->requ->method != YHTTP_GET))
+			errx(1, "parser_chunked: pipelined request missing");
+		parser_free(parser);
+	}
+
+	/* The decoded body is being streamed. */
+	if ((parser = parser_init()) == NULL)
+		errx(1, "parser_chunked: parser_init");
+	parser->chunk = test_chunk;
+	s = "POST / HTTP/1.1\r\nTransfer-Encoding: Chunked\r\n\r\n3\r\nabc";
+	rc = parser_parse(parser, (const unsigned char *)s, strlen(s));
+	if (rc != YHTTP_OK || parser->state != PARSER_CHUNKED)
+		errx(1, "parser_chunked: stream did not start");
+	if (parser->buf.used != 0)
+		errx(1, "parser_chunked: have %zu buffered bytes, want 0",
+		     parser->buf.used);
+	s = "\r\nA\r\n0123456789\r\n0\r\n\r\n";
+	rc = parser_parse(parser, (const unsigned char *)s, strlen(s));
+	if (rc != YHTTP_OK || parser->state != PARSER_DONE)
+		errx(1, "parser_chunked: stream did not end");
+	if (nstreamed != 13 || memcmp(streamed, "abc0123456789", 13) != 0)
+		errx(1, "parser_chunked: wrong streamed body");
+	parser_free(parser);
+
+	/* Malformed chunk sizes and missing line breaks. */
+	s = "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n";
+	parser = parse(s, 0);
+	if (parser->err != 400)
+		errx(1, "parser_chunked: have err %d, want 400", parser->err);
+	parser_free(parser);
+
+	s = "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+	    "fffffffffffffffffffffffff\r\n";
+	parser = parse(s, 0);
+	if (parser->err != 400)
+		errx(1, "parser_chunked: have err %d, want 400", parser->err);
+	parser_free(parser);
+
+	s = "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+	    "2\r\nabc\r\n";
+	parser = parse(s, 0);
+	if (parser->err != 400)
+		errx(1, "parser_chunked: have err %d, want 400", parser->err);
+	parser_free(parser);
+
+	/* Other transfer codings are not implemented. */
+	s = "POST / HTTP/1.1\r\nTransfer-Encoding: gzip, chunked\r\n\r\n";
+	parser = parse(s, 0);
+	if (parser->err != 501)
+		errx(1, "parser_chunked: have err %d, want 501", parser->err);
+	parser_free(parser);
+
+	/* A Transfer-Encoding must not come with a Content-Length. */
+	s = "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n"
+	    "Content-Length: 3\r\n\r\n";
+	parser = parse(s, 0);
+	if (parser->err != 400)
+		errx(1, "parser_chunked: have err %d, want 400", parser->err);
+	parser_free(parser);
+
+	return (0);
+}
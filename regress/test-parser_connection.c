@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2022 Emil Engler <engler+yhttp@unveil2.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../parser.c"
+
+struct connection_test {
+	const char	*requ;
+	int		 keep_alive;
+};
+
+static const struct connection_test	tests[] = {
+	{ "GET / HTTP/1.1\r\n\r\n", 1 },
+	{ "GET / HTTP/1.0\r\n\r\n", 0 },
+	{ "GET / HTTP/1.1\r\nConnection: close\r\n\r\n", 0 },
+	{ "GET / HTTP/1.1\r\nConnection: Close\r\n\r\n", 0 },
+	{ "GET / HTTP/1.1\r\nConnection: TE, close\r\n\r\n", 0 },
+	{ "GET / HTTP/1.1\r\nConnection: closed\r\n\r\n", 1 },
+	{ "GET / HTTP/1.1\r\nConnection: keep-alive\r\n\r\n", 1 },
+	{ "GET / HTTP/1.0\r\nConnection: Keep-Alive\r\n\r\n", 1 },
+	{ "GET / HTTP/1.0\r\nConnection: foo ,, keep-alive\r\n\r\n", 1 },
+	{ "GET / HTTP/1.0\r\nConnection: keep-alive, close\r\n\r\n", 0 },
+	{ NULL, 0 }
+};
+
+int
+main(int argc, char *argv[])
+{
+	struct parser	*parser;
+	const char	*s;
+	size_t		 i;
+
+	for (i = 0; tests[i].requ != NULL; ++i) {
+		if ((parser = parser_init()) == NULL)
+			errx(1, "parser_connection: parser_init");
+		if (parser_parse(parser, (const unsigned char *)tests[i].requ,
+				 strlen(tests[i].requ)) != YHTTP_OK)
+			errx(1, "parser_connection: parser_parse");
+		if (parser->state != PARSER_DONE)
+			errx(1, "parser_connection: %zu: have state %d, want "
+			     "PARSER_DONE", i, parser->state);
+		if (parser->keep_alive != tests[i].keep_alive)
+			errx(1, "parser_connection: %zu: have keep_alive %d, "
+			     "want %d", i, parser->keep_alive,
+			     tests[i].keep_alive);
+		parser_free(parser);
+	}
+
+	/* Only HTTP/1.x is supported. */
+	if ((parser = parser_init()) == NULL)
+		errx(1, "parser_connection: parser_init");
+	s = "GET / HTTP/2.0\r\n\r\n";
+	if (parser_parse(parser, (const unsigned char *)s, strlen(s)) !=
+	    YHTTP_OK)
+		errx(1, "parser_connection: parser_parse");
+	if (parser->err != 505)
+		errx(1, "parser_connection: have err %d, want 505",
+		     parser->err);
+	parser_free(parser);
+
+	return (0);
+}
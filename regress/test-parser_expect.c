@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2022 Emil Engler <engler+yhttp@unveil2.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../parser.c"
+
+struct expect_test {
+	const char	*requ;
+	int		 cont;
+	int		 err;
+};
+
+static int	test_expect(struct yhttp_requ *, void *);
+
+static const struct expect_test	tests[] = {
+	{ "POST / HTTP/1.1\r\nContent-Length: 3\r\n\r\n", 0, 0 },
+	{ "POST / HTTP/1.1\r\nExpect: 100-continue\r\n"
+	  "Content-Length: 3\r\n\r\n", 1, 0 },
+	{ "POST / HTTP/1.1\r\nExpect: 100-Continue\r\n"
+	  "Transfer-Encoding: chunked\r\n\r\n", 1, 0 },
+	{ "GET / HTTP/1.1\r\nExpect: 100-continue\r\n\r\n", 0, 0 },
+	{ "POST / HTTP/1.0\r\nExpect: 100-continue\r\n"
+	  "Content-Length: 3\r\n\r\n", 0, 0 },
+	{ "POST / HTTP/1.1\r\nExpect: 200-ok\r\n"
+	  "Content-Length: 3\r\n\r\n", 0, 417 },
+	{ "POST /large HTTP/1.1\r\nExpect: 100-continue\r\n"
+	  "Content-Length: 3\r\n\r\n", 0, 413 },
+	{ "POST /ok HTTP/1.1\r\nExpect: 100-continue\r\n"
+	  "Content-Length: 3\r\n\r\n", 0, 417 },
+	{ "POST /none HTTP/1.1\r\nExpect: 100-continue\r\n"
+	  "Content-Length: 3\r\n\r\n", 0, 417 },
+	{ "POST /bogus HTTP/1.1\r\nExpect: 100-continue\r\n"
+	  "Content-Length: 3\r\n\r\n", 0, 417 },
+	{ "POST /busy HTTP/1.1\r\nExpect: 100-continue\r\n"
+	  "Content-Length: 3\r\n\r\n", 0, 503 },
+	{ NULL, 0, 0 }
+};
+
+/*
+ * Reject anything that is being sent to /large or /busy, and answer with
+ * statuses that cannot reject a request for the other paths.
+ */
+static int
+test_expect(struct yhttp_requ *requ, void *udata)
+{
+	if (strcmp(requ->path, "/large") == 0)
+		return (413);
+	if (strcmp(requ->path, "/busy") == 0)
+		return (503);
+	if (strcmp(requ->path, "/ok") == 0)
+		return (200);
+	if (strcmp(requ->path, "/none") == 0)
+		return (0);
+	if (strcmp(requ->path, "/bogus") == 0)
+		return (999);
+
+	return (100);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct parser	*parser;
+	size_t		 i;
+
+	for (i = 0; tests[i].requ != NULL; ++i) {
+		if ((parser = parser_init()) == NULL)
+			errx(1, "parser_expect: parser_init");
+		parser->expect = test_expect;
+		if (parser_parse(parser, (const unsigned char *)tests[i].requ,
+				 strlen(tests[i].requ)) != YHTTP_OK)
+			errx(1, "parser_expect: parser_parse");
+		if (parser->cont != tests[i].cont)
+			errx(1, "parser_expect: %zu: have cont %d, want %d", i,
+			     parser->cont, tests[i].cont);
+		if (parser->err != tests[i].err)
+			errx(1, "parser_expect: %zu: have err %d, want %d", i,
+			     parser->err, tests[i].err);
+		parser_free(parser);
+	}
+
+	return (0);
+}
@@ -41,13 +41,15 @@ static const struct test	tests[] = {
 int
 main(int argc, char *argv[])
 {
+	struct arena		  arena;
 	struct hash		**ht, *node;
 	const struct test	 *t;
 	struct parser		 *parser;
 	int			  rc;
 
 	for (t = tests; t->input != NULL; ++t) {
-		if ((ht = hash_init()) == NULL)
+		arena_init(&arena);
+		if ((ht = hash_init(&arena)) == NULL)
 			errx(1, "parser_keyvalue: hash_init");
 		if ((parser = parser_init()) == NULL)
 			errx(1, "parser_keyvalue: parser_init");
@@ -68,7 +70,7 @@ main(int argc, char *argv[])
 				errx(1, "parser_keyvalue: have node->value %s, want %s", node->value, t->value);
 		}
 
-		hash_free(ht);
+		arena_free(&arena);
 		parser_free(parser);
 	}
 
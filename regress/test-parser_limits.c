@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2022 Emil Engler <engler+yhttp@unveil2.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../parser.c"
+
+struct limits_test {
+	const char	*requ;
+	int		 err;
+};
+
+/*
+ * The requests are being parsed with a request line of 24 bytes at most,
+ * 32 bytes of header fields, 2 header fields and a body of 4 bytes.
+ */
+static const struct limits_test	tests[] = {
+	{ "GET /0123456789 HTTP/1.1\r\n\r\n", 0 },
+	{ "GET /01234567890 HTTP/1.1\r\n\r\n", 414 },
+	{ "GET /0123456789abcdefghijklmnop", 414 },
+	{ "GET / HTTP/1.1\r\nA: 1\r\nB: 2\r\n\r\n", 0 },
+	{ "GET / HTTP/1.1\r\nA: 1\r\nB: 2\r\nC: 3\r\n\r\n", 431 },
+	{ "GET / HTTP/1.1\r\nA: 012345678901234567890123456\r\n\r\n", 0 },
+	{ "GET / HTTP/1.1\r\nA: 0123456789012345678901234567\r\n\r\n", 431 },
+	{ "GET / HTTP/1.1\r\nA: 0123456789012345678901234567890123", 431 },
+	{ "POST / HTTP/1.1\r\nContent-Length: 4\r\n\r\nabcd", 0 },
+	{ "POST / HTTP/1.1\r\nContent-Length: 5\r\n\r\n", 413 },
+	{ "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+	  "2\r\nab\r\n2\r\ncd\r\n0\r\n\r\n", 0 },
+	{ "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+	  "2\r\nab\r\n3\r\n", 413 },
+	{ "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+	  "0\r\nA: 1\r\nB: 2\r\nC: 3\r\n\r\n", 431 },
+	{ "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+	  "1;0123456789012345678901234567890123", 400 },
+	{ NULL, 0 }
+};
+
+int
+main(int argc, char *argv[])
+{
+	struct parser	*parser;
+	size_t		 i;
+
+	for (i = 0; tests[i].requ != NULL; ++i) {
+		if ((parser = parser_init()) == NULL)
+			errx(1, "parser_limits: parser_init");
+		parser->limits.nrline = 24;
+		parser->limits.nheader = 32;
+		parser->limits.nfields = 2;
+		parser->limits.nbody = 4;
+		if (parser_parse(parser, (const unsigned char *)tests[i].requ,
+				 strlen(tests[i].requ)) != YHTTP_OK)
+			errx(1, "parser_limits: parser_parse");
+		if (parser->err != tests[i].err)
+			errx(1, "parser_limits: %zu: have err %d, want %d", i,
+			     parser->err, tests[i].err);
+		if (tests[i].err == 0 && parser->state != PARSER_DONE)
+			errx(1, "parser_limits: %zu: have state %d, want "
+			     "PARSER_DONE", i, parser->state);
+		parser_free(parser);
+	}
+
+	return (0);
+}
@@ -35,6 +35,7 @@ static const char	*malformatted_tests[] = {
 int
 main(int argc, char *argv[])
 {
+	struct arena	  arena;
 	struct hash	**ht, *node;
 	struct parser	 *parser;
 	const char	 *query;
@@ -43,7 +44,8 @@ main(int argc, char *argv[])
 
 	/* Test the malformatted inputs. */
 	for (i = 0; malformatted_tests[i] != NULL; ++i) {
-		if ((ht = hash_init()) == NULL)
+		arena_init(&arena);
+		if ((ht = hash_init(&arena)) == NULL)
 			errx(1, "parser_query: hash_init");
 		if ((parser = parser_init()) == NULL)
 			errx(1, "parser_query: parser_init");
@@ -55,11 +57,12 @@ main(int argc, char *argv[])
 			errx(1, "parser_query: want err");
 
 		parser_free(parser);
-		hash_free(ht);
+		arena_free(&arena);
 	}
 
 	/* Test with normal input. */
-	if ((ht = hash_init()) == NULL)
+	arena_init(&arena);
+	if ((ht = hash_init(&arena)) == NULL)
 		errx(1, "parser_query: hash_init");
 	if ((parser = parser_init()) == NULL)
 		errx(1, "parser_query: parser_init");
@@ -92,7 +95,7 @@ main(int argc, char *argv[])
 		errx(1, "parser_query: have value %s, want empty string", node->value);
 
 	parser_free(parser);
-	hash_free(ht);
+	arena_free(&arena);
 
 	return (0);
 }
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2022 Emil Engler <engler+yhttp@unveil2.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../parser.c"
+
+static const char	*test = "POST /foo HTTP/1.1\r\n"
+				"Content-Length: 5\r\n"
+				"\r\n"
+				"helloGET /bar HTTP/1.1\r\n"
+				"\r\n"
+				"GET /baz HTTP/1.1\r\n";
+
+int
+main(int argc, char *argv[])
+{
+	struct yhttp_requ	*requ;
+	struct parser		*parser;
+	int			 rc;
+
+	if ((parser = parser_init()) == NULL)
+		errx(1, "parser_reset: parser_init");
+
+	/* The first request is complete, despite the bytes following it. */
+	rc = parser_parse(parser, (const unsigned char *)test, strlen(test));
+	if (rc != YHTTP_OK)
+		errx(1, "parser_reset: have %d, want YHTTP_OK", rc);
+	if (parser->state != PARSER_DONE)
+		errx(1, "parser_reset: have state %d, want PARSER_DONE", parser->state);
+	if (parser->requ->nbody != 5 || memcmp(parser->requ->body, "hello", 5) != 0)
+		errx(1, "parser_reset: wrong body");
+	if (yhttp_header(parser->requ, "Content-Length") == NULL)
+		errx(1, "parser_reset: Content-Length is missing");
+
+	/*
+	 * The second one is parsed from the remaining bytes, with the request
+	 * being built in the memory of the previous one.
+	 */
+	requ = parser->requ;
+	if ((rc = parser_reset(parser)) != YHTTP_OK)
+		errx(1, "parser_reset: have %d, want YHTTP_OK", rc);
+	if (parser->requ != requ)
+		errx(1, "parser_reset: request has not been reused");
+	if (parser->state != PARSER_DONE)
+		errx(1, "parser_reset: have state %d, want PARSER_DONE", parser->state);
+	if (strcmp(parser->requ->path, "/bar") != 0)
+		errx(1, "parser_reset: have path %s, want /bar", parser->requ->path);
+	if (parser->requ->method != YHTTP_GET || parser->requ->nbody != 0)
+		errx(1, "parser_reset: request has not been reset");
+	if (yhttp_header(parser->requ, "Content-Length") != NULL)
+		errx(1, "parser_reset: Content-Length has been kept");
+
+	/* The third one is still incomplete. */
+	if ((rc = parser_reset(parser)) != YHTTP_OK)
+		errx(1, "parser_reset: have %d, want YHTTP_OK", rc);
+	if (parser->state != PARSER_HEADERS)
+		errx(1, "parser_reset: have state %d, want PARSER_HEADERS", parser->state);
+	if (strcmp(parser->requ->path, "/baz") != 0)
+		errx(1, "parser_reset: have path %s, want /baz", parser->requ->path);
+
+	/* Without bytes beyond pos, the buffer is empty afterwards. */
+	parser->pos = parser->buf.used;
+	if ((rc = parser_reset(parser)) != YHTTP_OK)
+		errx(1, "parser_reset: have %d, want YHTTP_OK", rc);
+	if (parser->state != PARSER_RLINE || parser->buf.used != 0)
+		errx(1, "parser_reset: have state %d and used %zu, want PARSER_RLINE and 0",
+		     parser->state, parser->buf.used);
+
+	parser_free(parser);
+
+	return (0);
+}
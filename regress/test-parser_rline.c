@@ -31,6 +31,10 @@ static const char	*malformatted_tests[] = {
 	"UNKNOWN /foo HTTP/1.1\r\n",
 	"GET foo HTTP/1.1\r\n",
 	"GET  HTTP/1.1\r\n",
+	"GET /foo HTTP/1.x\r\n",
+	"GET /foo HTTP/1.10\r\n",
+	"GET /foo FOO/1.1\r\n",
+	"GET /foo HTTP/2.0\r\n",
 	NULL
 };
 
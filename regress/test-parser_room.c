@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2022 Emil Engler <engler+yhttp@unveil2.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../parser.c"
+
+static unsigned char	*room(struct parser *, size_t, size_t);
+static void		 put(struct parser *, const char *);
+static void		 test_chunk(struct yhttp_requ *, const unsigned char *,
+				    size_t, void *);
+
+static void
+test_chunk(struct yhttp_requ *requ, const unsigned char *data, size_t ndata,
+	   void *udata)
+{
+	*(size_t *)udata += ndata;
+}
+
+/*
+ * Get room for hint bytes from parser and check that it has at least want.
+ */
+static unsigned char *
+room(struct parser *parser, size_t hint, size_t want)
+{
+	unsigned char	*p;
+	size_t		 n;
+
+	if (parser_room(parser, hint, &p, &n) != YHTTP_OK)
+		errx(1, "parser_room");
+	if (n < want)
+		errx(1, "parser_room: have %zu, want at least %zu", n, want);
+	if (p != parser->buf.buf + parser->buf.used)
+		errx(1, "parser_room: room is not at the end of buf");
+
+	return (p);
+}
+
+/*
+ * Receive s into the room of parser, like net_recv() does.
+ */
+static void
+put(struct parser *parser, const char *s)
+{
+	unsigned char	*p;
+
+	p = room(parser, strlen(s), strlen(s));
+	memcpy(p, s, strlen(s));
+	if (parser_commit(parser, strlen(s)) != YHTTP_OK)
+		errx(1, "parser_commit");
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char	*bad[] = { "-1", "+5", "5x", "", "0x10",
+				   "18446744073709551616",
+				   "99999999999999999999999" };
+	struct parser	*parser;
+	unsigned char	*p;
+	size_t		 i, n, nstreamed;
+
+	if ((parser = parser_init()) == NULL)
+		errx(1, "parser_room: parser_init");
+
+	put(parser, "POST / HTTP/1.1\r\nContent-Length: 100000\r\n\r\nhello");
+	if (parser->state != PARSER_BODY)
+		errx(1, "parser_room: have state %d, want PARSER_BODY",
+		     parser->state);
+
+	/*
+	 * The room grows with the body that has arrived, instead of covering
+	 * all of it at once, and ends with the body.
+	 */
+	if ((p = room(parser, 16, 16)) != parser->buf.buf + 5)
+		errx(1, "parser_room: the room does not follow the body");
+	if (parser->buf.nbuf >= 100000)
+		errx(1, "parser_room: have nbuf %zu, want less than 100000",
+		     parser->buf.nbuf);
+	while (parser->state == PARSER_BODY) {
+		if (parser_room(parser, 16, &p, &n) != YHTTP_OK)
+			errx(1, "parser_room");
+		if (parser->buf.used + n > 100000 + 1)
+			errx(1, "parser_room: have room %zu past the body", n);
+		memset(p, 'x', n);
+		if (parser_commit(parser, n > 100000 - parser->buf.used ?
+				  100000 - parser->buf.used : n) != YHTTP_OK)
+			errx(1, "parser_commit");
+	}
+	if (parser->state != PARSER_DONE)
+		errx(1, "parser_room: have state %d, want PARSER_DONE",
+		     parser->state);
+	if (parser->requ->body != parser->buf.buf ||
+	    parser->requ->nbody != 100000 ||
+	    memcmp(parser->requ->body, "hellox", 6) != 0 ||
+	    parser->requ->body[100000 - 1] != 'x')
+		errx(1, "parser_room: wrong requ->body");
+
+	parser_free(parser);
+
+	/* A streamed body is not being made room for. */
+	if ((parser = parser_init()) == NULL)
+		errx(1, "parser_room: parser_init");
+	nstreamed = 0;
+	parser->chunk = test_chunk;
+	parser->udata = &nstreamed;
+	put(parser, "POST / HTTP/1.1\r\nContent-Length: 100000\r\n\r\nhello");
+	if (nstreamed != 5 || parser->buf.used != 0)
+		errx(1, "parser_room: have nstreamed %zu, buf.used %zu, "
+		     "want 5, 0", nstreamed, parser->buf.used);
+	room(parser, 16, 16);
+	if (parser->buf.nbuf >= 100000)
+		errx(1, "parser_room: have nbuf %zu, want less than 100000",
+		     parser->buf.nbuf);
+	put(parser, "world");
+	if (nstreamed != 10 || parser->buf.used != 0)
+		errx(1, "parser_room: have nstreamed %zu, want 10", nstreamed);
+	parser_free(parser);
+
+	/* A huge length does not get reserved up front. */
+	if ((parser = parser_init()) == NULL)
+		errx(1, "parser_room: parser_init");
+	parser->limits.nbody = 0;
+	put(parser, "POST / HTTP/1.1\r\n"
+	    "Content-Length: 18446744073709551615\r\n\r\n");
+	if (parser->state != PARSER_BODY || parser->err != 0)
+		errx(1, "parser_room: have state %d, err %d, "
+		     "want PARSER_BODY, 0", parser->state, parser->err);
+	room(parser, 16, 16);
+	if (parser->buf.nbuf >= 100000)
+		errx(1, "parser_room: have nbuf %zu, want less than 100000",
+		     parser->buf.nbuf);
+	parser_free(parser);
+
+	/* Anything but digits is not a length. */
+	for (i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i) {
+		if ((parser = parser_init()) == NULL)
+			errx(1, "parser_room: parser_init");
+		put(parser, "POST / HTTP/1.1\r\nContent-Length: ");
+		put(parser, bad[i]);
+		put(parser, "\r\n\r\n");
+		if (parser->err != 400)
+			errx(1, "parser_cl: \"%s\": have err %d, want 400",
+			     bad[i], parser->err);
+		parser_free(parser);
+	}
+
+	return (0);
+}
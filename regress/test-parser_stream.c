@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2022 Emil Engler <engler+yhttp@unveil2.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../parser.c"
+
+static void	test_head(struct yhttp_requ *, void *);
+static void	test_chunk(struct yhttp_requ *, const unsigned char *, size_t,
+			   void *);
+
+struct stream {
+	int	nhead;
+	char	body[32];
+	size_t	nbody;
+};
+
+static void
+test_head(struct yhttp_requ *requ, void *udata)
+{
+	struct stream	*st;
+
+	st = udata;
+	if (st->nbody != 0)
+		errx(1, "parser_stream: header after body");
+	++st->nhead;
+}
+
+static void
+test_chunk(struct yhttp_requ *requ, const unsigned char *data, size_t ndata,
+	   void *udata)
+{
+	struct stream	*st;
+
+	st = udata;
+	if (st->nhead != 1)
+		errx(1, "parser_stream: body before header");
+	if (st->nbody + ndata > sizeof(st->body))
+		errx(1, "parser_stream: body too long");
+	memcpy(st->body + st->nbody, data, ndata);
+	st->nbody += ndata;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct parser	*parser;
+	struct stream	 st;
+	const char	*s;
+	int		 rc;
+
+	memset(&st, 0, sizeof(st));
+	if ((parser = parser_init()) == NULL)
+		errx(1, "parser_stream: parser_init");
+	parser->head = test_head;
+	parser->chunk = test_chunk;
+	parser->udata = &st;
+
+	/* The start of the body arrives together with the header. */
+	s = "POST / HTTP/1.1\r\nContent-Length: 11\r\n\r\nhel";
+	rc = parser_parse(parser, (const unsigned char *)s, strlen(s));
+	if (rc != YHTTP_OK)
+		errx(1, "parser_stream: have %d, want YHTTP_OK", rc);
+	if (st.nhead != 1 || st.nbody != 3)
+		errx(1, "parser_stream: have nhead %d, nbody %zu", st.nhead,
+		     st.nbody);
+	if (parser->buf.used != 0)
+		errx(1, "parser_stream: have buf.used %zu, want 0",
+		     parser->buf.used);
+
+	/* The rest of it is not being buffered. */
+	s = "lo ";
+	if (parser_parse(parser, (const unsigned char *)s, strlen(s)) != YHTTP_OK)
+		errx(1, "parser_stream: parser_parse");
+	if (parser->buf.used != 0 || parser->state != PARSER_BODY)
+		errx(1, "parser_stream: body has been buffered");
+
+	/* Bytes beyond the body belong to the next request. */
+	s = "worldGET / HTTP/1.1\r\n\r\n";
+	if (parser_parse(parser, (const unsigned char *)s, strlen(s)) != YHTTP_OK)
+		errx(1, "parser_stream: parser_parse");
+	if (parser->state != PARSER_DONE)
+		errx(1, "parser_stream: have state %d, want PARSER_DONE",
+		     parser->state);
+	if (st.nbody != 11 || memcmp(st.body, "hello world", 11) != 0)
+		errx(1, "parser_stream: have body %.*s", (int)st.nbody, st.body);
+	if (parser->requ->body != NULL || parser->requ->nbody != 11)
+		errx(1, "parser_stream: wrong requ->body");
+
+	st.nbody = 0;
+	st.nhead = 0;
+	if ((rc = parser_reset(parser)) != YHTTP_OK)
+		errx(1, "parser_stream: parser_reset");
+	if (parser->state != PARSER_DONE || st.nhead != 1)
+		errx(1, "parser_stream: next request not parsed");
+
+	parser_free(parser);
+
+	return (0);
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2022 Emil Engler <engler+yhttp@unveil2.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../pool.h"
+#include "../yhttp.h"
+
+#define NJOBS	1000
+
+struct test_job {
+	struct pool_job	job;
+	int		done;
+};
+
+static void	test_job_fn(struct pool_job *);
+static void	test_pool_init_free(void);
+static void	test_pool_submit(void);
+
+static void
+test_job_fn(struct pool_job *job)
+{
+	((struct test_job *)job)->done = 1;
+}
+
+static void
+test_pool_init_free(void)
+{
+	struct pool	*pool;
+
+	if (pool_init(0) != NULL)
+		errx(1, "pool_init: have pool with 0 workers, want NULL");
+	if ((pool = pool_init(4)) == NULL)
+		errx(1, "pool_init");
+	pool_free(pool);
+	pool_free(NULL);
+}
+
+static void
+test_pool_submit(void)
+{
+	struct test_job	 jobs[NJOBS];
+	struct pool_cq	 cq;
+	struct pollfd	 pfd;
+	struct pool_job	*job;
+	struct pool	*pool;
+	size_t		 i, ndone;
+	int		 rc;
+
+	pool_cq_init(&cq);
+	if ((rc = pool_cq_open(&cq)) != YHTTP_OK)
+		errx(1, "pool_cq_open: have %d, want YHTTP_OK", rc);
+	if ((pool = pool_init(4)) == NULL)
+		errx(1, "pool_submit: pool_init");
+
+	/* An empty queue is not readable. */
+	if ((job = pool_cq_take(&cq)) != NULL)
+		errx(1, "pool_cq_take: have job, want NULL");
+
+	for (i = 0; i < NJOBS; ++i) {
+		jobs[i].job.fn = test_job_fn;
+		jobs[i].job.cq = &cq;
+		jobs[i].done = 0;
+		if ((rc = pool_submit(pool, &jobs[i].job)) != YHTTP_OK)
+			errx(1, "pool_submit: have %d, want YHTTP_OK", rc);
+	}
+
+	/* Collect all jobs through the completion queue. */
+	ndone = 0;
+	while (ndone != NJOBS) {
+		pfd.fd = cq.fd[0];
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, 5000) != 1)
+			errx(1, "pool_submit: completion queue is not readable");
+
+		for (job = pool_cq_take(&cq); job != NULL; job = job->next) {
+			if (!((struct test_job *)job)->done)
+				errx(1, "pool_submit: job has not been run");
+			++ndone;
+		}
+	}
+
+	pool_free(pool);
+	pool_cq_free(&cq);
+}
+
+int
+main(int argc, char *argv[])
+{
+	test_pool_init_free();
+	test_pool_submit();
+
+	return (0);
+}
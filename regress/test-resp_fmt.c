@@ -26,57 +26,230 @@
 static void	test_resp_fmt_rline(void);
 static void	test_resp_fmt_header(void);
 static void	test_resp_fmt_err(void);
+static void	test_resp_fmt(void);
+static void	test_resp_unavail(void);
+static void	test_resp_chunk(void);
+static void	test_resp_continue(void);
+static void	test_resp_switch(void);
+static void	test_resp_hint(void);
 
 static void
 test_resp_fmt_rline(void)
 {
-	char			*rline;
+	struct buf	buf;
 
-	if ((rline = resp_fmt_rline(200)) == NULL)
+	buf_init(&buf);
+	if (resp_fmt_rline(&buf, 200) != YHTTP_OK)
 		errx(1, "resp_fmt_rline");
-	if (strcmp(rline, "HTTP/1.1 200 OK\r\n") != 0)
-		errx(1, "resp_fmt_rline: have %s, want HTTP/1.1 200 OK\r\n", rline);
-	free(rline);
+	if (buf.used != 17 || memcmp(buf.buf, "HTTP/1.1 200 OK\r\n", 17) != 0)
+		errx(1, "resp_fmt_rline: have %.*s, want HTTP/1.1 200 OK\r\n", (int)buf.used, buf.buf);
+	buf_wipe(&buf);
 
-	if ((rline = resp_fmt_rline(1)) == NULL)
+	if (resp_fmt_rline(&buf, 1) != YHTTP_OK)
 		errx(1, "resp_fmt_rline");
-	if (strcmp(rline, "HTTP/1.1 1 NULL\r\n") != 0)
-		errx(1, "resp_fmt_rline: have %s, want HTTP/1.1 1 NULL\r\n", rline);
-	free(rline);
+	if (buf.used != 17 || memcmp(buf.buf, "HTTP/1.1 1 NULL\r\n", 17) != 0)
+		errx(1, "resp_fmt_rline: have %.*s, want HTTP/1.1 1 NULL\r\n", (int)buf.used, buf.buf);
+
+	/* It is being appended to what is in the buffer already. */
+	if (resp_fmt_rline(&buf, 200) != YHTTP_OK)
+		errx(1, "resp_fmt_rline");
+	if (buf.used != 34 || memcmp(buf.buf + 17, "HTTP/1.1 200 OK\r\n", 17) != 0)
+		errx(1, "resp_fmt_rline: have %.*s, want HTTP/1.1 200 OK\r\n", (int)buf.used, buf.buf);
+	buf_wipe(&buf);
 }
 
 static void
 test_resp_fmt_header(void)
 {
-	char		*header;
+	struct buf	 buf;
 	struct hash	 node;
 
 	node.name = (char *)"Foo";
 	node.value = (char *)"Bar";
 
-	if ((header = resp_fmt_header(&node)) == NULL)
+	buf_init(&buf);
+	if (resp_fmt_header(&buf, &node) != YHTTP_OK)
 		errx(1, "resp_fmt_header");
-	if (strcmp(header, "Foo: Bar\r\n") != 0)
-		errx(1, "resp_fmt_header: have %s, want Foo: Bar\r\n", header);
-	free(header);
+	if (buf.used != 10 || memcmp(buf.buf, "Foo: Bar\r\n", 10) != 0)
+		errx(1, "resp_fmt_header: have %.*s, want Foo: Bar\r\n", (int)buf.used, buf.buf);
+	buf_wipe(&buf);
 }
 
 static void
 test_resp_fmt_err(void)
 {
 	const char	*bad_requ;
-	char		*resp;
+	struct buf	 buf;
 
 	bad_requ = "HTTP/1.1 400 Bad Request\r\n"
+		   "Connection: close\r\n"
 		   "Content-Length: 11\r\n"
 		   "\r\n"
 		   "Bad Request";
 
-	if ((resp = resp_fmt_err(400)) == NULL)
+	buf_init(&buf);
+	if (resp_fmt_err(&buf, 400) != YHTTP_OK)
 		errx(1, "resp_fmt_err");
-	if (strcmp(resp, bad_requ) != 0)
-		errx(1, "resp_fmt_err: have %s, want %s", resp, bad_requ);
-	free(resp);
+	if (buf.used != strlen(bad_requ) || memcmp(buf.buf, bad_requ, buf.used) != 0)
+		errx(1, "resp_fmt_err: have %.*s, want %s", (int)buf.used, buf.buf, bad_requ);
+	buf_wipe(&buf);
+}
+
+static void
+test_resp_fmt(void)
+{
+	const char		*want;
+	struct arena		 arena;
+	struct yhttp_resp	*resp;
+	struct buf		 buf;
+
+	want = "HTTP/1.1 404 Not Found\r\n"
+	       "Foo: Bar\r\n"
+	       "Content-Length: 5\r\n"
+	       "\r\n"
+	       "hello";
+
+	arena_init(&arena);
+	if ((resp = yhttp_resp_init(&arena)) == NULL)
+		errx(1, "resp_fmt: yhttp_resp_init");
+	resp->status = 404;
+	if (hash_set(&arena, resp->headers, "Foo", "Bar") != YHTTP_OK)
+		errx(1, "resp_fmt: hash_set");
+	if ((resp->body = arena_alloc(&arena, 5)) == NULL)
+		err(1, "resp_fmt: arena_alloc");
+	memcpy(resp->body, "hello", 5);
+	resp->nbody = 5;
+
+	buf_init(&buf);
+	if (resp_fmt(&buf, resp, NULL, 0) != YHTTP_OK)
+		errx(1, "resp_fmt");
+	if (buf.used != strlen(want) || memcmp(buf.buf, want, buf.used) != 0)
+		errx(1, "resp_fmt: have %.*s, want %s", (int)buf.used, buf.buf, want);
+	buf_wipe(&buf);
+
+	/* The Connection header field is added, unless it has been set. */
+	want = "HTTP/1.1 404 Not Found\r\n"
+	       "Foo: Bar\r\n"
+	       "Connection: close\r\n"
+	       "Content-Length: 5\r\n"
+	       "\r\n"
+	       "hello";
+	if (resp_fmt(&buf, resp, "close", 0) != YHTTP_OK)
+		errx(1, "resp_fmt");
+	if (buf.used != strlen(want) || memcmp(buf.buf, want, buf.used) != 0)
+		errx(1, "resp_fmt: have %.*s, want %s", (int)buf.used, buf.buf, want);
+	buf_wipe(&buf);
+
+	if (hash_set(&arena, resp->headers, "Connection", "upgrade") != YHTTP_OK)
+		errx(1, "resp_fmt: hash_set");
+	if (resp_fmt(&buf, resp, "close", 0) != YHTTP_OK)
+		errx(1, "resp_fmt");
+	if (memmem(buf.buf, buf.used, "close", 5) != NULL)
+		errx(1, "resp_fmt: Connection header field set twice");
+	buf_wipe(&buf);
+
+	arena_free(&arena);
+}
+
+static void
+test_resp_unavail(void)
+{
+	const char	*want;
+	struct buf	 buf;
+
+	want = "HTTP/1.1 503 Service Unavailable\r\n"
+	       "Connection: close\r\n"
+	       "Retry-After: 1\r\n"
+	       "Content-Length: 19\r\n"
+	       "\r\n"
+	       "Service Unavailable";
+
+	buf_init(&buf);
+	if (resp_unavail(&buf, 1) != YHTTP_OK)
+		errx(1, "resp_unavail");
+	if (buf.used != strlen(want) || memcmp(buf.buf, want, buf.used) != 0)
+		errx(1, "resp_unavail: have %.*s, want %s", (int)buf.used,
+		     buf.buf, want);
+	buf_wipe(&buf);
+}
+
+static void
+test_resp_chunk(void)
+{
+	const char	*want;
+	struct buf	 buf;
+
+	want = "1a\r\n"
+	       "abcdefghijklmnopqrstuvwxyz\r\n"
+	       "0\r\n"
+	       "\r\n";
+
+	buf_init(&buf);
+	if (resp_chunk(&buf, (const unsigned char *)"abcdefghijklmnopqrstuvwxyz",
+		       26) != YHTTP_OK)
+		errx(1, "resp_chunk");
+	if (resp_chunk(&buf, NULL, 0) != YHTTP_OK)
+		errx(1, "resp_chunk");
+	if (buf.used != strlen(want) || memcmp(buf.buf, want, buf.used) != 0)
+		errx(1, "resp_chunk: have %.*s, want %s", (int)buf.used,
+		     buf.buf, want);
+	buf_wipe(&buf);
+}
+
+static void
+test_resp_continue(void)
+{
+	const char	*want;
+	struct buf	 buf;
+
+	want = "HTTP/1.1 100 Continue\r\n\r\n";
+
+	buf_init(&buf);
+	if (resp_continue(&buf) != YHTTP_OK)
+		errx(1, "resp_continue");
+	if (buf.used != strlen(want) || memcmp(buf.buf, want, buf.used) != 0)
+		errx(1, "resp_continue: have %.*s, want %s", (int)buf.used,
+		     buf.buf, want);
+	buf_wipe(&buf);
+}
+
+static void
+test_resp_switch(void)
+{
+	const char	*want;
+	struct buf	 buf;
+
+	want = "HTTP/1.1 101 Switching Protocols\r\n"
+	       "Connection: Upgrade\r\n"
+	       "Upgrade: h2c\r\n"
+	       "\r\n";
+
+	buf_init(&buf);
+	if (resp_switch(&buf, "h2c") != YHTTP_OK)
+		errx(1, "resp_switch");
+	if (buf.used != strlen(want) || memcmp(buf.buf, want, buf.used) != 0)
+		errx(1, "resp_switch: have %.*s, want %s", (int)buf.used,
+		     buf.buf, want);
+	buf_wipe(&buf);
+}
+
+static void
+test_resp_hint(void)
+{
+	const char	*want;
+	struct buf	 buf;
+
+	want = "HTTP/1.1 103 Early Hints\r\n"
+	       "Link: </style.css>; rel=preload; as=style\r\n"
+	       "\r\n";
+
+	buf_init(&buf);
+	if (resp_hint(&buf, "</style.css>; rel=preload; as=style") != YHTTP_OK)
+		errx(1, "resp_hint");
+	if (buf.used != strlen(want) || memcmp(buf.buf, want, buf.used) != 0)
+		errx(1, "resp_hint: have %.*s, want %s", (int)buf.used,
+		     buf.buf, want);
+	buf_wipe(&buf);
 }
 
 int
@@ -85,5 +258,11 @@ main(int argc, char *argv[])
 	test_resp_fmt_rline();
 	test_resp_fmt_header();
 	test_resp_fmt_err();
+	test_resp_fmt();
+	test_resp_unavail();
+	test_resp_chunk();
+	test_resp_continue();
+	test_resp_switch();
+	test_resp_hint();
 	return (0);
 }
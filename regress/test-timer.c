@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2022 Emil Engler <engler+yhttp@unveil2.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "../timer.c"
+
+static void	test_timer_arm_cancel(void);
+static void	test_timer_wheel_expire(void);
+static void	test_timer_wheel_timeout(void);
+
+static void
+test_timer_arm_cancel(void)
+{
+	struct timer_wheel	wheel;
+	struct timer		t;
+
+	timer_wheel_init(&wheel, 0);
+	timer_init(&t);
+
+	if (timer_armed(&t))
+		errx(1, "timer_init: timer is armed");
+
+	timer_arm(&wheel, &t, 0, 1000);
+	if (!timer_armed(&t))
+		errx(1, "timer_arm: timer is not armed");
+	if (t.expiry != 1000 / TIMER_TICK)
+		errx(1, "timer_arm: have expiry %llu, want %d", (unsigned long long)t.expiry, 1000 / TIMER_TICK);
+	if (wheel.ntimers != 1)
+		errx(1, "timer_arm: have ntimers %zu, want 1", wheel.ntimers);
+
+	/* Re-arming does not add the timer twice. */
+	timer_arm(&wheel, &t, 0, 2000);
+	if (wheel.ntimers != 1)
+		errx(1, "timer_arm: have ntimers %zu, want 1", wheel.ntimers);
+
+	timer_cancel(&wheel, &t);
+	if (timer_armed(&t))
+		errx(1, "timer_cancel: timer is armed");
+	if (wheel.ntimers != 0)
+		errx(1, "timer_cancel: have ntimers %zu, want 0", wheel.ntimers);
+
+	/* Cancelling twice is harmless. */
+	timer_cancel(&wheel, &t);
+	if (wheel.ntimers != 0)
+		errx(1, "timer_cancel: have ntimers %zu, want 0", wheel.ntimers);
+}
+
+static void
+test_timer_wheel_expire(void)
+{
+	struct timer_wheel	wheel;
+	struct timer		a, b, c;
+	uint64_t		rev;
+
+	rev = (uint64_t)TIMER_TICK * TIMER_NSLOTS;
+
+	timer_wheel_init(&wheel, 0);
+	timer_init(&a);
+	timer_init(&b);
+	timer_init(&c);
+
+	timer_arm(&wheel, &a, 0, 1000);
+	timer_arm(&wheel, &b, 0, 1000 + rev);	/* Same slot, next revolution. */
+	timer_arm(&wheel, &c, 0, 3000);
+
+	if (timer_wheel_expire(&wheel, 999) != NULL)
+		errx(1, "timer_wheel_expire: timer expired too early");
+	if (timer_wheel_expire(&wheel, 1000) != &a)
+		errx(1, "timer_wheel_expire: a has not expired");
+	if (timer_armed(&a))
+		errx(1, "timer_wheel_expire: a is still armed");
+	if (timer_wheel_expire(&wheel, 1000) != NULL)
+		errx(1, "timer_wheel_expire: b expired too early");
+
+	if (timer_wheel_expire(&wheel, 3000) != &c)
+		errx(1, "timer_wheel_expire: c has not expired");
+	if (timer_wheel_expire(&wheel, rev) != NULL)
+		errx(1, "timer_wheel_expire: b expired too early");
+	if (timer_wheel_expire(&wheel, 1000 + rev) != &b)
+		errx(1, "timer_wheel_expire: b has not expired");
+	if (wheel.ntimers != 0)
+		errx(1, "timer_wheel_expire: have ntimers %zu, want 0", wheel.ntimers);
+
+	/* Timers in the past expire on the next tick. */
+	timer_arm(&wheel, &a, 0, 0);
+	if (timer_wheel_expire(&wheel, 1000 + rev + TIMER_TICK) != &a)
+		errx(1, "timer_wheel_expire: a has not expired");
+}
+
+static void
+test_timer_wheel_timeout(void)
+{
+	struct timer_wheel	wheel;
+	struct timer		t;
+	int			ms;
+
+	timer_wheel_init(&wheel, 0);
+	timer_init(&t);
+
+	if ((ms = timer_wheel_timeout(&wheel, 0)) != -1)
+		errx(1, "timer_wheel_timeout: have %d, want -1", ms);
+
+	timer_arm(&wheel, &t, 0, 1000);
+	if ((ms = timer_wheel_timeout(&wheel, 100)) != 900)
+		errx(1, "timer_wheel_timeout: have %d, want 900", ms);
+	if ((ms = timer_wheel_timeout(&wheel, 2000)) != 0)
+		errx(1, "timer_wheel_timeout: have %d, want 0", ms);
+}
+
+int
+main(int argc, char *argv[])
+{
+	test_timer_arm_cancel();
+	test_timer_wheel_expire();
+	test_timer_wheel_timeout();
+
+	return (0);
+}
@@ -0,0 +1,276 @@
+/*
+ * Copyright (c) 2022 Emil Engler <engler+yhttp@unveil2.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../ws.c"
+
+struct event {
+	enum yhttp_ws_event	event;
+	char			data[64];
+	size_t			ndata;
+	int			n;
+};
+
+static void	frame(struct buf *, int, const char *, size_t);
+static void	event(struct yhttp_ws *, enum yhttp_ws_event,
+		      const unsigned char *, size_t, void *);
+static void	take(struct yhttp_ws *, const char *, size_t);
+static void	test_ws_accept(void);
+static void	test_ws_parse(void);
+static void	test_ws_errors(void);
+static void	test_ws_queue(void);
+
+/*
+ * Append a masked frame, as a client sends it.
+ */
+static void
+frame(struct buf *buf, int b0, const char *p, size_t n)
+{
+	unsigned char	hdr[8];
+	size_t		i, nhdr;
+
+	hdr[0] = b0;
+	if (n < 126) {
+		hdr[1] = WS_MASK | n;
+		nhdr = 2;
+	} else {
+		hdr[1] = WS_MASK | 126;
+		hdr[2] = n >> 8;
+		hdr[3] = n;
+		nhdr = 4;
+	}
+	memcpy(hdr + nhdr, "\x37\xfa\x21\x3d", 4);
+	nhdr += 4;
+	if (buf_append(buf, hdr, nhdr) != YHTTP_OK)
+		errx(1, "buf_append");
+	for (i = 0; i < n; ++i) {
+		hdr[0] = p[i] ^ hdr[nhdr - 4 + i % 4];
+		if (buf_append(buf, hdr, 1) != YHTTP_OK)
+			errx(1, "buf_append");
+	}
+}
+
+static void
+event(struct yhttp_ws *ws, enum yhttp_ws_event ev, const unsigned char *data,
+      size_t ndata, void *arg)
+{
+	struct event	*e;
+
+	e = arg;
+	e->event = ev;
+	e->ndata = ndata < sizeof(e->data) ? ndata : sizeof(e->data);
+	memcpy(e->data, data, e->ndata);
+	++e->n;
+}
+
+/*
+ * Check that the queued frames are exactly the n bytes of want.
+ */
+static void
+take(struct yhttp_ws *ws, const char *want, size_t n)
+{
+	struct buf	out;
+
+	buf_init(&out);
+	if (ws_take(ws, &out) != YHTTP_OK)
+		errx(1, "ws_take");
+	if (out.used != n || memcmp(out.buf, want, n) != 0)
+		errx(1, "ws_take: have %zu bytes, want %zu", out.used, n);
+	buf_wipe(&out);
+}
+
+static void
+test_ws_accept(void)
+{
+	char	accept[29];
+
+	/* The example of RFC 6455, section 1.3. */
+	if (ws_accept("dGhlIHNhbXBsZSBub25jZQ==", accept) != YHTTP_OK ||
+	    strcmp(accept, "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=") != 0)
+		errx(1, "ws_accept: want s3pPLMBiTxaQ9kYGzzhZRbK+xOo=");
+
+	if (ws_accept("dGhlIHNhbXBsZSBub25jZQ", accept) != YHTTP_EINVAL ||
+	    ws_accept("dGhlIHNhbXBsZSBub25j*Q==", accept) != YHTTP_EINVAL)
+		errx(1, "ws_accept: want YHTTP_EINVAL");
+}
+
+static void
+test_ws_parse(void)
+{
+	struct yhttp_ws	*ws;
+	struct event	 e;
+	struct buf	 in;
+	size_t		 i;
+	unsigned char	 hello[] = { 0x81, 0x85, 0x37, 0xfa, 0x21, 0x3d, 0x7f,
+				     0x9f, 0x4d, 0x51, 0x58 };
+
+	memset(&e, 0, sizeof(e));
+	if ((ws = ws_init(event, &e, 0, NULL)) == NULL)
+		errx(1, "ws_init");
+
+	/* The example of RFC 6455, section 5.7, byte by byte. */
+	for (i = 0; i < sizeof(hello); ++i) {
+		if (ws_parse(ws, hello + i, 1) != YHTTP_OK)
+			errx(1, "ws_parse");
+	}
+	if (e.n != 1 || e.event != YHTTP_WS_TEXT || e.ndata != 5 ||
+	    memcmp(e.data, "Hello", 5) != 0)
+		errx(1, "ws_parse: \"Hello\" has not been passed on");
+
+	/* A fragmented message with a ping in between. */
+	buf_init(&in);
+	frame(&in, WS_BINARY, "Hel", 3);
+	frame(&in, WS_FIN | WS_PING, "p", 1);
+	frame(&in, WS_FIN | WS_CONTINUATION, "lo", 2);
+	if (ws_parse(ws, in.buf, in.used) != YHTTP_OK)
+		errx(1, "ws_parse");
+	if (e.n != 2 || e.event != YHTTP_WS_BINARY || e.ndata != 5 ||
+	    memcmp(e.data, "Hello", 5) != 0)
+		errx(1, "ws_parse: fragmented message has not been passed on");
+	take(ws, "\x8a\x01p", 3);
+
+	/* A close frame is answered with the same status. */
+	in.used = 0;
+	frame(&in, WS_FIN | WS_CLOSE, "\x03\xe8", 2);
+	frame(&in, WS_FIN | WS_TEXT, "x", 1);
+	if (ws_parse(ws, in.buf, in.used) != YHTTP_OK)
+		errx(1, "ws_parse");
+	if (e.n != 2 || ws_done(ws))
+		errx(1, "ws_parse: frame after close has been passed on");
+	take(ws, "\x88\x02\x03\xe8", 4);
+	if (!ws_done(ws))
+		errx(1, "ws_done: want 1");
+	if (ws_queue(ws, WS_TEXT, NULL, 0) != YHTTP_EINVAL)
+		errx(1, "ws_queue: frame after close has been queued");
+	buf_wipe(&in);
+
+	ws_free(ws);
+}
+
+static void
+test_ws_errors(void)
+{
+	struct {
+		int		 b0;
+		const char	*p;
+		size_t		 n;
+		const char	*want;
+	} tests[] = {
+		{ WS_FIN | WS_RSV | WS_TEXT, "", 0, "\x88\x02\x03\xea" },
+		{ WS_FIN | 0x3, "", 0, "\x88\x02\x03\xea" },
+		{ WS_PING, "", 0, "\x88\x02\x03\xea" },
+		{ WS_FIN | WS_CONTINUATION, "", 0, "\x88\x02\x03\xea" },
+		{ WS_FIN | WS_TEXT, "\xc0\xaf", 2, "\x88\x02\x03\xef" },
+		{ WS_FIN | WS_TEXT, "\xed\xa0\x80", 3, "\x88\x02\x03\xef" },
+		{ WS_FIN | WS_BINARY, "12345", 5, "\x88\x02\x03\xf1" },
+		{ WS_FIN | WS_CLOSE, "\x03", 1, "\x88\x02\x03\xea" },
+		{ WS_FIN | WS_CLOSE, "\x03\xed", 2, "\x88\x02\x03\xea" }
+	};
+	struct yhttp_ws	*ws;
+	struct event	 e;
+	struct buf	 in;
+	unsigned char	 unmasked[] = { 0x81, 0x00 };
+	size_t		 i;
+
+	buf_init(&in);
+	for (i = 0; i < sizeof(tests) / sizeof(tests[0]); ++i) {
+		memset(&e, 0, sizeof(e));
+		if ((ws = ws_init(event, &e, 4, NULL)) == NULL)
+			errx(1, "ws_init");
+
+		in.used = 0;
+		frame(&in, tests[i].b0, tests[i].p, tests[i].n);
+		if (ws_parse(ws, in.buf, in.used) != YHTTP_OK)
+			errx(1, "ws_parse");
+		if (e.n != 0 || !ws->failed)
+			errx(1, "ws_parse: test %zu has been accepted", i);
+		take(ws, tests[i].want, 4);
+		if (!ws_done(ws))
+			errx(1, "ws_done: want 1");
+
+		ws_free(ws);
+	}
+	buf_wipe(&in);
+
+	/* Clients have to mask their frames. */
+	memset(&e, 0, sizeof(e));
+	if ((ws = ws_init(event, &e, 0, NULL)) == NULL)
+		errx(1, "ws_init");
+	if (ws_parse(ws, unmasked, sizeof(unmasked)) != YHTTP_OK)
+		errx(1, "ws_parse");
+	if (e.n != 0 || !ws->failed)
+		errx(1, "ws_parse: unmasked frame has been accepted");
+	ws_free(ws);
+}
+
+static void
+test_ws_queue(void)
+{
+	struct pool_cq	 cq;
+	struct yhttp_ws	*ws;
+	struct event	 e;
+	unsigned char	 big[300];
+	char		 want[8 + sizeof(big)];
+
+	pool_cq_init(&cq);
+	if (pool_cq_open(&cq) != YHTTP_OK)
+		errx(1, "pool_cq_open");
+	memset(&e, 0, sizeof(e));
+	if ((ws = ws_init(event, &e, 0, &cq)) == NULL)
+		errx(1, "ws_init");
+
+	/* Only the first frame wakes the event loop up. */
+	memset(big, 'x', sizeof(big));
+	if (ws_queue(ws, WS_TEXT, (const unsigned char *)"hi", 2) !=
+	    YHTTP_OK || ws_queue(ws, WS_BINARY, big, sizeof(big)) != YHTTP_OK)
+		errx(1, "ws_queue");
+	if (pool_cq_take(&cq) != &ws->job || !ws_taken(ws))
+		errx(1, "ws_queue: the event loop has not been woken up");
+	if (pool_cq_take(&cq) != NULL)
+		errx(1, "ws_queue: the event loop has been woken up twice");
+	memcpy(want, "\x81\x02hi\x82\x7e\x01\x2c", 8);
+	memcpy(want + 8, big, sizeof(big));
+	take(ws, want, sizeof(want));
+
+	/* A connection that goes away leaves the pending wakeup behind. */
+	if (ws_close(ws, WS_GOING_AWAY) != YHTTP_OK)
+		errx(1, "ws_close");
+	ws_free(ws);
+	if (pool_cq_take(&cq) != &ws->job)
+		errx(1, "ws_close: the event loop has not been woken up");
+	if (ws_taken(ws))
+		errx(1, "ws_taken: want 0");
+
+	pool_cq_free(&cq);
+}
+
+int
+main(int argc, char *argv[])
+{
+	test_ws_accept();
+	test_ws_parse();
+	test_ws_errors();
+	test_ws_queue();
+
+	return (0);
+}
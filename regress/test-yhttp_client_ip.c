@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2022 Emil Engler <engler+yhttp@unveil2.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <err.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../arena.h"
+#include "../yhttp.h"
+#include "../yhttp-internal.h"
+
+int
+main(int argc, char *argv[])
+{
+	struct yhttp_requ_internal	*internal;
+	struct yhttp_requ		*requ;
+	struct sockaddr_in		 sin;
+	struct sockaddr_in6		 sin6;
+	char				*ip;
+
+	if ((requ = yhttp_requ_init()) == NULL)
+		err(1, "yhttp_requ_init");
+	internal = requ->internal;
+
+	/* Without an address, there is nothing to format. */
+	if (yhttp_client_ip(requ) != NULL)
+		errx(1, "yhttp_client_ip: want NULL");
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	internal->addr = (struct sockaddr *)&sin;
+	if ((ip = yhttp_client_ip(requ)) == NULL)
+		err(1, "yhttp_client_ip");
+	if (strcmp(ip, "127.0.0.1") != 0)
+		errx(1, "yhttp_client_ip: have %s, want 127.0.0.1", ip);
+
+	/* The formatted address is cached. */
+	if (yhttp_client_ip(requ) != ip)
+		errx(1, "yhttp_client_ip: address is not cached");
+	yhttp_requ_free(requ);
+
+	if ((requ = yhttp_requ_init()) == NULL)
+		err(1, "yhttp_requ_init");
+	internal = requ->internal;
+
+	memset(&sin6, 0, sizeof(sin6));
+	sin6.sin6_family = AF_INET6;
+	sin6.sin6_addr = in6addr_loopback;
+	internal->addr = (struct sockaddr *)&sin6;
+	if ((ip = yhttp_client_ip(requ)) == NULL)
+		err(1, "yhttp_client_ip");
+	if (strcmp(ip, "::1") != 0)
+		errx(1, "yhttp_client_ip: have %s, want ::1", ip);
+	yhttp_requ_free(requ);
+
+	return (0);
+}
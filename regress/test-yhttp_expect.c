@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2022 Emil Engler <engler+yhttp@unveil2.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "../arena.h"
+#include "../yhttp.h"
+#include "../yhttp-internal.h"
+
+static int	test_expect(struct yhttp_requ *, void *);
+
+static int
+test_expect(struct yhttp_requ *requ, void *udata)
+{
+	return (100);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct yhttp	*yh;
+
+	if ((yh = yhttp_init(8080)) == NULL)
+		err(1, "yhttp_init");
+
+	if (yhttp_expect(NULL, test_expect) != YHTTP_EINVAL)
+		errx(1, "yhttp_expect: want YHTTP_EINVAL");
+
+	if (yhttp_expect(yh, test_expect) != YHTTP_OK)
+		errx(1, "yhttp_expect: want YHTTP_OK");
+	if (yh->expect != test_expect)
+		errx(1, "yhttp_expect: callback not set");
+	if (yhttp_expect(yh, NULL) != YHTTP_OK)
+		errx(1, "yhttp_expect: want YHTTP_OK");
+	if (yh->expect != NULL)
+		errx(1, "yhttp_expect: callback not unset");
+
+	yh->is_dispatched = 1;
+	if (yhttp_expect(yh, test_expect) != YHTTP_EBUSY)
+		errx(1, "yhttp_expect: want YHTTP_EBUSY");
+	yh->is_dispatched = 0;
+
+	yhttp_free(&yh);
+
+	return (0);
+}
@@ -20,6 +20,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include "../arena.h"
 #include "../yhttp.h"
 #include "../yhttp-internal.h"
 
@@ -37,8 +38,10 @@ main(int argc, char *argv[])
 	if ((yh = yhttp_init(8080)) == NULL)
 		err(1, "yhttp_init");
 
-	if (yh->pipe[0] != -1 || yh->pipe[1] != -1)
-		errx(1, "yhttp_init: have pipe not -1, want -1");
+	if (yh->pipes != NULL)
+		errx(1, "yhttp_init: have pipes not NULL, want NULL");
+	if (yh->npipes != 0)
+		errx(1, "yhttp_init: have npipes %zu, want 0", yh->npipes);
 	if (yh->is_dispatched != 0)
 		errx(1, "yhttp_init: have is_dispatched %d, want 0", yh->is_dispatched);
 	if (yh->port != 8080)
@@ -17,10 +17,12 @@
 #include <sys/types.h>
 
 #include <err.h>
+#include <errno.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "../arena.h"
 #include "../yhttp.h"
 #include "../yhttp-internal.h"
 #include "../hash.c"
@@ -31,6 +33,8 @@ main(int argc, char *argv[])
 	struct yhttp_requ_internal	*internal;
 	struct yhttp_requ		*requ;
 	struct yhttp_resp		*default_resp;
+	struct arena			 arena;
+	unsigned char			*p;
 	size_t				 i;
 
 	if ((requ = yhttp_requ_init()) == NULL)
@@ -38,8 +42,6 @@ main(int argc, char *argv[])
 
 	if (requ->path != NULL)
 		errx(1, "yhttp_requ_init: requ->path is not NULL");
-	if (requ->client_ip != NULL)
-		errx(1, "yhttp_requ_init: requ->client_ip is not NULL");
 	if (requ->body != NULL)
 		errx(1, "yhttp_requ_init: requ->body is not NULL");
 	if (requ->nbody != 0)
@@ -54,20 +56,38 @@ main(int argc, char *argv[])
 		errx(1, "yhttp_requ_init: internal->headers is NULL");
 	if (internal->queries == NULL)
 		errx(1, "yhttp_requ_init: internal->queries is NULL");
+	if (internal->addr != NULL)
+		errx(1, "yhttp_requ_init: internal->addr is not NULL");
+	if (internal->ip != NULL)
+		errx(1, "yhttp_requ_init: internal->ip is not NULL");
 	for (i = 0; i < NHASH; ++i) {
 		if (internal->headers[i] != NULL || internal->queries[i])
 			errx(1, "yhttp_requ_init: hash_init");
 	}
 
-	if ((default_resp = yhttp_resp_init()) == NULL)
+	if (internal->resp->arena != &internal->arena)
+		errx(1, "yhttp_requ_init: internal->resp->arena is not set");
+
+	arena_init(&arena);
+	if ((default_resp = yhttp_resp_init(&arena)) == NULL)
 		errx(1, "yhttp_requ_init: yhttp_resp_init");
-	hash_free(default_resp->headers);
-	hash_free(internal->resp->headers);
 	default_resp->headers = NULL;
+	default_resp->arena = NULL;
 	internal->resp->headers = NULL;
+	internal->resp->arena = NULL;
 	if (memcmp(default_resp, internal->resp, sizeof(struct yhttp_resp)) != 0)
 		errx(1, "yhttp_requ_init: internal->resp is not initialized");
-	yhttp_resp_free(default_resp);
+	arena_free(&arena);
+
+	/* Memory of the request is being taken from its arena. */
+	if ((p = yhttp_requ_alloc(requ, 64)) == NULL)
+		err(1, "yhttp_requ_alloc");
+	memset(p, 'a', 64);
+	if ((p = yhttp_requ_alloc(requ, 64 * 1024)) == NULL)
+		err(1, "yhttp_requ_alloc");
+	memset(p, 'a', 64 * 1024);
+	if (yhttp_requ_alloc(NULL, 64) != NULL || errno != EINVAL)
+		errx(1, "yhttp_requ_alloc: want EINVAL");
 
 	yhttp_requ_free(requ);
 	yhttp_requ_free(NULL);
@@ -20,6 +20,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include "../arena.h"
 #include "../yhttp.h"
 #include "../yhttp-internal.h"
 #include "../hash.c"
@@ -27,10 +28,12 @@
 int
 main(int argc, char *argv[])
 {
+	struct arena		 arena;
 	struct yhttp_resp	*resp;
 	size_t			 i;
 
-	if ((resp = yhttp_resp_init()) == NULL)
+	arena_init(&arena);
+	if ((resp = yhttp_resp_init(&arena)) == NULL)
 		errx(1, "yhttp_resp_init");
 
 	if (resp->headers == NULL)
@@ -40,6 +43,8 @@ main(int argc, char *argv[])
 			errx(1, "yhttp_resp_init: hash_init");
 	}
 
+	if (resp->arena != &arena)
+		errx(1, "yhttp_resp_init: resp->arena is not set");
 	if (resp->body != NULL)
 		errx(1, "yhttp_resp_init: resp->body is not NULL");
 	if (resp->nbody != 0)
@@ -47,8 +52,7 @@ main(int argc, char *argv[])
 	if (resp->status != 200)
 		errx(1, "yhttp_resp_init: resp->status is not 200");
 
-	yhttp_resp_free(resp);
-	yhttp_resp_free(NULL);
+	arena_free(&arena);
 
 	return (0);
 }
@@ -21,6 +21,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "../arena.h"
 #include "../hash.h"
 #include "../yhttp.h"
 #include "../yhttp-internal.h"
@@ -28,6 +29,14 @@
 static void	test_resp_status(void);
 static void	test_resp_header(void);
 static void	test_resp_body(void);
+static void	test_resp_stream(void);
+static ssize_t	test_fill(struct yhttp_requ *, unsigned char *, size_t,
+			  void *);
+static void	test_resp_websocket(void);
+static void	test_resp_early_hints(void);
+static int	test_hint(struct yhttp_requ *, const char *);
+static void	test_ws(struct yhttp_ws *, enum yhttp_ws_event,
+			const unsigned char *, size_t, void *);
 
 static void
 test_resp_status(void)
@@ -138,11 +147,152 @@ test_resp_body(void)
 	yhttp_requ_free(requ);
 }
 
+static ssize_t
+test_fill(struct yhttp_requ *requ, unsigned char *buf, size_t nbuf, void *arg)
+{
+	return (0);
+}
+
+static void
+test_resp_stream(void)
+{
+	struct yhttp_requ_internal	*internal;
+	struct yhttp_requ		*requ;
+	int				 arg;
+
+	if ((requ = yhttp_requ_init()) == NULL)
+		errx(1, "yhttp_resp_stream: yhttp_requ_init");
+	internal = requ->internal;
+
+	if (yhttp_resp_stream(NULL, test_fill, NULL) != YHTTP_EINVAL)
+		errx(1, "yhttp_resp_stream: want YHTTP_EINVAL");
+
+	if (yhttp_resp_stream(requ, test_fill, &arg) != YHTTP_OK)
+		errx(1, "yhttp_resp_stream: want YHTTP_OK");
+	if (internal->resp->fill != test_fill || internal->resp->arg != &arg)
+		errx(1, "yhttp_resp_stream: fill was not set");
+
+	/* Unset it again. */
+	if (yhttp_resp_stream(requ, NULL, &arg) != YHTTP_OK)
+		errx(1, "yhttp_resp_stream: want YHTTP_OK");
+	if (internal->resp->fill != NULL || internal->resp->arg != NULL)
+		errx(1, "yhttp_resp_stream: fill was not unset");
+
+	yhttp_requ_free(requ);
+}
+
+static void
+test_ws(struct yhttp_ws *ws, enum yhttp_ws_event event,
+	const unsigned char *data, size_t ndata, void *arg)
+{
+}
+
+static void
+test_resp_websocket(void)
+{
+	struct yhttp_requ_internal	*internal;
+	struct yhttp_requ		*requ;
+	struct hash			*node;
+	int				 arg;
+
+	if ((requ = yhttp_requ_init()) == NULL)
+		errx(1, "yhttp_resp_websocket: yhttp_requ_init");
+	internal = requ->internal;
+
+	/* The example of RFC 6455, section 1.3. */
+	if (hash_set(&internal->arena, internal->headers,
+		     "Upgrade", "websocket") != YHTTP_OK ||
+	    hash_set(&internal->arena, internal->headers,
+		     "Connection", "keep-alive, Upgrade") != YHTTP_OK ||
+	    hash_set(&internal->arena, internal->headers,
+		     "Sec-WebSocket-Key", "dGhlIHNhbXBsZSBub25jZQ==") != YHTTP_OK)
+		errx(1, "yhttp_resp_websocket: hash_set");
+
+	/* Sec-WebSocket-Version is missing. */
+	if (yhttp_resp_websocket(requ, test_ws, &arg) != YHTTP_EINVAL)
+		errx(1, "yhttp_resp_websocket: want YHTTP_EINVAL");
+	if (hash_set(&internal->arena, internal->headers,
+		     "Sec-WebSocket-Version", "8") != YHTTP_OK)
+		errx(1, "yhttp_resp_websocket: hash_set");
+	if (yhttp_resp_websocket(requ, test_ws, &arg) != YHTTP_EINVAL)
+		errx(1, "yhttp_resp_websocket: want YHTTP_EINVAL");
+	if (hash_set(&internal->arena, internal->headers,
+		     "Sec-WebSocket-Version", "13") != YHTTP_OK)
+		errx(1, "yhttp_resp_websocket: hash_set");
+
+	requ->method = YHTTP_POST;
+	if (yhttp_resp_websocket(requ, test_ws, &arg) != YHTTP_EINVAL)
+		errx(1, "yhttp_resp_websocket: want YHTTP_EINVAL");
+	requ->method = YHTTP_GET;
+
+	if (yhttp_resp_websocket(requ, test_ws, &arg) != YHTTP_OK)
+		errx(1, "yhttp_resp_websocket: want YHTTP_OK");
+	if (internal->resp->ws != test_ws || internal->resp->arg != &arg ||
+	    internal->resp->status != 101)
+		errx(1, "yhttp_resp_websocket: ws was not set");
+	node = hash_get(internal->resp->headers, "Sec-WebSocket-Accept");
+	if (node == NULL ||
+	    strcmp(node->value, "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=") != 0)
+		errx(1, "yhttp_resp_websocket: have %s, want "
+		     "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=",
+		     node == NULL ? "NULL" : node->value);
+
+	yhttp_requ_free(requ);
+}
+
+static int
+test_hint(struct yhttp_requ *requ, const char *link)
+{
+	struct yhttp_requ_internal	*internal;
+
+	internal = requ->internal;
+	++*(int *)internal->hintarg;
+	return (strcmp(link, "</a.js>; rel=preload") == 0 ? YHTTP_OK :
+	    YHTTP_EINVAL);
+}
+
+static void
+test_resp_early_hints(void)
+{
+	struct yhttp_requ_internal	*internal;
+	struct yhttp_requ		*requ;
+	int				 n;
+
+	if ((requ = yhttp_requ_init()) == NULL)
+		errx(1, "yhttp_resp_early_hints: yhttp_requ_init");
+	internal = requ->internal;
+
+	/* Without a connection, there is nothing to send. */
+	if (yhttp_resp_early_hints(requ, "</a.js>; rel=preload") != YHTTP_OK)
+		errx(1, "yhttp_resp_early_hints: want YHTTP_OK");
+
+	n = 0;
+	internal->hint = test_hint;
+	internal->hintarg = &n;
+	if (yhttp_resp_early_hints(NULL, "</a.js>") != YHTTP_EINVAL ||
+	    yhttp_resp_early_hints(requ, NULL) != YHTTP_EINVAL ||
+	    yhttp_resp_early_hints(requ, "") != YHTTP_EINVAL ||
+	    yhttp_resp_early_hints(requ, "</a.js>\r\nX: y") != YHTTP_EINVAL)
+		errx(1, "yhttp_resp_early_hints: want YHTTP_EINVAL");
+	if (n != 0)
+		errx(1, "yhttp_resp_early_hints: invalid link has been sent");
+
+	if (yhttp_resp_early_hints(requ, "</a.js>; rel=preload") != YHTTP_OK)
+		errx(1, "yhttp_resp_early_hints: want YHTTP_OK");
+	if (n != 1)
+		errx(1, "yhttp_resp_early_hints: have %d hints, want 1", n);
+
+	yhttp_requ_free(requ);
+}
+
 int
 main(int argc, char *argv[])
 {
 	test_resp_status();
 	test_resp_header();
 	test_resp_body();
+	test_resp_stream();
+	test_resp_websocket();
+	test_resp_early_hints();
 	return (0);
 }
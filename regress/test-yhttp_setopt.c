@@ -0,0 +1,140 @@
+/*
+ * Copyright (c) 2022 Emil Engler <engler+yhttp@unveil2.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "../arena.h"
+#include "../yhttp.h"
+#include "../yhttp-internal.h"
+
+int
+main(int argc, char *argv[])
+{
+	struct yhttp	*yh;
+
+	if ((yh = yhttp_init(8080)) == NULL)
+		err(1, "yhttp_init");
+
+	if (yhttp_setopt(NULL, YHTTP_OPT_WORKERS, 1) != YHTTP_EINVAL)
+		errx(1, "yhttp_setopt: want YHTTP_EINVAL");
+	if (yhttp_setopt(yh, -1, 1) != YHTTP_EINVAL)
+		errx(1, "yhttp_setopt: want YHTTP_EINVAL");
+
+	if (yhttp_setopt(yh, YHTTP_OPT_WORKERS, 8) != YHTTP_OK)
+		errx(1, "yhttp_setopt: want YHTTP_OK");
+	if (yh->nworkers != 8)
+		errx(1, "yhttp_setopt: have nworkers %zu, want 8", yh->nworkers);
+
+	if (yh->naccept != 64)
+		errx(1, "yhttp_init: have naccept %zu, want 64", yh->naccept);
+	if (yhttp_setopt(yh, YHTTP_OPT_ACCEPT_BUDGET, 0) != YHTTP_EINVAL)
+		errx(1, "yhttp_setopt: want YHTTP_EINVAL");
+	if (yhttp_setopt(yh, YHTTP_OPT_ACCEPT_BUDGET, 16) != YHTTP_OK)
+		errx(1, "yhttp_setopt: want YHTTP_OK");
+	if (yh->naccept != 16)
+		errx(1, "yhttp_setopt: have naccept %zu, want 16", yh->naccept);
+
+	if (yhttp_setopt(yh, YHTTP_OPT_IDLE_TIMEOUT, 0) != YHTTP_OK)
+		errx(1, "yhttp_setopt: want YHTTP_OK");
+	if (yh->tidle != 0)
+		errx(1, "yhttp_setopt: have tidle %zu, want 0", yh->tidle);
+	if (yhttp_setopt(yh, YHTTP_OPT_HEADER_TIMEOUT, 500) != YHTTP_OK)
+		errx(1, "yhttp_setopt: want YHTTP_OK");
+	if (yh->theader != 500)
+		errx(1, "yhttp_setopt: have theader %zu, want 500", yh->theader);
+	if (yhttp_setopt(yh, YHTTP_OPT_BODY_TIMEOUT, 1000) != YHTTP_OK)
+		errx(1, "yhttp_setopt: want YHTTP_OK");
+	if (yh->tbody != 1000)
+		errx(1, "yhttp_setopt: have tbody %zu, want 1000", yh->tbody);
+
+	if (yh->maxconns != 0)
+		errx(1, "yhttp_init: have maxconns %zu, want 0", yh->maxconns);
+	if (yhttp_setopt(yh, YHTTP_OPT_MAX_CONNS, 1024) != YHTTP_OK)
+		errx(1, "yhttp_setopt: want YHTTP_OK");
+	if (yh->maxconns != 1024)
+		errx(1, "yhttp_setopt: have maxconns %zu, want 1024", yh->maxconns);
+
+	if (yh->shedtarget != 0)
+		errx(1, "yhttp_init: have shedtarget %zu, want 0", yh->shedtarget);
+	if (yhttp_setopt(yh, YHTTP_OPT_SHED_TARGET, 5) != YHTTP_OK)
+		errx(1, "yhttp_setopt: want YHTTP_OK");
+	if (yh->shedtarget != 5)
+		errx(1, "yhttp_setopt: have shedtarget %zu, want 5", yh->shedtarget);
+	if (yh->shedinterval != 100)
+		errx(1, "yhttp_init: have shedinterval %zu, want 100", yh->shedinterval);
+	if (yhttp_setopt(yh, YHTTP_OPT_SHED_INTERVAL, 0) != YHTTP_EINVAL)
+		errx(1, "yhttp_setopt: want YHTTP_EINVAL");
+	if (yhttp_setopt(yh, YHTTP_OPT_SHED_INTERVAL, 200) != YHTTP_OK)
+		errx(1, "yhttp_setopt: want YHTTP_OK");
+	if (yh->shedinterval != 200)
+		errx(1, "yhttp_setopt: have shedinterval %zu, want 200", yh->shedinterval);
+
+	if (yh->maxrequs != 0)
+		errx(1, "yhttp_init: have maxrequs %zu, want 0", yh->maxrequs);
+	if (yhttp_setopt(yh, YHTTP_OPT_MAX_REQUESTS, 100) != YHTTP_OK)
+		errx(1, "yhttp_setopt: want YHTTP_OK");
+	if (yh->maxrequs != 100)
+		errx(1, "yhttp_setopt: have maxrequs %zu, want 100", yh->maxrequs);
+
+	if (yh->maxrline != 8192)
+		errx(1, "yhttp_init: have maxrline %zu, want 8192", yh->maxrline);
+	if (yhttp_setopt(yh, YHTTP_OPT_MAX_REQUEST_LINE, 1024) != YHTTP_OK)
+		errx(1, "yhttp_setopt: want YHTTP_OK");
+	if (yh->maxrline != 1024)
+		errx(1, "yhttp_setopt: have maxrline %zu, want 1024", yh->maxrline);
+
+	if (yh->maxheader != 65536)
+		errx(1, "yhttp_init: have maxheader %zu, want 65536", yh->maxheader);
+	if (yhttp_setopt(yh, YHTTP_OPT_MAX_HEADER_SIZE, 4096) != YHTTP_OK)
+		errx(1, "yhttp_setopt: want YHTTP_OK");
+	if (yh->maxheader != 4096)
+		errx(1, "yhttp_setopt: have maxheader %zu, want 4096", yh->maxheader);
+
+	if (yh->maxfields != 100)
+		errx(1, "yhttp_init: have maxfields %zu, want 100", yh->maxfields);
+	if (yhttp_setopt(yh, YHTTP_OPT_MAX_HEADERS, 10) != YHTTP_OK)
+		errx(1, "yhttp_setopt: want YHTTP_OK");
+	if (yh->maxfields != 10)
+		errx(1, "yhttp_setopt: have maxfields %zu, want 10", yh->maxfields);
+
+	if (yh->maxbody != 1048576)
+		errx(1, "yhttp_init: have maxbody %zu, want 1048576", yh->maxbody);
+	if (yhttp_setopt(yh, YHTTP_OPT_MAX_BODY_SIZE, 0) != YHTTP_OK)
+		errx(1, "yhttp_setopt: want YHTTP_OK");
+	if (yh->maxbody != 0)
+		errx(1, "yhttp_setopt: have maxbody %zu, want 0", yh->maxbody);
+
+	if (yh->nspare != 0)
+		errx(1, "yhttp_init: have nspare %zu, want 0", yh->nspare);
+	if (yhttp_setopt(yh, YHTTP_OPT_SPARE_REQUESTS, 256) != YHTTP_OK)
+		errx(1, "yhttp_setopt: want YHTTP_OK");
+	if (yh->nspare != 256)
+		errx(1, "yhttp_setopt: have nspare %zu, want 256", yh->nspare);
+
+	/* Options cannot be changed while dispatched. */
+	yh->is_dispatched = 1;
+	if (yhttp_setopt(yh, YHTTP_OPT_WORKERS, 1) != YHTTP_EBUSY)
+		errx(1, "yhttp_setopt: want YHTTP_EBUSY");
+	yh->is_dispatched = 0;
+
+	yhttp_free(&yh);
+
+	return (0);
+}
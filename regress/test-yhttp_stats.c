@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2022 Emil Engler <engler+yhttp@unveil2.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "../arena.h"
+#include "../yhttp.h"
+#include "../yhttp-internal.h"
+
+int
+main(int argc, char *argv[])
+{
+	struct yhttp		*yh;
+	struct yhttp_stats	 stats;
+
+	if ((yh = yhttp_init(8080)) == NULL)
+		err(1, "yhttp_init");
+
+	if (yhttp_stats(NULL, &stats) != YHTTP_EINVAL)
+		errx(1, "yhttp_stats: want YHTTP_EINVAL");
+	if (yhttp_stats(yh, NULL) != YHTTP_EINVAL)
+		errx(1, "yhttp_stats: want YHTTP_EINVAL");
+
+	if (yhttp_stats(yh, &stats) != YHTTP_OK)
+		errx(1, "yhttp_stats: want YHTTP_OK");
+	if (stats.nshed != 0 || stats.nepisodes != 0 || stats.nshedding != 0)
+		errx(1, "yhttp_stats: counters not zero");
+
+	yh->stats.nshed = 3;
+	yh->stats.nepisodes = 2;
+	yh->stats.nshedding = 1;
+	if (yhttp_stats(yh, &stats) != YHTTP_OK)
+		errx(1, "yhttp_stats: want YHTTP_OK");
+	if (stats.nshed != 3 || stats.nepisodes != 2 || stats.nshedding != 1)
+		errx(1, "yhttp_stats: counters not copied");
+
+	yhttp_free(&yh);
+
+	return (0);
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2022 Emil Engler <engler+yhttp@unveil2.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "../arena.h"
+#include "../yhttp.h"
+#include "../yhttp-internal.h"
+
+static void	test_head(struct yhttp_requ *, void *);
+static void	test_chunk(struct yhttp_requ *, const unsigned char *, size_t,
+			   void *);
+
+static void
+test_head(struct yhttp_requ *requ, void *udata)
+{
+}
+
+static void
+test_chunk(struct yhttp_requ *requ, const unsigned char *data, size_t ndata,
+	   void *udata)
+{
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct yhttp	*yh;
+
+	if ((yh = yhttp_init(8080)) == NULL)
+		err(1, "yhttp_init");
+
+	if (yhttp_stream(NULL, test_head, test_chunk) != YHTTP_EINVAL)
+		errx(1, "yhttp_stream: want YHTTP_EINVAL");
+	if (yhttp_stream(yh, test_head, NULL) != YHTTP_EINVAL)
+		errx(1, "yhttp_stream: want YHTTP_EINVAL");
+
+	if (yhttp_stream(yh, test_head, test_chunk) != YHTTP_OK)
+		errx(1, "yhttp_stream: want YHTTP_OK");
+	if (yh->head != test_head || yh->chunk != test_chunk)
+		errx(1, "yhttp_stream: callbacks not set");
+	if (yhttp_stream(yh, NULL, NULL) != YHTTP_OK)
+		errx(1, "yhttp_stream: want YHTTP_OK");
+	if (yh->head != NULL || yh->chunk != NULL)
+		errx(1, "yhttp_stream: callbacks not unset");
+
+	yh->is_dispatched = 1;
+	if (yhttp_stream(yh, NULL, test_chunk) != YHTTP_EBUSY)
+		errx(1, "yhttp_stream: want YHTTP_EBUSY");
+	yh->is_dispatched = 0;
+
+	yhttp_free(&yh);
+
+	return (0);
+}
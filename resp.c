@@ -19,25 +19,23 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "arena.h"
+#include "buf.h"
 #include "hash.h"
 #include "yhttp.h"
 #include "yhttp-internal.h"
-#include "net.h"
 #include "resp.h"
-#include "util.h"
 
 struct status_rp {
 	int		 status;
 	const char	*reason_phrase;
 };
 
-static const char	*resp_find_rp(int);
-static char		*resp_fmt_rline(int);
-static char		*resp_fmt_header(struct hash *);
-static char		*resp_fmt_err(int);
-static int		 resp_transmit_rline(int, int);
-static int		 resp_transmit_headers(int, struct yhttp_resp *);
-static int		 resp_transmit_body(int, struct yhttp_resp *);
+static int		 resp_fmt_rline(struct buf *, int);
+static int		 resp_fmt_header(struct buf *, struct hash *);
+static int		 resp_fmt_err(struct buf *, int);
+static int		 resp_fmt(struct buf *, struct yhttp_resp *,
+				  const char *, int);
 
 static struct status_rp	CODES[] = {
 	{ 100, "Continue" },
@@ -111,7 +109,7 @@ static struct status_rp	CODES[] = {
 	{ 0, "NULL" }
 };
 
-static const char *
+const char *
 resp_find_rp(int status)
 {
 	size_t	i;
@@ -124,143 +122,187 @@ resp_find_rp(int status)
 	return (CODES[i].reason_phrase);
 }
 
-static char *
-resp_fmt_rline(int status)
+static int
+resp_fmt_rline(struct buf *buf, int status)
 {
 	const char	*rp;
 
 	rp = resp_find_rp(status);
 
-	return (util_aprintf("HTTP/1.1 %d %s\r\n", status, rp));
+	return (buf_printf(buf, "HTTP/1.1 %d %s\r\n", status, rp));
 }
 
-static char *
-resp_fmt_header(struct hash *node)
+static int
+resp_fmt_header(struct buf *buf, struct hash *node)
 {
-	return (util_aprintf("%s: %s\r\n", node->name, node->value));
+	return (buf_printf(buf, "%s: %s\r\n", node->name, node->value));
 }
 
-static char *
-resp_fmt_err(int status)
+static int
+resp_fmt_err(struct buf *buf, int status)
 {
 	const char	*rp;
 
 	rp = resp_find_rp(status);
 
-	return (util_aprintf("HTTP/1.1 %d %s\r\n"
-			     "Content-Length: %zu\r\n"
-			     "\r\n"
-			     "%s",
-			     status, rp, strlen(rp), rp));
+	return (buf_printf(buf, "HTTP/1.1 %d %s\r\n"
+			   "Connection: close\r\n"
+			   "Content-Length: %zu\r\n"
+			   "\r\n"
+			   "%s",
+			   status, rp, strlen(rp), rp));
 }
 
+/*
+ * Serialize the entire response into buf, so that it can be transmitted at
+ * once, instead of issuing a send(2) for every single line.  Unless it is
+ * NULL or has been set by the callback function already, the Connection
+ * header field is set to conn.
+ *
+ * A body that is produced by resp->fill is not part of it.  It is either sent
+ * in chunks, or delimited by closing the connection, if chunked is not set.
+ */
 static int
-resp_transmit_rline(int s, int status)
-{
-	char	*rline;
-	ssize_t	 n;
-	size_t	 len;
-
-	if ((rline = resp_fmt_rline(status)) == NULL)
-		return (YHTTP_ERRNO);
-	len = strlen(rline);
-	n = net_send(s, (unsigned char *)rline, len);
-	free(rline);
-	if (n <= 0 || (size_t)n != len)
-		return (YHTTP_ERRNO);
-
-	return (YHTTP_OK);
-}
-
-static int
-resp_transmit_headers(int s, struct yhttp_resp *resp)
+resp_fmt(struct buf *buf, struct yhttp_resp *resp, const char *conn,
+	 int chunked)
 {
 	struct hash	**headers;
-	char		 *header;
-	ssize_t		  n;
-	size_t		  i, len;
+	const char	 *s;
+	size_t		  i;
+	int		  rc;
 
-	if ((headers = hash_dump(resp->headers)) == NULL)
-		return (YHTTP_ERRNO);
+	if ((rc = resp_fmt_rline(buf, resp->status)) != YHTTP_OK)
+		return (rc);
 
-	/* Format and transmit all header fields. */
+	if ((headers = hash_dump(resp->arena, resp->headers)) == NULL)
+		return (YHTTP_ERRNO);
 	for (i = 0; headers[i] != NULL; ++i) {
-		if ((header = resp_fmt_header(headers[i])) == NULL) {
-			free(headers);
-			return (YHTTP_ERRNO);
-		}
-		len = strlen(header);
-
-		n = net_send(s, (unsigned char *)header, len);
-		free(header);
-		if (n <= 0 || (size_t)n != len) {
-			free(headers);
-			return (YHTTP_ERRNO);
-		}
+		if ((rc = resp_fmt_header(buf, headers[i])) != YHTTP_OK)
+			return (rc);
 	}
-	free(headers);
 
-	/* Format and transmit the Content-Length header field. */
-	header = util_aprintf("Content-Length: %zu\r\n\r\n", resp->nbody);
-	if (header == NULL)
-		return (YHTTP_ERRNO);
-	len = strlen(header);
+	if (conn != NULL && hash_get(resp->headers, "Connection") == NULL) {
+		rc = buf_printf(buf, "Connection: %s\r\n", conn);
+		if (rc != YHTTP_OK)
+			return (rc);
+	}
 
-	n = net_send(s, (unsigned char *)header, len);
-	free(header);
-	if (n <= 0 || (size_t)n != len)
-		return (YHTTP_ERRNO);
+	/* An interim response, such as 101, has no body at all. */
+	if (resp->status < 200)
+		return (buf_append(buf, (const unsigned char *)"\r\n", 2));
 
-	return (YHTTP_OK);
-}
+	if (resp->fill != NULL) {
+		s = chunked ? "Transfer-Encoding: chunked\r\n\r\n" : "\r\n";
+		return (buf_append(buf, (const unsigned char *)s, strlen(s)));
+	}
 
-static int
-resp_transmit_body(int s, struct yhttp_resp *resp)
-{
-	ssize_t	n;
+	rc = buf_printf(buf, "Content-Length: %zu\r\n\r\n", resp->nbody);
+	if (rc != YHTTP_OK)
+		return (rc);
 
-	if (resp->nbody == 0) {
-		/* Do nothing if no body was set. */
+	/* Do nothing if no body was set. */
+	if (resp->nbody == 0)
 		return (YHTTP_OK);
-	}
 
-	n = net_send(s, resp->body, resp->nbody);
-	if (n <= 0 || (size_t)n != resp->nbody)
-		return (YHTTP_ERRNO);
+	return (buf_append(buf, resp->body, resp->nbody));
+}
 
-	return (YHTTP_OK);
+/*
+ * Append the serialized response to the output queue out, with conn as the
+ * value of the Connection header field, if it is not NULL.
+ */
+int
+resp(struct buf *out, struct yhttp_resp *resp, const char *conn, int chunked)
+{
+	return (resp_fmt(out, resp, conn, chunked));
 }
 
+/*
+ * Append a chunk of a body with the length ndata to the output queue out.
+ * An ndata of 0 ends the body.
+ */
 int
-resp(int s, struct yhttp_resp *resp)
+resp_chunk(struct buf *out, const unsigned char *data, size_t ndata)
 {
 	int	rc;
 
-	if ((rc = resp_transmit_rline(s, resp->status)) != YHTTP_OK)
-		return (rc);
-	if ((rc = resp_transmit_headers(s, resp)) != YHTTP_OK)
+	if (ndata == 0)
+		return (buf_append(out, (unsigned char *)"0\r\n\r\n", 5));
+
+	if ((rc = buf_printf(out, "%zx\r\n", ndata)) != YHTTP_OK)
 		return (rc);
-	if ((rc = resp_transmit_body(s, resp)) != YHTTP_OK)
+	if ((rc = buf_append(out, data, ndata)) != YHTTP_OK)
 		return (rc);
 
-	return (YHTTP_OK);
+	return (buf_append(out, (unsigned char *)"\r\n", 2));
 }
 
+/*
+ * Append the interim response that asks the client to send the message body
+ * to the output queue out.
+ */
 int
-resp_err(int s, int status)
+resp_continue(struct buf *out)
 {
-	char	*resp;
-	ssize_t	 n;
-	size_t	 len;
+	const char	*s;
 
-	if ((resp = resp_fmt_err(status)) == NULL)
-		return (YHTTP_ERRNO);
-	len = strlen(resp);
+	s = "HTTP/1.1 100 Continue\r\n\r\n";
+	return (buf_append(out, (unsigned char *)s, strlen(s)));
+}
 
-	n = net_send(s, (unsigned char *)resp, len);
-	free(resp);
-	if (n <= 0 || (size_t)n != len)
-		return (YHTTP_ERRNO);
+/*
+ * Append the interim response that lets the client fetch the resources of
+ * the Link header field link early to the output queue out.
+ */
+int
+resp_hint(struct buf *out, const char *link)
+{
+	return (buf_printf(out, "HTTP/1.1 103 %s\r\n"
+			   "Link: %s\r\n"
+			   "\r\n",
+			   resp_find_rp(103), link));
+}
+
+/*
+ * Append the response that switches the connection over to the protocol
+ * proto, as asked for by the Upgrade header field, to the output queue out.
+ */
+int
+resp_switch(struct buf *out, const char *proto)
+{
+	return (buf_printf(out, "HTTP/1.1 101 %s\r\n"
+			   "Connection: Upgrade\r\n"
+			   "Upgrade: %s\r\n"
+			   "\r\n",
+			   resp_find_rp(101), proto));
+}
+
+/*
+ * Append a minimal response with the status code status to the output
+ * queue out.
+ */
+int
+resp_err(struct buf *out, int status)
+{
+	return (resp_fmt_err(out, status));
+}
+
+/*
+ * Append a minimal 503 response to the output queue out, which asks the
+ * client to try again after retry seconds.
+ */
+int
+resp_unavail(struct buf *out, unsigned int retry)
+{
+	const char	*rp;
+
+	rp = resp_find_rp(503);
 
-	return (YHTTP_OK);
+	return (buf_printf(out, "HTTP/1.1 503 %s\r\n"
+			   "Connection: close\r\n"
+			   "Retry-After: %u\r\n"
+			   "Content-Length: %zu\r\n"
+			   "\r\n"
+			   "%s",
+			   rp, retry, strlen(rp), rp));
 }
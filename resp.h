@@ -17,7 +17,14 @@
 #ifndef RESP_H
 #define RESP_H
 
-int	resp(int, struct yhttp_resp *);
-int	resp_err(int, int);
+int	resp(struct buf *, struct yhttp_resp *, const char *, int);
+int	resp_chunk(struct buf *, const unsigned char *, size_t);
+int	resp_continue(struct buf *);
+int	resp_err(struct buf *, int);
+int	resp_hint(struct buf *, const char *);
+int	resp_switch(struct buf *, const char *);
+int	resp_unavail(struct buf *, unsigned int);
+
+const char	*resp_find_rp(int);
 
 #endif
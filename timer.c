@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) 2022 Emil Engler <engler+yhttp@unveil2.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+
+#include <limits.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "timer.h"
+
+static void	timer_unlink(struct timer_wheel *, struct timer *);
+
+static void
+timer_unlink(struct timer_wheel *wheel, struct timer *t)
+{
+	t->prev->next = t->next;
+	t->next->prev = t->prev;
+	t->next = NULL;
+	t->prev = NULL;
+	--wheel->ntimers;
+}
+
+/*
+ * Return the current time of a monotonic clock in milliseconds.
+ */
+uint64_t
+timer_now(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+void
+timer_wheel_init(struct timer_wheel *wheel, uint64_t now)
+{
+	size_t	i;
+
+	for (i = 0; i < TIMER_NSLOTS; ++i) {
+		wheel->slots[i].next = &wheel->slots[i];
+		wheel->slots[i].prev = &wheel->slots[i];
+		wheel->slots[i].expiry = 0;
+	}
+	wheel->tick = now / TIMER_TICK;
+	wheel->ntimers = 0;
+}
+
+/*
+ * Return the number of milliseconds until the next non-empty slot is due,
+ * suitable as the timeout of poll(2), or -1 if no timer is armed.  The slot
+ * may only contain timers of a later revolution, in which case the caller
+ * merely wakes up too early.
+ */
+int
+timer_wheel_timeout(struct timer_wheel *wheel, uint64_t now)
+{
+	struct timer	*head;
+	uint64_t	 tick, ms;
+
+	if (wheel->ntimers == 0)
+		return (-1);
+
+	for (tick = wheel->tick + 1; tick <= wheel->tick + TIMER_NSLOTS;
+	     ++tick) {
+		head = &wheel->slots[tick % TIMER_NSLOTS];
+		if (head->next != head)
+			break;
+	}
+
+	ms = tick * TIMER_TICK;
+	if (ms <= now)
+		return (0);
+	else if (ms - now > INT_MAX)
+		return (INT_MAX);
+	else
+		return (ms - now);
+}
+
+/*
+ * Advance the wheel up to now and return the next timer that has expired on
+ * the way, which is no longer armed afterwards.  It has to be called until
+ * it returns NULL.
+ */
+struct timer *
+timer_wheel_expire(struct timer_wheel *wheel, uint64_t now)
+{
+	struct timer	*head, *t;
+	uint64_t	 tick;
+
+	tick = now / TIMER_TICK;
+	if (wheel->ntimers == 0) {
+		/* Nothing can expire, so skip the slots altogether. */
+		if (tick > wheel->tick)
+			wheel->tick = tick;
+		return (NULL);
+	}
+
+	while (wheel->tick < tick) {
+		head = &wheel->slots[(wheel->tick + 1) % TIMER_NSLOTS];
+		for (t = head->next; t != head; t = t->next) {
+			if (t->expiry <= wheel->tick + 1) {
+				timer_unlink(wheel, t);
+				return (t);
+			}
+		}
+		++wheel->tick;
+	}
+
+	return (NULL);
+}
+
+void
+timer_init(struct timer *t)
+{
+	t->next = NULL;
+	t->prev = NULL;
+	t->expiry = 0;
+}
+
+/*
+ * Arm the timer t to expire timeout milliseconds after now, rounded up to the
+ * resolution of the wheel.  An armed timer is being re-armed.
+ */
+void
+timer_arm(struct timer_wheel *wheel, struct timer *t, uint64_t now,
+	  uint64_t timeout)
+{
+	struct timer	*head;
+
+	if (timer_armed(t))
+		timer_unlink(wheel, t);
+
+	t->expiry = (now + timeout + TIMER_TICK - 1) / TIMER_TICK;
+	if (t->expiry <= wheel->tick)
+		t->expiry = wheel->tick + 1;
+
+	head = &wheel->slots[t->expiry % TIMER_NSLOTS];
+	t->next = head;
+	t->prev = head->prev;
+	head->prev->next = t;
+	head->prev = t;
+	++wheel->ntimers;
+}
+
+void
+timer_cancel(struct timer_wheel *wheel, struct timer *t)
+{
+	if (timer_armed(t))
+		timer_unlink(wheel, t);
+}
+
+int
+timer_armed(const struct timer *t)
+{
+	return (t->prev != NULL);
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2022 Emil Engler <engler+yhttp@unveil2.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef TIMER_H
+#define TIMER_H
+
+/*
+ * The resolution of the timer wheel in milliseconds and the number of its
+ * slots.  A full revolution of the wheel spans TIMER_TICK * TIMER_NSLOTS
+ * milliseconds, longer timeouts simply stay in their slot for several
+ * revolutions.
+ */
+#define TIMER_TICK	250
+#define TIMER_NSLOTS	256
+
+/*
+ * A timer is embedded into the structure it belongs to.  The lists of the
+ * slots are circular and doubly linked, so that arming and cancelling a
+ * timer only touches its neighbours.
+ */
+struct timer {
+	struct timer	*next;
+	struct timer	*prev;		/* NULL if the timer is not armed. */
+	uint64_t	 expiry;	/* The tick at which it expires. */
+};
+
+struct timer_wheel {
+	struct timer	 slots[TIMER_NSLOTS];	/* The list heads. */
+	uint64_t	 tick;		/* The last tick that has been run. */
+	size_t		 ntimers;	/* The number of armed timers. */
+};
+
+uint64_t	 timer_now(void);
+
+void		 timer_wheel_init(struct timer_wheel *, uint64_t);
+int		 timer_wheel_timeout(struct timer_wheel *, uint64_t);
+struct timer	*timer_wheel_expire(struct timer_wheel *, uint64_t);
+
+void		 timer_init(struct timer *);
+void		 timer_arm(struct timer_wheel *, struct timer *, uint64_t,
+			   uint64_t);
+void		 timer_cancel(struct timer_wheel *, struct timer *);
+int		 timer_armed(const struct timer *);
+
+#endif
@@ -0,0 +1,611 @@
+/*
+ * Copyright (c) 2022 Emil Engler <engler+yhttp@unveil2.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/types.h>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "buf.h"
+#include "pool.h"
+#include "yhttp.h"
+#include "ws.h"
+
+/* Appended to the key of the client, see ws_accept(). */
+#define WS_GUID		"258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+/*
+ * Messages are refused with YHTTP_EBUSY, while more than WS_NQUEUE bytes have
+ * not been taken over by the event loop yet.
+ */
+#define WS_NQUEUE	(1024 * 1024)
+
+#define WS_FIN		0x80
+#define WS_RSV		0x70
+#define WS_MASK		0x80
+
+static uint32_t	 ws_rol(uint32_t, int);
+static void	 ws_sha1(const unsigned char *, size_t, unsigned char *);
+static int	 ws_utf8(const unsigned char *, size_t);
+static int	 ws_fail(struct yhttp_ws *, enum ws_status);
+static int	 ws_on_close(struct yhttp_ws *, const unsigned char *,
+			     size_t);
+static int	 ws_on_data(struct yhttp_ws *, enum ws_opcode, int,
+			    const unsigned char *, size_t);
+static int	 ws_frame(struct yhttp_ws *, unsigned char *, size_t,
+			  size_t *);
+
+static uint32_t
+ws_rol(uint32_t x, int n)
+{
+	return (x << n | x >> (32 - n));
+}
+
+/*
+ * Compute the SHA-1 digest of s, which is only used for the handshake.
+ */
+static void
+ws_sha1(const unsigned char *s, size_t ns, unsigned char *digest)
+{
+	uint32_t	h[5], w[80], a, b, c, d, e, f, k, t;
+	unsigned char	block[64];
+	uint64_t	nbits;
+	size_t		i, j, off;
+
+	h[0] = 0x67452301;
+	h[1] = 0xefcdab89;
+	h[2] = 0x98badcfe;
+	h[3] = 0x10325476;
+	h[4] = 0xc3d2e1f0;
+	nbits = (uint64_t)ns * 8;
+
+	/* The padding takes one or two blocks after the complete ones. */
+	for (off = 0; off < ns + 9; off += 64) {
+		for (i = 0; i < 64; ++i) {
+			if (off + i < ns)
+				block[i] = s[off + i];
+			else if (off + i == ns)
+				block[i] = 0x80;
+			else
+				block[i] = 0;
+		}
+		if (off + 64 >= ns + 9) {
+			for (i = 0; i < 8; ++i)
+				block[63 - i] = nbits >> (i * 8);
+		}
+
+		for (i = 0; i < 16; ++i) {
+			w[i] = (uint32_t)block[i * 4] << 24 |
+			    (uint32_t)block[i * 4 + 1] << 16 |
+			    (uint32_t)block[i * 4 + 2] << 8 | block[i * 4 + 3];
+		}
+		for (i = 16; i < 80; ++i)
+			w[i] = ws_rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^
+				      w[i - 16], 1);
+
+		a = h[0];
+		b = h[1];
+		c = h[2];
+		d = h[3];
+		e = h[4];
+		for (j = 0; j < 80; ++j) {
+			if (j < 20) {
+				f = (b & c) | (~b & d);
+				k = 0x5a827999;
+			} else if (j < 40) {
+				f = b ^ c ^ d;
+				k = 0x6ed9eba1;
+			} else if (j < 60) {
+				f = (b & c) | (b & d) | (c & d);
+				k = 0x8f1bbcdc;
+			} else {
+				f = b ^ c ^ d;
+				k = 0xca62c1d6;
+			}
+			t = ws_rol(a, 5) + f + e + k + w[j];
+			e = d;
+			d = c;
+			c = ws_rol(b, 30);
+			b = a;
+			a = t;
+		}
+		h[0] += a;
+		h[1] += b;
+		h[2] += c;
+		h[3] += d;
+		h[4] += e;
+	}
+
+	for (i = 0; i < 5; ++i) {
+		digest[i * 4] = h[i] >> 24;
+		digest[i * 4 + 1] = h[i] >> 16;
+		digest[i * 4 + 2] = h[i] >> 8;
+		digest[i * 4 + 3] = h[i];
+	}
+}
+
+/*
+ * Check whether s is valid UTF-8, as the payload of a text message has to be.
+ */
+static int
+ws_utf8(const unsigned char *s, size_t ns)
+{
+	uint32_t	cp, min;
+	size_t		i, j, n;
+
+	for (i = 0; i < ns; i += n) {
+		if (s[i] < 0x80) {
+			n = 1;
+			continue;
+		} else if ((s[i] & 0xe0) == 0xc0) {
+			n = 2;
+			cp = s[i] & 0x1f;
+			min = 0x80;
+		} else if ((s[i] & 0xf0) == 0xe0) {
+			n = 3;
+			cp = s[i] & 0x0f;
+			min = 0x800;
+		} else if ((s[i] & 0xf8) == 0xf0) {
+			n = 4;
+			cp = s[i] & 0x07;
+			min = 0x10000;
+		} else
+			return (0);
+
+		if (ns - i < n)
+			return (0);
+		for (j = 1; j < n; ++j) {
+			if ((s[i + j] & 0xc0) != 0x80)
+				return (0);
+			cp = cp << 6 | (s[i + j] & 0x3f);
+		}
+
+		/* Overlong forms, surrogates and beyond Unicode. */
+		if (cp < min || (cp >= 0xd800 && cp <= 0xdfff) ||
+		    cp > 0x10ffff)
+			return (0);
+	}
+
+	return (1);
+}
+
+/*
+ * Close the connection because of a violation of the protocol by the client.
+ * Everything it sends afterwards is ignored.
+ */
+static int
+ws_fail(struct yhttp_ws *ws, enum ws_status status)
+{
+	ws->failed = 1;
+	buf_wipe(&ws->msg);
+
+	return (ws_close(ws, status));
+}
+
+/*
+ * Answer a close frame with one, unless one has been sent already.
+ */
+static int
+ws_on_close(struct yhttp_ws *ws, const unsigned char *p, size_t n)
+{
+	unsigned int	status;
+
+	ws->recvclose = 1;
+	if (n == 0)
+		return (ws_close(ws, 0));
+	if (n == 1 || !ws_utf8(p + 2, n - 2))
+		return (ws_fail(ws, n == 1 ? WS_PROTOCOL_ERROR :
+				WS_INVALID_DATA));
+
+	/* The codes that may appear on the wire. */
+	status = p[0] << 8 | p[1];
+	if (status < 1000 || status >= 5000 || status == 1004 ||
+	    status == 1005 || status == 1006 ||
+	    (status > 1011 && status < 3000))
+		return (ws_fail(ws, WS_PROTOCOL_ERROR));
+
+	return (ws_close(ws, status));
+}
+
+/*
+ * Add a fragment to the current message, and pass the message to the
+ * callback function once fin is set.
+ */
+static int
+ws_on_data(struct yhttp_ws *ws, enum ws_opcode opcode, int fin,
+	   const unsigned char *p, size_t n)
+{
+	enum yhttp_ws_event	event;
+	int			rc;
+
+	if ((opcode == WS_CONTINUATION) != (ws->opcode != 0))
+		return (ws_fail(ws, WS_PROTOCOL_ERROR));
+	if (opcode != WS_CONTINUATION)
+		ws->opcode = opcode;
+
+	if ((rc = buf_append(&ws->msg, p, n)) != YHTTP_OK)
+		return (rc);
+	if (!fin)
+		return (YHTTP_OK);
+
+	if (ws->opcode == WS_TEXT && !ws_utf8(ws->msg.buf, ws->msg.used))
+		return (ws_fail(ws, WS_INVALID_DATA));
+
+	event = ws->opcode == WS_TEXT ? YHTTP_WS_TEXT : YHTTP_WS_BINARY;
+	ws->opcode = 0;
+	ws->cb(ws, event, ws->msg.buf, ws->msg.used, ws->arg);
+	buf_wipe(&ws->msg);
+
+	return (YHTTP_OK);
+}
+
+/*
+ * Handle the frame at the start of the n bytes of p, whose length is stored
+ * in nframe, or 0 if it is not complete yet.
+ */
+static int
+ws_frame(struct yhttp_ws *ws, unsigned char *p, size_t n, size_t *nframe)
+{
+	enum ws_opcode	 opcode;
+	unsigned char	*mask;
+	uint64_t	 len;
+	size_t		 nhdr, i;
+	int		 fin, rc;
+
+	*nframe = 0;
+	if (n < 2)
+		return (YHTTP_OK);
+
+	/* No extensions are negotiated and clients have to mask. */
+	if ((p[0] & WS_RSV) || !(p[1] & WS_MASK))
+		return (ws_fail(ws, WS_PROTOCOL_ERROR));
+	fin = p[0] & WS_FIN;
+	opcode = p[0] & 0x0f;
+
+	len = p[1] & 0x7f;
+	nhdr = 6;
+	if (len == 126) {
+		nhdr = 8;
+		if (n < 4)
+			return (YHTTP_OK);
+		len = p[2] << 8 | p[3];
+	} else if (len == 127) {
+		nhdr = 14;
+		if (n < 10)
+			return (YHTTP_OK);
+		len = 0;
+		for (i = 2; i < 10; ++i)
+			len = len << 8 | p[i];
+	}
+
+	if (opcode >= WS_CLOSE) {
+		if (opcode > WS_PONG || !fin || len > 125)
+			return (ws_fail(ws, WS_PROTOCOL_ERROR));
+	} else if (opcode > WS_BINARY)
+		return (ws_fail(ws, WS_PROTOCOL_ERROR));
+	else if (len > SIZE_MAX / 4 ||
+		 (ws->limit != 0 && len > ws->limit - ws->msg.used))
+		return (ws_fail(ws, WS_TOO_BIG));
+
+	if (n < nhdr || n - nhdr < len)
+		return (YHTTP_OK);
+	*nframe = nhdr + len;
+
+	mask = p + nhdr - 4;
+	p += nhdr;
+	for (i = 0; i < len; ++i)
+		p[i] ^= mask[i % 4];
+
+	switch (opcode) {
+	case WS_CLOSE:
+		return (ws_on_close(ws, p, len));
+	case WS_PING:
+		/* There is no answer after a close frame. */
+		rc = ws_queue(ws, WS_PONG, p, len);
+		return (rc == YHTTP_EINVAL ? YHTTP_OK : rc);
+	case WS_PONG:
+		return (YHTTP_OK);
+	default:
+		return (ws_on_data(ws, opcode, fin, p, len));
+	}
+}
+
+/*
+ * Create the state of a WebSocket connection, which passes its messages to
+ * cb and wakes the event loop of cq up for the frames of yhttp_ws_send().
+ * Messages are at most limit bytes long, unless it is 0.
+ */
+struct yhttp_ws *
+ws_init(void (*cb)(struct yhttp_ws *, enum yhttp_ws_event,
+		   const unsigned char *, size_t, void *),
+	void *arg, size_t limit, struct pool_cq *cq)
+{
+	struct yhttp_ws	*ws;
+
+	if ((ws = malloc(sizeof(struct yhttp_ws))) == NULL)
+		return (NULL);
+
+	/* job is never run by the pool, which tells it apart from others. */
+	ws->job.fn = NULL;
+	ws->job.cq = cq;
+	ws->job.next = NULL;
+	pthread_mutex_init(&ws->mtx, NULL);
+	buf_init(&ws->queue);
+	ws->queued = 0;
+	ws->orphan = 0;
+	ws->sentclose = 0;
+	ws->cq = cq;
+	buf_init(&ws->in);
+	buf_init(&ws->msg);
+	ws->opcode = 0;
+	ws->closed = 0;
+	ws->recvclose = 0;
+	ws->failed = 0;
+	ws->pinged = 0;
+	ws->limit = limit;
+	ws->conn = NULL;
+	ws->cb = cb;
+	ws->arg = arg;
+
+	return (ws);
+}
+
+/*
+ * Release ws on behalf of its connection.  If its job is still in the
+ * completion queue, it is freed by ws_taken() instead.
+ */
+void
+ws_free(struct yhttp_ws *ws)
+{
+	if (ws == NULL)
+		return;
+
+	buf_wipe(&ws->in);
+	buf_wipe(&ws->msg);
+
+	pthread_mutex_lock(&ws->mtx);
+	ws->sentclose = 1;
+	if (ws->queued) {
+		ws->orphan = 1;
+		pthread_mutex_unlock(&ws->mtx);
+		return;
+	}
+	pthread_mutex_unlock(&ws->mtx);
+
+	pthread_mutex_destroy(&ws->mtx);
+	buf_wipe(&ws->queue);
+	free(ws);
+}
+
+/*
+ * Compute the value of Sec-WebSocket-Accept for the Sec-WebSocket-Key of the
+ * client, which has to be the base64 encoding of 16 bytes, into the 29 bytes
+ * of accept.
+ */
+int
+ws_accept(const char *key, char *accept)
+{
+	const char	*alphabet;
+	unsigned char	 s[24 + sizeof(WS_GUID) - 1], digest[20];
+	uint32_t	 bits;
+	size_t		 i, n;
+
+	alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+		   "abcdefghijklmnopqrstuvwxyz0123456789+/";
+	if (strlen(key) != 24 || strcmp(key + 22, "==") != 0)
+		return (YHTTP_EINVAL);
+	for (i = 0; i < 22; ++i) {
+		if (strchr(alphabet, key[i]) == NULL)
+			return (YHTTP_EINVAL);
+	}
+
+	memcpy(s, key, 24);
+	memcpy(s + 24, WS_GUID, sizeof(WS_GUID) - 1);
+	ws_sha1(s, sizeof(s), digest);
+
+	/* The 20 bytes of the digest end with two bytes of padding. */
+	for (i = 0, n = 0; i < 21; i += 3) {
+		bits = (uint32_t)digest[i] << 16 | (uint32_t)digest[i + 1] << 8;
+		if (i + 2 < 20)
+			bits |= digest[i + 2];
+		accept[n++] = alphabet[bits >> 18 & 0x3f];
+		accept[n++] = alphabet[bits >> 12 & 0x3f];
+		accept[n++] = alphabet[bits >> 6 & 0x3f];
+		accept[n++] = i + 2 < 20 ? alphabet[bits & 0x3f] : '=';
+	}
+	accept[n] = '\0';
+
+	return (YHTTP_OK);
+}
+
+/*
+ * Handle the n bytes of p that have been received, passing complete messages
+ * on to the callback function.
+ */
+int
+ws_parse(struct yhttp_ws *ws, const unsigned char *p, size_t n)
+{
+	size_t	nframe, off;
+	int	rc;
+
+	ws->pinged = 0;
+	if (ws->failed || ws->recvclose)
+		return (YHTTP_OK);
+
+	if ((rc = buf_append(&ws->in, p, n)) != YHTTP_OK)
+		return (rc);
+
+	off = 0;
+	while (!ws->failed && !ws->recvclose) {
+		rc = ws_frame(ws, ws->in.buf + off, ws->in.used - off,
+			      &nframe);
+		if (rc != YHTTP_OK)
+			return (rc);
+		if (nframe == 0)
+			break;
+		off += nframe;
+	}
+
+	if (ws->failed || ws->recvclose || off == ws->in.used)
+		buf_wipe(&ws->in);
+	else if (off != 0)
+		return (buf_pop(&ws->in, off));
+
+	return (YHTTP_OK);
+}
+
+/*
+ * Queue a frame with the payload p of n bytes, and wake the event loop up.
+ * Nothing may follow a close frame.
+ */
+int
+ws_queue(struct yhttp_ws *ws, enum ws_opcode opcode, const unsigned char *p,
+	 size_t n)
+{
+	unsigned char	hdr[10];
+	size_t		nhdr, i;
+	int		rc;
+
+	hdr[0] = WS_FIN | opcode;
+	if (n < 126) {
+		hdr[1] = n;
+		nhdr = 2;
+	} else if (n <= UINT16_MAX) {
+		hdr[1] = 126;
+		hdr[2] = n >> 8;
+		hdr[3] = n;
+		nhdr = 4;
+	} else {
+		hdr[1] = 127;
+		for (i = 0; i < 8; ++i)
+			hdr[9 - i] = (uint64_t)n >> (i * 8);
+		nhdr = 10;
+	}
+
+	pthread_mutex_lock(&ws->mtx);
+	if (ws->sentclose) {
+		rc = YHTTP_EINVAL;
+		goto end;
+	}
+	if (opcode < WS_CLOSE && ws->queue.used > WS_NQUEUE) {
+		rc = YHTTP_EBUSY;
+		goto end;
+	}
+
+	if ((rc = buf_append(&ws->queue, hdr, nhdr)) != YHTTP_OK)
+		goto end;
+	if ((rc = buf_append(&ws->queue, p, n)) != YHTTP_OK) {
+		ws->queue.used -= nhdr;
+		goto end;
+	}
+	if (opcode == WS_CLOSE)
+		ws->sentclose = 1;
+
+	/* Only the first frame since the last wakeup needs to wake it up. */
+	if (!ws->queued && ws->cq != NULL) {
+		ws->queued = 1;
+		pool_cq_push(ws->cq, &ws->job);
+	}
+end:
+	pthread_mutex_unlock(&ws->mtx);
+
+	return (rc);
+}
+
+/*
+ * Queue a close frame with status, or without one if it is 0.  A close frame
+ * that has been queued already is not repeated.
+ */
+int
+ws_close(struct yhttp_ws *ws, int status)
+{
+	unsigned char	p[2];
+	int		rc;
+
+	p[0] = status >> 8;
+	p[1] = status;
+	rc = ws_queue(ws, WS_CLOSE, p, status != 0 ? 2 : 0);
+
+	return (rc == YHTTP_EINVAL ? YHTTP_OK : rc);
+}
+
+/*
+ * Ask an idle client for a sign of life, which any frame of it is.
+ */
+int
+ws_ping(struct yhttp_ws *ws)
+{
+	ws->pinged = 1;
+	return (ws_queue(ws, WS_PING, NULL, 0));
+}
+
+/*
+ * Move the queued frames over to the output queue out.
+ */
+int
+ws_take(struct yhttp_ws *ws, struct buf *out)
+{
+	struct buf	tmp;
+	int		rc;
+
+	rc = YHTTP_OK;
+	pthread_mutex_lock(&ws->mtx);
+	if (out->used == 0) {
+		tmp = *out;
+		*out = ws->queue;
+		ws->queue = tmp;
+	} else if (ws->queue.used != 0) {
+		rc = buf_append(out, ws->queue.buf, ws->queue.used);
+		buf_wipe(&ws->queue);
+	}
+	ws->closed = ws->sentclose;
+	pthread_mutex_unlock(&ws->mtx);
+
+	return (rc);
+}
+
+/*
+ * Note that the job of ws has been taken out of the completion queue.  Return
+ * 0 if its connection had been closed in the meantime, as ws is gone then.
+ */
+int
+ws_taken(struct yhttp_ws *ws)
+{
+	pthread_mutex_lock(&ws->mtx);
+	ws->queued = 0;
+	if (ws->orphan) {
+		pthread_mutex_unlock(&ws->mtx);
+		pthread_mutex_destroy(&ws->mtx);
+		buf_wipe(&ws->queue);
+		free(ws);
+		return (0);
+	}
+	pthread_mutex_unlock(&ws->mtx);
+
+	return (1);
+}
+
+/*
+ * Whether the connection is to be closed, once the output queue has been
+ * transmitted.
+ */
+int
+ws_done(const struct yhttp_ws *ws)
+{
+	return (ws->closed && (ws->recvclose || ws->failed));
+}
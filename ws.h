@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2022 Emil Engler <engler+yhttp@unveil2.org>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef WS_H
+#define WS_H
+
+enum ws_opcode {
+	WS_CONTINUATION = 0x0,
+	WS_TEXT = 0x1,
+	WS_BINARY = 0x2,
+	WS_CLOSE = 0x8,
+	WS_PING = 0x9,
+	WS_PONG = 0xa
+};
+
+/* The status codes of a close frame. */
+enum ws_status {
+	WS_NORMAL = 1000,
+	WS_GOING_AWAY = 1001,
+	WS_PROTOCOL_ERROR = 1002,
+	WS_INVALID_DATA = 1007,
+	WS_TOO_BIG = 1009
+};
+
+/*
+ * A connection that has switched over to the WebSocket protocol.  Frames may
+ * be queued from any thread, after which job is pushed into the completion
+ * queue of the event loop, so that it takes them over into the output queue
+ * of the connection.
+ */
+struct yhttp_ws {
+	struct pool_job	 job;		/* Must be the first member. */
+	pthread_mutex_t	 mtx;		/* Protects the members up to cq. */
+	struct buf	 queue;		/* Frames not yet taken over. */
+	int		 queued;	/* job is in the completion queue. */
+	int		 orphan;	/* Free once job has been taken. */
+	int		 sentclose;	/* A close frame has been queued. */
+	struct pool_cq	*cq;		/* Of the event loop. */
+
+	/* Only accessed by the event loop. */
+	struct buf	 in;		/* An incomplete frame. */
+	struct buf	 msg;		/* An incomplete message. */
+	int		 opcode;	/* The opcode of msg, or 0. */
+	int		 closed;	/* The close frame has been taken. */
+	int		 recvclose;	/* A close frame has been received. */
+	int		 failed;	/* The client has violated the protocol. */
+	int		 pinged;	/* The client has not answered yet. */
+	size_t		 limit;		/* The length of a message, or 0. */
+	void		*conn;		/* The connection of the event loop. */
+
+	void		(*cb)(struct yhttp_ws *, enum yhttp_ws_event,
+			      const unsigned char *, size_t, void *);
+	void		*arg;
+};
+
+struct yhttp_ws	*ws_init(void (*)(struct yhttp_ws *, enum yhttp_ws_event,
+				  const unsigned char *, size_t, void *),
+			 void *, size_t, struct pool_cq *);
+void		 ws_free(struct yhttp_ws *);
+
+int		 ws_accept(const char *, char *);
+int		 ws_parse(struct yhttp_ws *, const unsigned char *, size_t);
+int		 ws_queue(struct yhttp_ws *, enum ws_opcode,
+			  const unsigned char *, size_t);
+int		 ws_close(struct yhttp_ws *, int);
+int		 ws_ping(struct yhttp_ws *);
+int		 ws_take(struct yhttp_ws *, struct buf *);
+int		 ws_taken(struct yhttp_ws *);
+int		 ws_done(const struct yhttp_ws *);
+
+#endif
@@ -18,28 +18,71 @@
 #define YHTTP_INTERNAL_H
 
 struct yhttp {
-	int		pipe[2];	/* pipe(2). */
-	int		is_dispatched;	/* yhttp_dispatch() is running. */
-	uint16_t	port;		/* The TCP port. */
+	int		(*pipes)[2];	/* One pipe(2) per event loop. */
+	size_t		  npipes;	/* The number of event loops. */
+	struct pool	 *pool;		/* The handler pool or NULL. */
+	size_t		  nworkers;	/* Threads of the handler pool. */
+	size_t		  naccept;	/* Connections accepted per wakeup. */
+	size_t		  tidle;	/* Timeouts in milliseconds. */
+	size_t		  theader;
+	size_t		  tbody;
+	size_t		  maxconns;	/* Connections at most, or 0. */
+	size_t		  shedtarget;	/* Acceptable waiting time, or 0. */
+	size_t		  shedinterval;
+	size_t		  maxrequs;	/* Requests per connection, or 0. */
+	size_t		  maxrline;	/* Limits of a request, or 0. */
+	size_t		  maxheader;
+	size_t		  maxfields;
+	size_t		  maxbody;
+	size_t		  nspare;	/* Requests allocated up front. */
+	struct yhttp_stats
+			  stats;	/* Updated by the event loops. */
+	void		(*head)(struct yhttp_requ *, void *);
+	void		(*chunk)(struct yhttp_requ *, const unsigned char *,
+				 size_t, void *);
+	int		(*expect)(struct yhttp_requ *, void *);
+	int		  is_dispatched;/* yhttp_dispatch() is running. */
+	uint16_t	  port;		/* The TCP port. */
 };
 
+/*
+ * Everything that belongs to a request, including the request itself, is
+ * being allocated from its arena, which is being freed in one step.
+ */
 struct yhttp_requ_internal {
+	struct arena		  arena;
 	struct hash		**headers;	/* Header fields. */
 	struct hash		**queries;	/* Query fields. */
 	struct yhttp_resp	 *resp;
+	const struct sockaddr	 *addr;		/* The address of the client. */
+	char			 *ip;		/* addr formatted on demand. */
+
+	/* Sends a 103 response, while the callback function is running. */
+	int			(*hint)(struct yhttp_requ *, const char *);
+	void			 *hintarg;
 };
 
 struct yhttp_resp {
+	struct arena	 *arena;	/* The one of the request. */
 	struct hash	**headers;	/* The header fields. */
 	unsigned char	 *body;		/* The message body. */
 	size_t		  nbody;	/* The length of the body. */
 	int		  status;	/* The HTTP status code. */
+
+	/* Produces the body in place of body, if it is not NULL. */
+	ssize_t		(*fill)(struct yhttp_requ *, unsigned char *, size_t,
+				void *);
+
+	/* Takes the connection over after the response, if it is not NULL. */
+	void		(*ws)(struct yhttp_ws *, enum yhttp_ws_event,
+			      const unsigned char *, size_t, void *);
+	void		 *arg;		/* The last argument of fill or ws. */
 };
 
 struct yhttp_requ	*yhttp_requ_init(void);
+struct yhttp_requ	*yhttp_requ_reset(struct yhttp_requ *);
 void			 yhttp_requ_free(struct yhttp_requ *);
 
-struct yhttp_resp	*yhttp_resp_init(void);
-void			 yhttp_resp_free(struct yhttp_resp *);
+struct yhttp_resp	*yhttp_resp_init(struct arena *);
 
 #endif
@@ -15,9 +15,15 @@
  */
 
 #include <sys/types.h>
+#include <sys/socket.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
 #include <assert.h>
 #include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -25,10 +31,94 @@
 #include <unistd.h>
 
 #include "abnf.h"
+#include "arena.h"
+#include "buf.h"
 #include "hash.h"
 #include "yhttp.h"
 #include "yhttp-internal.h"
 #include "net.h"
+#include "pool.h"
+#include "ws.h"
+
+struct loop {
+	struct yhttp	 *yh;
+	void		(*cb)(struct yhttp_requ *, void *);
+	void		 *udata;
+	pthread_t	  thread;
+	int		  read_pipe;
+	int		  rc;
+};
+
+static void		 *yhttp_loop_run(void *);
+static struct yhttp_requ *yhttp_requ_build(struct arena *);
+
+/*
+ * Run one event loop.  If it fails, the remaining event loops are told to
+ * shutdown as well.
+ */
+static void *
+yhttp_loop_run(void *arg)
+{
+	struct loop	*loop;
+
+	loop = arg;
+	loop->rc = net_dispatch(loop->yh, loop->read_pipe, loop->cb,
+				loop->udata);
+	if (loop->rc != YHTTP_OK)
+		yhttp_stop(loop->yh);
+
+	return (NULL);
+}
+
+/*
+ * Build a request inside of arena, which moves into the space it has
+ * allocated for the internal part.  The arena is being freed on failure.
+ */
+static struct yhttp_requ *
+yhttp_requ_build(struct arena *arena)
+{
+	struct yhttp_requ_internal	*internal;
+	struct yhttp_requ		*requ;
+
+	if ((internal = arena_alloc(arena, sizeof(*internal))) == NULL) {
+		arena_free(arena);
+		return (NULL);
+	}
+	internal->arena = *arena;
+
+	if ((requ = arena_alloc(&internal->arena, sizeof(*requ))) == NULL)
+		goto err;
+	requ->internal = internal;
+
+	requ->path = NULL;
+
+	/*
+	 * The request body will be stored inside the buffer of the parser
+	 * rather than in a separately allocated space, meaning the clean-up
+	 * is not in our scope.
+	 */
+	requ->body = NULL;
+	requ->nbody = 0;
+
+	requ->method = YHTTP_GET;
+
+	internal->addr = NULL;
+	internal->ip = NULL;
+	internal->hint = NULL;
+	internal->hintarg = NULL;
+
+	if ((internal->headers = hash_init(&internal->arena)) == NULL)
+		goto err;
+	if ((internal->queries = hash_init(&internal->arena)) == NULL)
+		goto err;
+	if ((internal->resp = yhttp_resp_init(&internal->arena)) == NULL)
+		goto err;
+
+	return (requ);
+err:
+	arena_free(&internal->arena);
+	return (NULL);
+}
 
 /*
  * Functions from yhttp.h.
@@ -50,7 +140,27 @@ yhttp_init(uint16_t port)
 	if ((yh = malloc(sizeof(struct yhttp))) == NULL)
 		return (NULL);
 
-	memset(yh->pipe, -1, sizeof(yh->pipe));
+	yh->pipes = NULL;
+	yh->npipes = 0;
+	yh->pool = NULL;
+	yh->nworkers = 0;
+	yh->naccept = 64;
+	yh->tidle = 60000;
+	yh->theader = 10000;
+	yh->tbody = 30000;
+	yh->maxconns = 0;
+	yh->shedtarget = 0;
+	yh->shedinterval = 100;
+	yh->maxrequs = 0;
+	yh->maxrline = 8192;
+	yh->maxheader = 65536;
+	yh->maxfields = 100;
+	yh->maxbody = 1048576;
+	yh->nspare = 0;
+	memset(&yh->stats, 0, sizeof(yh->stats));
+	yh->head = NULL;
+	yh->chunk = NULL;
+	yh->expect = NULL;
 	yh->is_dispatched = 0;
 	yh->port = port;
 
@@ -67,6 +177,113 @@ yhttp_free(struct yhttp **yh)
 	*yh = NULL;
 }
 
+int
+yhttp_setopt(struct yhttp *yh, enum yhttp_opt opt, size_t value)
+{
+	if (yh == NULL)
+		return (YHTTP_EINVAL);
+
+	/* Options cannot be changed while the server is running. */
+	if (yh->is_dispatched)
+		return (YHTTP_EBUSY);
+
+	switch (opt) {
+	case YHTTP_OPT_WORKERS:
+		yh->nworkers = value;
+		break;
+	case YHTTP_OPT_ACCEPT_BUDGET:
+		if (value == 0)
+			return (YHTTP_EINVAL);
+		yh->naccept = value;
+		break;
+	case YHTTP_OPT_IDLE_TIMEOUT:
+		yh->tidle = value;
+		break;
+	case YHTTP_OPT_HEADER_TIMEOUT:
+		yh->theader = value;
+		break;
+	case YHTTP_OPT_BODY_TIMEOUT:
+		yh->tbody = value;
+		break;
+	case YHTTP_OPT_MAX_CONNS:
+		yh->maxconns = value;
+		break;
+	case YHTTP_OPT_SHED_TARGET:
+		yh->shedtarget = value;
+		break;
+	case YHTTP_OPT_SHED_INTERVAL:
+		if (value == 0)
+			return (YHTTP_EINVAL);
+		yh->shedinterval = value;
+		break;
+	case YHTTP_OPT_MAX_REQUESTS:
+		yh->maxrequs = value;
+		break;
+	case YHTTP_OPT_MAX_REQUEST_LINE:
+		yh->maxrline = value;
+		break;
+	case YHTTP_OPT_MAX_HEADER_SIZE:
+		yh->maxheader = value;
+		break;
+	case YHTTP_OPT_MAX_HEADERS:
+		yh->maxfields = value;
+		break;
+	case YHTTP_OPT_MAX_BODY_SIZE:
+		yh->maxbody = value;
+		break;
+	case YHTTP_OPT_SPARE_REQUESTS:
+		yh->nspare = value;
+		break;
+	default:
+		return (YHTTP_EINVAL);
+	}
+
+	return (YHTTP_OK);
+}
+
+int
+yhttp_stats(struct yhttp *yh, struct yhttp_stats *stats)
+{
+	if (yh == NULL || stats == NULL)
+		return (YHTTP_EINVAL);
+
+	/* The event loops may update the counters at any time. */
+	stats->nshed = __sync_add_and_fetch(&yh->stats.nshed, 0);
+	stats->nepisodes = __sync_add_and_fetch(&yh->stats.nepisodes, 0);
+	stats->nshedding = __sync_add_and_fetch(&yh->stats.nshedding, 0);
+
+	return (YHTTP_OK);
+}
+
+int
+yhttp_stream(struct yhttp *yh, void (*head)(struct yhttp_requ *, void *),
+	     void (*chunk)(struct yhttp_requ *, const unsigned char *, size_t,
+			   void *))
+{
+	if (yh == NULL || (head != NULL && chunk == NULL))
+		return (YHTTP_EINVAL);
+	if (yh->is_dispatched)
+		return (YHTTP_EBUSY);
+
+	yh->head = head;
+	yh->chunk = chunk;
+
+	return (YHTTP_OK);
+}
+
+int
+yhttp_expect(struct yhttp *yh, int (*expect)(struct yhttp_requ *, void *))
+{
+	if (yh == NULL)
+		return (YHTTP_EINVAL);
+	if (yh->is_dispatched)
+		return (YHTTP_EBUSY);
+
+	yh->expect = expect;
+
+	return (YHTTP_OK);
+}
+
 char *
 yhttp_header(struct yhttp_requ *requ, const char *name)
 {
@@ -93,6 +310,55 @@ yhttp_query(struct yhttp_requ *requ, const char *key)
 		return (node->value);
 }
 
+char *
+yhttp_client_ip(struct yhttp_requ *requ)
+{
+	struct yhttp_requ_internal	*internal;
+	const struct sockaddr		*sa;
+	const void			*addr;
+
+	internal = requ->internal;
+	if (internal->ip != NULL)
+		return (internal->ip);
+	if ((sa = internal->addr) == NULL)
+		return (NULL);
+
+	if (sa->sa_family == AF_INET)
+		addr = &((const struct sockaddr_in *)sa)->sin_addr;
+	else if (sa->sa_family == AF_INET6)
+		addr = &((const struct sockaddr_in6 *)sa)->sin6_addr;
+	else
+		return (NULL);
+
+	if ((internal->ip = arena_alloc(&internal->arena,
+					INET6_ADDRSTRLEN)) == NULL)
+		return (NULL);
+	if (inet_ntop(sa->sa_family, addr, internal->ip,
+		      INET6_ADDRSTRLEN) == NULL) {
+		internal->ip = NULL;
+		return (NULL);
+	}
+
+	return (internal->ip);
+}
+
+/*
+ * The memory is being released along with the request, once the response
+ * has been sent.
+ */
+void *
+yhttp_requ_alloc(struct yhttp_requ *requ, size_t n)
+{
+	struct yhttp_requ_internal	*internal;
+
+	if (requ == NULL) {
+		errno = EINVAL;
+		return (NULL);
+	}
+
+	internal = requ->internal;
+	return (arena_alloc(&internal->arena, n));
+}
 
 /*
  * The following function is largely based upon kcgi(3)s khttp_urlencode(),
@@ -271,7 +537,12 @@ yhttp_resp_header(struct yhttp_requ *requ, const char *name, const char *value)
 				return (YHTTP_EINVAL);
 		}
 
-		return (hash_set(internal->resp->headers, name, value));
+		name = arena_strdup(&internal->arena, name);
+		value = arena_strdup(&internal->arena, value);
+		if (name == NULL || value == NULL)
+			return (YHTTP_ERRNO);
+		return (hash_set(&internal->arena, internal->resp->headers, name,
+				 value));
 	}
 }
 
@@ -285,8 +556,8 @@ yhttp_resp_body(struct yhttp_requ *requ, const unsigned char *body,
 		return (YHTTP_EINVAL);
 
 	internal = requ->internal;
-	free(internal->resp->body);
 
+	/* A previous body remains in the arena until the request is done. */
 	if (body == NULL || nbody == 0) {
 		/* Unset the message body. */
 
@@ -296,7 +567,8 @@ yhttp_resp_body(struct yhttp_requ *requ, const unsigned char *body,
 	} else {
 		/* Set the message body. */
 
-		if ((internal->resp->body = malloc(nbody)) == NULL)
+		internal->resp->body = arena_alloc(&internal->arena, nbody);
+		if (internal->resp->body == NULL)
 			return (YHTTP_ERRNO);
 		memcpy(internal->resp->body, body, nbody);
 		internal->resp->nbody = nbody;
@@ -304,33 +576,220 @@ yhttp_resp_body(struct yhttp_requ *requ, const unsigned char *body,
 	}
 }
 
+int
+yhttp_resp_stream(struct yhttp_requ *requ,
+		  ssize_t (*fill)(struct yhttp_requ *, unsigned char *, size_t,
+				  void *),
+		  void *arg)
+{
+	struct yhttp_requ_internal	*internal;
+
+	if (requ == NULL)
+		return (YHTTP_EINVAL);
+
+	internal = requ->internal;
+	internal->resp->fill = fill;
+	internal->resp->ws = NULL;
+	internal->resp->arg = fill != NULL ? arg : NULL;
+
+	return (YHTTP_OK);
+}
+
+int
+yhttp_resp_early_hints(struct yhttp_requ *requ, const char *link)
+{
+	struct yhttp_requ_internal	*internal;
+	size_t				 i;
+
+	if (requ == NULL || link == NULL || *link == '\0')
+		return (YHTTP_EINVAL);
+	for (i = 0; link[i] != '\0'; ++i) {
+		if (!isprint((unsigned char)link[i]))
+			return (YHTTP_EINVAL);
+	}
+
+	/* Outside of the callback function, there is nothing to do. */
+	internal = requ->internal;
+	if (internal->hint == NULL)
+		return (YHTTP_OK);
+
+	return (internal->hint(requ, link));
+}
+
+int
+yhttp_resp_websocket(struct yhttp_requ *requ,
+		     void (*cb)(struct yhttp_ws *, enum yhttp_ws_event,
+				const unsigned char *, size_t, void *),
+		     void *arg)
+{
+	struct yhttp_requ_internal	*internal;
+	struct hash			*node;
+	char				 accept[29];
+	int				 rc;
+
+	if (requ == NULL || cb == NULL || requ->method != YHTTP_GET)
+		return (YHTTP_EINVAL);
+	internal = requ->internal;
+
+	/* The handshake of the client, see RFC 6455, section 4.2.1. */
+	node = hash_get(internal->headers, "Upgrade");
+	if (node == NULL || !abnf_has_token(node->value, "websocket"))
+		return (YHTTP_EINVAL);
+	node = hash_get(internal->headers, "Connection");
+	if (node == NULL || !abnf_has_token(node->value, "Upgrade"))
+		return (YHTTP_EINVAL);
+	node = hash_get(internal->headers, "Sec-WebSocket-Version");
+	if (node == NULL || strcmp(node->value, "13") != 0)
+		return (YHTTP_EINVAL);
+	node = hash_get(internal->headers, "Sec-WebSocket-Key");
+	if (node == NULL || ws_accept(node->value, accept) != YHTTP_OK)
+		return (YHTTP_EINVAL);
+
+	if ((rc = yhttp_resp_status(requ, 101)) != YHTTP_OK)
+		return (rc);
+	if ((rc = yhttp_resp_header(requ, "Connection", "Upgrade")) !=
+	    YHTTP_OK)
+		return (rc);
+	if ((rc = yhttp_resp_header(requ, "Upgrade", "websocket")) !=
+	    YHTTP_OK)
+		return (rc);
+	rc = yhttp_resp_header(requ, "Sec-WebSocket-Accept", accept);
+	if (rc != YHTTP_OK)
+		return (rc);
+
+	internal->resp->fill = NULL;
+	internal->resp->ws = cb;
+	internal->resp->arg = arg;
+
+	return (YHTTP_OK);
+}
+
+int
+yhttp_ws_send(struct yhttp_ws *ws, enum yhttp_ws_event type,
+	      const unsigned char *data, size_t ndata)
+{
+	if (ws == NULL || (data == NULL && ndata != 0))
+		return (YHTTP_EINVAL);
+
+	if (type == YHTTP_WS_TEXT)
+		return (ws_queue(ws, WS_TEXT, data, ndata));
+	else if (type == YHTTP_WS_BINARY)
+		return (ws_queue(ws, WS_BINARY, data, ndata));
+	else
+		return (YHTTP_EINVAL);
+}
+
+int
+yhttp_ws_close(struct yhttp_ws *ws, int status)
+{
+	if (ws == NULL || (status != 0 && (status < 1000 || status > 4999)))
+		return (YHTTP_EINVAL);
+
+	return (ws_close(ws, status));
+}
+
 int
 yhttp_dispatch(struct yhttp *yh, void (*cb)(struct yhttp_requ *, void *),
 	       void *udata)
 {
-	int	rc;
+	return (yhttp_dispatch_threads(yh, 1, cb, udata));
+}
 
-	if (yh == NULL || cb == NULL)
+int
+yhttp_dispatch_threads(struct yhttp *yh, size_t nthreads,
+		       void (*cb)(struct yhttp_requ *, void *), void *udata)
+{
+	struct loop	*loops;
+	size_t		 i, nstarted;
+	int		 rc;
+
+	if (yh == NULL || cb == NULL || nthreads == 0)
 		return (YHTTP_EINVAL);
 
 	/* The instance has already been dispatched. */
 	if (yh->is_dispatched)
 		return (YHTTP_EBUSY);
-	yh->is_dispatched = 1;
+
+	if (nthreads > SIZE_MAX / sizeof(struct loop) ||
+	    nthreads > SIZE_MAX / sizeof(int[2]))
+		return (YHTTP_EOVERFLOW);
+	if ((loops = malloc(sizeof(struct loop) * nthreads)) == NULL)
+		return (YHTTP_ERRNO);
+	if ((yh->pipes = malloc(sizeof(int[2]) * nthreads)) == NULL) {
+		free(loops);
+		return (YHTTP_ERRNO);
+	}
+	yh->npipes = nthreads;
+	for (i = 0; i < nthreads; ++i)
+		memset(yh->pipes[i], -1, sizeof(yh->pipes[i]));
 
 	/*
-	 * We are going to create a pipe(2) for the server, so that shutdown
-	 * can be communicated somehow (by sending EOF through the pipe(2)).
+	 * We are going to create a pipe(2) for every event loop, so that
+	 * shutdown can be communicated somehow (by sending EOF through the
+	 * pipe(2)).
 	 */
-	if (pipe(yh->pipe) == -1)
-		return (YHTTP_ERRNO);
+	rc = YHTTP_OK;
+	if (yh->nworkers > 0 && (yh->pool = pool_init(yh->nworkers)) == NULL) {
+		rc = YHTTP_ERRNO;
+		goto end;
+	}
+	for (i = 0; i < nthreads; ++i) {
+		if (pipe(yh->pipes[i]) == -1) {
+			rc = YHTTP_ERRNO;
+			goto end;
+		}
+
+		loops[i].yh = yh;
+		loops[i].cb = cb;
+		loops[i].udata = udata;
+		loops[i].read_pipe = yh->pipes[i][0];
+		loops[i].rc = YHTTP_OK;
+	}
+
+	/*
+	 * Only now yhttp_stop() is able to reach every event loop, so that it
+	 * must not see the instance as dispatched before.
+	 */
+	__sync_synchronize();
+	yh->is_dispatched = 1;
+
+	if (nthreads == 1) {
+		/* A single event loop runs in the calling thread. */
+		yhttp_loop_run(&loops[0]);
+	} else {
+		for (nstarted = 0; nstarted < nthreads; ++nstarted) {
+			errno = pthread_create(&loops[nstarted].thread, NULL,
+					       yhttp_loop_run,
+					       &loops[nstarted]);
+			if (errno != 0) {
+				rc = YHTTP_ERRNO;
+				yhttp_stop(yh);
+				break;
+			}
+		}
+		for (i = 0; i < nstarted; ++i)
+			pthread_join(loops[i].thread, NULL);
+	}
 
-	rc = net_dispatch(yh->port, yh->pipe[0], cb, udata);
+	/* Report the first error of an event loop, if any. */
+	for (i = 0; i < nthreads && rc == YHTTP_OK; ++i)
+		rc = loops[i].rc;
+end:
+	/* Destroy the pipes. */
+	for (i = 0; i < nthreads; ++i) {
+		if (yh->pipes[i][0] != -1)
+			close(yh->pipes[i][0]);
+		if (yh->pipes[i][1] != -1)
+			close(yh->pipes[i][1]);
+	}
+	free(yh->pipes);
+	yh->pipes = NULL;
+	yh->npipes = 0;
+	free(loops);
 
-	/* Destroy the pipe. */
-	close(yh->pipe[0]);
-	close(yh->pipe[1]);
-	memset(yh->pipe, -1, sizeof(yh->pipe));
+	/* Every event loop has waited for its jobs already. */
+	pool_free(yh->pool);
+	yh->pool = NULL;
 
 	yh->is_dispatched = 0;
 
@@ -340,14 +799,24 @@ yhttp_dispatch(struct yhttp *yh, void (*cb)(struct yhttp_requ *, void *),
 int
 yhttp_stop(struct yhttp *yh)
 {
+	size_t	i;
+	int	fd;
+
 	if (yh == NULL)
 		return (YHTTP_EINVAL);
 	if (!yh->is_dispatched)
 		return (YHTTP_ENOENT);
 
-	/* We tell the server to shutdown by closing its pipe(2). */
-	close(yh->pipe[1]);
-	yh->pipe[1] = -1;
+	/*
+	 * We tell every event loop to shutdown by closing its pipe(2).
+	 * Each write end is claimed atomically, as this function may run
+	 * concurrently from a failing event loop and a signal handler.
+	 */
+	for (i = 0; i < yh->npipes; ++i) {
+		fd = __sync_lock_test_and_set(&yh->pipes[i][1], -1);
+		if (fd != -1)
+			close(fd);
+	}
 
 	return (YHTTP_OK);
 }
@@ -359,51 +828,33 @@ yhttp_stop(struct yhttp *yh)
 struct yhttp_requ *
 yhttp_requ_init(void)
 {
-	struct yhttp_requ_internal	*internal;
-	struct yhttp_requ		*requ;
-
-	if ((requ = malloc(sizeof(struct yhttp_requ))) == NULL)
-		return (NULL);
-
-	requ->path = NULL;
-	requ->client_ip = NULL;
+	struct arena	arena;
 
-	/*
-	 * The request body will be stored inside the buffer of the parser
-	 * rather than in a separately allocated space, meaning the clean-up
-	 * is not in our scope.
-	 */
-	requ->body = NULL;
-	requ->nbody = 0;
-
-	requ->method = YHTTP_GET;
+	arena_init(&arena);
+	return (yhttp_requ_build(&arena));
+}
 
-	/* Initialize the internal field. */
-	if ((internal = malloc(sizeof(struct yhttp_requ_internal))) == NULL)
-		goto err;
-	requ->internal = internal;
+/*
+ * Reset requ in place for another request, releasing all of its allocations
+ * except for a single block of the arena, which the new request starts in.
+ * Like yhttp_requ_init(), NULL is being returned on failure, with requ having
+ * been freed.
+ */
+struct yhttp_requ *
+yhttp_requ_reset(struct yhttp_requ *requ)
+{
+	struct yhttp_requ_internal	*internal;
+	struct arena			 arena;
 
-	internal->headers = NULL;
-	internal->queries = NULL;
-	internal->resp = NULL;
+	if (requ == NULL)
+		return (yhttp_requ_init());
 
-	if ((internal->headers = hash_init()) == NULL)
-		goto err;
-	if ((internal->queries = hash_init()) == NULL)
-		goto err;
-	if ((internal->resp = yhttp_resp_init()) == NULL)
-		goto err;
+	/* The arena lives inside of the block it is about to keep. */
+	internal = requ->internal;
+	arena = internal->arena;
+	arena_reset(&arena);
 
-	return (requ);
-err:
-	free(requ);
-	if (internal != NULL) {
-		hash_free(internal->headers);
-		hash_free(internal->queries);
-		yhttp_resp_free(internal->resp);
-		free(internal);
-	}
-	return (NULL);
+	return (yhttp_requ_build(&arena));
 }
 
 void
@@ -414,46 +865,32 @@ yhttp_requ_free(struct yhttp_requ *requ)
 	if (requ == NULL)
 		return;
 
+	/*
+	 * The request itself and everything else is part of the arena.
+	 * See the comment regarding requ->body inside yhttp_requ_init().
+	 */
 	internal = requ->internal;
-
-	/* See the comment regarding requ->body inside yhttp_requ_init(). */
-	free(requ->path);
-	free(requ->client_ip);
-	free(requ);
-
-	hash_free(internal->headers);
-	hash_free(internal->queries);
-	yhttp_resp_free(internal->resp);
-	free(internal);
+	arena_free(&internal->arena);
 }
 
 struct yhttp_resp *
-yhttp_resp_init(void)
+yhttp_resp_init(struct arena *arena)
 {
 	struct yhttp_resp	*resp;
 
-	if ((resp = malloc(sizeof(struct yhttp_resp))) == NULL)
+	if ((resp = arena_alloc(arena, sizeof(struct yhttp_resp))) == NULL)
 		return (NULL);
+	resp->arena = arena;
 
-	if ((resp->headers = hash_init()) == NULL) {
-		free(resp);
+	if ((resp->headers = hash_init(arena)) == NULL)
 		return (NULL);
-	}
 
 	resp->body = NULL;
 	resp->nbody = 0;
 	resp->status = 200;
+	resp->fill = NULL;
+	resp->ws = NULL;
+	resp->arg = NULL;
 
 	return (resp);
 }
-
-void
-yhttp_resp_free(struct yhttp_resp *resp)
-{
-	if (resp == NULL)
-		return;
-
-	hash_free(resp->headers);
-	free(resp->body);
-	free(resp);
-}
@@ -26,6 +26,23 @@ enum yhttp_err {
 	YHTTP_EOVERFLOW
 };
 
+enum yhttp_opt {
+	YHTTP_OPT_WORKERS,
+	YHTTP_OPT_ACCEPT_BUDGET,
+	YHTTP_OPT_IDLE_TIMEOUT,
+	YHTTP_OPT_HEADER_TIMEOUT,
+	YHTTP_OPT_BODY_TIMEOUT,
+	YHTTP_OPT_MAX_CONNS,
+	YHTTP_OPT_SHED_TARGET,
+	YHTTP_OPT_SHED_INTERVAL,
+	YHTTP_OPT_MAX_REQUESTS,
+	YHTTP_OPT_MAX_REQUEST_LINE,
+	YHTTP_OPT_MAX_HEADER_SIZE,
+	YHTTP_OPT_MAX_HEADERS,
+	YHTTP_OPT_MAX_BODY_SIZE,
+	YHTTP_OPT_SPARE_REQUESTS
+};
+
 enum yhttp_method {
 	YHTTP_GET,
 	YHTTP_HEAD,
@@ -35,9 +52,17 @@ enum yhttp_method {
 	YHTTP_PATCH
 };
 
+enum yhttp_ws_event {
+	YHTTP_WS_OPEN,
+	YHTTP_WS_TEXT,
+	YHTTP_WS_BINARY,
+	YHTTP_WS_CLOSE
+};
+
+struct yhttp_ws;
+
 struct yhttp_requ {
 	char			*path;
-	char			*client_ip;
 	unsigned char		*body;
 	size_t			 nbody;
 	enum yhttp_method	 method;
@@ -45,11 +70,27 @@ struct yhttp_requ {
 	void			*internal;
 };
 
+struct yhttp_stats {
+	uint64_t	nshed;		/* Requests answered with 503. */
+	uint64_t	nepisodes;	/* Times shedding has started. */
+	size_t		nshedding;	/* Event loops shedding right now. */
+};
+
 struct yhttp	*yhttp_init(uint16_t);
 void		 yhttp_free(struct yhttp **);
+int		 yhttp_setopt(struct yhttp *, enum yhttp_opt, size_t);
+int		 yhttp_stats(struct yhttp *, struct yhttp_stats *);
+int		 yhttp_stream(struct yhttp *,
+			      void (*)(struct yhttp_requ *, void *),
+			      void (*)(struct yhttp_requ *,
+				       const unsigned char *, size_t, void *));
+int		 yhttp_expect(struct yhttp *,
+			      int (*)(struct yhttp_requ *, void *));
 
 char		*yhttp_header(struct yhttp_requ *, const char *);
 char		*yhttp_query(struct yhttp_requ *, const char *);
+char		*yhttp_client_ip(struct yhttp_requ *);
+void		*yhttp_requ_alloc(struct yhttp_requ *, size_t);
 
 char		*yhttp_url_enc(const char *);
 char		*yhttp_url_dec(const char *);
@@ -59,9 +100,28 @@ int		 yhttp_resp_header(struct yhttp_requ *, const char *,
 				   const char *);
 int		 yhttp_resp_body(struct yhttp_requ *, const unsigned char *,
 				 size_t);
+int		 yhttp_resp_stream(struct yhttp_requ *,
+				   ssize_t (*)(struct yhttp_requ *,
+					       unsigned char *, size_t,
+					       void *),
+				   void *);
+int		 yhttp_resp_early_hints(struct yhttp_requ *, const char *);
+int		 yhttp_resp_websocket(struct yhttp_requ *,
+				      void (*)(struct yhttp_ws *,
+					       enum yhttp_ws_event,
+					       const unsigned char *, size_t,
+					       void *),
+				      void *);
+
+int		 yhttp_ws_send(struct yhttp_ws *, enum yhttp_ws_event,
+			       const unsigned char *, size_t);
+int		 yhttp_ws_close(struct yhttp_ws *, int);
 
 int		 yhttp_dispatch(struct yhttp *,
 				void (*)(struct yhttp_requ *, void *), void *);
+int		 yhttp_dispatch_threads(struct yhttp *, size_t,
+					void (*)(struct yhttp_requ *, void *),
+					void *);
 int		 yhttp_stop(struct yhttp *);
 
 #endif